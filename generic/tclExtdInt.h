@@ -145,6 +145,27 @@ typedef struct {
     int         gotLock;      /* Succeeded? */
 } TclX_FlockInfo;
 
+/*
+ * Structure used to pass file numbers to wait on to TclXOSPoll.  Parallels
+ * the Posix struct pollfd.
+ */
+#define TCLX_POLL_READ    0x1
+#define TCLX_POLL_WRITE   0x2
+#define TCLX_POLL_EXCEPT  0x4
+
+typedef struct {
+    int         fnum;         /* File number from TclXOSGetSelectFnum */
+    int         events;       /* TCLX_POLL_* events to wait for */
+    int         revents;      /* TCLX_POLL_* events that occurred */
+    ClientData  clientData;   /* Caller's data for TclXOSPollSetWait */
+} TclX_PollInfo;
+
+/*
+ * A persistent set of file numbers to wait on, where the system supports it
+ * (epoll on Linux).  Opaque to the generic code.
+ */
+typedef struct TclX_PollSet TclX_PollSet;
+
 /*
  * Used to return argument messages by most commands.
  * FIX: Should be internal, got thought TclX_WrongArgs.
@@ -193,15 +214,33 @@ extern Tcl_Obj *tclXWrongArgsObj;
 #define ERRORLINE(interp) (Tcl_GetErrorLine(interp))
 #endif
 
+/*
+ * Type of a directory entry, as returned while walking a directory.  It's
+ * TCLX_FTYPE_UNKNOWN if the system doesn't return the type when reading the
+ * directory.
+ */
+typedef enum {
+    TCLX_FTYPE_UNKNOWN,
+    TCLX_FTYPE_FILE,
+    TCLX_FTYPE_DIRECTORY,
+    TCLX_FTYPE_LINK,
+    TCLX_FTYPE_CHAR,
+    TCLX_FTYPE_BLOCK,
+    TCLX_FTYPE_FIFO,
+    TCLX_FTYPE_SOCKET
+} TclX_FileType;
+
 /*
  * Callback type for walking directories.
  */
 typedef int
-(TclX_WalkDirProc) (Tcl_Interp  *interp,
-					char        *path,
-					char        *fileName,
-					int          caseSensitive,
-					ClientData   clientData);
+(TclX_WalkDirProc) (Tcl_Interp    *interp,
+					char          *path,
+					char          *fileName,
+					int            caseSensitive,
+					TclX_FileType  fileType,
+					ClientData     dirHandle,
+					ClientData     clientData);
 
 /*
  * Prototypes for utility procedures.
@@ -501,10 +540,48 @@ TclXOSWalkDir (Tcl_Interp       *interp,
                TclX_WalkDirProc *callback,
                ClientData        clientData);
 
+extern int
+TclXOSOpenDir (Tcl_Interp *interp,
+               char       *path,
+               ClientData *dirHandlePtr);
+
+extern void
+TclXOSCloseDir (ClientData dirHandle);
+
+extern int
+TclXOSWalkDirAt (Tcl_Interp       *interp,
+                 ClientData        dirHandle,
+                 char             *path,
+                 char             *fileName,
+                 int               hidden,
+                 TclX_WalkDirProc *callback,
+                 ClientData        clientData);
+
+extern int
+TclXOSStatDirEntry (ClientData   dirHandle,
+                    char        *path,
+                    char        *fileName,
+                    struct stat *statBuf);
+
 extern int
 TclXOSGetFileSize (Tcl_Channel  channel,
                    off_t       *fileSize);
 
+extern int
+TclXOSMapFile (Tcl_Channel   channel,
+               off_t         fileSize,
+               char        **addrPtr);
+
+extern void
+TclXOSUnmapFile (char  *addr,
+                 off_t  fileSize);
+
+extern int
+TclXOSWriteBuffers (Tcl_Channel   channel,
+                    int           numBufs,
+                    char        **bufs,
+                    int          *bufLens);
+
 extern int
 TclXOSftruncate (Tcl_Interp  *interp,
                  Tcl_Channel  channel,
@@ -520,6 +597,15 @@ TclXOSexecl (Tcl_Interp *interp,
              char       *path,
              char      **argList);
 
+extern int
+TclXOSspawn (Tcl_Interp  *interp,
+             char        *path,
+             char       **argList,
+             char       **envList,
+             int          numFds,
+             int         *childFds,
+             Tcl_Channel *channels);
+
 extern int
 TclXOSInetAtoN (Tcl_Interp     *interp,
                 const char     *strAddress,
@@ -581,6 +667,33 @@ TclXOSGetSelectFnum (Tcl_Interp *interp,
                      int         direction,
                      int *fnumPtr);
 
+int
+TclXOSPoll (Tcl_Interp     *interp,
+            TclX_PollInfo  *pollInfo,
+            int             numFnums,
+            struct timeval *timeoutPtr);
+
+TclX_PollSet *
+TclXOSPollSetCreate (Tcl_Interp *interp);
+
+void
+TclXOSPollSetDelete (TclX_PollSet *pollSetPtr);
+
+int
+TclXOSPollSetCtl (Tcl_Interp    *interp,
+                  TclX_PollSet  *pollSetPtr,
+                  int            fnum,
+                  int            oldEvents,
+                  int            newEvents,
+                  ClientData     clientData);
+
+int
+TclXOSPollSetWait (Tcl_Interp     *interp,
+                   TclX_PollSet   *pollSetPtr,
+                   TclX_PollInfo  *readyInfo,
+                   int             maxReady,
+                   struct timeval *timeoutPtr);
+
 int
 TclXOSHaveFlock (void);
 
@@ -612,6 +725,19 @@ TclXOSSetCloseOnExec (Tcl_Interp *interp,
                       Tcl_Channel channel,
                       int         value);
 
+int
+TclXOSSignalPipeOpen (Tcl_Interp   *interp,
+                      Tcl_FileProc *proc);
+
+void
+TclXOSSignalPipeClose (void);
+
+void
+TclXOSSignalPipeWakeup (void);
+
+void
+TclXOSSignalPipeDrain (void);
+
 void
 TclX_ChannelFdInit (Tcl_Interp *interp);
 #endif
@@ -151,6 +151,10 @@ EXTERN void_pt	TclX_HandleTblInit (const char *handleBase,
                                     int	    entrySize,
                                     int	    initEntries);
 
+EXTERN void_pt	TclX_HandleTblInitShared (const char *handleBase,
+                                          int	      entrySize,
+                                          int	      initEntries);
+
 EXTERN void	TclX_HandleTblRelease (void_pt headerPtr);
 
 EXTERN int	TclX_HandleTblUseCount (void_pt headerPtr,
@@ -18,29 +18,170 @@
 
 #include "tclExtdInt.h"
 
+/*
+ * Lines are read directly from the file rather than through the channel.
+ * Regular files are mapped into memory when the platform supports it.  A
+ * mapping belongs to the channel it was made through and is released when
+ * that channel is closed, or as soon as the file is seen to have changed, so
+ * a file truncated later can't leave a stale mapping behind.  Only the most
+ * recently used mappings are kept.
+ *
+ * Files that can't be mapped are read in fixed size blocks instead.  Only
+ * then are blocks kept, in a per-interpreter LRU cache keyed by the identity,
+ * size and modification time of the file, so repeated searches of the same
+ * file find the upper levels of the search already in memory, even if the
+ * file is reopened.  The block table is created on first use, so where every
+ * file is mapped the cache costs nothing.
+ */
+#define BSEARCH_BLOCK_SIZE   8192
+#define BSEARCH_MAX_BLOCKS   256
+#define BSEARCH_MAX_MAPS     16
+
+typedef struct {
+    dev_t   dev;
+    ino_t   ino;
+    time_t  mtime;
+    long    mtimeNsec;
+    off_t   size;
+    off_t   blockNum;
+} blockKey_t;
+
+typedef struct probeBlock_t {
+    Tcl_HashEntry        *hashEntryPtr;
+    struct probeBlock_t  *prevPtr;      /* Next more recently used. */
+    struct probeBlock_t  *nextPtr;      /* Next less recently used. */
+    int                   length;
+    char                  data [BSEARCH_BLOCK_SIZE];
+} probeBlock_t;
+
+typedef struct blockCache_t blockCache_t;
+
+typedef struct {
+    blockKey_t    key;          /* Key with a blockNum of zero. */
+    char         *addr;
+    Tcl_Channel   channel;      /* Channel the file was mapped through. */
+    blockCache_t *cachePtr;
+} fileMap_t;
+
+struct blockCache_t {
+    Tcl_HashTable *blockTablePtr;  /* NULL until a block is read. */
+    probeBlock_t  *mruPtr;
+    probeBlock_t  *lruPtr;
+    int            numBlocks;
+    fileMap_t     *maps [BSEARCH_MAX_MAPS];  /* Most recently used first. */
+    int            numMaps;
+};
+
+/*
+ * Flags for the built in comparison.
+ */
+#define BSEARCH_NUMERIC  1
+#define BSEARCH_NOCASE   2
+#define BSEARCH_PREFIX   4
+
+/*
+ * Kinds of number returned by ParseNumber.
+ */
+#define BSEARCH_NOT_NUMBER  0
+#define BSEARCH_INTEGER     1
+#define BSEARCH_DOUBLE      2
+
+/*
+ * A key to search for, with its numeric value for -numeric.
+ */
+typedef struct {
+    Tcl_Obj     *obj;
+    char        *str;
+    int          len;
+    int          numKind;
+    Tcl_WideInt  wideValue;
+    double       doubleValue;
+} searchKey_t;
+
 /*
  * Control block used to pass data used by the binary search routines.
  */
 typedef struct binSearchCB_t {
     Tcl_Interp   *interp;         /* Pointer to the interpreter.             */
-    char         *key;            /* The key to search for.                  */
+    searchKey_t   key;            /* The key to search for.                  */
+    int           cmpFlags;       /* BSEARCH_* flags for the comparison.     */
+    int           field;          /* Field of the line to compare.           */
+    int           separator;      /* Field separator, or -1 for white space. */
 
     Tcl_Channel   channel;        /* I/O channel.                            */
     Tcl_DString   lineBuf;        /* Dynamic buffer to hold a line of file.  */
+    Tcl_DString   rawBuf;         /* Line before encoding conversion.        */
     off_t         lastRecOffset;  /* Offset of last record read.             */
+    off_t         readOffset;     /* Offset following the last bytes read.   */
     int           cmpResult;      /* -1, 0 or 1 result of string compare.    */
-    char         *tclProc;        /* Name of Tcl comparsion proc, or NULL.   */
+    Tcl_Obj      *tclProc;        /* Name of Tcl comparsion proc, or NULL.   */
+
+    blockCache_t *cachePtr;       /* Cache of blocks read from files.        */
+    blockKey_t    fileKey;        /* Identifies the file in the cache.       */
+    off_t         fileSize;
+    char         *mapAddr;        /* File mapped into memory, or NULL.       */
+    off_t         lowOffset;      /* Lower bound of the search.              */
+    Tcl_Encoding  encoding;       /* Channel encoding.                       */
+    char          eolChar;        /* Line terminator.                        */
+    int           stripCR;        /* Strip CR before the terminator.         */
     } binSearchCB_t;
 
 /*
  * Prototypes of internal functions.
  */
 static int
-StandardKeyCompare (char *key, char *line);
+ParseNumber (char        *str,
+             int          len,
+             Tcl_WideInt *wideValuePtr,
+             double      *doubleValuePtr);
+
+static int
+CompareNumbers (int          numKind1,
+                Tcl_WideInt  wideValue1,
+                double       doubleValue1,
+                int          numKind2,
+                Tcl_WideInt  wideValue2,
+                double       doubleValue2);
+
+static int
+CompareStrings (char *str1,
+                int   len1,
+                char *str2,
+                int   len2,
+                int   noCase);
+
+static int
+CompareKeys (binSearchCB_t *searchCBPtr,
+             searchKey_t   *key1Ptr,
+             searchKey_t   *key2Ptr);
+
+static int
+SetKey (binSearchCB_t *searchCBPtr,
+        Tcl_Obj       *keyObj,
+        searchKey_t   *keyPtr);
+
+static char *
+GetKeyField (binSearchCB_t *searchCBPtr,
+             char          *line,
+             int           *fieldLenPtr);
+
+static int
+StandardKeyCompare (binSearchCB_t *searchCBPtr);
 
 static int
 TclProcKeyCompare (binSearchCB_t *searchCBPtr);
 
+static int
+GetBlock (binSearchCB_t  *searchCBPtr,
+          off_t           blockNum,
+          probeBlock_t  **blockPtrPtr);
+
+static int
+ReadRawLine (binSearchCB_t *searchCBPtr,
+             off_t          fileOffset,
+             int            saveLine,
+             off_t         *endOffsetPtr);
+
 static int
 ReadAndCompare (off_t          fileOffset,
                 binSearchCB_t *searchCBPtr);
@@ -48,44 +189,313 @@ ReadAndCompare (off_t          fileOffset,
 static int
 BinSearch (binSearchCB_t *searchCBPtr);
 
+static void
+ReleaseFileMap (fileMap_t *fileMapPtr);
+
+static void
+FileMapCloseHandler (ClientData clientData);
+
+static char *
+GetFileMap (blockCache_t *cachePtr,
+            blockKey_t   *fileKeyPtr,
+            Tcl_Channel   channel);
+
+static int
+SetupSearch (binSearchCB_t *searchCBPtr);
+
+static int
+KeySortCompare (const void *entry1Ptr,
+                const void *entry2Ptr);
+
+static int
+SearchKeyList (binSearchCB_t *searchCBPtr,
+               Tcl_Obj       *keyListPtr);
+
 static int 
 TclX_BsearchObjCmd (ClientData clientData, 
                     Tcl_Interp *interp,
                     int objc,
                     Tcl_Obj *const objv[]);
 
+static void
+BsearchCleanUp (ClientData  clientData,
+                Tcl_Interp *interp);
+
+/*-----------------------------------------------------------------------------
+ * ParseNumber --
+ *    Parse a number for -numeric comparison.
+ *
+ * Parameters:
+ *   o str (I) - The string to parse, which need not be terminated.
+ *   o len (I) - The length of the string.
+ *   o wideValuePtr (O) - The value of an integer is returned here.
+ *   o doubleValuePtr (O) - The value of the number is returned here.
+ * Results:
+ *   BSEARCH_INTEGER, BSEARCH_DOUBLE or BSEARCH_NOT_NUMBER.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ParseNumber (char *str,
+             int len,
+             Tcl_WideInt *wideValuePtr,
+             double *doubleValuePtr)
+{
+    char buf [64], *endPtr;
+
+    /*
+     * Copy to terminate it, anything this long is not a sensible key.
+     */
+    if ((len == 0) || (len >= (int) sizeof (buf)))
+        return BSEARCH_NOT_NUMBER;
+    memcpy (buf, str, len);
+    buf [len] = '\0';
+
+    errno = 0;
+    *wideValuePtr = strtoll (buf, &endPtr, 10);
+    if ((endPtr != buf) && (*endPtr == '\0') && (errno == 0)) {
+        *doubleValuePtr = (double) *wideValuePtr;
+        return BSEARCH_INTEGER;
+    }
+    *doubleValuePtr = strtod (buf, &endPtr);
+    if ((endPtr != buf) && (*endPtr == '\0'))
+        return BSEARCH_DOUBLE;
+    return BSEARCH_NOT_NUMBER;
+}
+
+/*-----------------------------------------------------------------------------
+ * CompareNumbers --
+ *    Compare two numbers returned by ParseNumber.  Integers are compared
+ *    exactly, anything else as doubles.
+ *
+ * Results:
+ *   < 0, 0 or > 0, as with strcmp.
+ *-----------------------------------------------------------------------------
+ */
+static int
+CompareNumbers (int numKind1,
+                Tcl_WideInt wideValue1,
+                double doubleValue1,
+                int numKind2,
+                Tcl_WideInt wideValue2,
+                double doubleValue2)
+{
+    if ((numKind1 == BSEARCH_INTEGER) && (numKind2 == BSEARCH_INTEGER))
+        return (wideValue1 > wideValue2) - (wideValue1 < wideValue2);
+    return (doubleValue1 > doubleValue2) - (doubleValue1 < doubleValue2);
+}
+
+/*-----------------------------------------------------------------------------
+ * CompareStrings --
+ *    Compare two UTF-8 strings, which need not be terminated.
+ *
+ * Parameters:
+ *   o str1, len1 (I) - The first string and its length in bytes.
+ *   o str2, len2 (I) - The second string and its length in bytes.
+ *   o noCase (I) - TRUE to compare without regard to case.
+ * Results:
+ *   < 0, 0 or > 0, as with strcmp.
+ *-----------------------------------------------------------------------------
+ */
+static int
+CompareStrings (char *str1,
+                int len1,
+                char *str2,
+                int len2,
+                int noCase)
+{
+    char *end1 = str1 + len1, *end2 = str2 + len2;
+    Tcl_UniChar ch1, ch2;
+    int cmpResult;
+
+    if (!noCase) {
+        cmpResult = memcmp (str1, str2, (len1 < len2) ? len1 : len2);
+        if (cmpResult != 0)
+            return cmpResult;
+        return len1 - len2;
+    }
+
+    while ((str1 < end1) && (str2 < end2)) {
+        str1 += Tcl_UtfToUniChar (str1, &ch1);
+        str2 += Tcl_UtfToUniChar (str2, &ch2);
+        if (ch1 != ch2) {
+            ch1 = Tcl_UniCharToLower (ch1);
+            ch2 = Tcl_UniCharToLower (ch2);
+            if (ch1 != ch2)
+                return (int) ch1 - (int) ch2;
+        }
+    }
+    return (str1 < end1) - (str2 < end2);
+}
+
+/*-----------------------------------------------------------------------------
+ * CompareKeys --
+ *    Compare two keys, using the same ordering as StandardKeyCompare.
+ *
+ * Results:
+ *   < 0, 0 or > 0, as with strcmp.
+ *-----------------------------------------------------------------------------
+ */
+static int
+CompareKeys (binSearchCB_t *searchCBPtr,
+             searchKey_t *key1Ptr,
+             searchKey_t *key2Ptr)
+{
+    if (searchCBPtr->cmpFlags & BSEARCH_NUMERIC)
+        return CompareNumbers (key1Ptr->numKind, key1Ptr->wideValue,
+                               key1Ptr->doubleValue, key2Ptr->numKind,
+                               key2Ptr->wideValue, key2Ptr->doubleValue);
+    return CompareStrings (key1Ptr->str, key1Ptr->len,
+                           key2Ptr->str, key2Ptr->len,
+                           searchCBPtr->cmpFlags & BSEARCH_NOCASE);
+}
+
+/*-----------------------------------------------------------------------------
+ * SetKey --
+ *    Set up a key to search for.
+ *
+ * Parameters:
+ *   o searchCBPtr (I) - The search control block.
+ *   o keyObj (I) - The key.
+ *   o keyPtr (O) - The key is set up here.
+ * Results:
+ *   TCL_OK or TCL_ERROR if a -numeric key is not a number.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SetKey (binSearchCB_t *searchCBPtr,
+        Tcl_Obj *keyObj,
+        searchKey_t *keyPtr)
+{
+    keyPtr->obj = keyObj;
+    keyPtr->str = Tcl_GetStringFromObj (keyObj, &keyPtr->len);
+    keyPtr->numKind = BSEARCH_NOT_NUMBER;
+
+    if (searchCBPtr->cmpFlags & BSEARCH_NUMERIC) {
+        keyPtr->numKind = ParseNumber (keyPtr->str, keyPtr->len,
+                                       &keyPtr->wideValue,
+                                       &keyPtr->doubleValue);
+        if (keyPtr->numKind == BSEARCH_NOT_NUMBER) {
+            TclX_AppendObjResult (searchCBPtr->interp,
+                                  "expected a number for key, got \"",
+                                  keyPtr->str, "\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * GetKeyField --
+ *    Locate the field of a line to compare the key with.  Fields are
+ *    separated by the separator character, or by runs of white space if
+ *    there is none, in which case the first field starts at the beginning
+ *    of the line.
+ *
+ * Parameters:
+ *   o searchCBPtr (I) - The search control block.
+ *   o line (I) - The line.
+ *   o fieldLenPtr (O) - The length of the field is returned here.
+ * Results:
+ *   A pointer to the field, or NULL if the line has too few fields.
+ *-----------------------------------------------------------------------------
+ */
+static char *
+GetKeyField (binSearchCB_t *searchCBPtr,
+             char *line,
+             int *fieldLenPtr)
+{
+    static char whiteSpace [] = " \t\r\n\v\f";
+    char *fieldPtr = line, *sepPtr;
+    int fieldNum;
+
+    for (fieldNum = 0; TRUE; fieldNum++) {
+        if (searchCBPtr->separator < 0) {
+            *fieldLenPtr = strcspn (fieldPtr, whiteSpace);
+            if (fieldNum == searchCBPtr->field)
+                return fieldPtr;
+            fieldPtr += *fieldLenPtr;
+            if (*fieldPtr == '\0')
+                return NULL;
+            fieldPtr += strspn (fieldPtr, whiteSpace);
+        } else {
+            sepPtr = strchr (fieldPtr, searchCBPtr->separator);
+            *fieldLenPtr = (sepPtr != NULL) ? (sepPtr - fieldPtr) :
+                (int) strlen (fieldPtr);
+            if (fieldNum == searchCBPtr->field)
+                return fieldPtr;
+            if (sepPtr == NULL)
+                return NULL;
+            fieldPtr = sepPtr + 1;
+        }
+    }
+}
+
 /*-----------------------------------------------------------------------------
  *
  * StandardKeyCompare --
- *    Standard comparison routine for BinSearch, compares the key to the
- *    first white-space seperated field in the line.
+ *    Built in comparison routine for BinSearch.  By default, compares the
+ *    key to the first white-space seperated field in the line as a string.
+ *    The cmpFlags, field and separator options of the search control block
+ *    modify this.  A line without the field compares as an empty field.
  *
  * Parameters:
- *   o key (I) - The key to search for.
- *   o line (I) - The line to compare the key to.
+ *   o searchCBPtr (I/O) - The search control block, the line should be in
+ *     lineBuf, the comparsion result is returned in cmpResult.
  *
  * Results:
- *   o < 0 if key < line-key
- *   o = 0 if key == line-key
- *   o > 0 if key > line-key.
+ *   TCL_OK or TCL_ERROR if -numeric is specified and the field is not a
+ *   number.
  *-----------------------------------------------------------------------------
  */
 static int
-StandardKeyCompare (char *key, char *line)
+StandardKeyCompare (binSearchCB_t *searchCBPtr)
 {
-    int  cmpResult, fieldLen;
-    char saveChar;
+    searchKey_t *keyPtr = &searchCBPtr->key;
+    char *line = Tcl_DStringValue (&searchCBPtr->lineBuf);
+    char *fieldPtr;
+    int fieldLen, numKind;
+    Tcl_WideInt wideValue;
+    double doubleValue;
 
-    fieldLen = strcspn (line, " \t\r\n\v\f");
+    fieldPtr = GetKeyField (searchCBPtr, line, &fieldLen);
+    if (fieldPtr == NULL) {
+        fieldPtr = "";
+        fieldLen = 0;
+    }
 
-    saveChar = line [fieldLen];
-    line [fieldLen] = 0;
-    cmpResult = strcmp (key, line);
-    line [fieldLen] = saveChar;
+    if (searchCBPtr->cmpFlags & BSEARCH_NUMERIC) {
+        numKind = ParseNumber (fieldPtr, fieldLen, &wideValue, &doubleValue);
+        if (numKind == BSEARCH_NOT_NUMBER) {
+            TclX_AppendObjResult (searchCBPtr->interp,
+                                  "expected a number in field of line \"",
+                                  line, "\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        searchCBPtr->cmpResult =
+            CompareNumbers (keyPtr->numKind, keyPtr->wideValue,
+                            keyPtr->doubleValue, numKind, wideValue,
+                            doubleValue);
+        return TCL_OK;
+    }
 
-    return cmpResult;
+    if (searchCBPtr->cmpFlags & BSEARCH_PREFIX) {
+        /*
+         * Only compare the part of the field that is the length of the key.
+         */
+        if (searchCBPtr->cmpFlags & BSEARCH_NOCASE) {
+            int keyChars = Tcl_NumUtfChars (keyPtr->str, keyPtr->len);
+            if (Tcl_NumUtfChars (fieldPtr, fieldLen) > keyChars)
+                fieldLen = Tcl_UtfAtIndex (fieldPtr, keyChars) - fieldPtr;
+        } else if (fieldLen > keyPtr->len) {
+            fieldLen = keyPtr->len;
+        }
+    }
+    searchCBPtr->cmpResult =
+        CompareStrings (keyPtr->str, keyPtr->len, fieldPtr, fieldLen,
+                        searchCBPtr->cmpFlags & BSEARCH_NOCASE);
+    return TCL_OK;
 }
-
+
 /*-----------------------------------------------------------------------------
  * TclProcKeyCompare --
  *    Comparison routine for BinSearch that runs a Tcl procedure to, 
@@ -102,18 +512,23 @@ StandardKeyCompare (char *key, char *line)
 static int
 TclProcKeyCompare (binSearchCB_t *searchCBPtr)
 {
-    const char *cmdArgv [3];
-    char *command, *oldResult;
+    Tcl_Obj *cmdObjv [3];
+    char *oldResult;
     int   result;
 
-    cmdArgv [0] = searchCBPtr->tclProc;
-    cmdArgv [1] = searchCBPtr->key;
-    cmdArgv [2] = searchCBPtr->lineBuf.string;
-    command = Tcl_Merge (3, cmdArgv);
+    /*
+     * Evaluate the words directly, rather than building a command string
+     * that has to be parsed again for every line.
+     */
+    cmdObjv [0] = searchCBPtr->tclProc;
+    cmdObjv [1] = searchCBPtr->key.obj;
+    cmdObjv [2] = Tcl_NewStringObj (Tcl_DStringValue (&searchCBPtr->lineBuf),
+                                    Tcl_DStringLength (&searchCBPtr->lineBuf));
+    Tcl_IncrRefCount (cmdObjv [2]);
 
-    result = Tcl_Eval (searchCBPtr->interp, command);
+    result = Tcl_EvalObjv (searchCBPtr->interp, 3, cmdObjv, 0);
 
-    ckfree (command);
+    Tcl_DecrRefCount (cmdObjv [2]);
     if (result == TCL_ERROR)
         return TCL_ERROR;
 
@@ -127,7 +542,9 @@ TclProcKeyCompare (binSearchCB_t *searchCBPtr)
         Tcl_ResetResult (searchCBPtr->interp);
         TclX_AppendObjResult (searchCBPtr->interp, "invalid integer \"",
                               oldResult, "\" returned from compare proc \"",
-                              searchCBPtr->tclProc, "\"", (char *) NULL);
+                              Tcl_GetStringFromObj (searchCBPtr->tclProc,
+                                                    NULL),
+                              "\"", (char *) NULL);
         ckfree (oldResult);
         return TCL_ERROR;
     }
@@ -135,6 +552,187 @@ TclProcKeyCompare (binSearchCB_t *searchCBPtr)
     return TCL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+ * GetBlock --
+ *    Get a block of the file being searched, from the cache if possible.
+ *    A block that is read is added to the cache, replacing the least
+ *    recently used one if the cache is full.
+ *
+ * Parameters:
+ *   o searchCBPtr (I) - The search control block.
+ *   o blockNum (I) - The number of the block.
+ *   o blockPtrPtr (O) - The block is returned here.
+ *
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+GetBlock (binSearchCB_t *searchCBPtr,
+          off_t blockNum,
+          probeBlock_t **blockPtrPtr)
+{
+    blockCache_t *cachePtr = searchCBPtr->cachePtr;
+    probeBlock_t *blockPtr;
+    Tcl_HashEntry *hashEntryPtr;
+    int newEntry, bytesRead;
+
+    if (cachePtr->blockTablePtr == NULL) {
+        cachePtr->blockTablePtr =
+            (Tcl_HashTable *) ckalloc (sizeof (Tcl_HashTable));
+        Tcl_InitHashTable (cachePtr->blockTablePtr,
+                           sizeof (blockKey_t) / sizeof (int));
+    }
+    searchCBPtr->fileKey.blockNum = blockNum;
+    hashEntryPtr = Tcl_CreateHashEntry (cachePtr->blockTablePtr,
+                                        (char *) &searchCBPtr->fileKey,
+                                        &newEntry);
+    if (!newEntry) {
+        blockPtr = (probeBlock_t *) Tcl_GetHashValue (hashEntryPtr);
+        if (blockPtr == cachePtr->mruPtr)
+            goto done;
+        /*
+         * Unlink, it's moved to the front below.
+         */
+        blockPtr->prevPtr->nextPtr = blockPtr->nextPtr;
+        if (blockPtr->nextPtr != NULL) {
+            blockPtr->nextPtr->prevPtr = blockPtr->prevPtr;
+        } else {
+            cachePtr->lruPtr = blockPtr->prevPtr;
+        }
+    } else {
+        if (cachePtr->numBlocks < BSEARCH_MAX_BLOCKS) {
+            blockPtr = (probeBlock_t *) ckalloc (sizeof (probeBlock_t));
+            cachePtr->numBlocks++;
+        } else {
+            blockPtr = cachePtr->lruPtr;
+            Tcl_DeleteHashEntry (blockPtr->hashEntryPtr);
+            cachePtr->lruPtr = blockPtr->prevPtr;
+            if (cachePtr->lruPtr != NULL) {
+                cachePtr->lruPtr->nextPtr = NULL;
+            } else {
+                cachePtr->mruPtr = NULL;
+            }
+        }
+        blockPtr->hashEntryPtr = hashEntryPtr;
+        Tcl_SetHashValue (hashEntryPtr, (ClientData) blockPtr);
+
+        /*
+         * Read the raw bytes; line terminators and encoding are handled by
+         * the caller.
+         */
+        blockPtr->length = 0;
+        if (Tcl_Seek (searchCBPtr->channel, blockNum * BSEARCH_BLOCK_SIZE,
+                      SEEK_SET) < 0)
+            goto posixError;
+        while (blockPtr->length < BSEARCH_BLOCK_SIZE) {
+            bytesRead = Tcl_ReadRaw (searchCBPtr->channel,
+                                     blockPtr->data + blockPtr->length,
+                                     BSEARCH_BLOCK_SIZE - blockPtr->length);
+            if (bytesRead < 0)
+                goto posixError;
+            if (bytesRead == 0)
+                break;
+            blockPtr->length += bytesRead;
+        }
+    }
+
+    blockPtr->prevPtr = NULL;
+    blockPtr->nextPtr = cachePtr->mruPtr;
+    if (cachePtr->mruPtr != NULL) {
+        cachePtr->mruPtr->prevPtr = blockPtr;
+    } else {
+        cachePtr->lruPtr = blockPtr;
+    }
+    cachePtr->mruPtr = blockPtr;
+
+  done:
+    *blockPtrPtr = blockPtr;
+    return TCL_OK;
+
+  posixError:
+    /*
+     * Don't leave a partial block in the cache.
+     */
+    Tcl_DeleteHashEntry (blockPtr->hashEntryPtr);
+    ckfree ((char *) blockPtr);
+    cachePtr->numBlocks--;
+    TclX_AppendObjResult (searchCBPtr->interp,
+                          Tcl_GetChannelName (searchCBPtr->channel), ": ",
+                          Tcl_PosixError (searchCBPtr->interp), (char *) NULL);
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadRawLine --
+ *    Find the next line terminator from the specified offset, optionally
+ *    saving the bytes up to it in rawBuf.
+ *
+ * Parameters:
+ *   o searchCBPtr (I/O) - The search control block.
+ *   o fileOffset (I) - The offset to start at.
+ *   o saveLine (I) - TRUE to save the bytes, FALSE to just skip them.
+ *   o endOffsetPtr (O) - The offset following the terminator is returned
+ *     here, or the file size if no terminator was found.
+ *
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadRawLine (binSearchCB_t *searchCBPtr,
+             off_t fileOffset,
+             int saveLine,
+             off_t *endOffsetPtr)
+{
+    probeBlock_t *blockPtr;
+    char *startPtr, *eolPtr;
+    int blockOffset;
+
+    Tcl_DStringSetLength (&searchCBPtr->rawBuf, 0);
+
+    if (searchCBPtr->mapAddr != NULL) {
+        startPtr = searchCBPtr->mapAddr + fileOffset;
+        eolPtr = memchr (startPtr, searchCBPtr->eolChar,
+                         (size_t) (searchCBPtr->fileSize - fileOffset));
+        if (eolPtr == NULL)
+            eolPtr = searchCBPtr->mapAddr + searchCBPtr->fileSize;
+        if (saveLine)
+            Tcl_DStringAppend (&searchCBPtr->rawBuf, startPtr,
+                               eolPtr - startPtr);
+        *endOffsetPtr = fileOffset + (eolPtr - startPtr);
+        if (*endOffsetPtr < searchCBPtr->fileSize)
+            (*endOffsetPtr)++;
+        return TCL_OK;
+    }
+
+    while (fileOffset < searchCBPtr->fileSize) {
+        if (GetBlock (searchCBPtr, fileOffset / BSEARCH_BLOCK_SIZE,
+                      &blockPtr) != TCL_OK)
+            return TCL_ERROR;
+        blockOffset = (int) (fileOffset % BSEARCH_BLOCK_SIZE);
+        if (blockOffset >= blockPtr->length)
+            break;  /* File shrank */
+
+        startPtr = blockPtr->data + blockOffset;
+        eolPtr = memchr (startPtr, searchCBPtr->eolChar,
+                         blockPtr->length - blockOffset);
+        if (eolPtr != NULL) {
+            if (saveLine)
+                Tcl_DStringAppend (&searchCBPtr->rawBuf, startPtr,
+                                   eolPtr - startPtr);
+            *endOffsetPtr = fileOffset + (eolPtr - startPtr) + 1;
+            return TCL_OK;
+        }
+        if (saveLine)
+            Tcl_DStringAppend (&searchCBPtr->rawBuf, startPtr,
+                               blockPtr->length - blockOffset);
+        fileOffset += blockPtr->length - blockOffset;
+    }
+    *endOffsetPtr = searchCBPtr->fileSize;
+    return TCL_OK;
+}
+
 /*-----------------------------------------------------------------------------
  * ReadAndCompare --
  *    Search for the next line in the file starting at the specified
@@ -160,80 +758,77 @@ TclProcKeyCompare (binSearchCB_t *searchCBPtr)
 static int
 ReadAndCompare (off_t fileOffset, binSearchCB_t *searchCBPtr)
 {
-    if (Tcl_Seek (searchCBPtr->channel, fileOffset, SEEK_SET) < 0)
-        goto posixError;
+    off_t endOffset;
+    int length;
 
     /*
-     * Go to beginning of next line by reading the remainder of the current
+     * Go to beginning of next line by skipping the remainder of the current
      * one.
      */
     if (fileOffset != 0) {
-        if (Tcl_Gets (searchCBPtr->channel, &searchCBPtr->lineBuf) < 0) {
-            if (Tcl_Eof (searchCBPtr->channel) ||
-                Tcl_InputBlocked (searchCBPtr->channel)) {
-                TclX_AppendObjResult (searchCBPtr->interp,
-                                    "bsearch got unexpected EOF on \"",
-                                    Tcl_GetChannelName (searchCBPtr->channel),
-                                     "\"", (char *) NULL);
-                return TCL_ERROR;
-            }
-            goto posixError;
-        }
+        if (ReadRawLine (searchCBPtr, fileOffset, FALSE,
+                         &fileOffset) != TCL_OK)
+            return TCL_ERROR;
     }
-    fileOffset = (off_t) Tcl_Tell (searchCBPtr->channel);  /* Offset of next line */
 
     /*
      * If this is the same line as before, then just leave the comparison
      * result unchanged.
      */
+    searchCBPtr->readOffset = fileOffset;
     if (fileOffset == searchCBPtr->lastRecOffset)
         return TCL_OK;
 
     searchCBPtr->lastRecOffset = fileOffset;
 
-    Tcl_DStringSetLength (&searchCBPtr->lineBuf, 0);
-
     /* 
-     * Read the line. Only compare if EOF was not hit, otherwise, treat as if
-     * we went above the key we are looking for.
+     * Only compare if EOF was not hit, otherwise, treat as if we went above
+     * the key we are looking for.
      */
-    if (Tcl_Gets (searchCBPtr->channel, &searchCBPtr->lineBuf) < 0) {
-        if (Tcl_Eof (searchCBPtr->channel) ||
-            Tcl_InputBlocked (searchCBPtr->channel)) {
-            searchCBPtr->cmpResult = -1;
-            return TCL_OK;
-        }
-        goto posixError;
+    if (fileOffset >= searchCBPtr->fileSize) {
+        searchCBPtr->cmpResult = -1;
+        return TCL_OK;
     }
 
+    /*
+     * Read the line and convert it from the channel's encoding.
+     */
+    if (ReadRawLine (searchCBPtr, fileOffset, TRUE, &endOffset) != TCL_OK)
+        return TCL_ERROR;
+    searchCBPtr->readOffset = endOffset;
+
+    length = Tcl_DStringLength (&searchCBPtr->rawBuf);
+    if (searchCBPtr->stripCR && (length > 0) &&
+        (Tcl_DStringValue (&searchCBPtr->rawBuf) [length - 1] == '\r'))
+        length--;
+    Tcl_DStringFree (&searchCBPtr->lineBuf);
+    Tcl_ExternalToUtfDString (searchCBPtr->encoding,
+                              Tcl_DStringValue (&searchCBPtr->rawBuf),
+                              length, &searchCBPtr->lineBuf);
+
     /*
      * Compare the line.
      */
     if (searchCBPtr->tclProc == NULL) {
-        searchCBPtr->cmpResult =
-            StandardKeyCompare (searchCBPtr->key, 
-                                searchCBPtr->lineBuf.string);
+        if (StandardKeyCompare (searchCBPtr) != TCL_OK)
+            return TCL_ERROR;
     } else {
         if (TclProcKeyCompare (searchCBPtr) != TCL_OK)
             return TCL_ERROR;
     }
 
     return TCL_OK;
-
-  posixError:
-   TclX_AppendObjResult (searchCBPtr->interp,
-                        Tcl_GetChannelName (searchCBPtr->channel), ": ",
-                        Tcl_PosixError (searchCBPtr->interp), (char *) NULL);
-   return TCL_ERROR;
 }
-
+
 /*-----------------------------------------------------------------------------
  * BinSearch --
  *      Binary search a sorted ASCII file.
  *
  * Parameters:
  *   o searchCBPtr (I/O) - The search control block, if the line is found,
- *     it is returned in lineBuf.
+ *     it is returned in lineBuf.  The search starts at lowOffset, which is
+ *     left as the lower bound of the search for any key greater than this
+ *     one.
  * Results:
  *     TCL_OK - If the key was found.
  *     TCL_BREAK - If it was not found.
@@ -248,9 +843,9 @@ BinSearch (binSearchCB_t *searchCBPtr)
 {
     off_t middle, high, low;
 
-    low = 0;
-    if (TclXOSGetFileSize (searchCBPtr->channel, &high) != TCL_OK)
-        goto posixError;
+    low = searchCBPtr->lowOffset;
+    high = searchCBPtr->fileSize;
+    searchCBPtr->lastRecOffset = -1;
 
     /*
      * "Binary search routines are never written right the first time around."
@@ -274,22 +869,291 @@ BinSearch (binSearchCB_t *searchCBPtr)
          */
         if (searchCBPtr->cmpResult > 0) {
             low = middle;
+            searchCBPtr->lowOffset = low;
         } else {
             high = middle - 1;
         }
     }
+}
 
-  posixError:
-   TclX_AppendObjResult (searchCBPtr->interp,
-                         Tcl_GetChannelName (searchCBPtr->channel), ": ",
-                         Tcl_PosixError (searchCBPtr->interp), (char *) NULL);
-   return TCL_ERROR;
+/*-----------------------------------------------------------------------------
+ * ReleaseFileMap --
+ *      Remove a mapping from the cache and unmap it.
+ *
+ * Parameters:
+ *   o fileMapPtr (I) - The mapping, which is freed.
+ *-----------------------------------------------------------------------------
+ */
+static void
+ReleaseFileMap (fileMap_t *fileMapPtr)
+{
+    blockCache_t *cachePtr = fileMapPtr->cachePtr;
+    int idx;
+
+    for (idx = 0; cachePtr->maps [idx] != fileMapPtr; idx++)
+        continue;
+    cachePtr->numMaps--;
+    memmove (&cachePtr->maps [idx], &cachePtr->maps [idx + 1],
+             (cachePtr->numMaps - idx) * sizeof (fileMap_t *));
+    TclXOSUnmapFile (fileMapPtr->addr, fileMapPtr->key.size);
+    ckfree ((char *) fileMapPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * FileMapCloseHandler --
+ *      Called when the channel a file was mapped through is closed, to
+ *      release the mapping.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FileMapCloseHandler (ClientData clientData)
+{
+    ReleaseFileMap ((fileMap_t *) clientData);
+}
+
+/*-----------------------------------------------------------------------------
+ * GetFileMap --
+ *      Get a mapping of a file from the cache, mapping it if it's not there.
+ *      Mappings of the same file, or made through the same channel, that
+ *      don't match the current key are stale and are released.
+ *
+ * Parameters:
+ *   o cachePtr (I/O) - The cache.
+ *   o fileKeyPtr (I) - Identifies the file.
+ *   o channel (I) - Channel open on the file.
+ * Results:
+ *     The address of the mapping, or NULL if the file can't be mapped.
+ *-----------------------------------------------------------------------------
+ */
+static char *
+GetFileMap (blockCache_t *cachePtr,
+            blockKey_t *fileKeyPtr,
+            Tcl_Channel channel)
+{
+    fileMap_t *fileMapPtr = NULL;
+    blockKey_t key;
+    int idx;
+
+    key = *fileKeyPtr;
+    key.blockNum = 0;
+
+    idx = 0;
+    while (idx < cachePtr->numMaps) {
+        fileMapPtr = cachePtr->maps [idx];
+        if ((fileMapPtr->channel == channel) &&
+            (memcmp (&fileMapPtr->key, &key, sizeof (blockKey_t)) == 0))
+            break;
+        if ((fileMapPtr->channel == channel) ||
+            ((fileMapPtr->key.dev == key.dev) &&
+             (fileMapPtr->key.ino == key.ino))) {
+            Tcl_DeleteCloseHandler (fileMapPtr->channel, FileMapCloseHandler,
+                                    (ClientData) fileMapPtr);
+            ReleaseFileMap (fileMapPtr);
+        } else {
+            idx++;
+        }
+    }
+    if (idx == cachePtr->numMaps) {
+        fileMapPtr = (fileMap_t *) ckalloc (sizeof (fileMap_t));
+        if (TclXOSMapFile (channel, key.size, &fileMapPtr->addr) != TCL_OK) {
+            ckfree ((char *) fileMapPtr);
+            return NULL;
+        }
+        fileMapPtr->key = key;
+        fileMapPtr->channel = channel;
+        fileMapPtr->cachePtr = cachePtr;
+        Tcl_CreateCloseHandler (channel, FileMapCloseHandler,
+                                (ClientData) fileMapPtr);
+        if (cachePtr->numMaps == BSEARCH_MAX_MAPS) {
+            fileMap_t *lruMapPtr = cachePtr->maps [BSEARCH_MAX_MAPS - 1];
+
+            Tcl_DeleteCloseHandler (lruMapPtr->channel, FileMapCloseHandler,
+                                    (ClientData) lruMapPtr);
+            ReleaseFileMap (lruMapPtr);
+        }
+        idx = cachePtr->numMaps++;
+    }
+
+    memmove (&cachePtr->maps [1], &cachePtr->maps [0],
+             idx * sizeof (fileMap_t *));
+    cachePtr->maps [0] = fileMapPtr;
+    return fileMapPtr->addr;
+}
+
+/*-----------------------------------------------------------------------------
+ * SetupSearch --
+ *      Get the information about the channel and file needed to read lines
+ *      directly from the file.
+ *
+ * Parameters:
+ *   o searchCBPtr (I/O) - The search control block.
+ * Results:
+ *     TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SetupSearch (binSearchCB_t *searchCBPtr)
+{
+    Tcl_Interp *interp = searchCBPtr->interp;
+    struct stat statBuf;
+    Tcl_DString encodingName;
+    int translation;
+
+    if (TclXOSFstat (interp, searchCBPtr->channel, &statBuf, NULL) != TCL_OK)
+        return TCL_ERROR;
+
+    memset (&searchCBPtr->fileKey, 0, sizeof (blockKey_t));
+    searchCBPtr->fileKey.dev = statBuf.st_dev;
+    searchCBPtr->fileKey.ino = statBuf.st_ino;
+    if (statBuf.st_ino == 0) {
+        /*
+         * No inode numbers, can only share blocks within the channel.
+         */
+        searchCBPtr->fileKey.ino = (ino_t) (size_t) searchCBPtr->channel;
+    }
+    searchCBPtr->fileKey.mtime = statBuf.st_mtime;
+#ifndef NO_STAT_MTIM
+    searchCBPtr->fileKey.mtimeNsec = statBuf.st_mtim.tv_nsec;
+#endif
+    searchCBPtr->fileKey.size = statBuf.st_size;
+    searchCBPtr->fileSize = statBuf.st_size;
+
+    searchCBPtr->mapAddr = NULL;
+    if (S_ISREG (statBuf.st_mode) && (statBuf.st_size > 0))
+        searchCBPtr->mapAddr = GetFileMap (searchCBPtr->cachePtr,
+                                           &searchCBPtr->fileKey,
+                                           searchCBPtr->channel);
+
+    if (TclX_GetChannelOption (interp, searchCBPtr->channel,
+                               TCLX_COPT_TRANSLATION,
+                               &translation) != TCL_OK)
+        return TCL_ERROR;
+    translation = (translation & TCLX_TRANSLATE_READ_MASK) >>
+        TCLX_TRANSLATE_READ_SHIFT;
+    searchCBPtr->eolChar = (translation == TCLX_TRANSLATE_CR) ? '\r' : '\n';
+    searchCBPtr->stripCR = (translation == TCLX_TRANSLATE_AUTO) ||
+        (translation == TCLX_TRANSLATE_CRLF);
+
+    Tcl_DStringInit (&encodingName);
+    if (Tcl_GetChannelOption (interp, searchCBPtr->channel, "-encoding",
+                              &encodingName) != TCL_OK) {
+        Tcl_DStringFree (&encodingName);
+        return TCL_ERROR;
+    }
+    if (STREQU (Tcl_DStringValue (&encodingName), "binary")) {
+        Tcl_DStringFree (&encodingName);
+        Tcl_DStringAppend (&encodingName, "iso8859-1", -1);
+    }
+    searchCBPtr->encoding =
+        Tcl_GetEncoding (interp, Tcl_DStringValue (&encodingName));
+    Tcl_DStringFree (&encodingName);
+    if (searchCBPtr->encoding == NULL)
+        return TCL_ERROR;
+    return TCL_OK;
 }
 
+/*
+ * Entry of the table used to sort the keys of a key list search.
+ */
+typedef struct {
+    searchKey_t    key;
+    int            idx;           /* Index in the key list. */
+    binSearchCB_t *searchCBPtr;
+} keyEntry_t;
+
+/*-----------------------------------------------------------------------------
+ * KeySortCompare --
+ *     qsort comparison function for keyEntry_t.  Keys are ordered the same
+ * way StandardKeyCompare orders them relative to lines.
+ *-----------------------------------------------------------------------------
+ */
+static int
+KeySortCompare (const void *entry1Ptr, const void *entry2Ptr)
+{
+    keyEntry_t *keyEntry1Ptr = (keyEntry_t *) entry1Ptr;
+    keyEntry_t *keyEntry2Ptr = (keyEntry_t *) entry2Ptr;
+
+    return CompareKeys (keyEntry1Ptr->searchCBPtr, &keyEntry1Ptr->key,
+                        &keyEntry2Ptr->key);
+}
+
+/*-----------------------------------------------------------------------------
+ * SearchKeyList --
+ *     Search for each of a list of keys.  With the standard comparison, the
+ * keys are searched for in ascending order, with each search starting from
+ * the lower bound left by the previous one, so the whole list is found in a
+ * single pass down the file.  The keys can't be ordered for a comparison
+ * proc, so they are searched for independently.
+ *
+ * Parameters:
+ *   o searchCBPtr (I/O) - The search control block.
+ *   o keyListPtr (I) - The list of keys.
+ * Results:
+ *     TCL_OK or TCL_ERROR.  The result is set to a list of the lines found,
+ * in the order of the keys, with an empty element for each key not found.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SearchKeyList (binSearchCB_t *searchCBPtr, Tcl_Obj *keyListPtr)
+{
+    Tcl_Interp *interp = searchCBPtr->interp;
+    Tcl_Obj **keyObjv, **resultObjv;
+    keyEntry_t *keyTable;
+    int keyObjc, idx, status;
+
+    if (Tcl_ListObjGetElements (interp, keyListPtr, &keyObjc,
+                                &keyObjv) != TCL_OK)
+        return TCL_ERROR;
+
+    keyTable = (keyEntry_t *) ckalloc ((keyObjc + 1) * sizeof (keyEntry_t));
+    resultObjv = (Tcl_Obj **) ckalloc ((keyObjc + 1) * sizeof (Tcl_Obj *));
+    status = TCL_OK;
+    for (idx = 0; idx < keyObjc; idx++) {
+        resultObjv [idx] = NULL;
+        if (status == TCL_OK)
+            status = SetKey (searchCBPtr, keyObjv [idx],
+                             &keyTable [idx].key);
+        keyTable [idx].idx = idx;
+        keyTable [idx].searchCBPtr = searchCBPtr;
+    }
+    if ((status == TCL_OK) && (searchCBPtr->tclProc == NULL))
+        qsort (keyTable, keyObjc, sizeof (keyEntry_t), KeySortCompare);
+
+    for (idx = 0; (status != TCL_ERROR) && (idx < keyObjc); idx++) {
+        searchCBPtr->key = keyTable [idx].key;
+        if (searchCBPtr->tclProc != NULL)
+            searchCBPtr->lowOffset = 0;
+        status = BinSearch (searchCBPtr);
+        if (status == TCL_ERROR)
+            break;
+        if (status == TCL_OK) {
+            resultObjv [keyTable [idx].idx] =
+                Tcl_NewStringObj (Tcl_DStringValue (&searchCBPtr->lineBuf),
+                                  Tcl_DStringLength (&searchCBPtr->lineBuf));
+        } else {
+            resultObjv [keyTable [idx].idx] = Tcl_NewObj ();
+        }
+    }
+
+    if (status != TCL_ERROR) {
+        Tcl_SetObjResult (interp, Tcl_NewListObj (keyObjc, resultObjv));
+        status = TCL_OK;
+    } else {
+        for (idx = 0; idx < keyObjc; idx++) {
+            if (resultObjv [idx] != NULL)
+                Tcl_DecrRefCount (resultObjv [idx]);
+        }
+    }
+    ckfree ((char *) keyTable);
+    ckfree ((char *) resultObjv);
+    return status;
+}
+
 /*-----------------------------------------------------------------------------
  * TclX_BsearchObjCmd --
  *     Implements the TCL bsearch command:
- *        bsearch filehandle key ?retvar?
+ *        bsearch ?options? filehandle key ?retvar? ?compare_proc?
+ *        bsearch -keys ?options? filehandle keylist ?compare_proc?
  *-----------------------------------------------------------------------------
  */
 static int
@@ -298,42 +1162,149 @@ TclX_BsearchObjCmd (ClientData clientData,
                     int objc,
                     Tcl_Obj *const objv[])
 {
-    int status;
+    int status, keyList = FALSE, argIdx;
     binSearchCB_t searchCB;
+    Tcl_Obj *retVarObj, *procObj;
+    char *option;
+
+    searchCB.cmpFlags = 0;
+    searchCB.field = 0;
+    searchCB.separator = -1;
+
+    /*
+     * Options come before the handle, which can't start with a "-".
+     */
+    for (argIdx = 1; argIdx < objc; argIdx++) {
+        option = Tcl_GetStringFromObj (objv [argIdx], NULL);
+        if (option [0] != '-')
+            break;
+        if (STREQU (option, "-keys")) {
+            keyList = TRUE;
+        } else if (STREQU (option, "-numeric")) {
+            searchCB.cmpFlags |= BSEARCH_NUMERIC;
+        } else if (STREQU (option, "-nocase")) {
+            searchCB.cmpFlags |= BSEARCH_NOCASE;
+        } else if (STREQU (option, "-prefix")) {
+            searchCB.cmpFlags |= BSEARCH_PREFIX;
+        } else if (STREQU (option, "-field")) {
+            if (argIdx + 1 >= objc)
+                goto argError;
+            if (Tcl_GetIntFromObj (interp, objv [++argIdx],
+                                   &searchCB.field) != TCL_OK)
+                return TCL_ERROR;
+            if (searchCB.field < 0) {
+                TclX_AppendObjResult (interp, "field number must be ",
+                                      ">= 0, got \"",
+                                      Tcl_GetStringFromObj (objv [argIdx],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else if (STREQU (option, "-separator")) {
+            int sepLen;
+            char *sepStr;
+
+            if (argIdx + 1 >= objc)
+                goto argError;
+            sepStr = Tcl_GetStringFromObj (objv [++argIdx], &sepLen);
+            if ((sepLen != 1) || (sepStr [0] == '\n')) {
+                TclX_AppendObjResult (interp, "separator must be a single ",
+                                      "byte character, got \"", sepStr,
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+            searchCB.separator = (unsigned char) sepStr [0];
+        } else {
+            TclX_AppendObjResult (interp, "invalid option \"", option,
+                                  "\", expected one of \"-keys\", ",
+                                  "\"-numeric\", \"-nocase\", \"-prefix\", ",
+                                  "\"-field\" or \"-separator\"",
+                                  (char *) NULL);
+            return TCL_ERROR;
+        }
+    }
+    if ((objc - argIdx < 2) || (objc - argIdx > (keyList ? 3 : 4)))
+        goto argError;
 
-    if ((objc < 3) || (objc > 5)) {
-        TclX_WrongArgs (interp, objv [0], 
-                        "handle key ?retvar? ?compare_proc?");
+    if ((searchCB.cmpFlags & BSEARCH_NUMERIC) &&
+        (searchCB.cmpFlags & (BSEARCH_NOCASE | BSEARCH_PREFIX))) {
+        TclX_AppendObjResult (interp, "-numeric can't be combined with ",
+                              "-nocase or -prefix", (char *) NULL);
+        return TCL_ERROR;
+    }
+    if (keyList) {
+        retVarObj = NULL;
+        procObj = (objc - argIdx == 3) ? objv [argIdx + 2] : NULL;
+    } else {
+        retVarObj = ((objc - argIdx >= 3) &&
+                     !TclX_IsNullObj (objv [argIdx + 2])) ?
+            objv [argIdx + 2] : NULL;
+        procObj = (objc - argIdx == 4) ? objv [argIdx + 3] : NULL;
+    }
+    if ((procObj != NULL) && ((searchCB.cmpFlags != 0) ||
+                              (searchCB.field != 0) ||
+                              (searchCB.separator >= 0))) {
+        TclX_AppendObjResult (interp, "comparison options can't be used ",
+                              "with a compare_proc", (char *) NULL);
         return TCL_ERROR;
     }
 
     searchCB.channel = TclX_GetOpenChannelObj (interp,
-                                               objv [1],
+                                               objv [argIdx],
                                                TCL_READABLE);
     if (searchCB.channel == NULL)
         return TCL_ERROR;
 
     searchCB.interp = interp;
-    searchCB.key = Tcl_GetStringFromObj (objv [2], NULL);
-    searchCB.lastRecOffset = -1;
-    searchCB.tclProc = (objc == 5) ? Tcl_GetStringFromObj (objv [4], NULL) :
-        NULL;
+    if (!keyList) {
+        if (SetKey (&searchCB, objv [argIdx + 1], &searchCB.key) != TCL_OK)
+            return TCL_ERROR;
+    }
+    searchCB.readOffset = 0;
+    searchCB.lowOffset = 0;
+    searchCB.tclProc = procObj;
+    searchCB.cachePtr = (blockCache_t *) clientData;
+    searchCB.encoding = NULL;
 
     Tcl_DStringInit (&searchCB.lineBuf);
+    Tcl_DStringInit (&searchCB.rawBuf);
 
-    status = BinSearch (&searchCB);
-    if (status == TCL_ERROR) {
-        Tcl_DStringFree (&searchCB.lineBuf);
-        return TCL_ERROR;
+    /*
+     * Hold a reference to the channel, so a compare proc that closes it
+     * can't release the file mapping while it is being searched.
+     */
+    Tcl_RegisterChannel (NULL, searchCB.channel);
+    status = SetupSearch (&searchCB);
+    if (status == TCL_OK) {
+        if (keyList) {
+            status = SearchKeyList (&searchCB, objv [argIdx + 1]);
+        } else {
+            status = BinSearch (&searchCB);
+        }
     }
+    if (searchCB.encoding != NULL)
+        Tcl_FreeEncoding (searchCB.encoding);
+
+    /*
+     * Leave the channel positioned after the last data read, as reading
+     * through the channel did.
+     */
+    if (status != TCL_ERROR)
+        Tcl_Seek (searchCB.channel, searchCB.readOffset, SEEK_SET);
+    Tcl_UnregisterChannel (NULL, searchCB.channel);
+    if (status == TCL_ERROR)
+        goto errorExit;
+
+    if (keyList)
+        goto okExit;
 
     if (status == TCL_BREAK) {
-        if ((objc >= 4) && !TclX_IsNullObj (objv [3]))
+        if (retVarObj != NULL)
             Tcl_SetBooleanObj (Tcl_GetObjResult (interp), FALSE);
         goto okExit;
     }
 
-    if ((objc == 3) || TclX_IsNullObj (objv [3])) {
+    if (retVarObj == NULL) {
         Tcl_SetStringObj (Tcl_GetObjResult (interp),
                           Tcl_DStringValue (&searchCB.lineBuf),
                           -1);
@@ -342,7 +1313,7 @@ TclX_BsearchObjCmd (ClientData clientData,
 
         valPtr = Tcl_NewStringObj (Tcl_DStringValue (&searchCB.lineBuf),
                                    -1);
-        if (Tcl_ObjSetVar2(interp, objv[3], NULL, valPtr,
+        if (Tcl_ObjSetVar2(interp, retVarObj, NULL, valPtr,
                            TCL_PARSE_PART1|TCL_LEAVE_ERR_MSG) == NULL) {
             Tcl_DecrRefCount (valPtr);
             goto errorExit;
@@ -352,11 +1323,48 @@ TclX_BsearchObjCmd (ClientData clientData,
 
   okExit:
     Tcl_DStringFree (&searchCB.lineBuf);
+    Tcl_DStringFree (&searchCB.rawBuf);
     return TCL_OK;
 
   errorExit:
     Tcl_DStringFree (&searchCB.lineBuf);
-    return TCL_OK;
+    Tcl_DStringFree (&searchCB.rawBuf);
+    return TCL_ERROR;
+
+  argError:
+    TclX_WrongArgs (interp, objv [0], 
+                    "?options? handle key ?retvar? ?compare_proc?");
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * BsearchCleanUp --
+ *     Called when the interpreter is deleted to free the block cache.
+ *-----------------------------------------------------------------------------
+ */
+static void
+BsearchCleanUp (ClientData clientData, Tcl_Interp *interp)
+{
+    blockCache_t *cachePtr = (blockCache_t *) clientData;
+    probeBlock_t *blockPtr;
+
+    while (cachePtr->mruPtr != NULL) {
+        blockPtr = cachePtr->mruPtr;
+        cachePtr->mruPtr = blockPtr->nextPtr;
+        ckfree ((char *) blockPtr);
+    }
+    if (cachePtr->blockTablePtr != NULL) {
+        Tcl_DeleteHashTable (cachePtr->blockTablePtr);
+        ckfree ((char *) cachePtr->blockTablePtr);
+    }
+    while (cachePtr->numMaps > 0) {
+        fileMap_t *fileMapPtr = cachePtr->maps [0];
+
+        Tcl_DeleteCloseHandler (fileMapPtr->channel, FileMapCloseHandler,
+                                (ClientData) fileMapPtr);
+        ReleaseFileMap (fileMapPtr);
+    }
+    ckfree ((char *) cachePtr);
 }
 
 /*-----------------------------------------------------------------------------
@@ -367,10 +1375,21 @@ TclX_BsearchObjCmd (ClientData clientData,
 void
 TclX_BsearchInit (Tcl_Interp *interp)
 {
+    blockCache_t *cachePtr;
+
+    cachePtr = (blockCache_t *) ckalloc (sizeof (blockCache_t));
+    cachePtr->blockTablePtr = NULL;
+    cachePtr->mruPtr = NULL;
+    cachePtr->lruPtr = NULL;
+    cachePtr->numBlocks = 0;
+    cachePtr->numMaps = 0;
+
+    Tcl_CallWhenDeleted (interp, BsearchCleanUp, (ClientData) cachePtr);
+
     Tcl_CreateObjCommand (interp, 
                           "bsearch",
                           TclX_BsearchObjCmd, 
-                          (ClientData) NULL,
+                          (ClientData) cachePtr,
                           (Tcl_CmdDeleteProc*) NULL);
 }
 
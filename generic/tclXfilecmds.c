@@ -20,6 +20,99 @@
 
 static char *FILE_ID_OPT = "-fileid";
 
+/*
+ * Options and state for readdir, passed to ReadDirCallback.
+ */
+#define READDIR_TYPES  1   /* Return the type of each entry.   */
+#define READDIR_STAT   2   /* Return the status of each entry. */
+
+typedef struct {
+    Tcl_Obj  *fileListObj;
+    int       flags;
+    int       numPatterns;  /* Glob patterns names must match. */
+    Tcl_Obj **patterns;
+} readDirInfo_t;
+
+/*
+ * State for walkdir.  The paths given to the scripts are built from the
+ * directory path given to the command, rather than the translated path used
+ * to read directories.
+ */
+typedef struct {
+    Tcl_Obj     *pathVarObj;    /* Variable set to the path of the entry. */
+    Tcl_Obj     *typeVarObj;    /* Variable set to the type or NULL.      */
+    Tcl_Obj     *bodyObj;
+    Tcl_Obj     *pruneObj;      /* Decides if a directory is walked.      */
+    int          maxDepth;      /* Deepest level walked, -1 if unlimited. */
+    int          numPatterns;   /* Glob patterns names must match.        */
+    Tcl_Obj    **patterns;
+    int          depth;         /* Level of the entries being walked.     */
+    Tcl_DString  dirPath;       /* Directory being walked.                */
+} walkDir_t;
+
+#ifdef TCL_THREADS
+/*
+ * Parallel walking.  Worker threads read directories ahead of the
+ * interpreter thread, which runs the scripts on the entries.  The
+ * directories are delivered in the order they were found, so the tree is
+ * walked breadth-first.
+ */
+typedef struct walkDirBatch_t {
+    char                  *path;        /* Translated path to read.     */
+    char                  *subPath;     /* Path relative to the root.   */
+    char                  *tclPath;     /* Path given to the scripts.   */
+    int                    depth;       /* Level of the entries.        */
+    Tcl_DString            names;       /* Names, each NUL terminated.  */
+    int                   *nameStarts;
+    TclX_FileType         *fileTypes;
+    int                    numEntries;
+    int                    maxEntries;
+    int                    caseSensitive;
+    int                    errorNum;    /* Set if reading failed.       */
+    int                    done;        /* Reading is complete.         */
+    struct walkDirBatch_t *nextPtr;     /* Next in the work queue or the
+                                           list waiting to be queued.   */
+    struct walkDirBatch_t *nextInFlightPtr;/* Next in order of submission. */
+} walkDirBatch_t;
+
+/*
+ * State shared between the interpreter thread and the workers.  The root
+ * directory is opened before the workers start and each directory is opened
+ * relative to it, so symbolic links are not followed.  Everything from the
+ * mutex down is protected by it.
+ */
+typedef struct {
+    ClientData       rootHandle;        /* The directory being walked. */
+    char            *rootPath;
+    Tcl_Mutex        mutex;
+    Tcl_Condition    workCond;          /* Signaled when work is queued. */
+    Tcl_Condition    doneCond;          /* Signaled when a batch is done. */
+    walkDirBatch_t  *queueHead;         /* Batches waiting for a worker. */
+    walkDirBatch_t  *queueTail;
+    int              shutdown;          /* Workers should exit. */
+} parallelWalk_t;
+#endif
+
+/*
+ * Number of characters for_file reads from a regular file at a time.
+ */
+#define FOR_FILE_BLOCK_CHARS (256 * 1024)
+
+/*
+ * Names of the directory entry types, indexed by TclX_FileType.  These are
+ * the same as returned by "file type".
+ */
+static char *fileTypeNames [] = {
+    "unknown",
+    "file",
+    "directory",
+    "link",
+    "characterSpecial",
+    "blockSpecial",
+    "fifo",
+    "socket"
+};
+
 /*
  * Prototypes of internal functions.
  */
@@ -28,12 +121,111 @@ TruncateByPath  (Tcl_Interp  *interp,
                  char        *filePath,
                  off_t        newSize);
 
+static TclX_FileType
+ModeToFileType (int mode);
+
+static Tcl_Obj *
+StatToListObj (struct stat *statBufPtr);
+
+static int
+ReadDirCallback (Tcl_Interp    *interp,
+                 char          *path,
+                 char          *fileName,
+                 int            caseSensitive,
+                 TclX_FileType  fileType,
+                 ClientData     dirHandle,
+                 ClientData     clientData);
+
+static void
+AppendEntryPath (Tcl_DString *pathPtr,
+                 char        *fileName);
+
+static int
+WalkDirEntry (Tcl_Interp    *interp,
+              walkDir_t     *walkPtr,
+              char          *dirPath,
+              char          *fileName,
+              int            caseSensitive,
+              TclX_FileType  fileType,
+              int           *descendPtr);
+
+static int
+WalkDirCallback (Tcl_Interp    *interp,
+                 char          *path,
+                 char          *fileName,
+                 int            caseSensitive,
+                 TclX_FileType  fileType,
+                 ClientData     dirHandle,
+                 ClientData     clientData);
+
+#ifdef TCL_THREADS
+static walkDirBatch_t *
+NewDirBatch (char *path,
+             char *subPath,
+             char *tclPath,
+             int   depth);
+
+static void
+FreeDirBatch (walkDirBatch_t *batchPtr);
+
+static int
+ReadDirBatchCallback (Tcl_Interp    *interp,
+                      char          *path,
+                      char          *fileName,
+                      int            caseSensitive,
+                      TclX_FileType  fileType,
+                      ClientData     dirHandle,
+                      ClientData     clientData);
+
+static Tcl_ThreadCreateType
+WalkWorkerThread (ClientData clientData);
+
+static int
+DeliverDirBatch (Tcl_Interp      *interp,
+                 walkDir_t       *walkPtr,
+                 walkDirBatch_t  *batchPtr,
+                 walkDirBatch_t **waitTailPtr);
+
+static int
+WalkDirParallel (Tcl_Interp *interp,
+                 walkDir_t  *walkPtr,
+                 char       *path,
+                 char       *tclPath,
+                 int         numThreads);
+#endif
+
+static Tcl_Channel
+OpenFileOrPipeline (Tcl_Interp *interp,
+                    Tcl_Obj    *fileNameObj,
+                    char       *mode);
+
+static int
+PlainTextChannel (Tcl_Interp  *interp,
+                  Tcl_Channel  channel,
+                  int          direction,
+                  int         *allowCRPtr);
+
+static int
+IsPlainText (char *text,
+             int   textLen,
+             int   allowCR);
+
+static int
+ReadRawBlock (Tcl_Channel  channel,
+              Tcl_Obj     *bufObj,
+              int          toRead);
+
+static int
+ForFileLine (Tcl_Interp *interp,
+             Tcl_Obj    *varObj,
+             Tcl_Obj    *bodyObj,
+             Tcl_Obj    *lineObj);
+
 static int
-ReadDirCallback (Tcl_Interp  *interp,
-                 char        *path,
-                 char        *fileName,
-                 int          caseSensitive,
-                 ClientData   clientData);
+ForFileBlocks (Tcl_Interp  *interp,
+               Tcl_Channel  channel,
+               Tcl_Obj     *varObj,
+               Tcl_Obj     *bodyObj);
 
 static int 
 TclX_PipeObjCmd (ClientData  clientData,
@@ -53,6 +245,30 @@ TclX_ReaddirObjCmd (ClientData clientData,
                     int         objc,
                     Tcl_Obj    *const objv[]);
 
+static int
+TclX_WalkdirObjCmd (ClientData clientData,
+                    Tcl_Interp *interp,
+                    int         objc,
+                    Tcl_Obj    *const objv[]);
+
+static int
+TclX_For_fileObjCmd (ClientData clientData,
+                     Tcl_Interp *interp,
+                     int         objc,
+                     Tcl_Obj    *const objv[]);
+
+static int
+TclX_Read_fileObjCmd (ClientData clientData,
+                      Tcl_Interp *interp,
+                      int         objc,
+                      Tcl_Obj    *const objv[]);
+
+static int
+TclX_Write_fileObjCmd (ClientData clientData,
+                       Tcl_Interp *interp,
+                       int         objc,
+                       Tcl_Obj    *const objv[]);
+
 
 /*-----------------------------------------------------------------------------
  * Tcl_PipeObjCmd --
@@ -203,41 +419,150 @@ TclX_FtruncateObjCmd (ClientData clientData,
     }
 }
 
+/*-----------------------------------------------------------------------------
+ * ModeToFileType --
+ *
+ *   Convert the file type bits of a stat mode to a file type.
+ *-----------------------------------------------------------------------------
+ */
+static TclX_FileType
+ModeToFileType (int mode)
+{
+    switch (mode & S_IFMT) {
+      case S_IFREG:
+        return TCLX_FTYPE_FILE;
+      case S_IFDIR:
+        return TCLX_FTYPE_DIRECTORY;
+#ifdef S_IFLNK
+      case S_IFLNK:
+        return TCLX_FTYPE_LINK;
+#endif
+      case S_IFCHR:
+        return TCLX_FTYPE_CHAR;
+#ifdef S_IFBLK
+      case S_IFBLK:
+        return TCLX_FTYPE_BLOCK;
+#endif
+      case S_IFIFO:
+        return TCLX_FTYPE_FIFO;
+#ifdef S_IFSOCK
+      case S_IFSOCK:
+        return TCLX_FTYPE_SOCKET;
+#endif
+    }
+    return TCLX_FTYPE_UNKNOWN;
+}
+
+/*-----------------------------------------------------------------------------
+ * StatToListObj --
+ *
+ *   Return the status of a directory entry as a keyed list, with the same
+ * keys as fstat, except for tty.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+StatToListObj (struct stat *statBufPtr)
+{
+    Tcl_Obj *fieldObjv [11], *pairObjv [2];
+    int      idx = 0;
+
+#define STAT_FIELD(name, valueObj) \
+    pairObjv [0] = Tcl_NewStringObj (name, -1); \
+    pairObjv [1] = valueObj; \
+    fieldObjv [idx++] = Tcl_NewListObj (2, pairObjv)
+
+    STAT_FIELD ("atime", Tcl_NewLongObj ((long) statBufPtr->st_atime));
+    STAT_FIELD ("ctime", Tcl_NewLongObj ((long) statBufPtr->st_ctime));
+    STAT_FIELD ("dev", Tcl_NewIntObj ((int) statBufPtr->st_dev));
+    STAT_FIELD ("gid", Tcl_NewIntObj ((int) statBufPtr->st_gid));
+    STAT_FIELD ("ino", Tcl_NewWideIntObj ((Tcl_WideInt) statBufPtr->st_ino));
+    STAT_FIELD ("mode", Tcl_NewIntObj ((int) statBufPtr->st_mode));
+    STAT_FIELD ("mtime", Tcl_NewLongObj ((long) statBufPtr->st_mtime));
+    STAT_FIELD ("nlink", Tcl_NewIntObj ((int) statBufPtr->st_nlink));
+    STAT_FIELD ("size", Tcl_NewWideIntObj ((Tcl_WideInt) statBufPtr->st_size));
+    STAT_FIELD ("uid", Tcl_NewIntObj ((int) statBufPtr->st_uid));
+    STAT_FIELD ("type", Tcl_NewStringObj (
+        fileTypeNames [ModeToFileType (statBufPtr->st_mode)], -1));
+#undef STAT_FIELD
+
+    return Tcl_NewListObj (idx, fieldObjv);
+}
+
 /*-----------------------------------------------------------------------------
  * ReadDirCallback --
  *
- *   Callback procedure for walking directories.
+ *   Callback procedure for walking directories.  Entries that don't match
+ * the glob patterns are skipped before their status is looked up.  An entry
+ * that is removed before its status can be looked up is skipped.
  * Parameters:
  *   o interp (I) - Interp is passed though.
  *   o path (I) - Normalized path to directory.
  *   o fileName (I) - Tcl normalized file name in directory.
  *   o caseSensitive (I) - Are the file names case sensitive?  Always
  *     TRUE on Unix.
- *   o clientData (I) - Tcl_DString to append names to.
+ *   o fileType (I) - Type of the entry, if known.
+ *   o dirHandle (I) - Directory handle for TclXOSStatDirEntry.
+ *   o clientData (I) - readDirInfo_t with the list to append names to.
  * Returns:
- *   TCL_OK.
+ *   TCL_OK or TCL_ERROR.
  *-----------------------------------------------------------------------------
  */
 static int
-ReadDirCallback (Tcl_Interp *interp,
-                 char *path,
-                 char *fileName,
-                 int caseSensitive,
-                 ClientData clientData)
+ReadDirCallback (Tcl_Interp    *interp,
+                 char          *path,
+                 char          *fileName,
+                 int            caseSensitive,
+                 TclX_FileType  fileType,
+                 ClientData     dirHandle,
+                 ClientData     clientData)
 {
-    Tcl_Obj *fileListObj = (Tcl_Obj *) clientData;
-    Tcl_Obj *fileNameObj;
-    int      result;
+    readDirInfo_t *infoPtr = (readDirInfo_t *) clientData;
+    struct stat    statBuf;
+    Tcl_Obj       *valueObj = NULL;
+    int            idx;
 
-    fileNameObj = Tcl_NewStringObj (fileName, -1);
-    result = Tcl_ListObjAppendElement (interp, fileListObj, fileNameObj);
-    return result;
+    if (infoPtr->numPatterns > 0) {
+        for (idx = 0; idx < infoPtr->numPatterns; idx++) {
+            if (Tcl_StringCaseMatch (fileName,
+                                     Tcl_GetString (infoPtr->patterns [idx]),
+                                     !caseSensitive))
+                break;
+        }
+        if (idx == infoPtr->numPatterns)
+            return TCL_OK;
+    }
+
+    if ((infoPtr->flags & READDIR_STAT) ||
+        ((infoPtr->flags & READDIR_TYPES) &&
+         (fileType == TCLX_FTYPE_UNKNOWN))) {
+        if (TclXOSStatDirEntry (dirHandle, path, fileName, &statBuf) < 0) {
+            if (errno == ENOENT)
+                return TCL_OK;
+            TclX_AppendObjResult (interp, "stat of \"", fileName,
+                                  "\" in directory \"", path, "\" failed: ",
+                                  Tcl_PosixError (interp), (char *) NULL);
+            return TCL_ERROR;
+        }
+        if (infoPtr->flags & READDIR_STAT) {
+            valueObj = StatToListObj (&statBuf);
+        } else {
+            fileType = ModeToFileType (statBuf.st_mode);
+        }
+    }
+    if ((valueObj == NULL) && (infoPtr->flags & READDIR_TYPES))
+        valueObj = Tcl_NewStringObj (fileTypeNames [fileType], -1);
+
+    Tcl_ListObjAppendElement (interp, infoPtr->fileListObj,
+                              Tcl_NewStringObj (fileName, -1));
+    if (valueObj != NULL)
+        Tcl_ListObjAppendElement (interp, infoPtr->fileListObj, valueObj);
+    return TCL_OK;
 }
-
+
 /*-----------------------------------------------------------------------------
  * Tcl_ReaddirObjCmd --
  *     Implements the rename TCL command:
- *         readdir ?-hidden? dirPath
+ *         readdir ?-hidden? ?-types? ?-stat? ?-glob patternList? dirPath
  *
  * Results:
  *      Standard TCL result.
@@ -249,36 +574,61 @@ TclX_ReaddirObjCmd (ClientData clientData,
                     int objc,
                     Tcl_Obj *const objv[])
 {
-    Tcl_DString  pathBuf;
-    char        *dirPath;
-    int          hidden, status;
-    Tcl_Obj     *fileListObj;
-    char        *switchString;
-    int          dirPathLen;
-    
-    if ((objc < 2) || (objc > 3))
-        return TclX_WrongArgs (interp, objv [0], "?-hidden? dirPath");
+    Tcl_DString    pathBuf;
+    char          *dirPath;
+    int            hidden, status, objIdx;
+    readDirInfo_t  info;
+    Tcl_Obj       *patternListObj = NULL;
+    char          *switchString;
 
-    if (objc == 2) {
-        dirPath = Tcl_GetStringFromObj (objv [1], &dirPathLen);
-        hidden = FALSE;
-    } else {
-        switchString = Tcl_GetStringFromObj (objv [1], NULL);
-        if (!STREQU (switchString, "-hidden")) {
-            TclX_AppendObjResult (interp,
-                                  "expected option of \"-hidden\", got \"",
+    hidden = FALSE;
+    info.flags = 0;
+    info.numPatterns = 0;
+    info.patterns = NULL;
+
+    for (objIdx = 1; objIdx < objc - 1; objIdx++) {
+        switchString = Tcl_GetStringFromObj (objv [objIdx], NULL);
+        if (switchString [0] != '-')
+            break;
+        if (STREQU (switchString, "-hidden")) {
+            hidden = TRUE;
+        } else if (STREQU (switchString, "-types")) {
+            info.flags |= READDIR_TYPES;
+        } else if (STREQU (switchString, "-stat")) {
+            info.flags |= READDIR_STAT;
+        } else if (STREQU (switchString, "-glob")) {
+            if (++objIdx >= objc - 1)
+                goto wrongArgs;
+            patternListObj = objv [objIdx];
+        } else {
+            TclX_AppendObjResult (interp, "expected option of \"-hidden\", ",
+                                  "\"-types\", \"-stat\" or \"-glob\", got \"",
                                   switchString, "\"", (char *) NULL);
             return TCL_ERROR;
         }
-        dirPath = Tcl_GetStringFromObj (objv [2], NULL);
-        hidden = TRUE;
+    }
+    if (objIdx != objc - 1)
+        goto wrongArgs;
+
+    /*
+     * Keep the pattern list from shimmering while it's in use.
+     */
+    if (patternListObj != NULL) {
+        if (Tcl_ListObjGetElements (interp, patternListObj,
+                                    &info.numPatterns,
+                                    &info.patterns) != TCL_OK)
+            return TCL_ERROR;
+        Tcl_IncrRefCount (patternListObj);
     }
 
     Tcl_DStringInit (&pathBuf);
 
-    fileListObj = Tcl_NewObj ();
+    info.fileListObj = Tcl_NewObj ();
 
-    dirPath = Tcl_TranslateFileName (interp, dirPath, &pathBuf);
+    dirPath = Tcl_TranslateFileName (interp,
+                                     Tcl_GetStringFromObj (objv [objIdx],
+                                                           NULL),
+                                     &pathBuf);
     if (dirPath == NULL) {
         goto errorExit;
     }
@@ -287,21 +637,1311 @@ TclX_ReaddirObjCmd (ClientData clientData,
                             dirPath,
                             hidden,
                             ReadDirCallback,
-                            (ClientData) fileListObj);
+                            (ClientData) &info);
     if (status == TCL_ERROR)
         goto errorExit;
 
+    if (patternListObj != NULL)
+        Tcl_DecrRefCount (patternListObj);
     Tcl_DStringFree (&pathBuf);
-    Tcl_SetObjResult (interp, fileListObj);
+    Tcl_SetObjResult (interp, info.fileListObj);
     return TCL_OK;
 
   errorExit:
+    if (patternListObj != NULL)
+        Tcl_DecrRefCount (patternListObj);
     Tcl_DStringFree (&pathBuf);
-    Tcl_DecrRefCount (fileListObj);
+    Tcl_DecrRefCount (info.fileListObj);
     return TCL_ERROR;
+
+  wrongArgs:
+    return TclX_WrongArgs (interp, objv [0],
+                           "?-hidden? ?-types? ?-stat? ?-glob patternList? "
+                           "dirPath");
+}
+
+
+/*-----------------------------------------------------------------------------
+ * AppendEntryPath --
+ *
+ *   Append the name of a directory entry to the path of the directory.
+ *-----------------------------------------------------------------------------
+ */
+static void
+AppendEntryPath (Tcl_DString *pathPtr,
+                 char        *fileName)
+{
+    int pathLen = Tcl_DStringLength (pathPtr);
+
+    if ((pathLen > 0) && (Tcl_DStringValue (pathPtr) [pathLen - 1] != '/'))
+        Tcl_DStringAppend (pathPtr, "/", 1);
+    Tcl_DStringAppend (pathPtr, fileName, -1);
+}
+
+/*-----------------------------------------------------------------------------
+ * WalkDirEntry --
+ *
+ *   Run the walkdir scripts on a directory entry.  The body is evaluated if
+ * the name matches the glob patterns.  For a directory that is within the
+ * depth limit, the prune script is then evaluated to decide if it should be
+ * walked.
+ * Parameters:
+ *   o interp (I) - Errors are returned in result.
+ *   o walkPtr (I) - The walkdir state.
+ *   o dirPath (I) - Path to the directory, as given to the scripts.
+ *   o fileName (I) - Name of the entry.
+ *   o caseSensitive (I) - Are the file names case sensitive?
+ *   o fileType (I) - Type of the entry.
+ *   o descendPtr (O) - Set to TRUE if the entry should be walked.
+ * Returns:
+ *   TCL_OK, TCL_ERROR or the code that should end the walk, such as
+ * TCL_BREAK.
+ *-----------------------------------------------------------------------------
+ */
+static int
+WalkDirEntry (Tcl_Interp    *interp,
+              walkDir_t     *walkPtr,
+              char          *dirPath,
+              char          *fileName,
+              int            caseSensitive,
+              TclX_FileType  fileType,
+              int           *descendPtr)
+{
+    Tcl_DString  entryPath;
+    Tcl_Obj     *pathObj;
+    int          matched, prune, idx, result;
+    char         msg [64];
+
+    *descendPtr = (fileType == TCLX_FTYPE_DIRECTORY) &&
+        ((walkPtr->maxDepth < 0) || (walkPtr->depth < walkPtr->maxDepth));
+
+    matched = (walkPtr->numPatterns == 0);
+    for (idx = 0; (idx < walkPtr->numPatterns) && !matched; idx++) {
+        matched = Tcl_StringCaseMatch (fileName,
+                                       Tcl_GetString (walkPtr->patterns [idx]),
+                                       !caseSensitive);
+    }
+    if (!matched && !(*descendPtr && (walkPtr->pruneObj != NULL)))
+        return TCL_OK;
+
+    Tcl_DStringInit (&entryPath);
+    Tcl_DStringAppend (&entryPath, dirPath, -1);
+    AppendEntryPath (&entryPath, fileName);
+    pathObj = Tcl_NewStringObj (Tcl_DStringValue (&entryPath),
+                                Tcl_DStringLength (&entryPath));
+    Tcl_IncrRefCount (pathObj);
+    Tcl_DStringFree (&entryPath);
+
+    result = TCL_OK;
+    if (matched) {
+        if (Tcl_ObjSetVar2 (interp, walkPtr->pathVarObj, NULL, pathObj,
+                            TCL_LEAVE_ERR_MSG) == NULL)
+            goto errorExit;
+        if ((walkPtr->typeVarObj != NULL) &&
+            (Tcl_ObjSetVar2 (interp, walkPtr->typeVarObj, NULL,
+                             Tcl_NewStringObj (fileTypeNames [fileType], -1),
+                             TCL_LEAVE_ERR_MSG) == NULL))
+            goto errorExit;
+
+        result = Tcl_EvalObjEx (interp, walkPtr->bodyObj, 0);
+        if (result == TCL_CONTINUE) {
+            result = TCL_OK;
+        } else if (result == TCL_ERROR) {
+            sprintf (msg, "\n    (\"walkdir\" body line %d)",
+                     ERRORLINE (interp));
+            Tcl_AddErrorInfo (interp, msg);
+        }
+        if (result != TCL_OK)
+            goto exitPoint;
+    }
+
+    if (*descendPtr && (walkPtr->pruneObj != NULL)) {
+        if (Tcl_ObjSetVar2 (interp, walkPtr->pathVarObj, NULL, pathObj,
+                            TCL_LEAVE_ERR_MSG) == NULL)
+            goto errorExit;
+        if ((walkPtr->typeVarObj != NULL) &&
+            (Tcl_ObjSetVar2 (interp, walkPtr->typeVarObj, NULL,
+                             Tcl_NewStringObj (fileTypeNames [fileType], -1),
+                             TCL_LEAVE_ERR_MSG) == NULL))
+            goto errorExit;
+
+        result = Tcl_EvalObjEx (interp, walkPtr->pruneObj, 0);
+        if (result == TCL_OK) {
+            result = Tcl_GetBooleanFromObj (interp, Tcl_GetObjResult (interp),
+                                            &prune);
+            if ((result == TCL_OK) && prune)
+                *descendPtr = FALSE;
+        } else if (result == TCL_CONTINUE) {
+            *descendPtr = FALSE;
+            result = TCL_OK;
+        }
+        if (result == TCL_ERROR) {
+            sprintf (msg, "\n    (\"walkdir\" prune script line %d)",
+                     ERRORLINE (interp));
+            Tcl_AddErrorInfo (interp, msg);
+        }
+    }
+
+  exitPoint:
+    Tcl_DecrRefCount (pathObj);
+    return result;
+
+  errorExit:
+    Tcl_DecrRefCount (pathObj);
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * WalkDirCallback --
+ *
+ *   Callback procedure for walking directories with walkdir.  Subdirectories
+ * are walked as they are found, relative to the open directory.
+ * Parameters:
+ *   o interp (I) - Interp is passed though.
+ *   o path (I) - Normalized path to directory.
+ *   o fileName (I) - Tcl normalized file name in directory.
+ *   o caseSensitive (I) - Are the file names case sensitive?  Always
+ *     TRUE on Unix.
+ *   o fileType (I) - Type of the entry, if known.
+ *   o dirHandle (I) - Directory handle for TclXOSStatDirEntry and
+ *     TclXOSWalkDirAt.
+ *   o clientData (I) - The walkdir state.
+ * Returns:
+ *   TCL_OK, TCL_ERROR or the code that should end the walk.
+ *-----------------------------------------------------------------------------
+ */
+static int
+WalkDirCallback (Tcl_Interp    *interp,
+                 char          *path,
+                 char          *fileName,
+                 int            caseSensitive,
+                 TclX_FileType  fileType,
+                 ClientData     dirHandle,
+                 ClientData     clientData)
+{
+    walkDir_t   *walkPtr = (walkDir_t *) clientData;
+    struct stat  statBuf;
+    int          descend, dirPathLen, result;
+
+    if (fileType == TCLX_FTYPE_UNKNOWN) {
+        if (TclXOSStatDirEntry (dirHandle, path, fileName, &statBuf) < 0) {
+            if (errno == ENOENT)
+                return TCL_OK;
+            TclX_AppendObjResult (interp, "stat of \"", fileName,
+                                  "\" in directory \"", path, "\" failed: ",
+                                  Tcl_PosixError (interp), (char *) NULL);
+            return TCL_ERROR;
+        }
+        fileType = ModeToFileType (statBuf.st_mode);
+    }
+
+    result = WalkDirEntry (interp, walkPtr,
+                           Tcl_DStringValue (&walkPtr->dirPath), fileName,
+                           caseSensitive, fileType, &descend);
+    if ((result != TCL_OK) || !descend)
+        return result;
+
+    dirPathLen = Tcl_DStringLength (&walkPtr->dirPath);
+    AppendEntryPath (&walkPtr->dirPath, fileName);
+    walkPtr->depth++;
+
+    result = TclXOSWalkDirAt (interp, dirHandle, path, fileName, TRUE,
+                              WalkDirCallback, clientData);
+
+    walkPtr->depth--;
+    Tcl_DStringSetLength (&walkPtr->dirPath, dirPathLen);
+    return result;
+}
+
+#ifdef TCL_THREADS
+/*-----------------------------------------------------------------------------
+ * NewDirBatch --
+ *
+ *   Allocate a batch to read a directory into.
+ *-----------------------------------------------------------------------------
+ */
+static walkDirBatch_t *
+NewDirBatch (char *path,
+             char *subPath,
+             char *tclPath,
+             int   depth)
+{
+    walkDirBatch_t *batchPtr;
+
+    batchPtr = (walkDirBatch_t *) ckalloc (sizeof (walkDirBatch_t));
+    batchPtr->path = ckstrdup (path);
+    batchPtr->subPath = ckstrdup (subPath);
+    batchPtr->tclPath = ckstrdup (tclPath);
+    batchPtr->depth = depth;
+    Tcl_DStringInit (&batchPtr->names);
+    batchPtr->nameStarts = NULL;
+    batchPtr->fileTypes = NULL;
+    batchPtr->numEntries = 0;
+    batchPtr->maxEntries = 0;
+    batchPtr->caseSensitive = TRUE;
+    batchPtr->errorNum = 0;
+    batchPtr->done = FALSE;
+    batchPtr->nextPtr = NULL;
+    batchPtr->nextInFlightPtr = NULL;
+    return batchPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeDirBatch --
+ *
+ *   Free a directory batch.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeDirBatch (walkDirBatch_t *batchPtr)
+{
+    ckfree (batchPtr->path);
+    ckfree (batchPtr->subPath);
+    ckfree (batchPtr->tclPath);
+    Tcl_DStringFree (&batchPtr->names);
+    if (batchPtr->nameStarts != NULL) {
+        ckfree ((char *) batchPtr->nameStarts);
+        ckfree ((char *) batchPtr->fileTypes);
+    }
+    ckfree ((char *) batchPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadDirBatchCallback --
+ *
+ *   Callback procedure for reading a directory into a batch in a worker
+ * thread.  Entries of unknown type are looked up here, so the interpreter
+ * thread doesn't have to.  An entry that is removed before its type is found
+ * is skipped.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadDirBatchCallback (Tcl_Interp    *interp,
+                      char          *path,
+                      char          *fileName,
+                      int            caseSensitive,
+                      TclX_FileType  fileType,
+                      ClientData     dirHandle,
+                      ClientData     clientData)
+{
+    walkDirBatch_t *batchPtr = (walkDirBatch_t *) clientData;
+    struct stat     statBuf;
+
+    if (fileType == TCLX_FTYPE_UNKNOWN) {
+        if (TclXOSStatDirEntry (dirHandle, path, fileName, &statBuf) < 0) {
+            if (errno == ENOENT)
+                return TCL_OK;
+        } else {
+            fileType = ModeToFileType (statBuf.st_mode);
+        }
+    }
+
+    if (batchPtr->numEntries == batchPtr->maxEntries) {
+        batchPtr->maxEntries = (batchPtr->maxEntries == 0) ? 64 :
+            2 * batchPtr->maxEntries;
+        batchPtr->nameStarts = (int *)
+            ckrealloc ((char *) batchPtr->nameStarts,
+                       batchPtr->maxEntries * sizeof (int));
+        batchPtr->fileTypes = (TclX_FileType *)
+            ckrealloc ((char *) batchPtr->fileTypes,
+                       batchPtr->maxEntries * sizeof (TclX_FileType));
+    }
+    batchPtr->nameStarts [batchPtr->numEntries] =
+        Tcl_DStringLength (&batchPtr->names);
+    batchPtr->fileTypes [batchPtr->numEntries] = fileType;
+    batchPtr->numEntries++;
+    Tcl_DStringAppend (&batchPtr->names, fileName, strlen (fileName) + 1);
+    batchPtr->caseSensitive = caseSensitive;
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * WalkWorkerThread --
+ *
+ *   Body of a walkdir worker thread.  Reads the directories queued by the
+ * interpreter thread until told to shut down.  Each directory is opened
+ * from the root directory a level at a time, without following symbolic
+ * links, so one that is replaced by a link while the tree is being walked
+ * is skipped.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_ThreadCreateType
+WalkWorkerThread (ClientData clientData)
+{
+    parallelWalk_t *walkPtr = (parallelWalk_t *) clientData;
+    walkDirBatch_t *batchPtr;
+
+    Tcl_MutexLock (&walkPtr->mutex);
+    while (TRUE) {
+        while ((walkPtr->queueHead == NULL) && !walkPtr->shutdown) {
+            Tcl_ConditionWait (&walkPtr->workCond, &walkPtr->mutex, NULL);
+        }
+        if (walkPtr->queueHead == NULL)
+            break;
+        batchPtr = walkPtr->queueHead;
+        walkPtr->queueHead = batchPtr->nextPtr;
+        if (walkPtr->queueHead == NULL)
+            walkPtr->queueTail = NULL;
+        Tcl_MutexUnlock (&walkPtr->mutex);
+
+        errno = 0;
+        if (TclXOSWalkDirAt (NULL, walkPtr->rootHandle, walkPtr->rootPath,
+                             batchPtr->subPath, TRUE, ReadDirBatchCallback,
+                             (ClientData) batchPtr) == TCL_ERROR)
+            batchPtr->errorNum = (errno != 0) ? errno : EIO;
+
+        Tcl_MutexLock (&walkPtr->mutex);
+        batchPtr->done = TRUE;
+        Tcl_ConditionNotify (&walkPtr->doneCond);
+    }
+    Tcl_MutexUnlock (&walkPtr->mutex);
+
+    Tcl_ExitThread (0);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*-----------------------------------------------------------------------------
+ * DeliverDirBatch --
+ *
+ *   Run the walkdir scripts on the entries of a directory read by a worker.
+ * Subdirectories to walk are added to the list waiting to be queued.  A
+ * subdirectory that was removed before it could be read is skipped.
+ * Returns:
+ *   TCL_OK, TCL_ERROR or the code that should end the walk.
+ *-----------------------------------------------------------------------------
+ */
+static int
+DeliverDirBatch (Tcl_Interp      *interp,
+                 walkDir_t       *walkPtr,
+                 walkDirBatch_t  *batchPtr,
+                 walkDirBatch_t **waitTailPtr)
+{
+    walkDirBatch_t *subDirPtr;
+    Tcl_DString     subDirPath, subDirSubPath, subDirTclPath;
+    char           *fileName;
+    int             idx, descend, result;
+
+    if (batchPtr->errorNum != 0) {
+        if ((batchPtr->depth > 1) &&
+            ((batchPtr->errorNum == ENOENT) ||
+             (batchPtr->errorNum == ENOTDIR)))
+            return TCL_OK;
+        Tcl_SetErrno (batchPtr->errorNum);
+        TclX_AppendObjResult (interp, "open of directory \"", batchPtr->path,
+                              "\" failed: ", Tcl_PosixError (interp),
+                              (char *) NULL);
+        return TCL_ERROR;
+    }
+
+    Tcl_DStringInit (&subDirPath);
+    Tcl_DStringInit (&subDirSubPath);
+    Tcl_DStringInit (&subDirTclPath);
+    walkPtr->depth = batchPtr->depth;
+    result = TCL_OK;
+    for (idx = 0; idx < batchPtr->numEntries; idx++) {
+        fileName = Tcl_DStringValue (&batchPtr->names) +
+            batchPtr->nameStarts [idx];
+        result = WalkDirEntry (interp, walkPtr, batchPtr->tclPath, fileName,
+                               batchPtr->caseSensitive,
+                               batchPtr->fileTypes [idx], &descend);
+        if (result != TCL_OK)
+            break;
+        if (!descend)
+            continue;
+
+        Tcl_DStringSetLength (&subDirPath, 0);
+        TclX_JoinPath (batchPtr->path, fileName, &subDirPath);
+        Tcl_DStringSetLength (&subDirSubPath, 0);
+        Tcl_DStringAppend (&subDirSubPath, batchPtr->subPath, -1);
+        AppendEntryPath (&subDirSubPath, fileName);
+        Tcl_DStringSetLength (&subDirTclPath, 0);
+        Tcl_DStringAppend (&subDirTclPath, batchPtr->tclPath, -1);
+        AppendEntryPath (&subDirTclPath, fileName);
+        subDirPtr = NewDirBatch (Tcl_DStringValue (&subDirPath),
+                                 Tcl_DStringValue (&subDirSubPath),
+                                 Tcl_DStringValue (&subDirTclPath),
+                                 batchPtr->depth + 1);
+        (*waitTailPtr)->nextPtr = subDirPtr;
+        *waitTailPtr = subDirPtr;
+    }
+    Tcl_DStringFree (&subDirPath);
+    Tcl_DStringFree (&subDirSubPath);
+    Tcl_DStringFree (&subDirTclPath);
+    return result;
 }
 
-
+/*-----------------------------------------------------------------------------
+ * WalkDirParallel --
+ *
+ *   Walk a directory tree, with worker threads reading the directories.
+ * Parameters:
+ *   o interp (I) - Errors are returned in result.
+ *   o walkPtr (I) - The walkdir state.
+ *   o path (I) - Translated path to the directory to walk.
+ *   o tclPath (I) - Path to the directory, as given to the scripts.
+ *   o numThreads (I) - The number of worker threads to use.
+ * Returns:
+ *   TCL_OK, TCL_ERROR or the code that ended the walk.
+ *-----------------------------------------------------------------------------
+ */
+static int
+WalkDirParallel (Tcl_Interp *interp,
+                 walkDir_t  *walkPtr,
+                 char       *path,
+                 char       *tclPath,
+                 int         numThreads)
+{
+    parallelWalk_t   walk;
+    walkDirBatch_t   waitList, *waitTail, *batchPtr;
+    walkDirBatch_t  *inFlightHead, *inFlightTail;
+    Tcl_ThreadId    *threadIds;
+    int              numInFlight, threadResult, idx, result;
+
+    if (TclXOSOpenDir (interp, path, &walk.rootHandle) != TCL_OK)
+        return TCL_ERROR;
+    walk.rootPath = path;
+    walk.mutex = NULL;
+    walk.workCond = NULL;
+    walk.doneCond = NULL;
+    walk.queueHead = NULL;
+    walk.queueTail = NULL;
+    walk.shutdown = FALSE;
+
+    threadIds = (Tcl_ThreadId *) ckalloc (numThreads * sizeof (Tcl_ThreadId));
+    for (idx = 0; idx < numThreads; idx++) {
+        if (Tcl_CreateThread (&threadIds [idx], WalkWorkerThread,
+                              (ClientData) &walk, TCL_THREAD_STACK_DEFAULT,
+                              TCL_THREAD_JOINABLE) != TCL_OK)
+            break;
+    }
+    numThreads = idx;
+
+    /*
+     * The head of the list of directories waiting to be queued is a dummy,
+     * so they can be appended without checking for an empty list.
+     */
+    waitList.nextPtr = NewDirBatch (path, "", tclPath, 1);
+    waitTail = waitList.nextPtr;
+    inFlightHead = inFlightTail = NULL;
+    numInFlight = 0;
+
+    if (numThreads == 0) {
+        TclX_AppendObjResult (interp, "can't create walkdir worker thread",
+                              (char *) NULL);
+        result = TCL_ERROR;
+        goto walkExit;
+    }
+
+    result = TCL_OK;
+    while (TRUE) {
+        /*
+         * Keep enough directories queued that the workers never idle while
+         * the scripts run.
+         */
+        while ((waitList.nextPtr != NULL) && (numInFlight < 2 * numThreads)) {
+            batchPtr = waitList.nextPtr;
+            waitList.nextPtr = batchPtr->nextPtr;
+            if (waitList.nextPtr == NULL)
+                waitTail = &waitList;
+            batchPtr->nextPtr = NULL;
+
+            if (inFlightTail == NULL)
+                inFlightHead = batchPtr;
+            else
+                inFlightTail->nextInFlightPtr = batchPtr;
+            inFlightTail = batchPtr;
+            numInFlight++;
+
+            Tcl_MutexLock (&walk.mutex);
+            if (walk.queueTail == NULL)
+                walk.queueHead = batchPtr;
+            else
+                walk.queueTail->nextPtr = batchPtr;
+            walk.queueTail = batchPtr;
+            Tcl_ConditionNotify (&walk.workCond);
+            Tcl_MutexUnlock (&walk.mutex);
+        }
+        if (numInFlight == 0)
+            break;
+
+        batchPtr = inFlightHead;
+        Tcl_MutexLock (&walk.mutex);
+        while (!batchPtr->done) {
+            Tcl_ConditionWait (&walk.doneCond, &walk.mutex, NULL);
+        }
+        Tcl_MutexUnlock (&walk.mutex);
+
+        inFlightHead = batchPtr->nextInFlightPtr;
+        if (inFlightHead == NULL)
+            inFlightTail = NULL;
+        numInFlight--;
+
+        result = DeliverDirBatch (interp, walkPtr, batchPtr, &waitTail);
+        FreeDirBatch (batchPtr);
+        if (result != TCL_OK)
+            goto walkExit;
+    }
+
+  walkExit:
+    /*
+     * Discard queued work and stop the workers.  Batches being read still
+     * belong to the workers until they have been joined.
+     */
+    Tcl_MutexLock (&walk.mutex);
+    walk.queueHead = NULL;
+    walk.queueTail = NULL;
+    walk.shutdown = TRUE;
+    Tcl_ConditionNotify (&walk.workCond);
+    Tcl_MutexUnlock (&walk.mutex);
+    for (idx = 0; idx < numThreads; idx++) {
+        Tcl_JoinThread (threadIds [idx], &threadResult);
+    }
+    ckfree ((char *) threadIds);
+
+    while (inFlightHead != NULL) {
+        batchPtr = inFlightHead;
+        inFlightHead = batchPtr->nextInFlightPtr;
+        FreeDirBatch (batchPtr);
+    }
+    while (waitList.nextPtr != NULL) {
+        batchPtr = waitList.nextPtr;
+        waitList.nextPtr = batchPtr->nextPtr;
+        FreeDirBatch (batchPtr);
+    }
+
+    Tcl_ConditionFinalize (&walk.workCond);
+    Tcl_ConditionFinalize (&walk.doneCond);
+    Tcl_MutexFinalize (&walk.mutex);
+    TclXOSCloseDir (walk.rootHandle);
+    return result;
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+ * TclX_WalkdirObjCmd --
+ *     Implements the walkdir TCL command:
+ *         walkdir ?-depth n? ?-glob patternList? ?-prune script?
+ *                 ?-parallel numthreads? dirPath var body
+ *
+ * Results:
+ *      Standard TCL result.
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_WalkdirObjCmd (ClientData clientData,
+                    Tcl_Interp *interp,
+                    int objc,
+                    Tcl_Obj *const objv[])
+{
+    walkDir_t    walk;
+    Tcl_DString  pathBuf;
+    Tcl_Obj     *patternListObj = NULL, *varListObj = NULL, **varObjv;
+    char        *switchString, *dirPath;
+    int          objIdx, numThreads, varObjc, status;
+
+    walk.typeVarObj = NULL;
+    walk.pruneObj = NULL;
+    walk.maxDepth = -1;
+    walk.numPatterns = 0;
+    walk.patterns = NULL;
+    walk.depth = 1;
+    numThreads = 1;
+
+    for (objIdx = 1; objIdx < objc - 3; objIdx++) {
+        switchString = Tcl_GetStringFromObj (objv [objIdx], NULL);
+        if (switchString [0] != '-')
+            break;
+        if (objIdx + 1 >= objc - 3)
+            goto wrongArgs;
+        if (STREQU (switchString, "-depth")) {
+            if (Tcl_GetIntFromObj (interp, objv [++objIdx],
+                                   &walk.maxDepth) != TCL_OK)
+                return TCL_ERROR;
+            if (walk.maxDepth < 1) {
+                TclX_AppendObjResult (interp, "depth must be greater than ",
+                                      "zero, got \"",
+                                      Tcl_GetStringFromObj (objv [objIdx],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else if (STREQU (switchString, "-glob")) {
+            patternListObj = objv [++objIdx];
+        } else if (STREQU (switchString, "-prune")) {
+            walk.pruneObj = objv [++objIdx];
+        } else if (STREQU (switchString, "-parallel")) {
+            if (Tcl_GetIntFromObj (interp, objv [++objIdx],
+                                   &numThreads) != TCL_OK)
+                return TCL_ERROR;
+            if (numThreads < 1) {
+                TclX_AppendObjResult (interp, "number of threads must be ",
+                                      "greater than zero, got \"",
+                                      Tcl_GetStringFromObj (objv [objIdx],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else {
+            TclX_AppendObjResult (interp, "expected option of \"-depth\", ",
+                                  "\"-glob\", \"-prune\" or \"-parallel\", ",
+                                  "got \"", switchString, "\"",
+                                  (char *) NULL);
+            return TCL_ERROR;
+        }
+    }
+    if (objIdx != objc - 3)
+        goto wrongArgs;
+
+    /*
+     * The scripts could change the representation of the lists, so private
+     * copies are used.
+     */
+    varListObj = Tcl_DuplicateObj (objv [objIdx + 1]);
+    Tcl_IncrRefCount (varListObj);
+    if (Tcl_ListObjGetElements (interp, varListObj, &varObjc,
+                                &varObjv) != TCL_OK)
+        goto errorExit;
+    if ((varObjc < 1) || (varObjc > 2)) {
+        TclX_AppendObjResult (interp, "expected a list of one or two ",
+                              "variable names, got \"",
+                              Tcl_GetStringFromObj (varListObj, NULL), "\"",
+                              (char *) NULL);
+        goto errorExit;
+    }
+    walk.pathVarObj = varObjv [0];
+    if (varObjc == 2)
+        walk.typeVarObj = varObjv [1];
+    walk.bodyObj = objv [objIdx + 2];
+
+    if (patternListObj != NULL) {
+        patternListObj = Tcl_DuplicateObj (patternListObj);
+        Tcl_IncrRefCount (patternListObj);
+        if (Tcl_ListObjGetElements (interp, patternListObj,
+                                    &walk.numPatterns,
+                                    &walk.patterns) != TCL_OK)
+            goto errorExit;
+    }
+
+    Tcl_DStringInit (&pathBuf);
+    Tcl_DStringInit (&walk.dirPath);
+    Tcl_DStringAppend (&walk.dirPath,
+                       Tcl_GetStringFromObj (objv [objIdx], NULL), -1);
+
+    dirPath = Tcl_TranslateFileName (interp,
+                                     Tcl_DStringValue (&walk.dirPath),
+                                     &pathBuf);
+    if (dirPath == NULL) {
+        status = TCL_ERROR;
+#ifdef TCL_THREADS
+    } else if (numThreads > 1) {
+        status = WalkDirParallel (interp, &walk, dirPath,
+                                  Tcl_DStringValue (&walk.dirPath),
+                                  numThreads);
+#endif
+    } else {
+        status = TclXOSWalkDir (interp, dirPath, TRUE, WalkDirCallback,
+                                (ClientData) &walk);
+    }
+    Tcl_DStringFree (&pathBuf);
+    Tcl_DStringFree (&walk.dirPath);
+
+    if ((status == TCL_OK) || (status == TCL_BREAK)) {
+        Tcl_ResetResult (interp);
+        status = TCL_OK;
+    }
+    Tcl_DecrRefCount (varListObj);
+    if (patternListObj != NULL)
+        Tcl_DecrRefCount (patternListObj);
+    return status;
+
+  errorExit:
+    Tcl_DecrRefCount (varListObj);
+    if (patternListObj != NULL)
+        Tcl_DecrRefCount (patternListObj);
+    return TCL_ERROR;
+
+  wrongArgs:
+    return TclX_WrongArgs (interp, objv [0],
+                           "?-depth n? ?-glob patternList? ?-prune script? "
+                           "?-parallel numthreads? dirPath var body");
+}
+
+
+/*-----------------------------------------------------------------------------
+ * OpenFileOrPipeline --
+ *
+ *   Open a file for for_file, read_file or write_file.  As with open, a name
+ * starting with "|" is a command pipeline, read from or written to.
+ * Parameters:
+ *   o interp (I) - Errors are returned in result.
+ *   o fileNameObj (I) - The file name or pipeline.
+ *   o mode (I) - "r" or "w".
+ * Returns:
+ *   The channel or NULL if an error occured.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_Channel
+OpenFileOrPipeline (Tcl_Interp *interp,
+                    Tcl_Obj    *fileNameObj,
+                    char       *mode)
+{
+    Tcl_Channel   channel;
+    const char  **cmdArgv;
+    char         *fileName;
+    int           cmdArgc;
+
+    fileName = Tcl_GetStringFromObj (fileNameObj, NULL);
+    if (fileName [0] != '|')
+        return Tcl_FSOpenFileChannel (interp, fileNameObj, mode, 0666);
+
+    if (Tcl_SplitList (interp, fileName + 1, &cmdArgc,
+                       &cmdArgv) != TCL_OK)
+        return NULL;
+    channel = Tcl_OpenCommandChannel (interp, cmdArgc, cmdArgv,
+                                      TCL_STDERR | TCL_ENFORCE_MODE |
+                                      ((mode [0] == 'r') ?
+                                       TCL_STDOUT : TCL_STDIN));
+    ckfree ((char *) cmdArgv);
+    return channel;
+}
+
+/*-----------------------------------------------------------------------------
+ * PlainTextChannel --
+ *
+ *   Determine if ASCII text passes through a channel unchanged, so it can be
+ * read or written without the channel's encoding and translation.  This is
+ * the case if the encoding is a superset of ASCII, the end of line
+ * translation doesn't change newlines and there is no end of file character.
+ * Parameters:
+ *   o interp (I) - Used to get the options, its result is left unchanged.
+ *   o channel (I) - The channel.
+ *   o direction (I) - TCL_READABLE or TCL_WRITABLE.
+ *   o allowCRPtr (O) - Set to FALSE if carriage returns are translated.
+ * Returns:
+ *   TRUE if the channel passes ASCII text unchanged, FALSE if not.
+ *-----------------------------------------------------------------------------
+ */
+static int
+PlainTextChannel (Tcl_Interp  *interp,
+                  Tcl_Channel  channel,
+                  int          direction,
+                  int         *allowCRPtr)
+{
+    Tcl_DString   value;
+    const char  **valueArgv;
+    char         *optValue;
+    int           plain, valueArgc, idx;
+
+    Tcl_DStringInit (&value);
+    plain = FALSE;
+    *allowCRPtr = TRUE;
+
+    if (Tcl_GetChannelOption (interp, channel, "-encoding",
+                              &value) != TCL_OK)
+        goto exitPoint;
+    optValue = Tcl_DStringValue (&value);
+    if (!(STREQU (optValue, "utf-8") || STREQU (optValue, "ascii") ||
+          STRNEQU (optValue, "iso8859-", 8)))
+        goto exitPoint;
+
+    Tcl_DStringSetLength (&value, 0);
+    if (Tcl_GetChannelOption (interp, channel, "-translation",
+                              &value) != TCL_OK)
+        goto exitPoint;
+    optValue = Tcl_DStringValue (&value);
+    if ((direction == TCL_READABLE) && STREQU (optValue, "auto")) {
+        *allowCRPtr = FALSE;
+    } else if (!(STREQU (optValue, "lf") || STREQU (optValue, "binary"))) {
+        goto exitPoint;
+    }
+
+    Tcl_DStringSetLength (&value, 0);
+    if (Tcl_GetChannelOption (interp, channel, "-eofchar",
+                              &value) != TCL_OK)
+        goto exitPoint;
+    if (Tcl_SplitList (NULL, Tcl_DStringValue (&value), &valueArgc,
+                       &valueArgv) != TCL_OK)
+        goto exitPoint;
+    plain = TRUE;
+    for (idx = 0; idx < valueArgc; idx++) {
+        if (valueArgv [idx][0] != '\0')
+            plain = FALSE;
+    }
+    ckfree ((char *) valueArgv);
+
+  exitPoint:
+    Tcl_DStringFree (&value);
+    Tcl_ResetResult (interp);
+    return plain;
+}
+
+/*-----------------------------------------------------------------------------
+ * IsPlainText --
+ *
+ *   Determine if text is the same in Tcl's internal form and in ASCII: no
+ * bytes with the high bit set and no NULs.  Carriage returns may be excluded
+ * too.  The text is checked a word at a time.
+ *-----------------------------------------------------------------------------
+ */
+#define PLAIN_ONES  ((unsigned long) -1 / 0xFF)
+#define PLAIN_HIGHS (PLAIN_ONES * 0x80)
+#define PLAIN_HAS_ZERO(word) (((word) - PLAIN_ONES) & ~(word) & PLAIN_HIGHS)
+
+static int
+IsPlainText (char *text,
+             int   textLen,
+             int   allowCR)
+{
+    unsigned long word;
+    unsigned char *textPtr = (unsigned char *) text;
+    unsigned char *textEnd = textPtr + textLen;
+
+    for (; textEnd - textPtr >= (int) sizeof (word);
+         textPtr += sizeof (word)) {
+        memcpy (&word, textPtr, sizeof (word));
+        if ((word & PLAIN_HIGHS) || PLAIN_HAS_ZERO (word))
+            return FALSE;
+        if (!allowCR && PLAIN_HAS_ZERO (word ^ (PLAIN_ONES * '\r')))
+            return FALSE;
+    }
+    for (; textPtr < textEnd; textPtr++) {
+        if ((*textPtr >= 0x80) || (*textPtr == '\0') ||
+            (!allowCR && (*textPtr == '\r')))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadRawBlock --
+ *
+ *   Read bytes from a channel without translation and append them to an
+ * unshared object with only a string representation.
+ * Parameters:
+ *   o channel (I) - The channel.
+ *   o bufObj (I) - The object to append to.
+ *   o toRead (I) - The number of bytes to read.
+ * Returns:
+ *   The number of bytes read, which is less than toRead only at the end of
+ * the file, or -1 if an error occured.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadRawBlock (Tcl_Channel  channel,
+              Tcl_Obj     *bufObj,
+              int          toRead)
+{
+    char *buf;
+    int   bufLen, numRead, readLen;
+
+    Tcl_GetStringFromObj (bufObj, &bufLen);
+    Tcl_SetObjLength (bufObj, bufLen + toRead);
+    buf = Tcl_GetString (bufObj) + bufLen;
+
+    for (numRead = 0; numRead < toRead; numRead += readLen) {
+        readLen = Tcl_ReadRaw (channel, buf + numRead, toRead - numRead);
+        if (readLen < 0) {
+            Tcl_SetObjLength (bufObj, bufLen);
+            return -1;
+        }
+        if (readLen == 0)
+            break;
+    }
+    Tcl_SetObjLength (bufObj, bufLen + numRead);
+    return numRead;
+}
+
+/*-----------------------------------------------------------------------------
+ * ForFileLine --
+ *
+ *   Set the for_file variable to a line and evaluate the body.  The body is
+ * compiled the first time and the byte code is reused after that.
+ * Returns:
+ *   TCL_OK to continue with the next line, or the code that ends the loop.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ForFileLine (Tcl_Interp *interp,
+             Tcl_Obj    *varObj,
+             Tcl_Obj    *bodyObj,
+             Tcl_Obj    *lineObj)
+{
+    int  result;
+    char msg [64];
+
+    if (Tcl_ObjSetVar2 (interp, varObj, NULL, lineObj,
+                        TCL_LEAVE_ERR_MSG) == NULL)
+        return TCL_ERROR;
+
+    result = Tcl_EvalObjEx (interp, bodyObj, 0);
+    if (result == TCL_CONTINUE) {
+        result = TCL_OK;
+    } else if (result == TCL_ERROR) {
+        sprintf (msg, "\n    (\"for_file\" body line %d)",
+                 ERRORLINE (interp));
+        Tcl_AddErrorInfo (interp, msg);
+    }
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * ForFileBlocks --
+ *
+ *   Run the for_file loop on a regular file, reading it in large blocks and
+ * splitting them into lines in memory.  Blocks of plain text are read
+ * without the channel's encoding and translation, if they would not change
+ * them.  At the first block that isn't plain, the file is positioned back to
+ * its start and the rest is read through the channel.
+ * Returns:
+ *   TCL_OK at the end of the file, or the code that ended the loop.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ForFileBlocks (Tcl_Interp  *interp,
+               Tcl_Channel  channel,
+               Tcl_Obj     *varObj,
+               Tcl_Obj     *bodyObj)
+{
+    Tcl_Obj     *bufObj;
+    Tcl_WideInt  rawOffset;
+    char        *text, *textEnd, *linePtr, *lineEnd;
+    int          raw, allowCR, numRead, textLen, atEof, result;
+
+    raw = PlainTextChannel (interp, channel, TCL_READABLE, &allowCR);
+    rawOffset = 0;
+
+    bufObj = Tcl_NewObj ();
+    Tcl_IncrRefCount (bufObj);
+    result = TCL_OK;
+    atEof = FALSE;
+
+    while (!atEof) {
+        if (raw) {
+            Tcl_GetStringFromObj (bufObj, &textLen);
+            numRead = ReadRawBlock (channel, bufObj, FOR_FILE_BLOCK_CHARS);
+            if (numRead < 0)
+                goto readError;
+            text = Tcl_GetString (bufObj);
+            if (!IsPlainText (text + textLen, numRead, allowCR)) {
+                Tcl_SetObjLength (bufObj, textLen);
+                if (Tcl_Seek (channel, rawOffset, SEEK_SET) < 0)
+                    goto readError;
+                raw = FALSE;
+                continue;
+            }
+            rawOffset += numRead;
+        } else {
+            numRead = Tcl_ReadChars (channel, bufObj, FOR_FILE_BLOCK_CHARS,
+                                     1);
+            if (numRead < 0)
+                goto readError;
+        }
+        atEof = (numRead < FOR_FILE_BLOCK_CHARS);
+
+        text = Tcl_GetStringFromObj (bufObj, &textLen);
+        textEnd = text + textLen;
+        for (linePtr = text; ; linePtr = lineEnd + 1) {
+            lineEnd = memchr (linePtr, '\n', textEnd - linePtr);
+            if (lineEnd == NULL) {
+                if (!atEof || (linePtr == textEnd))
+                    break;
+                lineEnd = textEnd;
+            }
+            result = ForFileLine (interp, varObj, bodyObj,
+                                  Tcl_NewStringObj (linePtr,
+                                                    lineEnd - linePtr));
+            if ((result != TCL_OK) || (lineEnd == textEnd))
+                goto exitPoint;
+        }
+
+        /*
+         * Keep the start of a line that continues in the next block.
+         */
+        memmove (text, linePtr, textEnd - linePtr);
+        Tcl_SetObjLength (bufObj, textEnd - linePtr);
+    }
+
+  exitPoint:
+    Tcl_DecrRefCount (bufObj);
+    return result;
+
+  readError:
+    Tcl_DecrRefCount (bufObj);
+    Tcl_ResetResult (interp);
+    TclX_AppendObjResult (interp, "error reading \"",
+                          Tcl_GetChannelName (channel), "\": ",
+                          Tcl_PosixError (interp), (char *) NULL);
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_For_fileObjCmd --
+ *     Implements the for_file TCL command:
+ *         for_file var fileName code
+ *
+ * Results:
+ *      Standard TCL result, which is the result of the last evaluation of
+ * code.
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_For_fileObjCmd (ClientData clientData,
+                     Tcl_Interp *interp,
+                     int objc,
+                     Tcl_Obj *const objv[])
+{
+    Tcl_Channel  channel;
+    Tcl_Obj     *lineObj, *resultObj;
+    int          seekable, result;
+
+    if (objc != 4)
+        return TclX_WrongArgs (interp, objv [0], "var fileName code");
+
+    channel = OpenFileOrPipeline (interp, objv [2], "r");
+    if (channel == NULL)
+        return TCL_ERROR;
+
+    if (TclXOSSeekable (interp, channel, &seekable) != TCL_OK) {
+        Tcl_Close (NULL, channel);
+        return TCL_ERROR;
+    }
+
+    /*
+     * Other than regular files are read a line at a time, so lines are
+     * processed as they arrive.
+     */
+    if (seekable) {
+        result = ForFileBlocks (interp, channel, objv [1], objv [3]);
+    } else {
+        while (TRUE) {
+            lineObj = Tcl_NewObj ();
+            if (Tcl_GetsObj (channel, lineObj) < 0) {
+                Tcl_DecrRefCount (lineObj);
+                if (Tcl_Eof (channel)) {
+                    result = TCL_OK;
+                } else {
+                    Tcl_ResetResult (interp);
+                    TclX_AppendObjResult (interp, "error reading \"",
+                                          Tcl_GetChannelName (channel),
+                                          "\": ", Tcl_PosixError (interp),
+                                          (char *) NULL);
+                    result = TCL_ERROR;
+                }
+                break;
+            }
+            result = ForFileLine (interp, objv [1], objv [3], lineObj);
+            if (result != TCL_OK)
+                break;
+        }
+    }
+
+    /*
+     * Closing a pipeline reports its errors, without losing the result of
+     * the body.
+     */
+    if ((result == TCL_OK) || (result == TCL_BREAK)) {
+        resultObj = Tcl_GetObjResult (interp);
+        Tcl_IncrRefCount (resultObj);
+        if (Tcl_Close (interp, channel) != TCL_OK) {
+            Tcl_DecrRefCount (resultObj);
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult (interp, resultObj);
+        Tcl_DecrRefCount (resultObj);
+    } else {
+        Tcl_Close (NULL, channel);
+    }
+
+    if (result == TCL_BREAK) {
+        Tcl_ResetResult (interp);
+        result = TCL_OK;
+    }
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_Read_fileObjCmd --
+ *     Implements the read_file TCL command:
+ *         read_file ?-nonewline? fileName
+ *         read_file fileName numBytes
+ *
+ * The contents of a regular file are read with its size in a single read,
+ * straight into the result.  If the channel would have changed them, the
+ * file is read again through the channel.
+ *
+ * Results:
+ *      Standard TCL result.
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_Read_fileObjCmd (ClientData clientData,
+                      Tcl_Interp *interp,
+                      int objc,
+                      Tcl_Obj *const objv[])
+{
+    Tcl_Channel  channel;
+    Tcl_Obj     *fileNameObj, *resultObj;
+    off_t        fileSize;
+    char        *text;
+    int          noNewline, toRead, numRead, seekable, allowCR, textLen;
+
+    noNewline = FALSE;
+    toRead = -1;
+    if (objc == 2) {
+        fileNameObj = objv [1];
+    } else if ((objc == 3) &&
+               STREQU (Tcl_GetStringFromObj (objv [1], NULL), "-nonewline")) {
+        noNewline = TRUE;
+        fileNameObj = objv [2];
+    } else if (objc == 3) {
+        fileNameObj = objv [1];
+        if (STREQU (Tcl_GetStringFromObj (objv [2], NULL), "nonewline")) {
+            noNewline = TRUE;
+        } else if ((Tcl_GetIntFromObj (NULL, objv [2], &toRead) != TCL_OK) ||
+                   (toRead < 0)) {
+            TclX_AppendObjResult (interp, "expected non-negative integer ",
+                                  "but got \"",
+                                  Tcl_GetStringFromObj (objv [2], NULL),
+                                  "\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+    } else {
+        return TclX_WrongArgs (interp, objv [0],
+                               "?-nonewline? fileName ?numBytes?");
+    }
+
+    channel = OpenFileOrPipeline (interp, fileNameObj, "r");
+    if (channel == NULL)
+        return TCL_ERROR;
+
+    resultObj = Tcl_NewObj ();
+    Tcl_IncrRefCount (resultObj);
+
+    if ((TclXOSSeekable (interp, channel, &seekable) == TCL_OK) && seekable &&
+        (TclXOSGetFileSize (channel, &fileSize) == TCL_OK) &&
+        (fileSize > 0) && (fileSize < INT_MAX) &&
+        PlainTextChannel (interp, channel, TCL_READABLE, &allowCR)) {
+        numRead = (int) fileSize;
+        if ((toRead >= 0) && (toRead < numRead))
+            numRead = toRead;
+        numRead = ReadRawBlock (channel, resultObj, numRead);
+        if (numRead < 0)
+            goto readError;
+        text = Tcl_GetStringFromObj (resultObj, &textLen);
+        if (IsPlainText (text, textLen, allowCR)) {
+            if (toRead >= 0)
+                toRead -= numRead;
+        } else {
+            Tcl_SetObjLength (resultObj, 0);
+            if (Tcl_Seek (channel, 0, SEEK_SET) < 0)
+                goto readError;
+        }
+    }
+    Tcl_ResetResult (interp);
+
+    /*
+     * Read whatever is left, including anything added to the file since its
+     * size was taken.
+     */
+    if ((toRead != 0) &&
+        (Tcl_ReadChars (channel, resultObj, toRead, 1) < 0))
+        goto readError;
+    if (Tcl_Close (interp, channel) != TCL_OK) {
+        Tcl_DecrRefCount (resultObj);
+        return TCL_ERROR;
+    }
+
+    if (noNewline) {
+        text = Tcl_GetStringFromObj (resultObj, &textLen);
+        if ((textLen > 0) && (text [textLen - 1] == '\n'))
+            Tcl_SetObjLength (resultObj, textLen - 1);
+    }
+    Tcl_SetObjResult (interp, resultObj);
+    Tcl_DecrRefCount (resultObj);
+    return TCL_OK;
+
+  readError:
+    Tcl_ResetResult (interp);
+    TclX_AppendObjResult (interp, "error reading \"",
+                          Tcl_GetStringFromObj (fileNameObj, NULL), "\": ",
+                          Tcl_PosixError (interp), (char *) NULL);
+    Tcl_Close (NULL, channel);
+    Tcl_DecrRefCount (resultObj);
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_Write_fileObjCmd --
+ *     Implements the write_file TCL command:
+ *         write_file fileName string ?string ...?
+ *
+ * Each string is written followed by a newline.  If the channel wouldn't
+ * change them, the strings are written in a single gathered write rather
+ * than through the channel.
+ *
+ * Results:
+ *      Standard TCL result.
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_Write_fileObjCmd (ClientData clientData,
+                       Tcl_Interp *interp,
+                       int objc,
+                       Tcl_Obj *const objv[])
+{
+    Tcl_Channel   channel;
+    char        **bufs;
+    int          *bufLens;
+    int           objIdx, numBufs, allowCR, plain;
+
+    if (objc < 2)
+        return TclX_WrongArgs (interp, objv [0],
+                               "fileName ?string ...?");
+
+    channel = OpenFileOrPipeline (interp, objv [1], "w");
+    if (channel == NULL)
+        return TCL_ERROR;
+
+    bufs = (char **) ckalloc (2 * objc * sizeof (char *));
+    bufLens = (int *) ckalloc (2 * objc * sizeof (int));
+    numBufs = 0;
+    plain = PlainTextChannel (interp, channel, TCL_WRITABLE, &allowCR);
+    for (objIdx = 2; objIdx < objc; objIdx++) {
+        bufs [numBufs] = Tcl_GetStringFromObj (objv [objIdx],
+                                               &bufLens [numBufs]);
+        if (plain)
+            plain = IsPlainText (bufs [numBufs], bufLens [numBufs], TRUE);
+        numBufs++;
+        bufs [numBufs] = "\n";
+        bufLens [numBufs] = 1;
+        numBufs++;
+    }
+
+    if (plain) {
+        if (TclXOSWriteBuffers (channel, numBufs, bufs, bufLens) != TCL_OK)
+            goto writeError;
+    } else {
+        for (objIdx = 2; objIdx < objc; objIdx++) {
+            if ((Tcl_WriteObj (channel, objv [objIdx]) < 0) ||
+                (TclX_WriteNL (channel) < 0))
+                goto writeError;
+        }
+    }
+    ckfree ((char *) bufs);
+    ckfree ((char *) bufLens);
+    return Tcl_Close (interp, channel);
+
+  writeError:
+    TclX_AppendObjResult (interp, "error writing \"",
+                          Tcl_GetStringFromObj (objv [1], NULL), "\": ",
+                          Tcl_PosixError (interp), (char *) NULL);
+    ckfree ((char *) bufs);
+    ckfree ((char *) bufLens);
+    Tcl_Close (NULL, channel);
+    return TCL_ERROR;
+}
+
+
 /*-----------------------------------------------------------------------------
  * TclX_FilecmdsInit --
  *     Initialize the file commands.
@@ -327,6 +1967,30 @@ TclX_FilecmdsInit (Tcl_Interp *interp)
 			  TclX_ReaddirObjCmd,
                           (ClientData) NULL,
 			  (Tcl_CmdDeleteProc*) NULL);
+
+    Tcl_CreateObjCommand (interp,
+                          "walkdir",
+                          TclX_WalkdirObjCmd,
+                          (ClientData) NULL,
+                          (Tcl_CmdDeleteProc*) NULL);
+
+    Tcl_CreateObjCommand (interp,
+                          "for_file",
+                          TclX_For_fileObjCmd,
+                          (ClientData) NULL,
+                          (Tcl_CmdDeleteProc*) NULL);
+
+    Tcl_CreateObjCommand (interp,
+                          "read_file",
+                          TclX_Read_fileObjCmd,
+                          (ClientData) NULL,
+                          (Tcl_CmdDeleteProc*) NULL);
+
+    Tcl_CreateObjCommand (interp,
+                          "write_file",
+                          TclX_Write_fileObjCmd,
+                          (ClientData) NULL,
+                          (Tcl_CmdDeleteProc*) NULL);
 }
 
 
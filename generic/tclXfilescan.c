@@ -27,19 +27,53 @@
 typedef struct matchDef_t {
     Tcl_RegExp          regExp;
     Tcl_Obj            *regExpObj;
+    int                 regExpFlags;
     Tcl_Obj            *command;
     struct matchDef_t  *nextMatchDefPtr;
 } matchDef_t;
 
+typedef struct scanFollow_t scanFollow_t;
+
 typedef struct scanContext_t {
-    matchDef_t  *matchListHead;
-    matchDef_t  *matchListTail;
-    Tcl_Obj     *defaultAction;
-    char         contextHandle [16];
-    Tcl_Channel  copyFileChannel;
-    int          fileOpen;
+    matchDef_t   *matchListHead;
+    matchDef_t   *matchListTail;
+    Tcl_Obj      *defaultAction;
+    char          contextHandle [16];
+    Tcl_Channel   copyFileChannel;
+    int           fileOpen;
+    int           deleted;          /* Context deleted during a scan. */
+    scanFollow_t *followListHead;   /* Channels attached to the context. */
 } scanContext_t;
 
+/*
+ * A channel attached to a scan context.  Lines appended to the channel are
+ * scanned from the event loop.  Files are polled for new data on a timer,
+ * other channels (pipes, sockets) use a channel handler.
+ */
+struct scanFollow_t {
+    scanContext_t *contextPtr;
+    Tcl_Interp    *interp;
+    Tcl_Channel    userChannel;     /* Channel that was attached. */
+    Tcl_Channel    channel;         /* Channel being read.  After a rotation
+                                       this is a channel opened on pathObj. */
+    Tcl_Obj       *pathObj;         /* Normalized path of the file to check
+                                       for rotation or NULL. */
+    int            seekable;        /* Polled file rather than a stream. */
+    int            interval;        /* Poll interval, in milliseconds. */
+    int            wasBlocking;     /* Blocking mode to restore on detach. */
+    Tcl_TimerToken timer;
+    dev_t          dev;             /* Identity of the file being read. */
+    ino_t          ino;
+    Tcl_DString    partial;         /* Partial trailing line. */
+    off_t          partialOffset;
+    long           lineNum;
+    long           bytesRead;
+    int            detached;
+    scanFollow_t  *nextPtr;
+};
+
+#define SCAN_FOLLOW_INTERVAL 250
+
 /*
  * Data kept on a specific scan.
  */
@@ -49,15 +83,85 @@ typedef struct {
     scanContext_t    *contextPtr;   /* Current scan context. */
     Tcl_Channel       channel;      /* The channel being scanned. */
     char             *line;         /* The line from the file. */
-    Tcl_UniChar      *uniLine;      /* UniCode (wide) char line. */
+    int               lineLen;
+    Tcl_UniChar      *uniLine;      /* UniCode (wide) char line, NULL if
+                                       not yet converted. */
     int               uniLineLen;
+    Tcl_DString       uniLineBuf;   /* Buffer holding uniLine. */
     off_t             offset;       /* The offset into the file. */
     long              bytesRead;    /* Number of translated bytes read.*/
     long              lineNum;      /* Current scanned line in the file. */
     matchDef_t       *matchPtr;     /* The current match, or NULL for the
                                        default. */
+    Tcl_RegExpInfo    regExpInfo;   /* Subexpression indices of the current
+                                       match. */
+    int               evalFlags;    /* TCL_EVAL_GLOBAL when scanning from
+                                       the event loop. */
 } scanData_t;
 
+#ifdef TCL_THREADS
+/*
+ * Parallel scanning.  The interpreter thread reads the file in batches of
+ * lines which are matched by a pool of worker threads.  The results are
+ * handed back to the interpreter thread, which executes the match commands.
+ * Regular expressions can't be shared between threads, so each worker
+ * compiles its own copy of the context's patterns when it starts.  A worker
+ * can't report a regular expression error without an interpreter, so it
+ * stops matching the batch at the line that failed and the interpreter
+ * thread matches the rest of the batch itself, returning the same error as
+ * a sequential scan.
+ */
+#define SCAN_BATCH_LINES  512
+#define SCAN_BATCH_BYTES  (64 * 1024)
+
+/*
+ * A pattern that matched a line of a batch.
+ */
+typedef struct {
+    int  lineIdx;       /* Index of the line in the batch. */
+    int  patternIdx;    /* Index of the pattern in the context. */
+    int  nsubs;         /* Number of subexpressions. */
+    int  indicesIdx;    /* Index of the match indices in the batch. */
+} scanHit_t;
+
+typedef struct scanBatch_t {
+    Tcl_DString         text;           /* Lines, each NUL terminated. */
+    int                 numLines;
+    int                 lineStart [SCAN_BATCH_LINES];
+    off_t               lineOffset [SCAN_BATCH_LINES];
+    long                firstLineNum;   /* Line number of the first line. */
+    long                bytesRead;      /* Bytes read before the batch. */
+    scanHit_t          *hits;           /* Matches, in line order. */
+    int                 numHits;
+    int                 maxHits;
+    Tcl_RegExpIndices  *indices;        /* Match and subexpression indices. */
+    int                 numIndices;
+    int                 maxIndices;
+    int                 done;           /* Matching is complete. */
+    int                 failedLineIdx;  /* Line where matching failed, or
+                                           numLines if none did. */
+    struct scanBatch_t *nextPtr;        /* Next in the work queue or free
+                                           list. */
+    struct scanBatch_t *nextInFlightPtr;/* Next in order of submission. */
+} scanBatch_t;
+
+/*
+ * State shared between the interpreter thread and the workers.  Everything
+ * from the mutex down is protected by it.
+ */
+typedef struct {
+    int              numPatterns;
+    char           **patterns;          /* Copies of the pattern strings. */
+    int             *patternFlags;
+    Tcl_Mutex        mutex;
+    Tcl_Condition    workCond;          /* Signaled when work is queued. */
+    Tcl_Condition    doneCond;          /* Signaled when a batch is done. */
+    scanBatch_t     *queueHead;         /* Batches waiting for a worker. */
+    scanBatch_t     *queueTail;
+    int              shutdown;          /* Workers should exit. */
+} parallelScan_t;
+#endif
+
 /*
  * Prototypes of internal functions.
  */
@@ -74,6 +178,56 @@ ScanContextDelete (Tcl_Interp  *interp,
                    void_pt      scanTablePtr,
                    Tcl_Obj     *contextHandleObj);
 
+static void
+FreeContext (char *clientData);
+
+static int
+ScanContextAttach (Tcl_Interp  *interp,
+                   void_pt      scanTablePtr,
+                   int          objc,
+                   Tcl_Obj     *const objv[]);
+
+static int
+ScanContextDetach (Tcl_Interp  *interp,
+                   void_pt      scanTablePtr,
+                   Tcl_Obj     *contextHandleObj,
+                   Tcl_Obj     *fileHandleObj);
+
+static void
+FollowDetach (scanFollow_t *followPtr,
+              int           channelClosed);
+
+static void
+FreeFollow (char *clientData);
+
+static void
+FollowCloseHandler (ClientData clientData);
+
+static void
+FollowTimerProc (ClientData clientData);
+
+static void
+FollowChannelProc (ClientData clientData,
+                   int        mask);
+
+static void
+FollowPoll (scanFollow_t *followPtr);
+
+static int
+FollowRotated (scanFollow_t *followPtr);
+
+static int
+FollowRead (scanFollow_t *followPtr);
+
+static int
+FollowScanLine (scanFollow_t *followPtr,
+                Tcl_DString  *lineBufPtr,
+                off_t         offset);
+
+static void
+FollowFinish (scanFollow_t *followPtr,
+              int           result);
+
 static int
 ScanContextCopyFile (Tcl_Interp  *interp,
                      void_pt      scanTablePtr,
@@ -107,11 +261,59 @@ static int
 SetMatchInfoVar (Tcl_Interp *interp,
                  scanData_t *scanData);
 
+static int
+EvalMatchCommand (Tcl_Interp *interp,
+                  scanData_t *scanData);
+
+static int
+ScanUnmatchedLine (Tcl_Interp *interp,
+                   scanData_t *scanData,
+                   int         matchedAtLeastOne);
+
+static int
+ScanLine (Tcl_Interp *interp,
+          scanData_t *scanData);
+
 static int
 ScanFile (Tcl_Interp    *interp,
           scanContext_t *contextPtr,
           Tcl_Channel    channel);
 
+#ifdef TCL_THREADS
+static scanBatch_t *
+AllocBatch (scanBatch_t **freeListPtr);
+
+static void
+FreeBatches (scanBatch_t *batchPtr);
+
+static void
+MatchBatch (scanBatch_t *batchPtr,
+            Tcl_RegExp  *regExps,
+            int          numPatterns);
+
+static Tcl_ThreadCreateType
+ScanWorkerThread (ClientData clientData);
+
+static int
+ReadBatch (Tcl_Interp    *interp,
+           Tcl_Channel    channel,
+           scanBatch_t   *batchPtr,
+           Tcl_DString   *lineBufPtr);
+
+static int
+DeliverBatch (Tcl_Interp  *interp,
+              scanData_t  *scanData,
+              matchDef_t **matchDefs,
+              scanBatch_t *batchPtr);
+
+static int
+ScanFileParallel (Tcl_Interp    *interp,
+                  scanContext_t *contextPtr,
+                  Tcl_Channel    channel,
+                  int            numThreads,
+                  int            unordered);
+#endif
+
 static void
 ScanFileCloseHandler (ClientData clientData);
 
@@ -130,12 +332,31 @@ FileScanCleanUp (ClientData  clientData,
  * CleanUpContext --
  *
  *   Release all resources allocated to the specified scan context.  Doesn't
- * free the table entry.
+ * free the table entry.  The context itself is freed once no scan is using
+ * it.
  *-----------------------------------------------------------------------------
  */
 static void
 CleanUpContext (void_pt scanTablePtr, scanContext_t *contextPtr)
 {
+    while (contextPtr->followListHead != NULL) {
+        FollowDetach (contextPtr->followListHead, FALSE);
+    }
+    ClearCopyFile (contextPtr);
+    contextPtr->deleted = TRUE;
+    Tcl_EventuallyFree ((ClientData) contextPtr, FreeContext);
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeContext --
+ *
+ *   Free a scan context and its matches.  Called by Tcl_EventuallyFree.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeContext (char *clientData)
+{
+    scanContext_t *contextPtr = (scanContext_t *) clientData;
     matchDef_t  *matchPtr, *oldMatchPtr;
 
     for (matchPtr = contextPtr->matchListHead; matchPtr != NULL;) {
@@ -149,10 +370,9 @@ CleanUpContext (void_pt scanTablePtr, scanContext_t *contextPtr)
     if (contextPtr->defaultAction != NULL) {
         Tcl_DecrRefCount (contextPtr->defaultAction);
     }
-    ClearCopyFile (contextPtr);
     ckfree ((char *) contextPtr);
 }
-
+
 /*-----------------------------------------------------------------------------
  * ScanContextCreate --
  *
@@ -170,6 +390,8 @@ ScanContextCreate (Tcl_Interp *interp, void_pt scanTablePtr)
     contextPtr->matchListTail = NULL;
     contextPtr->defaultAction = NULL;
     contextPtr->copyFileChannel = NULL;
+    contextPtr->deleted = FALSE;
+    contextPtr->followListHead = NULL;
 
     tableEntryPtr = (scanContext_t **)
         TclX_HandleAlloc (scanTablePtr,
@@ -315,16 +537,564 @@ ScanContextCopyFile (Tcl_Interp *interp,
         return TCL_OK;
     }
 
-    return SetCopyFileObj (interp, contextPtr, fileHandleObj);
+    return SetCopyFileObj (interp, contextPtr, fileHandleObj);
+}
+
+
+/*-----------------------------------------------------------------------------
+ * ScanContextAttach --
+ *
+ *   Attach a channel to a scan context, implements the subcommand:
+ *         scancontext attach contexthandle filehandle ?-interval ms?
+ *                    ?-path filename?
+ *-----------------------------------------------------------------------------
+ */
+static int
+ScanContextAttach (Tcl_Interp *interp,
+                   void_pt scanTablePtr,
+                   int objc,
+                   Tcl_Obj *const objv[])
+{
+    scanContext_t *contextPtr, **tableEntryPtr;
+    scanFollow_t  *followPtr;
+    Tcl_Channel    channel;
+    struct stat    statBuf;
+    Tcl_Obj       *pathObj = NULL;
+    char          *option;
+    int            argIdx, interval, seekable, blockingMode;
+
+    tableEntryPtr = (scanContext_t **) TclX_HandleXlateObj (interp,
+                                                            scanTablePtr,
+                                                            objv [2]);
+    if (tableEntryPtr == NULL)
+        return TCL_ERROR;
+    contextPtr = *tableEntryPtr;
+
+    channel = TclX_GetOpenChannelObj (interp, objv [3], TCL_READABLE);
+    if (channel == NULL)
+        return TCL_ERROR;
+
+    interval = SCAN_FOLLOW_INTERVAL;
+    for (argIdx = 4; argIdx < objc; argIdx += 2) {
+        option = Tcl_GetStringFromObj (objv [argIdx], NULL);
+        if (argIdx + 1 >= objc)
+            goto argError;
+        if (STREQU (option, "-interval")) {
+            if (Tcl_GetIntFromObj (interp, objv [argIdx + 1],
+                                   &interval) != TCL_OK)
+                return TCL_ERROR;
+            if (interval <= 0) {
+                TclX_AppendObjResult (interp, "interval must be greater ",
+                                      "than zero, got \"",
+                                      Tcl_GetStringFromObj (objv [argIdx + 1],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else if (STREQU (option, "-path")) {
+            pathObj = objv [argIdx + 1];
+        } else {
+            goto argError;
+        }
+    }
+
+    for (followPtr = contextPtr->followListHead; followPtr != NULL;
+         followPtr = followPtr->nextPtr) {
+        if (followPtr->userChannel == channel) {
+            TclX_AppendObjResult (interp, "channel \"",
+                                  Tcl_GetChannelName (channel),
+                                  "\" is already attached to ",
+                                  contextPtr->contextHandle, (char *) NULL);
+            return TCL_ERROR;
+        }
+    }
+
+    if (TclXOSSeekable (interp, channel, &seekable) != TCL_OK)
+        return TCL_ERROR;
+    if (seekable) {
+        if (TclXOSFstat (interp, channel, &statBuf, NULL) != TCL_OK)
+            return TCL_ERROR;
+    }
+
+    followPtr = (scanFollow_t *) ckalloc (sizeof (scanFollow_t));
+    followPtr->contextPtr = contextPtr;
+    followPtr->interp = interp;
+    followPtr->userChannel = channel;
+    followPtr->channel = channel;
+    followPtr->pathObj = NULL;
+    followPtr->seekable = seekable;
+    followPtr->interval = interval;
+    followPtr->wasBlocking = FALSE;
+    followPtr->timer = NULL;
+    Tcl_DStringInit (&followPtr->partial);
+    followPtr->partialOffset = 0;
+    followPtr->lineNum = 0;
+    followPtr->bytesRead = 0;
+    followPtr->detached = FALSE;
+
+    if (seekable) {
+        followPtr->dev = statBuf.st_dev;
+        followPtr->ino = statBuf.st_ino;
+        if (pathObj != NULL) {
+            /*
+             * Normalized now, so a later cd doesn't change the file checked.
+             */
+            followPtr->pathObj = Tcl_FSGetNormalizedPath (interp, pathObj);
+            if (followPtr->pathObj == NULL) {
+                ckfree ((char *) followPtr);
+                return TCL_ERROR;
+            }
+            Tcl_IncrRefCount (followPtr->pathObj);
+        }
+        followPtr->timer = Tcl_CreateTimerHandler (0, FollowTimerProc,
+                                                   (ClientData) followPtr);
+    } else {
+        /*
+         * Streams are read non-blocking so that a partial line is held in
+         * the channel buffer until the rest arrives.
+         */
+        if (TclX_GetChannelOption (interp, channel, TCLX_COPT_BLOCKING,
+                                   &blockingMode) != TCL_OK) {
+            ckfree ((char *) followPtr);
+            return TCL_ERROR;
+        }
+        followPtr->wasBlocking = (blockingMode == TCLX_MODE_BLOCKING);
+        if (followPtr->wasBlocking) {
+            if (TclX_SetChannelOption (interp, channel, TCLX_COPT_BLOCKING,
+                                       TCLX_MODE_NONBLOCKING) != TCL_OK) {
+                ckfree ((char *) followPtr);
+                return TCL_ERROR;
+            }
+        }
+        Tcl_CreateChannelHandler (channel, TCL_READABLE, FollowChannelProc,
+                                  (ClientData) followPtr);
+    }
+    Tcl_CreateCloseHandler (channel, FollowCloseHandler,
+                            (ClientData) followPtr);
+
+    followPtr->nextPtr = contextPtr->followListHead;
+    contextPtr->followListHead = followPtr;
+    return TCL_OK;
+
+  argError:
+    return TclX_WrongArgs (interp, objv [0],
+                           "attach contexthandle filehandle ?-interval ms? "
+                           "?-path filename?");
+}
+
+/*-----------------------------------------------------------------------------
+ * ScanContextDetach --
+ *
+ *   Detach a channel from a scan context, implements the subcommand:
+ *         scancontext detach contexthandle filehandle
+ *-----------------------------------------------------------------------------
+ */
+static int
+ScanContextDetach (Tcl_Interp *interp,
+                   void_pt scanTablePtr,
+                   Tcl_Obj *contextHandleObj,
+                   Tcl_Obj *fileHandleObj)
+{
+    scanContext_t **tableEntryPtr;
+    scanFollow_t   *followPtr;
+    Tcl_Channel     channel;
+
+    tableEntryPtr = (scanContext_t **) TclX_HandleXlateObj (interp,
+                                                            scanTablePtr,
+                                                            contextHandleObj);
+    if (tableEntryPtr == NULL)
+        return TCL_ERROR;
+
+    channel = TclX_GetOpenChannelObj (interp, fileHandleObj, 0);
+    if (channel == NULL)
+        return TCL_ERROR;
+
+    for (followPtr = (*tableEntryPtr)->followListHead; followPtr != NULL;
+         followPtr = followPtr->nextPtr) {
+        if (followPtr->userChannel == channel) {
+            FollowDetach (followPtr, FALSE);
+            return TCL_OK;
+        }
+    }
+    TclX_AppendObjResult (interp, "channel \"", Tcl_GetChannelName (channel),
+                          "\" is not attached to ",
+                          (*tableEntryPtr)->contextHandle, (char *) NULL);
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowDetach --
+ *
+ *   Stop scanning an attached channel and release its resources.
+ *
+ * Parameters:
+ *   o followPtr - The attachment.
+ *   o channelClosed - TRUE if called because the channel is being closed.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FollowDetach (scanFollow_t *followPtr, int channelClosed)
+{
+    scanFollow_t **prevPtrPtr;
+
+    for (prevPtrPtr = &followPtr->contextPtr->followListHead;
+         *prevPtrPtr != followPtr; prevPtrPtr = &(*prevPtrPtr)->nextPtr)
+        continue;
+    *prevPtrPtr = followPtr->nextPtr;
+
+    if (followPtr->timer != NULL) {
+        Tcl_DeleteTimerHandler (followPtr->timer);
+        followPtr->timer = NULL;
+    }
+    if (!channelClosed) {
+        if (!followPtr->seekable) {
+            Tcl_DeleteChannelHandler (followPtr->userChannel,
+                                      FollowChannelProc,
+                                      (ClientData) followPtr);
+            if (followPtr->wasBlocking) {
+                TclX_SetChannelOption (NULL, followPtr->userChannel,
+                                       TCLX_COPT_BLOCKING,
+                                       TCLX_MODE_BLOCKING);
+            }
+        }
+        Tcl_DeleteCloseHandler (followPtr->userChannel, FollowCloseHandler,
+                                (ClientData) followPtr);
+    }
+    if (followPtr->channel != followPtr->userChannel) {
+        Tcl_Close (NULL, followPtr->channel);
+    }
+    followPtr->detached = TRUE;
+    Tcl_EventuallyFree ((ClientData) followPtr, FreeFollow);
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeFollow --
+ *
+ *   Free a detached attachment.  Called by Tcl_EventuallyFree.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeFollow (char *clientData)
+{
+    scanFollow_t *followPtr = (scanFollow_t *) clientData;
+
+    Tcl_DStringFree (&followPtr->partial);
+    if (followPtr->pathObj != NULL)
+        Tcl_DecrRefCount (followPtr->pathObj);
+    ckfree ((char *) followPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowCloseHandler --
+ *   Close handler for an attached channel.  Detaches it from the context.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FollowCloseHandler (ClientData clientData)
+{
+    FollowDetach ((scanFollow_t *) clientData, TRUE);
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowTimerProc --
+ *   Timer handler that polls an attached file for new data.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FollowTimerProc (ClientData clientData)
+{
+    scanFollow_t *followPtr = (scanFollow_t *) clientData;
+
+    followPtr->timer = NULL;
+    Tcl_Preserve ((ClientData) followPtr);
+    FollowPoll (followPtr);
+    if (!followPtr->detached) {
+        followPtr->timer = Tcl_CreateTimerHandler (followPtr->interval,
+                                                   FollowTimerProc,
+                                                   clientData);
+    }
+    Tcl_Release ((ClientData) followPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowChannelProc --
+ *   Channel handler that scans the lines available on an attached stream.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FollowChannelProc (ClientData clientData, int mask)
+{
+    scanFollow_t *followPtr = (scanFollow_t *) clientData;
+    int result;
+
+    /*
+     * Disable the handler while the match commands run, in case they
+     * re-enter the event loop.
+     */
+    Tcl_Preserve ((ClientData) followPtr);
+    Tcl_CreateChannelHandler (followPtr->channel, 0, FollowChannelProc,
+                              clientData);
+    result = FollowRead (followPtr);
+    FollowFinish (followPtr, result);
+    if (!followPtr->detached) {
+        Tcl_CreateChannelHandler (followPtr->channel, TCL_READABLE,
+                                  FollowChannelProc, clientData);
+    }
+    Tcl_Release ((ClientData) followPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowPoll --
+ *
+ *   Check an attached file for new data, truncation or rotation, and scan
+ * any new lines.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FollowPoll (scanFollow_t *followPtr)
+{
+    struct stat statBuf;
+    off_t pos;
+    int result;
+
+    if (TclXOSFstat (followPtr->interp, followPtr->channel, &statBuf,
+                     NULL) != TCL_OK) {
+        FollowFinish (followPtr, TCL_ERROR);
+        return;
+    }
+    pos = (off_t) Tcl_Tell (followPtr->channel);
+
+    if (statBuf.st_size < pos) {
+        /*
+         * Truncated, start again from the beginning.
+         */
+        Tcl_Seek (followPtr->channel, 0, SEEK_SET);
+        Tcl_DStringSetLength (&followPtr->partial, 0);
+        followPtr->lineNum = 0;
+        followPtr->bytesRead = 0;
+    } else if (statBuf.st_size == pos) {
+        if ((followPtr->pathObj == NULL) || !FollowRotated (followPtr))
+            return;
+    } else {
+        Tcl_Seek (followPtr->channel, pos, SEEK_SET);  /* Clears EOF */
+    }
+    result = FollowRead (followPtr);
+    FollowFinish (followPtr, result);
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowRotated --
+ *
+ *   Check if the path of an attached file now refers to a different file.
+ * If it does, finish scanning the old file and switch to the new one.
+ *
+ * Returns:
+ *   TRUE if switched to a new file, FALSE otherwise.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FollowRotated (scanFollow_t *followPtr)
+{
+    Tcl_StatBuf statBuf;
+    Tcl_Channel newChannel;
+    Tcl_DString optionBuf;
+    Tcl_DString lineBuf;
+    int result;
+
+    if (Tcl_FSStat (followPtr->pathObj, &statBuf) != 0)
+        return FALSE;  /* Not created yet. */
+    if ((statBuf.st_dev == followPtr->dev) &&
+        (statBuf.st_ino == followPtr->ino))
+        return FALSE;
+
+    newChannel = Tcl_FSOpenFileChannel (NULL, followPtr->pathObj, "r", 0);
+    if (newChannel == NULL)
+        return FALSE;
+    Tcl_DStringInit (&optionBuf);
+    if (Tcl_GetChannelOption (NULL, followPtr->userChannel, "-encoding",
+                              &optionBuf) == TCL_OK) {
+        Tcl_SetChannelOption (NULL, newChannel, "-encoding",
+                              Tcl_DStringValue (&optionBuf));
+    }
+    Tcl_DStringSetLength (&optionBuf, 0);
+    if (Tcl_GetChannelOption (NULL, followPtr->userChannel, "-translation",
+                              &optionBuf) == TCL_OK) {
+        Tcl_SetChannelOption (NULL, newChannel, "-translation",
+                              Tcl_DStringValue (&optionBuf));
+    }
+    Tcl_DStringFree (&optionBuf);
+
+    /*
+     * Pick up anything written to the old file before it was replaced.  Its
+     * last line is complete, even without a newline.
+     */
+    Tcl_Seek (followPtr->channel, Tcl_Tell (followPtr->channel), SEEK_SET);
+    result = FollowRead (followPtr);
+    if ((result == TCL_OK) && !followPtr->detached &&
+        (Tcl_DStringLength (&followPtr->partial) > 0)) {
+        Tcl_DStringInit (&lineBuf);
+        result = FollowScanLine (followPtr, &lineBuf,
+                                 followPtr->partialOffset);
+        Tcl_DStringFree (&lineBuf);
+    }
+    FollowFinish (followPtr, result);
+    if (followPtr->detached) {
+        Tcl_Close (NULL, newChannel);
+        return FALSE;
+    }
+
+    if (followPtr->channel != followPtr->userChannel) {
+        Tcl_Close (NULL, followPtr->channel);
+    }
+    followPtr->channel = newChannel;
+    followPtr->dev = statBuf.st_dev;
+    followPtr->ino = statBuf.st_ino;
+    followPtr->lineNum = 0;
+    followPtr->bytesRead = 0;
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowRead --
+ *
+ *   Scan the complete lines available on an attached channel.  A partial
+ * trailing line of a file is saved until the rest of it is written.
+ *
+ * Returns:
+ *   TCL_OK, TCL_BREAK if scanning of the channel should stop or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FollowRead (scanFollow_t *followPtr)
+{
+    Tcl_Channel channel = followPtr->channel;
+    Tcl_DString lineBuf;
+    off_t offset;
+    int result = TCL_OK;
+
+    Tcl_DStringInit (&lineBuf);
+    while (!followPtr->detached) {
+        offset = (off_t) Tcl_Tell (channel);
+        if (offset < 0)
+            offset = followPtr->bytesRead;
+        Tcl_DStringSetLength (&lineBuf, 0);
+        if (Tcl_Gets (channel, &lineBuf) < 0) {
+            if (Tcl_InputBlocked (channel))
+                break;
+            if (Tcl_Eof (channel)) {
+                if (!followPtr->seekable)
+                    result = TCL_BREAK;
+                break;
+            }
+            Tcl_SetStringObj (Tcl_GetObjResult (followPtr->interp),
+                              Tcl_PosixError (followPtr->interp), -1);
+            result = TCL_ERROR;
+            break;
+        }
+        if (followPtr->seekable && Tcl_Eof (channel)) {
+            if (Tcl_DStringLength (&followPtr->partial) == 0)
+                followPtr->partialOffset = offset;
+            Tcl_DStringAppend (&followPtr->partial,
+                               Tcl_DStringValue (&lineBuf),
+                               Tcl_DStringLength (&lineBuf));
+            break;
+        }
+        result = FollowScanLine (followPtr, &lineBuf, offset);
+        if (result != TCL_OK)
+            break;
+    }
+    Tcl_DStringFree (&lineBuf);
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowScanLine --
+ *
+ *   Scan a line read from an attached channel, prefixed by any saved partial
+ * line.
+ *
+ * Parameters:
+ *   o followPtr - The attachment.
+ *   o lineBufPtr - The line.  Modified.
+ *   o offset - Offset of the line in the file.
+ * Returns:
+ *   TCL_OK, TCL_BREAK if scanning of the channel should stop or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FollowScanLine (scanFollow_t *followPtr,
+                Tcl_DString  *lineBufPtr,
+                off_t         offset)
+{
+    scanData_t data;
+    int result;
+
+    if (Tcl_DStringLength (&followPtr->partial) > 0) {
+        offset = followPtr->partialOffset;
+        Tcl_DStringAppend (&followPtr->partial,
+                           Tcl_DStringValue (lineBufPtr),
+                           Tcl_DStringLength (lineBufPtr));
+        Tcl_DStringSetLength (lineBufPtr, 0);
+        Tcl_DStringAppend (lineBufPtr, Tcl_DStringValue (&followPtr->partial),
+                           Tcl_DStringLength (&followPtr->partial));
+        Tcl_DStringSetLength (&followPtr->partial, 0);
+    }
+
+    followPtr->lineNum++;
+    followPtr->bytesRead += Tcl_DStringLength (lineBufPtr) + 1;
+
+    data.contextPtr = followPtr->contextPtr;
+    data.channel = followPtr->userChannel;
+    data.line = Tcl_DStringValue (lineBufPtr);
+    data.lineLen = Tcl_DStringLength (lineBufPtr);
+    data.offset = offset;
+    data.bytesRead = followPtr->bytesRead;
+    data.lineNum = followPtr->lineNum;
+    data.evalFlags = TCL_EVAL_GLOBAL;
+    Tcl_DStringInit (&data.uniLineBuf);
+
+    Tcl_Preserve ((ClientData) data.contextPtr);
+    result = ScanLine (followPtr->interp, &data);
+    Tcl_Release ((ClientData) data.contextPtr);
+
+    Tcl_DStringFree (&data.uniLineBuf);
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowFinish --
+ *
+ *   Handle the result of scanning an attached channel from the event loop.
+ * Errors are reported as background errors.  The channel is detached on an
+ * error, a break or return from a match command, or the end of a stream.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FollowFinish (scanFollow_t *followPtr, int result)
+{
+    Tcl_Interp *interp = followPtr->interp;
+
+    if (result == TCL_ERROR) {
+        Tcl_AddObjErrorInfo (interp, "\n    while scanning attached channel",
+                             -1);
+        Tcl_BackgroundError (interp);
+    }
+    if ((result != TCL_OK) && !followPtr->detached) {
+        FollowDetach (followPtr, FALSE);
+    }
+    Tcl_ResetResult (interp);
 }
 
-
+
 /*-----------------------------------------------------------------------------
  * TclX_ScancontextObjCmd --
  *
  *   Implements the TCL scancontext Tcl command, which has the following forms:
  *         scancontext create
- *         scancontext delete
+ *         scancontext delete contexthandle
+ *         scancontext copyfile contexthandle ?filehandle?
+ *         scancontext attach contexthandle filehandle ?options?
+ *         scancontext detach contexthandle filehandle
  *-----------------------------------------------------------------------------
  */
 static int
@@ -377,8 +1147,33 @@ TclX_ScancontextObjCmd (ClientData clientData,
                                     (objc == 4) ? objv [3] : NULL);
     }
 
+    /*
+     * Attach or detach a channel to scan from the event loop.
+     */
+    if (STREQU (subCommand, "attach")) {
+        if ((objc < 4) || (objc > 8))
+	    return TclX_WrongArgs (interp, objv [0],
+                              "attach contexthandle filehandle ?-interval ms? "
+                              "?-path filename?");
+
+        return ScanContextAttach (interp,
+                                  (void_pt) clientData,
+                                  objc, objv);
+    }
+
+    if (STREQU (subCommand, "detach")) {
+        if (objc != 4)
+	    return TclX_WrongArgs (interp, objv [0],
+                                   "detach contexthandle filehandle");
+
+        return ScanContextDetach (interp,
+                                  (void_pt) clientData,
+                                  objv [2], objv [3]);
+    }
+
     TclX_AppendObjResult (interp, "invalid argument, expected one of: ",
-                          "\"create\", \"delete\", or \"copyfile\"",
+                          "\"create\", \"delete\", \"copyfile\", ",
+                          "\"attach\", or \"detach\"",
                           (char *) NULL);
     return TCL_ERROR;
 }
@@ -455,6 +1250,7 @@ TclX_ScanmatchObjCmd (ClientData clientData,
 
     newmatch->regExpObj = objv[firstArg + 1],
     Tcl_IncrRefCount (newmatch->regExpObj);
+    newmatch->regExpFlags = regExpFlags;
     newmatch->command = objv [firstArg + 2];
     Tcl_IncrRefCount (newmatch->command);
 
@@ -485,8 +1281,8 @@ argError:
  * Parameters:
  *   o interp - The Tcl interpreter to set the matchInfo variable in.
  *     Errors are returned in result.
- *   o scanData - Data about the current line being scanned.
- *     been stored.
+ *   o scanData - Data about the current line being scanned.  The
+ *     regExpInfo field must contain the indices of the current match.
  *-----------------------------------------------------------------------------
  */
 static int
@@ -499,6 +1295,10 @@ SetMatchInfoVar (Tcl_Interp *interp, scanData_t *scanData)
     char key [32];
     Tcl_Obj *valueObjPtr, *indexObjv [2];
     Tcl_RegExpInfo regExpInfo;
+    int varFlags = TCL_LEAVE_ERR_MSG;
+
+    if (scanData->evalFlags & TCL_EVAL_GLOBAL)
+        varFlags |= TCL_GLOBAL_ONLY;
 
     Tcl_DStringInit(&valueBuf);
 
@@ -508,15 +1308,15 @@ SetMatchInfoVar (Tcl_Interp *interp, scanData_t *scanData)
     if (!scanData->storedLine) {
         scanData->storedLine = TRUE;
 
-        Tcl_UnsetVar (interp, MATCHINFO, 0);
+        Tcl_UnsetVar (interp, MATCHINFO, varFlags & TCL_GLOBAL_ONLY);
         
         if (Tcl_SetVar2 (interp, MATCHINFO, "line", scanData->line, 
-                         TCL_LEAVE_ERR_MSG) == NULL)
+                         varFlags) == NULL)
             goto errorExit;
 
         valueObjPtr = Tcl_NewLongObj ((long) scanData->offset);
         if (Tcl_SetVar2Ex(interp, MATCHINFO, "offset", valueObjPtr,
-                          TCL_LEAVE_ERR_MSG) == NULL) {
+                          varFlags) == NULL) {
             Tcl_DecrRefCount (valueObjPtr);
             goto errorExit;
         }
@@ -529,26 +1329,26 @@ SetMatchInfoVar (Tcl_Interp *interp, scanData_t *scanData)
          */
         valueObjPtr = Tcl_NewLongObj ((long) scanData->bytesRead);
         if (Tcl_SetObjVar2 (interp, MATCHINFO, "bytesread", valueObjPtr,
-                            TCL_LEAVE_ERR_MSG) == NULL) {
+                            varFlags) == NULL) {
             Tcl_DecrRefCount (valueObjPtr);
             goto errorExit;
         }
 #endif
         valueObjPtr = Tcl_NewIntObj ((long) scanData->lineNum);
         if (Tcl_SetVar2Ex(interp, MATCHINFO, "linenum", valueObjPtr,
-                          TCL_LEAVE_ERR_MSG) == NULL) {
+                          varFlags) == NULL) {
             Tcl_DecrRefCount (valueObjPtr);
             goto errorExit;
         }
 
         if (Tcl_SetVar2 (interp, MATCHINFO, "context",
                          scanData->contextPtr->contextHandle,
-                         TCL_LEAVE_ERR_MSG) == NULL)
+                         varFlags) == NULL)
             goto errorExit;
 
         if (Tcl_SetVar2 (interp, MATCHINFO, "handle", 
                          Tcl_GetChannelName (scanData->channel),
-                         TCL_LEAVE_ERR_MSG) == NULL)
+                         varFlags) == NULL)
             goto errorExit;
 
     }
@@ -556,7 +1356,7 @@ SetMatchInfoVar (Tcl_Interp *interp, scanData_t *scanData)
     if (scanData->contextPtr->copyFileChannel != NULL) {
         if (Tcl_SetVar2 (interp, MATCHINFO, "copyHandle", 
                          Tcl_GetChannelName (scanData->contextPtr->copyFileChannel),
-                         TCL_LEAVE_ERR_MSG) == NULL)
+                         varFlags) == NULL)
             goto errorExit;
     }
 
@@ -564,7 +1364,15 @@ SetMatchInfoVar (Tcl_Interp *interp, scanData_t *scanData)
         goto exitPoint;
     }
 
-    Tcl_RegExpGetInfo(scanData->matchPtr->regExp, &regExpInfo);
+    regExpInfo = scanData->regExpInfo;
+    if ((regExpInfo.nsubs > 0) && (scanData->uniLine == NULL)) {
+        Tcl_DStringSetLength (&scanData->uniLineBuf, 0);
+        scanData->uniLine =
+            Tcl_UtfToUniCharDString (scanData->line, scanData->lineLen,
+                                     &scanData->uniLineBuf);
+        scanData->uniLineLen = Tcl_DStringLength (&scanData->uniLineBuf) /
+            sizeof (Tcl_UniChar);
+    }
     for (idx = 0; idx < regExpInfo.nsubs; idx++) {
 	start = regExpInfo.matches[idx+1].start;
 	end = regExpInfo.matches[idx+1].end;
@@ -578,7 +1386,7 @@ SetMatchInfoVar (Tcl_Interp *interp, scanData_t *scanData)
         }
         valueObjPtr = Tcl_NewListObj (2, indexObjv);
         if (Tcl_SetVar2Ex(interp, MATCHINFO, key, valueObjPtr,
-                            TCL_LEAVE_ERR_MSG) == NULL) {
+                            varFlags) == NULL) {
             Tcl_DecrRefCount (valueObjPtr);
             goto errorExit;
         }
@@ -590,7 +1398,7 @@ SetMatchInfoVar (Tcl_Interp *interp, scanData_t *scanData)
         valueObjPtr = Tcl_NewStringObj(value, (end - start));
 
         if (Tcl_SetVar2Ex(interp, MATCHINFO, key, valueObjPtr,
-                            TCL_LEAVE_ERR_MSG) == NULL) {
+                            varFlags) == NULL) {
             Tcl_DecrRefCount (valueObjPtr);
             goto errorExit;
         }
@@ -605,6 +1413,150 @@ SetMatchInfoVar (Tcl_Interp *interp, scanData_t *scanData)
     return TCL_ERROR;
 }
 
+/*-----------------------------------------------------------------------------
+ * EvalMatchCommand --
+ *
+ *   Set the matchInfo variable for the current match and evaluate its
+ * command.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter.  Errors are returned in result.
+ *   o scanData - Data about the current line being scanned.  The matchPtr
+ *     field is the match whose command is evaluated.
+ * Returns:
+ *   TCL_OK to continue with the next match, TCL_CONTINUE if no more matches
+ * should be processed for this line, TCL_BREAK if the scan should be
+ * terminated or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+EvalMatchCommand (Tcl_Interp *interp, scanData_t *scanData)
+{
+    int result;
+
+    if (SetMatchInfoVar (interp, scanData) != TCL_OK)
+        return TCL_ERROR;
+
+    result = Tcl_EvalObjEx (interp, scanData->matchPtr->command,
+                            scanData->evalFlags);
+    if (result == TCL_ERROR) {
+        Tcl_AddObjErrorInfo (interp, 
+            "\n    while executing a match command", -1);
+        return TCL_ERROR;
+    }
+    if (result == TCL_RETURN)
+        return TCL_BREAK;
+    if (result == TCL_BREAK || result == TCL_CONTINUE)
+        return result;
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * ScanUnmatchedLine --
+ *
+ *   Finish processing of a line, executing the default action and writing
+ * the line to the copy file if it wasn't matched.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter.  Errors are returned in result.
+ *   o scanData - Data about the current line being scanned.
+ *   o matchedAtLeastOne - TRUE if any pattern matched the line.
+ * Returns:
+ *   TCL_OK, TCL_BREAK if the scan should be terminated or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ScanUnmatchedLine (Tcl_Interp *interp,
+                   scanData_t *scanData,
+                   int         matchedAtLeastOne)
+{
+    scanContext_t *contextPtr = scanData->contextPtr;
+    int result;
+
+    if (matchedAtLeastOne)
+        return TCL_OK;
+
+    if (contextPtr->defaultAction != NULL) {
+        scanData->matchPtr = NULL;
+        if (SetMatchInfoVar (interp, scanData) != TCL_OK)
+            return TCL_ERROR;
+
+        result = Tcl_EvalObjEx (interp, contextPtr->defaultAction,
+                                scanData->evalFlags);
+        if (result == TCL_ERROR) {
+            Tcl_AddObjErrorInfo (interp, 
+                "\n    while executing a match default command", -1);
+            return TCL_ERROR;
+        }
+        if ((result == TCL_BREAK) || (result == TCL_RETURN))
+            return TCL_BREAK;
+    }
+
+    if (contextPtr->copyFileChannel != NULL) {
+        if ((Tcl_Write (contextPtr->copyFileChannel, scanData->line,
+                        scanData->lineLen) < 0) ||
+            (TclX_WriteNL (contextPtr->copyFileChannel) < 0)) {
+            Tcl_SetStringObj (Tcl_GetObjResult (interp),
+                              Tcl_PosixError (interp), -1);
+            return TCL_ERROR;
+        }
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * ScanLine --
+ *
+ *   Match a line against all patterns of the scan context, executing the
+ * commands of the patterns that match, or the default action if none do.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter.  Errors are returned in result.
+ *   o scanData - Data about the scan.  The line, lineLen, offset and lineNum
+ *     fields describe the line to scan.
+ * Returns:
+ *   TCL_OK, TCL_BREAK if the scan should be terminated or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ScanLine (Tcl_Interp *interp, scanData_t *scanData)
+{
+    int result, matchStat, matchedAtLeastOne;
+
+    scanData->storedLine = FALSE;
+    scanData->uniLine = NULL;
+    matchedAtLeastOne = FALSE;
+
+    for (scanData->matchPtr = scanData->contextPtr->matchListHead; 
+         scanData->matchPtr != NULL; 
+         scanData->matchPtr = scanData->matchPtr->nextMatchDefPtr) {
+
+        matchStat = Tcl_RegExpExec (interp,
+                                    scanData->matchPtr->regExp,
+                                    scanData->line,
+                                    scanData->line);
+        if (matchStat < 0)
+            return TCL_ERROR;
+        if (matchStat == 0)
+            continue;  /* Try next match pattern */
+        matchedAtLeastOne = TRUE;
+        Tcl_RegExpGetInfo (scanData->matchPtr->regExp,
+                           &scanData->regExpInfo);
+
+        result = EvalMatchCommand (interp, scanData);
+        if (result == TCL_CONTINUE) {
+            /* 
+             * Don't process any more matches for this line.
+             */
+            break;
+        }
+        if (result != TCL_OK)
+            return result;
+    }
+
+    return ScanUnmatchedLine (interp, scanData, matchedAtLeastOne);
+}
+
 /*-----------------------------------------------------------------------------
  * ScanFile --
  *
@@ -614,10 +1566,9 @@ SetMatchInfoVar (Tcl_Interp *interp, scanData_t *scanData)
 static int
 ScanFile (Tcl_Interp *interp, scanContext_t *contextPtr, Tcl_Channel channel)
 {
-    Tcl_DString lineBuf, uniLineBuf;
-    int result, matchedAtLeastOne;
+    Tcl_DString lineBuf;
+    int result;
     scanData_t data;
-    int matchStat;
     
     if (contextPtr->matchListHead == NULL) {
         TclX_AppendObjResult (interp, "no patterns in current scan context",
@@ -630,14 +1581,15 @@ ScanFile (Tcl_Interp *interp, scanContext_t *contextPtr, Tcl_Channel channel)
     data.channel = channel;
     data.bytesRead = 0;
     data.lineNum = 0;
+    data.evalFlags = 0;
     
     Tcl_DStringInit (&lineBuf);
-    Tcl_DStringInit (&uniLineBuf);
+    Tcl_DStringInit (&data.uniLineBuf);
 
     result = TCL_OK;
     while (TRUE) {
-        if (!contextPtr->fileOpen)
-            goto scanExit;  /* Closed by a callback */
+        if (!contextPtr->fileOpen || contextPtr->deleted)
+            goto scanExit;  /* Closed or deleted by a callback */
 
         data.offset = (off_t) Tcl_Tell (channel);
         Tcl_DStringSetLength (&lineBuf, 0);
@@ -652,106 +1604,507 @@ ScanFile (Tcl_Interp *interp, scanContext_t *contextPtr, Tcl_Channel channel)
 
 
         data.line = Tcl_DStringValue(&lineBuf);
+        data.lineLen = Tcl_DStringLength(&lineBuf);
         data.bytesRead += (lineBuf.length + 1);  /* Include EOLN */
         data.lineNum++;
-        data.storedLine = FALSE;
 
-        /* Convert to UTF to UniCode */
-        Tcl_DStringSetLength (&uniLineBuf, 0);
-        data.uniLine = Tcl_UtfToUniCharDString(Tcl_DStringValue(&lineBuf),
-                                               Tcl_DStringLength(&lineBuf),
-                                               &uniLineBuf);
-        data.uniLineLen = Tcl_DStringLength(&uniLineBuf) / sizeof(Tcl_UniChar);
+        result = ScanLine (interp, &data);
+        if (result != TCL_OK)
+            goto scanExit;
+    }
 
-        matchedAtLeastOne = FALSE;
+  scanExit:
+    Tcl_DStringFree (&lineBuf);
+    Tcl_DStringFree (&data.uniLineBuf);
+    if (result == TCL_ERROR)
+        return TCL_ERROR;
+    return TCL_OK;
+}
+
+#ifdef TCL_THREADS
+/*-----------------------------------------------------------------------------
+ * AllocBatch --
+ *
+ *   Get an empty batch, reusing one from a free list if available.
+ *-----------------------------------------------------------------------------
+ */
+static scanBatch_t *
+AllocBatch (scanBatch_t **freeListPtr)
+{
+    scanBatch_t *batchPtr = *freeListPtr;
+
+    if (batchPtr != NULL) {
+        *freeListPtr = batchPtr->nextPtr;
+        Tcl_DStringSetLength (&batchPtr->text, 0);
+    } else {
+        batchPtr = (scanBatch_t *) ckalloc (sizeof (scanBatch_t));
+        Tcl_DStringInit (&batchPtr->text);
+        batchPtr->hits = NULL;
+        batchPtr->maxHits = 0;
+        batchPtr->indices = NULL;
+        batchPtr->maxIndices = 0;
+    }
+    batchPtr->numLines = 0;
+    batchPtr->numHits = 0;
+    batchPtr->numIndices = 0;
+    batchPtr->done = FALSE;
+    batchPtr->failedLineIdx = SCAN_BATCH_LINES;
+    batchPtr->nextPtr = NULL;
+    batchPtr->nextInFlightPtr = NULL;
+    return batchPtr;
+}
 
-        for (data.matchPtr = contextPtr->matchListHead; 
-             data.matchPtr != NULL; 
-             data.matchPtr = data.matchPtr->nextMatchDefPtr) {
+/*-----------------------------------------------------------------------------
+ * FreeBatches --
+ *
+ *   Release a list of batches linked by nextPtr.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeBatches (scanBatch_t *batchPtr)
+{
+    scanBatch_t *nextPtr;
+
+    while (batchPtr != NULL) {
+        nextPtr = batchPtr->nextPtr;
+        Tcl_DStringFree (&batchPtr->text);
+        if (batchPtr->hits != NULL)
+            ckfree ((char *) batchPtr->hits);
+        if (batchPtr->indices != NULL)
+            ckfree ((char *) batchPtr->indices);
+        ckfree ((char *) batchPtr);
+        batchPtr = nextPtr;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * MatchBatch --
+ *
+ *   Match all lines of a batch against the patterns, recording the hits.
+ * Called in a worker thread.  If a pattern fails to match a line with an
+ * error, the hits of that line are dropped and matching stops there.
+ *-----------------------------------------------------------------------------
+ */
+static void
+MatchBatch (scanBatch_t *batchPtr, Tcl_RegExp *regExps, int numPatterns)
+{
+    char *line;
+    int lineIdx, patIdx, numIdx, matchStat, lineHits, lineIndices;
+    scanHit_t *hitPtr;
+    Tcl_RegExpInfo regExpInfo;
 
-            matchStat = Tcl_RegExpExec(interp,
-		    data.matchPtr->regExp,
-		    Tcl_DStringValue(&lineBuf),
-		    Tcl_DStringValue(&lineBuf));
+    batchPtr->failedLineIdx = batchPtr->numLines;
+    for (lineIdx = 0; lineIdx < batchPtr->numLines; lineIdx++) {
+        line = Tcl_DStringValue (&batchPtr->text) +
+            batchPtr->lineStart [lineIdx];
+        lineHits = batchPtr->numHits;
+        lineIndices = batchPtr->numIndices;
+        for (patIdx = 0; patIdx < numPatterns; patIdx++) {
+            matchStat = (regExps [patIdx] == NULL) ? -1 :
+                Tcl_RegExpExec (NULL, regExps [patIdx], line, line);
             if (matchStat < 0) {
-                result = TCL_ERROR;
-                goto scanExit;
+                batchPtr->numHits = lineHits;
+                batchPtr->numIndices = lineIndices;
+                batchPtr->failedLineIdx = lineIdx;
+                return;
             }
-            if (matchStat == 0) {
-                continue;  /* Try next match pattern */
+            if (matchStat == 0)
+                continue;
+            Tcl_RegExpGetInfo (regExps [patIdx], &regExpInfo);
+
+            if (batchPtr->numHits == batchPtr->maxHits) {
+                batchPtr->maxHits = (batchPtr->maxHits == 0) ? 64 :
+                    2 * batchPtr->maxHits;
+                batchPtr->hits = (scanHit_t *)
+                    ckrealloc ((char *) batchPtr->hits,
+                               batchPtr->maxHits * sizeof (scanHit_t));
             }
-            matchedAtLeastOne = TRUE;
+            numIdx = regExpInfo.nsubs + 1;
+            if (batchPtr->numIndices + numIdx > batchPtr->maxIndices) {
+                batchPtr->maxIndices = 2 * batchPtr->maxIndices + numIdx;
+                batchPtr->indices = (Tcl_RegExpIndices *)
+                    ckrealloc ((char *) batchPtr->indices,
+                               batchPtr->maxIndices *
+                               sizeof (Tcl_RegExpIndices));
+            }
+            hitPtr = &batchPtr->hits [batchPtr->numHits++];
+            hitPtr->lineIdx = lineIdx;
+            hitPtr->patternIdx = patIdx;
+            hitPtr->nsubs = regExpInfo.nsubs;
+            hitPtr->indicesIdx = batchPtr->numIndices;
+            memcpy (&batchPtr->indices [batchPtr->numIndices],
+                    regExpInfo.matches, numIdx * sizeof (Tcl_RegExpIndices));
+            batchPtr->numIndices += numIdx;
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * ScanWorkerThread --
+ *
+ *   Body of a scan worker thread.  Compiles a private copy of the patterns,
+ * then matches batches from the work queue until told to shut down.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_ThreadCreateType
+ScanWorkerThread (ClientData clientData)
+{
+    parallelScan_t *scanPtr = (parallelScan_t *) clientData;
+    Tcl_Obj **regExpObjs;
+    Tcl_RegExp *regExps;
+    scanBatch_t *batchPtr;
+    int idx;
+
+    regExpObjs = (Tcl_Obj **)
+        ckalloc (scanPtr->numPatterns * sizeof (Tcl_Obj *));
+    regExps = (Tcl_RegExp *)
+        ckalloc (scanPtr->numPatterns * sizeof (Tcl_RegExp));
+    for (idx = 0; idx < scanPtr->numPatterns; idx++) {
+        regExpObjs [idx] = Tcl_NewStringObj (scanPtr->patterns [idx], -1);
+        Tcl_IncrRefCount (regExpObjs [idx]);
+        regExps [idx] = Tcl_GetRegExpFromObj (NULL, regExpObjs [idx],
+                                              scanPtr->patternFlags [idx]);
+    }
+
+    Tcl_MutexLock (&scanPtr->mutex);
+    while (TRUE) {
+        while ((scanPtr->queueHead == NULL) && !scanPtr->shutdown) {
+            Tcl_ConditionWait (&scanPtr->workCond, &scanPtr->mutex, NULL);
+        }
+        if (scanPtr->queueHead == NULL)
+            break;
+        batchPtr = scanPtr->queueHead;
+        scanPtr->queueHead = batchPtr->nextPtr;
+        if (scanPtr->queueHead == NULL)
+            scanPtr->queueTail = NULL;
+        Tcl_MutexUnlock (&scanPtr->mutex);
+
+        MatchBatch (batchPtr, regExps, scanPtr->numPatterns);
+
+        Tcl_MutexLock (&scanPtr->mutex);
+        batchPtr->done = TRUE;
+        Tcl_ConditionNotify (&scanPtr->doneCond);
+    }
+    Tcl_MutexUnlock (&scanPtr->mutex);
+
+    for (idx = 0; idx < scanPtr->numPatterns; idx++) {
+        Tcl_DecrRefCount (regExpObjs [idx]);
+    }
+    ckfree ((char *) regExpObjs);
+    ckfree ((char *) regExps);
+
+    Tcl_ExitThread (0);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadBatch --
+ *
+ *   Fill a batch with lines read from the channel.
+ *
+ * Returns:
+ *   TCL_OK if the batch was filled, TCL_BREAK if EOF (or a blocked
+ * non-blocking channel) was reached, possibly leaving a partial batch, or
+ * TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadBatch (Tcl_Interp  *interp,
+           Tcl_Channel  channel,
+           scanBatch_t *batchPtr,
+           Tcl_DString *lineBufPtr)
+{
+    int lineIdx;
+
+    while ((batchPtr->numLines < SCAN_BATCH_LINES) &&
+           (Tcl_DStringLength (&batchPtr->text) < SCAN_BATCH_BYTES)) {
+        lineIdx = batchPtr->numLines;
+        batchPtr->lineOffset [lineIdx] = (off_t) Tcl_Tell (channel);
+        Tcl_DStringSetLength (lineBufPtr, 0);
+        if (Tcl_Gets (channel, lineBufPtr) < 0) {
+            if (Tcl_Eof (channel) || Tcl_InputBlocked (channel))
+                return TCL_BREAK;
+            Tcl_SetStringObj (Tcl_GetObjResult (interp),
+                              Tcl_PosixError (interp), -1);
+            return TCL_ERROR;
+        }
+        batchPtr->lineStart [lineIdx] = Tcl_DStringLength (&batchPtr->text);
+        Tcl_DStringAppend (&batchPtr->text, Tcl_DStringValue (lineBufPtr),
+                           Tcl_DStringLength (lineBufPtr) + 1);
+        batchPtr->numLines++;
+    }
+    return TCL_OK;
+}
 
-            result = SetMatchInfoVar (interp, &data);
+/*-----------------------------------------------------------------------------
+ * DeliverBatch --
+ *
+ *   Execute the match commands for a batch that has been matched.  Lines
+ * from the one a worker failed to match on are matched here instead.
+ *
+ * Returns:
+ *   TCL_OK, TCL_BREAK if the scan should be terminated or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+DeliverBatch (Tcl_Interp  *interp,
+              scanData_t  *scanData,
+              matchDef_t **matchDefs,
+              scanBatch_t *batchPtr)
+{
+    scanHit_t *hitPtr = batchPtr->hits;
+    scanHit_t *hitEnd = batchPtr->hits + batchPtr->numHits;
+    int lineIdx, result, matchedAtLeastOne, skipMatches;
+
+    scanData->bytesRead = batchPtr->bytesRead;
+    for (lineIdx = 0; lineIdx < batchPtr->numLines; lineIdx++) {
+        if (!scanData->contextPtr->fileOpen || scanData->contextPtr->deleted)
+            return TCL_BREAK;  /* Closed or deleted by a callback */
+
+        scanData->line = Tcl_DStringValue (&batchPtr->text) +
+            batchPtr->lineStart [lineIdx];
+        scanData->lineLen = strlen (scanData->line);
+        scanData->offset = batchPtr->lineOffset [lineIdx];
+        scanData->bytesRead += scanData->lineLen + 1;
+        scanData->lineNum = batchPtr->firstLineNum + lineIdx;
+        scanData->storedLine = FALSE;
+        scanData->uniLine = NULL;
+
+        if (lineIdx >= batchPtr->failedLineIdx) {
+            result = ScanLine (interp, scanData);
             if (result != TCL_OK)
-                goto scanExit;
+                return result;
+            continue;
+        }
 
-            result = Tcl_EvalObj (interp, data.matchPtr->command);
-            if (result == TCL_ERROR) {
-                Tcl_AddObjErrorInfo (interp, 
-                    "\n    while executing a match command", -1);
-                goto scanExit;
-            }
+        matchedAtLeastOne = FALSE;
+        skipMatches = FALSE;
+        for (; (hitPtr < hitEnd) && (hitPtr->lineIdx == lineIdx); hitPtr++) {
+            matchedAtLeastOne = TRUE;
+            if (skipMatches)
+                continue;
+            scanData->matchPtr = matchDefs [hitPtr->patternIdx];
+            scanData->regExpInfo.nsubs = hitPtr->nsubs;
+            scanData->regExpInfo.matches =
+                batchPtr->indices + hitPtr->indicesIdx;
+
+            result = EvalMatchCommand (interp, scanData);
             if (result == TCL_CONTINUE) {
-                /* 
-                 * Don't process any more matches for this line.
-                 */
-                goto matchLineExit;
-            }
-            if ((result == TCL_BREAK) || (result == TCL_RETURN)) {
-                /*
-                 * Terminate scan.
-                 */
-                result = TCL_OK;
-                goto scanExit;
+                skipMatches = TRUE;
+            } else if (result != TCL_OK) {
+                return result;
             }
         }
 
-      matchLineExit:
+        result = ScanUnmatchedLine (interp, scanData, matchedAtLeastOne);
+        if (result != TCL_OK)
+            return result;
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * ScanFileParallel --
+ *
+ *   Scan a file given a scancontext, matching lines on a pool of worker
+ * threads.  Match commands are executed in this thread, either in file order
+ * or, if unordered is set, in the order batches finish matching.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ScanFileParallel (Tcl_Interp    *interp,
+                  scanContext_t *contextPtr,
+                  Tcl_Channel    channel,
+                  int            numThreads,
+                  int            unordered)
+{
+    parallelScan_t scan;
+    scanData_t data;
+    Tcl_ThreadId *threadIds;
+    matchDef_t *matchPtr, **matchDefs;
+    scanBatch_t *freeList = NULL, *batchPtr, *prevPtr;
+    scanBatch_t *inFlightHead = NULL, *inFlightTail = NULL;
+    Tcl_DString lineBuf;
+    int idx, numInFlight, atEof, result, readResult, threadResult;
+    long lineNum, bytesRead;
+
+    if (contextPtr->matchListHead == NULL) {
+        TclX_AppendObjResult (interp, "no patterns in current scan context",
+                              (char *) NULL);
+        return TCL_ERROR;
+    }
+
+    memset (&scan, 0, sizeof (scan));
+    for (matchPtr = contextPtr->matchListHead; matchPtr != NULL;
+         matchPtr = matchPtr->nextMatchDefPtr) {
+        scan.numPatterns++;
+    }
+    matchDefs = (matchDef_t **)
+        ckalloc (scan.numPatterns * sizeof (matchDef_t *));
+    scan.patterns = (char **) ckalloc (scan.numPatterns * sizeof (char *));
+    scan.patternFlags = (int *) ckalloc (scan.numPatterns * sizeof (int));
+    for (idx = 0, matchPtr = contextPtr->matchListHead; matchPtr != NULL;
+         idx++, matchPtr = matchPtr->nextMatchDefPtr) {
+        matchDefs [idx] = matchPtr;
+        scan.patterns [idx] =
+            ckstrdup (Tcl_GetStringFromObj (matchPtr->regExpObj, NULL));
+        scan.patternFlags [idx] = matchPtr->regExpFlags;
+    }
+
+    threadIds = (Tcl_ThreadId *) ckalloc (numThreads * sizeof (Tcl_ThreadId));
+    for (idx = 0; idx < numThreads; idx++) {
+        if (Tcl_CreateThread (&threadIds [idx], ScanWorkerThread,
+                              (ClientData) &scan, TCL_THREAD_STACK_DEFAULT,
+                              TCL_THREAD_JOINABLE) != TCL_OK) {
+            break;
+        }
+    }
+    numThreads = idx;
+
+    data.storedLine = FALSE;
+    data.contextPtr = contextPtr;
+    data.channel = channel;
+    data.evalFlags = 0;
+    Tcl_DStringInit (&data.uniLineBuf);
+    Tcl_DStringInit (&lineBuf);
+
+    if (numThreads == 0) {
+        TclX_AppendObjResult (interp, "can't create scan worker thread",
+                              (char *) NULL);
+        result = TCL_ERROR;
+        goto scanExit;
+    }
+
+    numInFlight = 0;
+    atEof = FALSE;
+    lineNum = 1;
+    bytesRead = 0;
+    result = TCL_OK;
+    while (TRUE) {
         /*
-         * Process default action if required.
+         * Keep enough batches queued that the workers never idle while the
+         * match commands run.
          */
-        if ((contextPtr->defaultAction != NULL) && (!matchedAtLeastOne)) {
-            data.matchPtr = NULL;
-            result = SetMatchInfoVar(interp,
-                                     &data);
-            if (result != TCL_OK)
-                goto scanExit;
-
-            result = Tcl_EvalObj (interp, contextPtr->defaultAction);
-            if (result == TCL_ERROR) {
-                Tcl_AddObjErrorInfo (interp, 
-                    "\n    while executing a match default command", -1);
-                goto scanExit;
+        while (!atEof && (numInFlight < 2 * numThreads)) {
+            if (!contextPtr->fileOpen) {
+                atEof = TRUE;  /* Closed by a callback */
+                break;
             }
-            if ((result == TCL_BREAK) || (result == TCL_RETURN)) {
-                /*
-                 * Terminate scan.
-                 */
-                result = TCL_OK;
+            batchPtr = AllocBatch (&freeList);
+            readResult = ReadBatch (interp, channel, batchPtr, &lineBuf);
+            if (readResult == TCL_ERROR) {
+                batchPtr->nextPtr = freeList;
+                freeList = batchPtr;
+                result = TCL_ERROR;
                 goto scanExit;
             }
+            if (readResult == TCL_BREAK)
+                atEof = TRUE;
+            if (batchPtr->numLines == 0) {
+                batchPtr->nextPtr = freeList;
+                freeList = batchPtr;
+                break;
+            }
+            batchPtr->firstLineNum = lineNum;
+            batchPtr->bytesRead = bytesRead;
+            lineNum += batchPtr->numLines;
+            bytesRead += Tcl_DStringLength (&batchPtr->text);
+
+            if (inFlightTail == NULL)
+                inFlightHead = batchPtr;
+            else
+                inFlightTail->nextInFlightPtr = batchPtr;
+            inFlightTail = batchPtr;
+            numInFlight++;
+
+            Tcl_MutexLock (&scan.mutex);
+            if (scan.queueTail == NULL)
+                scan.queueHead = batchPtr;
+            else
+                scan.queueTail->nextPtr = batchPtr;
+            scan.queueTail = batchPtr;
+            Tcl_ConditionNotify (&scan.workCond);
+            Tcl_MutexUnlock (&scan.mutex);
         }
+        if (numInFlight == 0)
+            break;
 
-	if ((contextPtr->copyFileChannel != NULL) && (!matchedAtLeastOne)) {
-	    if ((Tcl_Write (contextPtr->copyFileChannel, Tcl_DStringValue(&lineBuf),
-                            Tcl_DStringLength(&lineBuf)) < 0) ||
-                (TclX_WriteNL (contextPtr->copyFileChannel) < 0)) {
-                Tcl_SetStringObj (Tcl_GetObjResult (interp),
-                                  Tcl_PosixError (interp), -1);
-		return TCL_ERROR;
-	    }
-	}
+        /*
+         * Wait for the next batch to deliver: the oldest one, or when
+         * unordered, the first one found done.
+         */
+        Tcl_MutexLock (&scan.mutex);
+        while (TRUE) {
+            prevPtr = NULL;
+            for (batchPtr = inFlightHead; batchPtr != NULL;
+                 batchPtr = batchPtr->nextInFlightPtr) {
+                if (batchPtr->done || !unordered)
+                    break;
+                prevPtr = batchPtr;
+            }
+            if ((batchPtr != NULL) && batchPtr->done)
+                break;
+            Tcl_ConditionWait (&scan.doneCond, &scan.mutex, NULL);
+        }
+        Tcl_MutexUnlock (&scan.mutex);
+
+        if (prevPtr == NULL)
+            inFlightHead = batchPtr->nextInFlightPtr;
+        else
+            prevPtr->nextInFlightPtr = batchPtr->nextInFlightPtr;
+        if (inFlightTail == batchPtr)
+            inFlightTail = prevPtr;
+        numInFlight--;
+
+        result = DeliverBatch (interp, &data, matchDefs, batchPtr);
+        batchPtr->nextPtr = freeList;
+        freeList = batchPtr;
+        if (result != TCL_OK)
+            goto scanExit;
     }
 
   scanExit:
+    /*
+     * Discard queued work and stop the workers.  Batches being matched still
+     * belong to the workers until they have been joined.
+     */
+    Tcl_MutexLock (&scan.mutex);
+    scan.queueHead = NULL;
+    scan.queueTail = NULL;
+    scan.shutdown = TRUE;
+    Tcl_ConditionNotify (&scan.workCond);
+    Tcl_MutexUnlock (&scan.mutex);
+    for (idx = 0; idx < numThreads; idx++) {
+        Tcl_JoinThread (threadIds [idx], &threadResult);
+    }
+
+    while (inFlightHead != NULL) {
+        batchPtr = inFlightHead;
+        inFlightHead = batchPtr->nextInFlightPtr;
+        batchPtr->nextPtr = freeList;
+        freeList = batchPtr;
+    }
+    FreeBatches (freeList);
+
+    Tcl_ConditionFinalize (&scan.workCond);
+    Tcl_ConditionFinalize (&scan.doneCond);
+    Tcl_MutexFinalize (&scan.mutex);
+    for (idx = 0; idx < scan.numPatterns; idx++) {
+        ckfree (scan.patterns [idx]);
+    }
+    ckfree ((char *) scan.patterns);
+    ckfree ((char *) scan.patternFlags);
+    ckfree ((char *) matchDefs);
+    ckfree ((char *) threadIds);
     Tcl_DStringFree (&lineBuf);
-    Tcl_DStringFree (&uniLineBuf);
+    Tcl_DStringFree (&data.uniLineBuf);
+
     if (result == TCL_ERROR)
         return TCL_ERROR;
     return TCL_OK;
 }
-
+#endif
+
 /*-----------------------------------------------------------------------------
  * ScanFileCloseHandler --
  *   Close handler for the file being scanned.  Marks it as not open.
@@ -769,7 +2122,8 @@ ScanFileCloseHandler (ClientData clientData)
  * TclX_ScanfileObjCmd --
  *
  *   Implements the TCL command:
- *        scanfile ?-copyfile copyhandle? contexthandle filehandle
+ *        scanfile ?-copyfile copyhandle? ?-parallel numthreads? ?-unordered?
+ *                 contexthandle filehandle
  *-----------------------------------------------------------------------------
  */
 static int
@@ -781,22 +2135,43 @@ TclX_ScanfileObjCmd (ClientData clientData,
     scanContext_t *contextPtr, **tableEntryPtr;
     Tcl_Obj       *contextHandleObj, *fileHandleObj, *copyFileHandleObj;
     Tcl_Channel    channel;
-    int            status;
-
-    if ((objc != 3) && (objc != 5))
-        goto argError;
-
-    if (objc == 3) {
-	contextHandleObj = objv [1];
-	fileHandleObj = objv [2];
-	copyFileHandleObj = NULL;
-    } else {
-	if (!STREQU (Tcl_GetStringFromObj (objv[1], NULL), "-copyfile"))
+    int            status, argIdx, numThreads, unordered;
+    char          *option;
+
+    copyFileHandleObj = NULL;
+    numThreads = 0;
+    unordered = FALSE;
+
+    for (argIdx = 1; argIdx < objc - 2; argIdx++) {
+        option = Tcl_GetStringFromObj (objv [argIdx], NULL);
+        if (STREQU (option, "-copyfile")) {
+            if (argIdx + 1 >= objc - 2)
+                goto argError;
+            copyFileHandleObj = objv [++argIdx];
+        } else if (STREQU (option, "-parallel")) {
+            if (argIdx + 1 >= objc - 2)
+                goto argError;
+            if (Tcl_GetIntFromObj (interp, objv [++argIdx],
+                                   &numThreads) != TCL_OK)
+                return TCL_ERROR;
+            if (numThreads < 1) {
+                TclX_AppendObjResult (interp, "number of threads must be ",
+                                      "greater than zero, got \"",
+                                      Tcl_GetStringFromObj (objv [argIdx],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else if (STREQU (option, "-unordered")) {
+            unordered = TRUE;
+        } else {
             goto argError;
-	copyFileHandleObj = objv [2];
-	contextHandleObj = objv [3];
-	fileHandleObj = objv [4];
+        }
     }
+    if (objc - argIdx != 2)
+        goto argError;
+    contextHandleObj = objv [argIdx];
+    fileHandleObj = objv [argIdx + 1];
 
     tableEntryPtr = (scanContext_t **)
         TclX_HandleXlateObj (interp,
@@ -824,6 +2199,13 @@ TclX_ScanfileObjCmd (ClientData clientData,
     Tcl_CreateCloseHandler (channel,
                             ScanFileCloseHandler,
                             (ClientData) contextPtr);
+    Tcl_Preserve ((ClientData) contextPtr);
+#ifdef TCL_THREADS
+    if (numThreads > 0) {
+        status = ScanFileParallel (interp, contextPtr, channel, numThreads,
+                                   unordered);
+    } else
+#endif
     status = ScanFile(interp, contextPtr, channel);
     if (contextPtr->fileOpen == TRUE) {
 	Tcl_DeleteCloseHandler(channel, ScanFileCloseHandler,
@@ -836,13 +2218,15 @@ TclX_ScanfileObjCmd (ClientData clientData,
     if (copyFileHandleObj != NULL) {
         ClearCopyFile (contextPtr);
     }
+    Tcl_Release ((ClientData) contextPtr);
     return status;
 
   argError:
     return TclX_WrongArgs (interp, objv [0],
-		           "?-copyfile filehandle? contexthandle filehandle");
+		           "?-copyfile filehandle? ?-parallel numthreads? "
+                           "?-unordered? contexthandle filehandle");
 }
-
+
 /*-----------------------------------------------------------------------------
  * FileScanCleanUp --
  *
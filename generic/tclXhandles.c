@@ -39,25 +39,46 @@ static int entryHeaderSize = 0;
     ((((size) + entryAlignment - 1) / entryAlignment) * entryAlignment)
 
 /*
- * This is the table header.  It is separately allocated from the table body,
- * since it must keep track of a table body that might move.  Each entry in the
- * table is preceded with a header which has the free list link, which is a
- * entry index of the next free entry.  Special values keep track of allocated
- * entries.
+ * This is the table header.  The table body is allocated in chunks of a fixed
+ * number of entries, which is a power of two, so that entries never move as
+ * the table grows.  The header keeps an array of pointers to the chunks, which
+ * is all that is reallocated on growth.  Each entry in the table is preceded
+ * with a header which has the free list link, which is a entry index of the
+ * next free entry.  Special values keep track of allocated entries.
+ *
+ * Shared tables may be used from multiple threads.  Allocation, freeing and
+ * walking are serialized with a mutex in the table header.  Translating a
+ * handle takes no lock: chunks never move, and chunk arrays replaced on
+ * growth are kept until the table is released, so a reader never follows a
+ * freed pointer.  The table size is published after the chunk array, with a
+ * memory barrier in between.
  */
 
 #define NULL_IDX      -1
 #define ALLOCATED_IDX -2
 
+/*
+ * Minimum number of entries in a chunk.
+ */
+#define MIN_CHUNK_ENTRIES 32
+
 typedef unsigned char ubyte_t;
 typedef ubyte_t *ubyte_pt;
 
 typedef struct {
     int      useCount;          /* Keeps track of the number sharing       */
+    unsigned generation;        /* Unique id of this table, see below      */
     int      entrySize;         /* Entry size in bytes, including header   */
     int      tableSize;         /* Current number of entries in the table  */
     int      freeHeadIdx;       /* Index of first free entry in the table  */
-    ubyte_pt bodyPtr;           /* Pointer to table body                   */
+    int      chunkShift;        /* Log2 of the number of entries in chunk  */
+    int      numChunks;         /* Number of chunks allocated              */
+    int      chunksSize;        /* Number of slots in chunks array         */
+    ubyte_pt *chunks;           /* Pointers to table body chunks           */
+    int      shared;            /* Table may be used by multiple threads   */
+    Tcl_Mutex mutex;            /* Serializes changes to shared tables     */
+    int      numRetired;        /* Number of replaced chunk arrays         */
+    ubyte_pt **retired;         /* Chunk arrays kept for shared tables     */
     int      baseLength;        /* Length of handleBase.                   */
     char     handleBase [1];    /* Base handle name.  MUST BE LAST FIELD!  */
     } tblHeader_t;
@@ -65,14 +86,71 @@ typedef tblHeader_t *tblHeader_pt;
 
 typedef struct {
     int freeLink;
+    int entryIdx;               /* Index of this entry, for freeing */
   } entryHeader_t;
 typedef entryHeader_t *entryHeader_pt;
 
 /*
- * This macro is used to return a pointer to an entry, given its index.
+ * Handle objects cache the decoded entry index along with the generation of
+ * the table it was decoded for, so translating the same object again is just
+ * a comparison.  Generations are never reused, so an object decoded for a
+ * table that has been released can't match a new table at the same address.
+ */
+static unsigned tableGeneration = 0;
+TCL_DECLARE_MUTEX(generationMutex)
+
+static Tcl_ObjType handleObjType = {
+    "tclx.handle",              /* name */
+    NULL,                       /* freeIntRepProc, nothing allocated */
+    NULL,                       /* dupIntRepProc, copy the internal rep */
+    NULL,                       /* updateStringProc, string always valid */
+    NULL                        /* setFromAnyProc */
+};
+
+#define HANDLE_OBJ_GENERATION(objPtr) \
+    ((unsigned) (size_t) (objPtr)->internalRep.twoPtrValue.ptr1)
+#define HANDLE_OBJ_INDEX(objPtr) \
+    ((int) (size_t) (objPtr)->internalRep.twoPtrValue.ptr2)
+
+/*
+ * This macro is used to return a pointer to an entry, given its index, which
+ * must be less than the table size.
  */
 #define TBL_INDEX(hdrPtr, idx) \
-    ((entryHeader_pt) (hdrPtr->bodyPtr + (hdrPtr->entrySize * idx)))
+    ((entryHeader_pt) ((hdrPtr)->chunks [(idx) >> (hdrPtr)->chunkShift] + \
+                       ((hdrPtr)->entrySize * \
+                        ((idx) & ((1 << (hdrPtr)->chunkShift) - 1)))))
+
+/*
+ * Macros to lock a shared table and to order the publication of new entries
+ * with lock-free readers.
+ */
+#define TBL_LOCK(hdrPtr) \
+    if ((hdrPtr)->shared) Tcl_MutexLock (&(hdrPtr)->mutex)
+#define TBL_UNLOCK(hdrPtr) \
+    if ((hdrPtr)->shared) Tcl_MutexUnlock (&(hdrPtr)->mutex)
+
+/*
+ * A full fence is used where the compiler provides one.  Where it doesn't,
+ * TBL_LOCKED_LOOKUP is defined and readers of shared tables take the lock.
+ */
+#if !defined(TCL_THREADS)
+#   define TBL_MEMORY_BARRIER(hdrPtr)
+#elif defined(__GNUC__)
+#   define TBL_MEMORY_BARRIER(hdrPtr) \
+    if ((hdrPtr)->shared) __sync_synchronize ()
+#elif defined(_MSC_VER)
+#   define TBL_MEMORY_BARRIER(hdrPtr) \
+    if ((hdrPtr)->shared) MemoryBarrier ()
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && \
+      !defined(__STDC_NO_ATOMICS__)
+#   include <stdatomic.h>
+#   define TBL_MEMORY_BARRIER(hdrPtr) \
+    if ((hdrPtr)->shared) atomic_thread_fence (memory_order_seq_cst)
+#else
+#   define TBL_LOCKED_LOOKUP
+#   define TBL_MEMORY_BARRIER(hdrPtr)
+#endif
 
 /*
  * This macros to convert between pointers to the user and header area of
@@ -99,6 +177,16 @@ static entryHeader_pt
 AllocEntry (tblHeader_pt  tblHdrPtr,
             int          *entryIdxPtr);
 
+static entryHeader_pt
+LookupEntry (tblHeader_pt tblHdrPtr,
+             int          entryIdx);
+
+static void_pt
+HandleTblInit (const char *handleBase,
+               int         entrySize,
+               int         initEntries,
+               int         shared);
+
 static int
 HandleDecodeObj (Tcl_Interp   *interp,
                  tblHeader_pt  tblHdrPtr,
@@ -133,44 +221,70 @@ LinkInNewEntries (tblHeader_pt tblHdrPtr,
     for (entIdx = newIdx; entIdx < lastIdx; entIdx++) {
         entryHdrPtr = TBL_INDEX (tblHdrPtr, entIdx);
         entryHdrPtr->freeLink = entIdx + 1;
+        entryHdrPtr->entryIdx = entIdx;
     }
     entryHdrPtr = TBL_INDEX (tblHdrPtr, lastIdx);
     entryHdrPtr->freeLink = tblHdrPtr->freeHeadIdx;
+    entryHdrPtr->entryIdx = lastIdx;
     tblHdrPtr->freeHeadIdx = newIdx;
 
 }
 
 /*=============================================================================
  * ExpandTable --
- *   Expand a handle table, doubling its size.
+ *   Expand a handle table by adding chunks.  Existing entries don't move.
  * Parameters:
  *   o tblHdrPtr (I) - A pointer to the table header.
  *   o neededIdx (I) - If positive, then the table will be expanded so that
- *     this entry is available.  If -1, then just expand by the number of 
- *     entries specified on table creation.  MUST be smaller than this size.
+ *     this entry is available.  If -1, then just expand by one chunk.
  *-----------------------------------------------------------------------------
  */
 static void
 ExpandTable (tblHeader_pt tblHdrPtr,
              int          neededIdx)
 {
-    ubyte_pt oldbodyPtr = tblHdrPtr->bodyPtr;
-    int      numNewEntries;
-    int      newSize;
+    int chunkEntries = 1 << tblHdrPtr->chunkShift;
+    int numNewChunks;
     
     if (neededIdx < 0)
-        numNewEntries = tblHdrPtr->tableSize;
+        numNewChunks = 1;
     else
-        numNewEntries = (neededIdx - tblHdrPtr->tableSize) + 1;
-    newSize = (tblHdrPtr->tableSize + numNewEntries) * tblHdrPtr->entrySize;
-
-    tblHdrPtr->bodyPtr = (ubyte_pt) ckalloc (newSize);
-    memcpy (tblHdrPtr->bodyPtr, oldbodyPtr, 
-            (tblHdrPtr->tableSize * tblHdrPtr->entrySize));
-    LinkInNewEntries (tblHdrPtr, tblHdrPtr->tableSize, numNewEntries);
-    tblHdrPtr->tableSize += numNewEntries;
-    ckfree ((char *) oldbodyPtr);
-    
+        numNewChunks = (neededIdx >> tblHdrPtr->chunkShift) + 1 -
+            tblHdrPtr->numChunks;
+
+    while (numNewChunks-- > 0) {
+        /*
+         * Only the array of chunk pointers is reallocated, doubling it.  For
+         * shared tables, the old array may still be in use by a reader, so
+         * it is kept until the table is released.
+         */
+        if (tblHdrPtr->numChunks == tblHdrPtr->chunksSize) {
+            if (tblHdrPtr->shared) {
+                ubyte_pt *newChunks = (ubyte_pt *)
+                    ckalloc (2 * tblHdrPtr->chunksSize * sizeof (ubyte_pt));
+
+                memcpy (newChunks, tblHdrPtr->chunks,
+                        tblHdrPtr->chunksSize * sizeof (ubyte_pt));
+                tblHdrPtr->retired = (ubyte_pt **)
+                    ckrealloc ((char *) tblHdrPtr->retired,
+                               (tblHdrPtr->numRetired + 1) *
+                               sizeof (ubyte_pt *));
+                tblHdrPtr->retired [tblHdrPtr->numRetired++] =
+                    tblHdrPtr->chunks;
+                tblHdrPtr->chunks = newChunks;
+            } else {
+                tblHdrPtr->chunks = (ubyte_pt *)
+                    ckrealloc ((char *) tblHdrPtr->chunks,
+                               2 * tblHdrPtr->chunksSize * sizeof (ubyte_pt));
+            }
+            tblHdrPtr->chunksSize *= 2;
+        }
+        tblHdrPtr->chunks [tblHdrPtr->numChunks++] =
+            (ubyte_pt) ckalloc (chunkEntries * tblHdrPtr->entrySize);
+        LinkInNewEntries (tblHdrPtr, tblHdrPtr->tableSize, chunkEntries);
+        TBL_MEMORY_BARRIER (tblHdrPtr);
+        tblHdrPtr->tableSize += chunkEntries;
+    }
 }
 
 /*=============================================================================
@@ -203,6 +317,38 @@ AllocEntry (tblHeader_pt  tblHdrPtr,
     return entryHdrPtr;
     
 }
+
+/*=============================================================================
+ * LookupEntry --
+ *   Find an allocated entry given its index.  Shared tables are only locked
+ *   where TBL_MEMORY_BARRIER has no fence to offer.
+ * Parameters:
+ *   o tblHdrPtr (I) - A pointer to the table header.
+ *   o entryIdx (I) - The index of the entry, which isn't range checked yet.
+ * Returns:
+ *    A pointer to the entry, or NULL if the entry isn't allocated.
+ *-----------------------------------------------------------------------------
+ */
+static entryHeader_pt
+LookupEntry (tblHeader_pt tblHdrPtr,
+             int          entryIdx)
+{
+    entryHeader_pt entryHdrPtr = NULL;
+
+#ifdef TBL_LOCKED_LOOKUP
+    TBL_LOCK (tblHdrPtr);
+#endif
+    if (entryIdx < tblHdrPtr->tableSize) {
+        TBL_MEMORY_BARRIER (tblHdrPtr);
+        entryHdrPtr = TBL_INDEX (tblHdrPtr, entryIdx);
+        if (entryHdrPtr->freeLink != ALLOCATED_IDX)
+            entryHdrPtr = NULL;
+    }
+#ifdef TBL_LOCKED_LOOKUP
+    TBL_UNLOCK (tblHdrPtr);
+#endif
+    return entryHdrPtr;
+}
 
 /*=============================================================================
  * HandleDecode --
@@ -271,7 +417,7 @@ HandleDecodeObj (Tcl_Interp   *interp,
 }
 
 /*=============================================================================
- * TclX_HandleTblInit --
+ * HandleTblInit --
  *   Create and initialize a Tcl dynamic handle table.  The use count on the
  *   table is set to one.
  * Parameters:
@@ -279,12 +425,16 @@ HandleDecodeObj (Tcl_Interp   *interp,
  *     in the form "baseNN", where NN is the table entry number.
  *   o entrySize (I) - The size of an entry, in bytes.
  *   o initEntries (I) - Initial size of the table, in entries.
+ *   o shared (I) - TRUE if the table may be used by multiple threads.
  * Returns:
  *   A pointer to the table header.  
  *-----------------------------------------------------------------------------
  */
-void_pt
-TclX_HandleTblInit (const char *handleBase, int entrySize, int initEntries)
+static void_pt
+HandleTblInit (const char *handleBase,
+               int         entrySize,
+               int         initEntries,
+               int         shared)
 {
     tblHeader_pt tblHdrPtr;
     int          baseLength = strlen ((char *) handleBase);
@@ -310,6 +460,13 @@ TclX_HandleTblInit (const char *handleBase, int entrySize, int initEntries)
     tblHdrPtr = (tblHeader_pt) ckalloc (sizeof (tblHeader_t) + baseLength + 1);
 
     tblHdrPtr->useCount = 1;
+    tblHdrPtr->shared = shared;
+    tblHdrPtr->mutex = NULL;
+    tblHdrPtr->numRetired = 0;
+    tblHdrPtr->retired = NULL;
+    Tcl_MutexLock (&generationMutex);
+    tblHdrPtr->generation = ++tableGeneration;
+    Tcl_MutexUnlock (&generationMutex);
     tblHdrPtr->baseLength = baseLength;
     strcpy (tblHdrPtr->handleBase, (char *) handleBase);
 
@@ -318,14 +475,68 @@ TclX_HandleTblInit (const char *handleBase, int entrySize, int initEntries)
      */
     tblHdrPtr->entrySize = entryHeaderSize + ROUND_ENTRY_SIZE (entrySize);
     tblHdrPtr->freeHeadIdx = NULL_IDX;
-    tblHdrPtr->tableSize = initEntries;
-    tblHdrPtr->bodyPtr =
-        (ubyte_pt) ckalloc (initEntries * tblHdrPtr->entrySize);
-    LinkInNewEntries (tblHdrPtr, 0, initEntries);
+    tblHdrPtr->tableSize = 0;
+
+    /*
+     * Chunks hold the initial number of entries, rounded up to a power of
+     * two.  The first one is allocated now.
+     */
+    tblHdrPtr->chunkShift = 0;
+    while ((1 << tblHdrPtr->chunkShift) < initEntries ||
+           (1 << tblHdrPtr->chunkShift) < MIN_CHUNK_ENTRIES)
+        tblHdrPtr->chunkShift++;
+    tblHdrPtr->numChunks = 0;
+    tblHdrPtr->chunksSize = 4;
+    tblHdrPtr->chunks =
+        (ubyte_pt *) ckalloc (tblHdrPtr->chunksSize * sizeof (ubyte_pt));
+    ExpandTable (tblHdrPtr, -1);
 
     return (void_pt) tblHdrPtr;
 
 }
+
+/*=============================================================================
+ * TclX_HandleTblInit --
+ *   Create and initialize a Tcl dynamic handle table.  The use count on the
+ *   table is set to one.  The table must only be used by one thread at a
+ *   time.
+ * Parameters:
+ *   o handleBase(I) - The base name of the handle, the handle will be returned
+ *     in the form "baseNN", where NN is the table entry number.
+ *   o entrySize (I) - The size of an entry, in bytes.
+ *   o initEntries (I) - Initial size of the table, in entries.
+ * Returns:
+ *   A pointer to the table header.  
+ *-----------------------------------------------------------------------------
+ */
+void_pt
+TclX_HandleTblInit (const char *handleBase, int entrySize, int initEntries)
+{
+    return HandleTblInit (handleBase, entrySize, initEntries, FALSE);
+}
+
+/*=============================================================================
+ * TclX_HandleTblInitShared --
+ *   Create and initialize a Tcl dynamic handle table that may be used by
+ *   multiple threads at once.  Entries may be allocated and freed, and handles
+ *   translated, concurrently.  Two threads must not free the same entry, and
+ *   an entry's contents are not protected.
+ * Parameters:
+ *   o handleBase(I) - The base name of the handle, the handle will be returned
+ *     in the form "baseNN", where NN is the table entry number.
+ *   o entrySize (I) - The size of an entry, in bytes.
+ *   o initEntries (I) - Initial size of the table, in entries.
+ * Returns:
+ *   A pointer to the table header.  
+ *-----------------------------------------------------------------------------
+ */
+void_pt
+TclX_HandleTblInitShared (const char *handleBase,
+                          int         entrySize,
+                          int         initEntries)
+{
+    return HandleTblInit (handleBase, entrySize, initEntries, TRUE);
+}
 
 /*=============================================================================
  * TclX_HandleTblUseCount --
@@ -342,9 +553,13 @@ int
 TclX_HandleTblUseCount (void_pt headerPtr, int amount)
 {
     tblHeader_pt   tblHdrPtr = (tblHeader_pt)headerPtr;
+    int            useCount;
         
+    TBL_LOCK (tblHdrPtr);
     tblHdrPtr->useCount += amount;
-    return tblHdrPtr->useCount;
+    useCount = tblHdrPtr->useCount;
+    TBL_UNLOCK (tblHdrPtr);
+    return useCount;
 }
 
 /*=============================================================================
@@ -360,10 +575,22 @@ void
 TclX_HandleTblRelease (void_pt headerPtr)
 {
     tblHeader_pt  tblHdrPtr = (tblHeader_pt) headerPtr;
-
-    tblHdrPtr->useCount--;
-    if (tblHdrPtr->useCount <= 0) {
-        ckfree ((char *) tblHdrPtr->bodyPtr);
+    int           idx, useCount;
+
+    TBL_LOCK (tblHdrPtr);
+    useCount = --tblHdrPtr->useCount;
+    TBL_UNLOCK (tblHdrPtr);
+
+    if (useCount <= 0) {
+        for (idx = 0; idx < tblHdrPtr->numChunks; idx++)
+            ckfree ((char *) tblHdrPtr->chunks [idx]);
+        ckfree ((char *) tblHdrPtr->chunks);
+        for (idx = 0; idx < tblHdrPtr->numRetired; idx++)
+            ckfree ((char *) tblHdrPtr->retired [idx]);
+        if (tblHdrPtr->retired != NULL)
+            ckfree ((char *) tblHdrPtr->retired);
+        if (tblHdrPtr->shared)
+            Tcl_MutexFinalize (&tblHdrPtr->mutex);
         ckfree ((char *) tblHdrPtr);
     }
 }
@@ -387,7 +614,9 @@ TclX_HandleAlloc (void_pt headerPtr, char *handlePtr)
     entryHeader_pt entryHdrPtr;
     int            entryIdx;
 
-    entryHdrPtr = AllocEntry ((tblHeader_pt) headerPtr, &entryIdx);
+    TBL_LOCK (tblHdrPtr);
+    entryHdrPtr = AllocEntry (tblHdrPtr, &entryIdx);
+    TBL_UNLOCK (tblHdrPtr);
     sprintf (handlePtr, "%s%d", tblHdrPtr->handleBase, entryIdx);
      
     return USER_AREA (entryHdrPtr);
@@ -415,10 +644,8 @@ TclX_HandleXlate (Tcl_Interp *interp, void_pt headerPtr, const char *handle)
     
     if ((entryIdx = HandleDecode (interp, tblHdrPtr, handle)) < 0)
         return NULL;
-    entryHdrPtr = TBL_INDEX (tblHdrPtr, entryIdx);
 
-    if ((entryIdx >= tblHdrPtr->tableSize) ||
-            (entryHdrPtr->freeLink != ALLOCATED_IDX)) {
+    if ((entryHdrPtr = LookupEntry (tblHdrPtr, entryIdx)) == NULL) {
         TclX_AppendObjResult (interp, tblHdrPtr->handleBase, " is not open",
                               (char *) NULL);
         return NULL;
@@ -438,6 +665,9 @@ TclX_HandleXlate (Tcl_Interp *interp, void_pt headerPtr, const char *handle)
  *   o handleObj (I) - The object containing the handle assigned to the entry.
  * Returns:
  *   A pointer to the entry, or NULL if an error occured.
+ * Notes:
+ *   The decoded index is cached in the object, so the handle string is
+ * only parsed the first time the object is used with a table.
  *-----------------------------------------------------------------------------
  */
 void_pt
@@ -448,14 +678,25 @@ TclX_HandleXlateObj (Tcl_Interp *interp, void_pt headerPtr, Tcl_Obj *handleObj)
     int            entryIdx;
     char          *handle;
 
-    handle = Tcl_GetStringFromObj (handleObj, NULL);
+    if ((handleObj->typePtr == &handleObjType) &&
+        (HANDLE_OBJ_GENERATION (handleObj) == tblHdrPtr->generation)) {
+        entryIdx = HANDLE_OBJ_INDEX (handleObj);
+    } else {
+        handle = Tcl_GetStringFromObj (handleObj, NULL);
     
-    if ((entryIdx = HandleDecodeObj (interp, tblHdrPtr, handle)) < 0)
-        return NULL;
-    entryHdrPtr = TBL_INDEX (tblHdrPtr, entryIdx);
+        if ((entryIdx = HandleDecodeObj (interp, tblHdrPtr, handle)) < 0)
+            return NULL;
+
+        if ((handleObj->typePtr != NULL) &&
+            (handleObj->typePtr->freeIntRepProc != NULL))
+            handleObj->typePtr->freeIntRepProc (handleObj);
+        handleObj->internalRep.twoPtrValue.ptr1 =
+            (void *) (size_t) tblHdrPtr->generation;
+        handleObj->internalRep.twoPtrValue.ptr2 = (void *) (size_t) entryIdx;
+        handleObj->typePtr = &handleObjType;
+    }
 
-    if ((entryIdx >= tblHdrPtr->tableSize) ||
-            (entryHdrPtr->freeLink != ALLOCATED_IDX)) {
+    if ((entryHdrPtr = LookupEntry (tblHdrPtr, entryIdx)) == NULL) {
         TclX_AppendObjResult (interp, tblHdrPtr->handleBase, 
                               " is not open", (char *) NULL);
         return NULL;
@@ -484,21 +725,25 @@ TclX_HandleWalk (void_pt headerPtr, int *walkKeyPtr)
     tblHeader_pt   tblHdrPtr = (tblHeader_pt)headerPtr;
     int            entryIdx;
     entryHeader_pt entryHdrPtr;
+    void_pt        entryPtr = NULL;
 
     if (*walkKeyPtr == -1)
         entryIdx = 0;
     else
         entryIdx = *walkKeyPtr + 1;
         
+    TBL_LOCK (tblHdrPtr);
     while (entryIdx < tblHdrPtr->tableSize) {
         entryHdrPtr = TBL_INDEX (tblHdrPtr, entryIdx);
         if (entryHdrPtr->freeLink == ALLOCATED_IDX) {
             *walkKeyPtr = entryIdx;
-            return USER_AREA (entryHdrPtr);
+            entryPtr = USER_AREA (entryHdrPtr);
+            break;
         }
         entryIdx++;
     }
-    return NULL;
+    TBL_UNLOCK (tblHdrPtr);
+    return entryPtr;
 
 }
 
@@ -538,12 +783,13 @@ TclX_HandleFree (void_pt headerPtr, void_pt entryPtr)
     entryHeader_pt entryHdrPtr;
 
     entryHdrPtr = HEADER_AREA (entryPtr);
+    TBL_LOCK (tblHdrPtr);
     if (entryHdrPtr->freeLink != ALLOCATED_IDX)
         Tcl_Panic ("Tcl_HandleFree: entry not allocated %p\n", entryHdrPtr);
 
     entryHdrPtr->freeLink = tblHdrPtr->freeHeadIdx;
-    tblHdrPtr->freeHeadIdx =
-        (((ubyte_pt) entryHdrPtr) - tblHdrPtr->bodyPtr) / tblHdrPtr->entrySize;
+    tblHdrPtr->freeHeadIdx = entryHdrPtr->entryIdx;
+    TBL_UNLOCK (tblHdrPtr);
     
 }
 
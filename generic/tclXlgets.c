@@ -27,14 +27,69 @@
 #include "tclExtdInt.h"
 
 /*
- * State for current list being read.
+ * State for current list being read.  Lines are read into an object that
+ * is kept for the whole list, so a list spanning lines is parsed in place.
+ * If channel is NULL, lines are taken from text in memory instead.
  */
 typedef struct {
     Tcl_Channel channel;   /* Channel to read from */
-    Tcl_DString buffer;    /* Buffer for line being read */
+    Tcl_Obj *lineObj;      /* Buffer for line being read */
     int lineIdx;           /* Index of next line to read. */
+    char *memPtr;          /* Next line in memory. */
+    char *memEnd;          /* End of the text in memory. */
+    int memEof;            /* The text ends at the end of the file. */
 } ReadData;
 
+/*
+ * Table of bytes that end a run of ordinary characters in a list element.
+ * The parser skips runs of other bytes without looking at them further.
+ */
+#define LGETS_SPECIAL(c) (specialChars [UCHAR (c)])
+
+static char specialChars [256];
+static int specialCharsInit = FALSE;
+
+/*
+ * Number of elements collected on the stack before allocating.
+ */
+#define LGETS_STATIC_ELEMS 32
+
+#ifdef TCL_THREADS
+/*
+ * Parallel batch reading.  The interpreter thread reads a block of text
+ * from the channel, which is split into a chunk per thread at newlines and
+ * parsed by worker threads.  A list may span lines, so a chunk can start in
+ * the middle of one; each chunk is parsed speculatively from its start.
+ * The chunks are then taken in order, and one that doesn't start where the
+ * lists of the previous one ended is parsed again by the interpreter
+ * thread.  Text left after the last list used is pushed back into the
+ * channel.
+ */
+#define LGETS_CHUNK_CHARS (256 * 1024)
+
+/*
+ * With -count, the first block read is this size and later ones are sized
+ * from the average length of the lists read, so little text is read ahead
+ * to be pushed back.
+ */
+#define LGETS_PROBE_CHARS (16 * 1024)
+
+typedef struct {
+    char        *start;          /* Start of the chunk. */
+    char        *end;            /* Lists starting before this are parsed. */
+    char        *textEnd;        /* End of the text read. */
+    int          atEof;          /* The text ends at the end of the file. */
+    Tcl_Obj     *listsObj;       /* The lists parsed. */
+    int         *listEnds;       /* End of each list, relative to start. */
+    int          listEndsAlloc;
+    char        *stopPtr;        /* Start of the first list not parsed. */
+    int          status;         /* TCL_OK, TCL_ERROR or TCL_CONTINUE if
+                                    the text ends inside a list. */
+    int          threaded;       /* Parsed by a worker thread. */
+    Tcl_ThreadId threadId;
+} lgetsChunk_t;
+#endif
+
 
 /*
  * Prototypes of internal functions.
@@ -51,7 +106,60 @@ ReadListInit (Tcl_Interp  *interp,
 static int
 ReadListElement (Tcl_Interp  *interp,
                  ReadData    *dataPtr,
-                 Tcl_Obj     *elemObjPtr);
+                 Tcl_Obj    **elemObjPtr);
+
+static int
+ReadList (Tcl_Interp  *interp,
+          ReadData    *dataPtr,
+          Tcl_Obj    **listObjPtr);
+
+static int
+ReturnListBatch (Tcl_Interp  *interp,
+                 Tcl_Obj     *batchObj,
+                 int          numRead,
+                 int          rstat,
+                 Tcl_Obj     *varNameObj);
+
+static int
+ReadListBatch (Tcl_Interp  *interp,
+               Tcl_Channel  channel,
+               int          count,
+               Tcl_Obj     *varNameObj);
+
+#ifdef TCL_THREADS
+static void
+ParseChunk (lgetsChunk_t *chunkPtr);
+
+static void
+FreeChunk (lgetsChunk_t *chunkPtr);
+
+static int
+FindListEnd (lgetsChunk_t *chunkPtr,
+             char         *pos);
+
+static Tcl_ThreadCreateType
+ParseChunkThread (ClientData clientData);
+
+static int
+SeekPastText (Tcl_Interp  *interp,
+              Tcl_Channel  channel,
+              Tcl_WideInt  offset,
+              Tcl_WideInt  numChars,
+              int          atLineEnd);
+
+static int
+PushBackText (Tcl_Interp  *interp,
+              Tcl_Channel  channel,
+              char        *text,
+              int          length);
+
+static int
+ReadListBatchParallel (Tcl_Interp  *interp,
+                       Tcl_Channel  channel,
+                       int          count,
+                       Tcl_Obj     *varNameObj,
+                       int          numThreads);
+#endif
 
 static int 
 TclX_LgetsObjCmd (ClientData  clientData, 
@@ -59,18 +167,21 @@ TclX_LgetsObjCmd (ClientData  clientData,
                  int          objc,
                  Tcl_Obj     *const objv[]);
 
-
+
 /*-----------------------------------------------------------------------------
  * ReadLineList --
  *
- *   Read a list line from a channel.
+ *   Read a list line from a channel, appending it to the line buffer.
  *
  * Paramaters:
- *   o interp - Errors are returned in result.
+ *   o interp - Errors are returned in result.  If NULL, no error message
+ *     is returned.
  *   o dataPtr - Data for list read.
  * Returns:
  *   o TCL_OK if read succeeded..
  *   o TCL_BREAK if EOF without reading any data.
+ *   o TCL_CONTINUE if reading from memory and the text ends before the
+ *     end of the line, but not at the end of the file.
  *   o TCL_ERROR if an error occured, with error message in interp.
  *-----------------------------------------------------------------------------
  */
@@ -78,21 +189,34 @@ static int
 ReadListLine (Tcl_Interp  *interp,
               ReadData    *dataPtr)
 {
+    char *nlPtr;
+
     /*
      * Read the first line of the list. 
      */
-    if (Tcl_Gets (dataPtr->channel, &dataPtr->buffer) < 0) {
-        if (Tcl_Eof (dataPtr->channel)) {
-            /*
-             * If not first read, then we have failed in the middle of a list.
-             */
-            if (dataPtr->lineIdx > 0) {
-                TclX_AppendObjResult (interp, "EOF in list element",
-                                      (char *) NULL);
-                return TCL_ERROR;
-            }
-            return TCL_BREAK;  /* EOF with no data */
+    if (dataPtr->channel == NULL) {
+        nlPtr = NULL;
+        if (dataPtr->memPtr < dataPtr->memEnd) {
+            nlPtr = memchr (dataPtr->memPtr, '\n',
+                            dataPtr->memEnd - dataPtr->memPtr);
+        }
+        if ((nlPtr == NULL) && !dataPtr->memEof)
+            return TCL_CONTINUE;
+        if (nlPtr != NULL) {
+            Tcl_AppendToObj (dataPtr->lineObj, dataPtr->memPtr,
+                             nlPtr - dataPtr->memPtr + 1);
+            dataPtr->memPtr = nlPtr + 1;
+            return TCL_OK;
+        }
+        if (dataPtr->memPtr < dataPtr->memEnd) {
+            dataPtr->memPtr = dataPtr->memEnd;
+            goto noNewline;
         }
+        goto eofReached;
+    }
+    if (Tcl_GetsObj (dataPtr->channel, dataPtr->lineObj) < 0) {
+        if (Tcl_Eof (dataPtr->channel))
+            goto eofReached;
         TclX_AppendObjResult (interp, Tcl_PosixError (interp), (char *) NULL);
         return TCL_ERROR;
     }
@@ -101,25 +225,43 @@ ReadListLine (Tcl_Interp  *interp,
      * If data was read, but the read terminate with an EOF rather than a
      * newline, its an error.
      */
-    if (Tcl_Eof (dataPtr->channel)) {
-        TclX_AppendObjResult (interp,
-                              "EOF encountered before newline while reading ",
-                              "list from channel", (char *) NULL);
-        return TCL_ERROR;
-    }
+    if (Tcl_Eof (dataPtr->channel))
+        goto noNewline;
 
     /*
      * Add back in the newline.
      */
-    Tcl_DStringAppend (&dataPtr->buffer, "\n", 1);
+    Tcl_AppendToObj (dataPtr->lineObj, "\n", 1);
     return TCL_OK;
+
+  eofReached:
+    /*
+     * If not first read, then we have failed in the middle of a list.
+     */
+    if (dataPtr->lineIdx > 0) {
+        if (interp != NULL) {
+            TclX_AppendObjResult (interp, "EOF in list element",
+                                  (char *) NULL);
+        }
+        return TCL_ERROR;
+    }
+    return TCL_BREAK;  /* EOF with no data */
+
+  noNewline:
+    if (interp != NULL) {
+        TclX_AppendObjResult (interp,
+                              "EOF encountered before newline while reading ",
+                              "list from channel", (char *) NULL);
+    }
+    return TCL_ERROR;
 }
 
-
+
 /*-----------------------------------------------------------------------------
  * ReadListInit --
  *
- *    Initialize for reading list elements from a file.
+ *    Initialize for reading list elements from a file.  The line buffer
+ * must be allocated and empty.
  *
  * Paramaters:
  *   o interp - Errors are returned in result.
@@ -136,11 +278,10 @@ ReadListInit (Tcl_Interp  *interp,
               Tcl_Channel  channel,
               ReadData    *dataPtr)
 {
-    int rstat;
-    char *p, *limit;
+    int rstat, length;
+    char *start, *p, *limit;
 
     dataPtr->channel = channel;
-    Tcl_DStringInit (&dataPtr->buffer);
     dataPtr->lineIdx = 0;
 
     rstat = ReadListLine (interp, dataPtr);
@@ -150,16 +291,17 @@ ReadListInit (Tcl_Interp  *interp,
     /*
      * Advance to the first non-whitespace.
      */
-    p =  Tcl_DStringValue (&dataPtr->buffer);
-    limit = p + Tcl_DStringLength (&dataPtr->buffer);
+    start = Tcl_GetStringFromObj (dataPtr->lineObj, &length);
+    p = start;
+    limit = p + length;
     while ((p < limit) && (isspace(UCHAR(*p)))) {
         p++;
     }
-    dataPtr->lineIdx = p - Tcl_DStringValue (&dataPtr->buffer);
+    dataPtr->lineIdx = p - start;
     return TCL_OK;
 }
 
-
+
 /*-----------------------------------------------------------------------------
  * ReadListElement --
  *
@@ -169,32 +311,46 @@ ReadListInit (Tcl_Interp  *interp,
  * Paramaters:
  *   o interp - Errors are returned in result.
  *   o dataPtr - Data for list read.  As initialized by ReadListInit.
- *   o elemObjPtr - An object to copy the list element to.
+ *   o elemObjPtr - The element is returned here, in a new object.
  * Returns:
  *   o TCL_OK if an element was read.
  *   o TCL_BREAK if the end of the list was reached.
+ *   o TCL_CONTINUE if reading from memory and the text ends in the list.
  *   o TCL_ERROR if an error occured.
  * Notes:
- *   Code is a modified version of UCB procedure tclUtil.c:TclFindElement
+ *   Code is a modified version of UCB procedure tclUtil.c:TclFindElement.
+ * Runs of ordinary characters are skipped using a table and the element
+ * is only copied when it ends or a backslash is substituted, so most
+ * elements are created with a single allocation.
  *-----------------------------------------------------------------------------
  */
 static int
 ReadListElement (Tcl_Interp  *interp,
                  ReadData    *dataPtr,
-                 Tcl_Obj     *elemObjPtr)
+                 Tcl_Obj    **elemObjPtr)
 {
     register char *p;
+    char *start;		/* Start of the line buffer. */
     char *cpStart;		/* Points to next byte to copy. */
     char *limit;		/* Points just after list's last byte. */
     int openBraces = 0;		/* Brace nesting level during parse. */
     int inQuotes = 0;
-    int numChars;
+    int numChars, length;
     char *p2;
     int rstat, cpIdx;
+    Tcl_Obj *elemObj = NULL;
+
+#define ELEM_APPEND(str, len) \
+    if (elemObj == NULL) { \
+        elemObj = Tcl_NewStringObj ((str), (len)); \
+    } else { \
+        Tcl_AppendToObj (elemObj, (str), (len)); \
+    }
 
-    p = Tcl_DStringValue (&dataPtr->buffer) + dataPtr->lineIdx;
-    limit = Tcl_DStringValue (&dataPtr->buffer) +
-        Tcl_DStringLength (&dataPtr->buffer);
+    *elemObjPtr = NULL;
+    start = Tcl_GetStringFromObj (dataPtr->lineObj, &length);
+    p = start + dataPtr->lineIdx;
+    limit = start + length;
 
     /*
      * If we are at the end of the string, there are no more elements.
@@ -219,9 +375,13 @@ ReadListElement (Tcl_Interp  *interp,
 
     /*
      * Find element's end (a space, close brace, or the end of the string).
+     * The line buffer always ends in a zero byte, which stops the scan.
      */
 
     while (1) {
+        while (!LGETS_SPECIAL (*p)) {
+            p++;
+        }
 	switch (*p) {
 
 	    /*
@@ -244,7 +404,7 @@ ReadListElement (Tcl_Interp  *interp,
 		if (openBraces > 1) {
 		    openBraces--;
 		} else if (openBraces == 1) {
-                    Tcl_AppendToObj (elemObjPtr, cpStart, (p - cpStart));
+                    ELEM_APPEND (cpStart, (p - cpStart));
 		    p++;
 		    if ((p >= limit) || isspace(UCHAR(*p))) {
 			goto done;
@@ -268,7 +428,8 @@ ReadListElement (Tcl_Interp  *interp,
                         Tcl_ResetResult (interp);
                         TclX_AppendObjResult (interp, buf, (char *) NULL);
 		    }
-		    return TCL_ERROR;
+                    rstat = TCL_ERROR;
+                    goto errorExit;
 		}
 		break;
 
@@ -287,8 +448,8 @@ ReadListElement (Tcl_Interp  *interp,
                 if (openBraces > 0) {
                     p += (numChars - 1);  /* Advanced again at end of loop */
                 } else {
-                    Tcl_AppendToObj (elemObjPtr, cpStart, (p - cpStart));
-                    Tcl_AppendToObj (elemObjPtr, &bsChar, 1);
+                    ELEM_APPEND (cpStart, (p - cpStart));
+                    Tcl_AppendToObj (elemObj, &bsChar, 1);
                     p += (numChars - 1);
                     cpStart = p + 1;  /* already stored character */
                 }
@@ -307,7 +468,7 @@ ReadListElement (Tcl_Interp  *interp,
 	    case '\t':
 	    case '\v':
 		if ((openBraces == 0) && !inQuotes) {
-                    Tcl_AppendToObj (elemObjPtr, cpStart, (p - cpStart));
+                    ELEM_APPEND (cpStart, (p - cpStart));
 		    goto done;
 		}
 		break;
@@ -318,7 +479,7 @@ ReadListElement (Tcl_Interp  *interp,
 
 	    case '"':
 		if (inQuotes) {
-                    Tcl_AppendToObj (elemObjPtr, cpStart, (p - cpStart));
+                    ELEM_APPEND (cpStart, (p - cpStart));
 		    p++;
 		    if ((p >= limit) || isspace(UCHAR(*p))) {
 			goto done;
@@ -342,7 +503,8 @@ ReadListElement (Tcl_Interp  *interp,
                         Tcl_ResetResult (interp);
                         TclX_AppendObjResult (interp, buf, (char *) NULL);
 		    }
-		    return TCL_ERROR;
+                    rstat = TCL_ERROR;
+                    goto errorExit;
 		}
 		break;
 
@@ -359,7 +521,7 @@ ReadListElement (Tcl_Interp  *interp,
                     break;  /* Byte of zero */
 
                 if ((openBraces == 0) && (inQuotes == 0)) {
-                    Tcl_AppendToObj (elemObjPtr, cpStart, (p - cpStart));
+                    ELEM_APPEND (cpStart, (p - cpStart));
                     goto done;
                 }
                 
@@ -368,17 +530,17 @@ ReadListElement (Tcl_Interp  *interp,
                  * pointers.  Note we set `p' to one back, since we don't want
                  * the p++ below to miss the next character.
                  */
-                dataPtr->lineIdx = p - Tcl_DStringValue (&dataPtr->buffer);
-                cpIdx = cpStart - Tcl_DStringValue (&dataPtr->buffer);
+                dataPtr->lineIdx = p - start;
+                cpIdx = cpStart - start;
 
                 rstat = ReadListLine (interp, dataPtr);
                 if (rstat != TCL_OK)
-                    return rstat;
+                    goto errorExit;
 
-                p = Tcl_DStringValue (&dataPtr->buffer) + dataPtr->lineIdx - 1;
-                limit = Tcl_DStringValue (&dataPtr->buffer) +
-                    Tcl_DStringLength (&dataPtr->buffer);
-                cpStart = Tcl_DStringValue (&dataPtr->buffer) + cpIdx;
+                start = Tcl_GetStringFromObj (dataPtr->lineObj, &length);
+                p = start + dataPtr->lineIdx - 1;
+                limit = start + length;
+                cpStart = start + cpIdx;
             }
         }
 	p++;
@@ -388,15 +550,626 @@ ReadListElement (Tcl_Interp  *interp,
     while ((p < limit) && (isspace(UCHAR(*p)))) {
 	p++;
     }
-    dataPtr->lineIdx = p - Tcl_DStringValue (&dataPtr->buffer);
+    dataPtr->lineIdx = p - start;
+    *elemObjPtr = elemObj;
+    return TCL_OK;
+
+  errorExit:
+    if (elemObj != NULL)
+        Tcl_DecrRefCount (elemObj);
+    return rstat;
+#undef ELEM_APPEND
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadList --
+ *
+ *    Read a list, parsing off each element until the list is read.  More
+ * lines are read if newlines are encountered in the middle of a list.  The
+ * elements are collected in an array and the list object is created from
+ * it at the end.
+ *
+ * Paramaters:
+ *   o interp - Errors are returned in result.
+ *   o dataPtr - Data for list read, with an empty line buffer.
+ *   o listObjPtr - The list is returned here, in a new object.  On an
+ *     error, the elements that have been read are returned.
+ * Returns:
+ *   o TCL_OK if a list was read.
+ *   o TCL_BREAK if EOF without reading any data.
+ *   o TCL_CONTINUE if reading from memory and the text ends in the list.
+ *   o TCL_ERROR if an error occured.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadList (Tcl_Interp  *interp,
+          ReadData    *dataPtr,
+          Tcl_Obj    **listObjPtr)
+{
+    Tcl_Obj *staticElems [LGETS_STATIC_ELEMS];
+    Tcl_Obj **elems = staticElems;
+    int numElems = 0, elemsAlloc = LGETS_STATIC_ELEMS;
+    Tcl_Obj *elemObj;
+    int rstat;
+
+    rstat = ReadListInit (interp, dataPtr->channel, dataPtr);
+    if (rstat != TCL_OK) {
+        *listObjPtr = Tcl_NewObj ();
+        return rstat;
+    }
+
+    while (TRUE) {
+        rstat = ReadListElement (interp, dataPtr, &elemObj);
+        if (rstat != TCL_OK)
+            break;
+        if (numElems == elemsAlloc) {
+            elemsAlloc *= 2;
+            if (elems == staticElems) {
+                elems = (Tcl_Obj **) ckalloc (elemsAlloc * sizeof (Tcl_Obj *));
+                memcpy (elems, staticElems, numElems * sizeof (Tcl_Obj *));
+            } else {
+                elems = (Tcl_Obj **) ckrealloc ((char *) elems,
+                                                elemsAlloc *
+                                                sizeof (Tcl_Obj *));
+            }
+        }
+        elems [numElems++] = elemObj;
+    }
+
+    *listObjPtr = Tcl_NewListObj (numElems, elems);
+    if (elems != staticElems)
+        ckfree ((char *) elems);
+    return (rstat == TCL_BREAK) ? TCL_OK : rstat;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReturnListBatch --
+ *
+ *    Return the lists read by lgets -count or -all, as the result or in a
+ * variable.
+ *
+ * Paramaters:
+ *   o interp - The list of lists or the count is returned in the result.
+ *     If rstat is TCL_ERROR, the result holds the error message.
+ *   o batchObj - The lists read.
+ *   o numRead - The number of lists read.
+ *   o rstat - TCL_OK, TCL_BREAK if the end of the file was reached or
+ *     TCL_ERROR if reading failed.
+ *   o varNameObj - If not NULL, the variable to store the list of lists in.
+ *     On an error, the variable is set to the lists that were read before
+ *     the one in error.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReturnListBatch (Tcl_Interp  *interp,
+                 Tcl_Obj     *batchObj,
+                 int          numRead,
+                 int          rstat,
+                 Tcl_Obj     *varNameObj)
+{
+    Tcl_Obj *saveResult = NULL;
+
+    if (varNameObj == NULL) {
+        if (rstat != TCL_ERROR)
+            Tcl_SetObjResult (interp, batchObj);
+        return (rstat == TCL_ERROR) ? TCL_ERROR : TCL_OK;
+    }
+
+    /*
+     * On an error, save the message while setting the variable.  If
+     * setting the variable fails, report that instead.
+     */
+    if (rstat == TCL_ERROR) {
+        saveResult = Tcl_GetObjResult (interp);
+        Tcl_IncrRefCount (saveResult);
+    }
+    if (Tcl_ObjSetVar2 (interp, varNameObj, NULL, batchObj,
+                        TCL_PARSE_PART1|TCL_LEAVE_ERR_MSG) == NULL) {
+        rstat = TCL_ERROR;
+    } else if (saveResult != NULL) {
+        Tcl_SetObjResult (interp, saveResult);
+    } else {
+        Tcl_SetIntObj (Tcl_GetObjResult (interp),
+                       ((numRead == 0) && (rstat == TCL_BREAK)) ? -1 :
+                       numRead);
+    }
+    if (saveResult != NULL)
+        Tcl_DecrRefCount (saveResult);
+    return (rstat == TCL_ERROR) ? TCL_ERROR : TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadListBatch --
+ *
+ *    Read a number of lists from a channel for lgets -count and -all.  The
+ * line buffer is reused for every list.
+ *
+ * Paramaters:
+ *   o interp - The list of lists or the count is returned in the result,
+ *     errors are returned in result.
+ *   o channel - The channel to read from.
+ *   o count - The number of lists to read, or -1 to read to the end of the
+ *     file.
+ *   o varNameObj - If not NULL, the variable to store the list of lists in.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadListBatch (Tcl_Interp  *interp,
+               Tcl_Channel  channel,
+               int          count,
+               Tcl_Obj     *varNameObj)
+{
+    ReadData readData;
+    Tcl_Obj *batchObj, *listObj;
+    int rstat = TCL_OK, numRead = 0;
+
+    readData.channel = channel;
+    readData.lineObj = Tcl_NewObj ();
+    Tcl_IncrRefCount (readData.lineObj);
+
+    batchObj = Tcl_NewListObj (0, NULL);
+    Tcl_IncrRefCount (batchObj);
+
+    while ((count < 0) || (numRead < count)) {
+        Tcl_SetObjLength (readData.lineObj, 0);
+        rstat = ReadList (interp, &readData, &listObj);
+        if (rstat != TCL_OK) {
+            Tcl_DecrRefCount (listObj);
+            break;
+        }
+        Tcl_ListObjAppendElement (NULL, batchObj, listObj);
+        numRead++;
+    }
+    Tcl_DecrRefCount (readData.lineObj);
+
+    rstat = ReturnListBatch (interp, batchObj, numRead, rstat, varNameObj);
+    Tcl_DecrRefCount (batchObj);
+    return rstat;
+}
+
+#ifdef TCL_THREADS
+/*-----------------------------------------------------------------------------
+ * ParseChunk --
+ *
+ *    Parse the lists that start in a chunk of text.  The last one may
+ * extend past the end of the chunk.  This is called from worker threads,
+ * so errors are only noted, the message is produced by parsing the list in
+ * error again with an interpreter.
+ *-----------------------------------------------------------------------------
+ */
+static void
+ParseChunk (lgetsChunk_t *chunkPtr)
+{
+    ReadData readData;
+    Tcl_Obj *listObj;
+    char *listStart;
+    int numLists = 0, rstat = TCL_OK;
+
+    readData.channel = NULL;
+    readData.lineObj = Tcl_NewObj ();
+    Tcl_IncrRefCount (readData.lineObj);
+    readData.memPtr = chunkPtr->start;
+    readData.memEnd = chunkPtr->textEnd;
+    readData.memEof = chunkPtr->atEof;
+
+    chunkPtr->listsObj = Tcl_NewListObj (0, NULL);
+    Tcl_IncrRefCount (chunkPtr->listsObj);
+
+    while (readData.memPtr < chunkPtr->end) {
+        listStart = readData.memPtr;
+        Tcl_SetObjLength (readData.lineObj, 0);
+        rstat = ReadList (NULL, &readData, &listObj);
+        if (rstat != TCL_OK) {
+            Tcl_DecrRefCount (listObj);
+            readData.memPtr = listStart;
+            break;
+        }
+        Tcl_ListObjAppendElement (NULL, chunkPtr->listsObj, listObj);
+        if (numLists == chunkPtr->listEndsAlloc) {
+            chunkPtr->listEndsAlloc = (numLists == 0) ? 256 : 2 * numLists;
+            chunkPtr->listEnds = (int *)
+                ckrealloc ((char *) chunkPtr->listEnds,
+                           chunkPtr->listEndsAlloc * sizeof (int));
+        }
+        chunkPtr->listEnds [numLists++] = readData.memPtr - chunkPtr->start;
+    }
+    Tcl_DecrRefCount (readData.lineObj);
+
+    chunkPtr->stopPtr = readData.memPtr;
+    chunkPtr->status = (rstat == TCL_BREAK) ? TCL_OK : rstat;
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeChunk --
+ *
+ *    Release the lists parsed from a chunk.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeChunk (lgetsChunk_t *chunkPtr)
+{
+    if (chunkPtr->listsObj != NULL) {
+        Tcl_DecrRefCount (chunkPtr->listsObj);
+        chunkPtr->listsObj = NULL;
+    }
+    if (chunkPtr->listEnds != NULL) {
+        ckfree ((char *) chunkPtr->listEnds);
+        chunkPtr->listEnds = NULL;
+        chunkPtr->listEndsAlloc = 0;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * FindListEnd --
+ *
+ *    Find where a list parsed from a chunk ends at a position.
+ *
+ * Returns:
+ *   The index of the list following the one ending at pos, or -1 if no
+ * list ends there.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FindListEnd (lgetsChunk_t *chunkPtr,
+             char         *pos)
+{
+    int low, high, mid, offset = pos - chunkPtr->start;
+
+    Tcl_ListObjLength (NULL, chunkPtr->listsObj, &high);
+    low = 0;
+    high--;
+    while (low <= high) {
+        mid = (low + high) / 2;
+        if (chunkPtr->listEnds [mid] == offset)
+            return mid + 1;
+        if (chunkPtr->listEnds [mid] < offset) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+/*-----------------------------------------------------------------------------
+ * ParseChunkThread --
+ *
+ *    Worker thread for parsing a chunk.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_ThreadCreateType
+ParseChunkThread (ClientData clientData)
+{
+    ParseChunk ((lgetsChunk_t *) clientData);
+
+    Tcl_ExitThread (0);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*-----------------------------------------------------------------------------
+ * SeekPastText --
+ *
+ *    Position a channel after text that was read and used, so text read
+ * ahead will be read again.  Line end translation and invalid bytes in the
+ * encoding mean the number of bytes the text was read from isn't known, so
+ * the channel is positioned back where reading started and the text is
+ * read again.  If the text ends at a line end, the last line is read as a
+ * line, so all of a CR-LF pair is read.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SeekPastText (Tcl_Interp  *interp,
+              Tcl_Channel  channel,
+              Tcl_WideInt  offset,
+              Tcl_WideInt  numChars,
+              int          atLineEnd)
+{
+    Tcl_Obj *skipObj;
+    int readChars, numRead = 0;
+
+    if (Tcl_Seek (channel, offset, SEEK_SET) < 0)
+        goto posixError;
+
+    skipObj = Tcl_NewObj ();
+    Tcl_IncrRefCount (skipObj);
+    if (atLineEnd)
+        numChars--;
+    while (numChars > 0) {
+        readChars = (numChars > LGETS_CHUNK_CHARS) ? LGETS_CHUNK_CHARS :
+            (int) numChars;
+        numRead = Tcl_ReadChars (channel, skipObj, readChars, FALSE);
+        if (numRead <= 0)
+            break;
+        numChars -= numRead;
+    }
+    if (atLineEnd && (numRead >= 0))
+        numRead = Tcl_GetsObj (channel, skipObj);
+    Tcl_DecrRefCount (skipObj);
+    if ((numRead < 0) && !Tcl_Eof (channel))
+        goto posixError;
+    return TCL_OK;
+
+  posixError:
+    TclX_AppendObjResult (interp, Tcl_PosixError (interp), (char *) NULL);
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * PushBackText --
+ *
+ *    Push text that was read but not used back into a channel that can't
+ * seek, converted back to the channel's encoding, so it will be read again.
+ * The text has already had its line ends translated, which translating it
+ * again doesn't change.
+ *-----------------------------------------------------------------------------
+ */
+static int
+PushBackText (Tcl_Interp  *interp,
+              Tcl_Channel  channel,
+              char        *text,
+              int          length)
+{
+    Tcl_DString nameBuf, externalBuf;
+    Tcl_Encoding encoding;
+    char *encodingName;
+
+    Tcl_DStringInit (&nameBuf);
+    if (Tcl_GetChannelOption (interp, channel, "-encoding",
+                              &nameBuf) != TCL_OK) {
+        Tcl_DStringFree (&nameBuf);
+        return TCL_ERROR;
+    }
+    encodingName = Tcl_DStringValue (&nameBuf);
+    if (STREQU (encodingName, "binary"))
+        encodingName = "iso8859-1";
+    encoding = Tcl_GetEncoding (interp, encodingName);
+    Tcl_DStringFree (&nameBuf);
+    if (encoding == NULL)
+        return TCL_ERROR;
+
+    Tcl_UtfToExternalDString (encoding, text, length, &externalBuf);
+    Tcl_FreeEncoding (encoding);
+    if (Tcl_Ungets (channel, Tcl_DStringValue (&externalBuf),
+                    Tcl_DStringLength (&externalBuf), FALSE) < 0) {
+        Tcl_DStringFree (&externalBuf);
+        TclX_AppendObjResult (interp, Tcl_PosixError (interp),
+                              (char *) NULL);
+        return TCL_ERROR;
+    }
+    Tcl_DStringFree (&externalBuf);
     return TCL_OK;
 }
-
+
+/*-----------------------------------------------------------------------------
+ * ReadListBatchParallel --
+ *
+ *    Read a number of lists from a channel for lgets -count and -all,
+ * parsing them with worker threads.  The lists are returned in the same
+ * order, and with the same errors, as ReadListBatch.
+ *
+ * Paramaters:
+ *   o interp - The list of lists or the count is returned in the result,
+ *     errors are returned in result.
+ *   o channel - The channel to read from.
+ *   o count - The number of lists to read, or -1 to read to the end of the
+ *     file.
+ *   o varNameObj - If not NULL, the variable to store the list of lists in.
+ *   o numThreads - The number of threads parsing, including this one.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadListBatchParallel (Tcl_Interp  *interp,
+                       Tcl_Channel  channel,
+                       int          count,
+                       Tcl_Obj     *varNameObj,
+                       int          numThreads)
+{
+    lgetsChunk_t *chunks, *chunkPtr;
+    Tcl_Obj *textObj, *batchObj, *listObj, **listObjv;
+    ReadData readData;
+    char *text, *textEnd, *pos, *split;
+    int textLen, numChunks, idx, listIdx, listObjc, threadResult;
+    int numRead = 0, atEof = FALSE, rstat = TCL_OK, blockChars;
+    double usedLen = 0.0;
+    Tcl_WideInt startOffset, usedChars = 0;
+    int atLineEnd = FALSE;
+
+    chunks = (lgetsChunk_t *) ckalloc (numThreads * sizeof (lgetsChunk_t));
+    textObj = Tcl_NewObj ();
+    Tcl_IncrRefCount (textObj);
+    batchObj = Tcl_NewListObj (0, NULL);
+    Tcl_IncrRefCount (batchObj);
+    startOffset = Tcl_Tell (channel);
+
+    while ((rstat == TCL_OK) && !atEof && ((count < 0) || (numRead < count))) {
+        /*
+         * Read a block, adding it to the text left from the last one.  If
+         * the block ends at a newline, keep reading until it doesn't, so no
+         * half of a CR-LF pair is left in the channel.
+         */
+        blockChars = numThreads * LGETS_CHUNK_CHARS;
+        if (count >= 0) {
+            if (numRead == 0) {
+                if (blockChars > LGETS_PROBE_CHARS)
+                    blockChars = LGETS_PROBE_CHARS;
+            } else if ((usedLen / numRead) * (count - numRead) * 1.125
+                       < blockChars) {
+                blockChars = (int) ((usedLen / numRead) *
+                                    (count - numRead) * 1.125) + 1;
+            }
+        }
+        if (Tcl_ReadChars (channel, textObj, blockChars, TRUE) < 0)
+            goto posixError;
+        text = Tcl_GetStringFromObj (textObj, &textLen);
+        while ((textLen > 0) && (text [textLen - 1] == '\n') &&
+               !Tcl_Eof (channel)) {
+            if (Tcl_ReadChars (channel, textObj, 1, TRUE) < 0)
+                goto posixError;
+            text = Tcl_GetStringFromObj (textObj, &textLen);
+        }
+        atEof = Tcl_Eof (channel);
+        textEnd = text + textLen;
+        if (textLen == 0)
+            break;
+
+        /*
+         * Split the text into chunks after newlines and parse them.
+         */
+        pos = text;
+        for (numChunks = 0; (numChunks < numThreads) && (pos < textEnd);
+             numChunks++) {
+            chunkPtr = &chunks [numChunks];
+            split = text + (textLen / numThreads) * (numChunks + 1);
+            if ((numChunks == numThreads - 1) || (split >= textEnd)) {
+                split = textEnd;
+            } else {
+                if (split < pos)
+                    split = pos;
+                split = memchr (split, '\n', textEnd - split);
+                split = (split == NULL) ? textEnd : split + 1;
+            }
+            chunkPtr->start = pos;
+            chunkPtr->end = split;
+            chunkPtr->textEnd = textEnd;
+            chunkPtr->atEof = atEof;
+            chunkPtr->listsObj = NULL;
+            chunkPtr->listEnds = NULL;
+            chunkPtr->listEndsAlloc = 0;
+            chunkPtr->threaded = FALSE;
+            pos = split;
+        }
+        for (idx = 1; idx < numChunks; idx++) {
+            chunkPtr = &chunks [idx];
+            chunkPtr->threaded =
+                (Tcl_CreateThread (&chunkPtr->threadId, ParseChunkThread,
+                                   (ClientData) chunkPtr,
+                                   TCL_THREAD_STACK_DEFAULT,
+                                   TCL_THREAD_JOINABLE) == TCL_OK);
+        }
+        ParseChunk (&chunks [0]);
+        for (idx = 1; idx < numChunks; idx++) {
+            chunkPtr = &chunks [idx];
+            if (chunkPtr->threaded) {
+                Tcl_JoinThread (chunkPtr->threadId, &threadResult);
+            } else {
+                ParseChunk (chunkPtr);
+            }
+        }
+
+        /*
+         * Take the lists from the chunks in order.  A chunk that doesn't
+         * start where the lists of the previous one ended started inside a
+         * list.  Its parse is still right from any list end that is where
+         * the previous lists ended, which it usually reaches within a line.
+         * If it isn't, parse it again from the right place, unless the
+         * lists of the previous chunk cover it.
+         */
+        pos = text;
+        for (idx = 0; idx < numChunks; idx++) {
+            chunkPtr = &chunks [idx];
+            listIdx = 0;
+            if (chunkPtr->start != pos) {
+                if (pos >= chunkPtr->end)
+                    continue;
+                listIdx = FindListEnd (chunkPtr, pos);
+                if (listIdx < 0) {
+                    FreeChunk (chunkPtr);
+                    chunkPtr->start = pos;
+                    ParseChunk (chunkPtr);
+                    listIdx = 0;
+                }
+            }
+            Tcl_ListObjGetElements (NULL, chunkPtr->listsObj, &listObjc,
+                                    &listObjv);
+            for (; listIdx < listObjc; listIdx++) {
+                if ((count >= 0) && (numRead == count))
+                    break;
+                Tcl_ListObjAppendElement (NULL, batchObj, listObjv [listIdx]);
+                numRead++;
+                pos = chunkPtr->start + chunkPtr->listEnds [listIdx];
+            }
+            if (listIdx < listObjc)
+                break;
+            pos = chunkPtr->stopPtr;
+            if (chunkPtr->status == TCL_ERROR) {
+                /*
+                 * Parse the list in error again to get the message.  This
+                 * reads the same lines that lgets would have.
+                 */
+                readData.channel = NULL;
+                readData.lineObj = Tcl_NewObj ();
+                Tcl_IncrRefCount (readData.lineObj);
+                readData.memPtr = pos;
+                readData.memEnd = textEnd;
+                readData.memEof = atEof;
+                rstat = ReadList (interp, &readData, &listObj);
+                Tcl_DecrRefCount (listObj);
+                Tcl_DecrRefCount (readData.lineObj);
+                pos = readData.memPtr;
+                rstat = TCL_ERROR;
+                break;
+            }
+            if (chunkPtr->status == TCL_CONTINUE)
+                break;
+        }
+        for (idx = 0; idx < numChunks; idx++) {
+            FreeChunk (&chunks [idx]);
+        }
+
+        /*
+         * Keep the text after the last list used.
+         */
+        usedLen += pos - text;
+        if ((startOffset >= 0) && (pos > text)) {
+            usedChars += Tcl_NumUtfChars (text, pos - text);
+            atLineEnd = (pos [-1] == '\n');
+        }
+        listObj = Tcl_NewStringObj (pos, textEnd - pos);
+        Tcl_DecrRefCount (textObj);
+        textObj = listObj;
+        Tcl_IncrRefCount (textObj);
+    }
+
+    /*
+     * Return the text read ahead to the channel.
+     */
+    text = Tcl_GetStringFromObj (textObj, &textLen);
+    if ((textLen > 0) &&
+        (((startOffset >= 0) ?
+          SeekPastText (interp, channel, startOffset, usedChars,
+                        atLineEnd) :
+          PushBackText (interp, channel, text, textLen)) != TCL_OK)) {
+        rstat = TCL_ERROR;
+    } else if ((rstat == TCL_OK) && atEof) {
+        rstat = TCL_BREAK;
+    }
+    goto done;
+
+  posixError:
+    TclX_AppendObjResult (interp, Tcl_PosixError (interp), (char *) NULL);
+    rstat = TCL_ERROR;
+
+  done:
+    rstat = ReturnListBatch (interp, batchObj, numRead, rstat, varNameObj);
+    Tcl_DecrRefCount (batchObj);
+    Tcl_DecrRefCount (textObj);
+    ckfree ((char *) chunks);
+    return rstat;
+}
+#endif
+
 /*-----------------------------------------------------------------------------
  * Tcl_LgetsObjCmd --
  *
  * Implements the `lgets' Tcl command:
  *    lgets fileId ?varName?
+ *    lgets ?-count count|-all? ?-parallel numthreads? fileId ?varName?
  *
  * Results:
  *      A standard Tcl result.
@@ -413,14 +1186,70 @@ TclX_LgetsObjCmd (ClientData  clientData,
 {
     Tcl_Channel channel;
     ReadData readData;
-    int rstat, optValue;
-    Tcl_Obj *elemObj, *dataObj;
+    int rstat, optValue, argIdx, count = 0, numThreads = 0;
+#ifdef TCL_THREADS
+    int seekable;
+#endif
+    Tcl_Obj *dataObj;
+    char *optStr;
 
-    if ((objc < 2) || (objc > 3)) {
+    /*
+     * Parse the batch options.  Channel names never start with a `-'.
+     */
+    for (argIdx = 1; argIdx < objc; argIdx++) {
+        optStr = Tcl_GetStringFromObj (objv [argIdx], NULL);
+        if (optStr [0] != '-')
+            break;
+        if (STREQU (optStr, "-all")) {
+            count = -1;
+        } else if (STREQU (optStr, "-count")) {
+            if (argIdx + 1 >= objc)
+                goto batchWrongArgs;
+            if (Tcl_GetIntFromObj (interp, objv [++argIdx],
+                                   &count) != TCL_OK)
+                return TCL_ERROR;
+            if (count <= 0) {
+                TclX_AppendObjResult (interp, "count must be greater than ",
+                                      "zero, got \"",
+                                      Tcl_GetStringFromObj (objv [argIdx],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else if (STREQU (optStr, "-parallel")) {
+            if (argIdx + 1 >= objc)
+                goto batchWrongArgs;
+            if (Tcl_GetIntFromObj (interp, objv [++argIdx],
+                                   &numThreads) != TCL_OK)
+                return TCL_ERROR;
+            if (numThreads < 1) {
+                TclX_AppendObjResult (interp, "number of threads must be ",
+                                      "greater than zero, got \"",
+                                      Tcl_GetStringFromObj (objv [argIdx],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else {
+            TclX_AppendObjResult (interp, "invalid option \"", optStr,
+                                  "\", expected one of \"-count\", ",
+                                  "\"-all\" or \"-parallel\"",
+                                  (char *) NULL);
+            return TCL_ERROR;
+        }
+    }
+    if ((numThreads > 0) && (count == 0)) {
+        TclX_AppendObjResult (interp, "-parallel is only valid with -count ",
+                              "or -all", (char *) NULL);
+        return TCL_ERROR;
+    }
+    if ((objc - argIdx < 1) || (objc - argIdx > 2)) {
+        if (argIdx > 1)
+            goto batchWrongArgs;
         return TclX_WrongArgs (interp, objv [0], "fileId ?varName?");
     }
 
-    channel = TclX_GetOpenChannelObj (interp, objv [1], TCL_READABLE);
+    channel = TclX_GetOpenChannelObj (interp, objv [argIdx], TCL_READABLE);
     if (channel == NULL)
         return TCL_ERROR;
 
@@ -439,25 +1268,39 @@ TclX_LgetsObjCmd (ClientData  clientData,
         return TCL_ERROR;
     }
 
+#ifdef TCL_THREADS
     /*
-     * Read the list, parsing off each element until the list is read.
-     * More lines are read if newlines are encountered in the middle of
-     * a list.
+     * Reading ahead with -count could block waiting for text that isn't
+     * needed, so it's only done on regular files.  Other channels read the
+     * lists sequentially.
      */
-    rstat = ReadListInit (interp, channel, &readData);
+    if ((numThreads > 1) && (count > 0)) {
+        if (TclXOSSeekable (interp, channel, &seekable) != TCL_OK)
+            return TCL_ERROR;
+        if (!seekable)
+            numThreads = 1;
+    }
+    if (numThreads > 1) {
+        return ReadListBatchParallel (interp, channel, count,
+                                      (objc - argIdx > 1) ?
+                                      objv [argIdx + 1] : NULL,
+                                      numThreads);
+    }
+#endif
+    if (count != 0) {
+        return ReadListBatch (interp, channel, count,
+                              (objc - argIdx > 1) ? objv [argIdx + 1] : NULL);
+    }
 
-    dataObj = Tcl_NewListObj (0, NULL);
-    Tcl_IncrRefCount (dataObj);
+    /*
+     * Read the list.
+     */
+    readData.channel = channel;
+    readData.lineObj = Tcl_NewObj ();
+    Tcl_IncrRefCount (readData.lineObj);
 
-    while (rstat == TCL_OK) {
-        elemObj = Tcl_NewStringObj ("", 0);
-        rstat = ReadListElement (interp, &readData, elemObj);
-        if (rstat == TCL_OK) {
-            Tcl_ListObjAppendElement (NULL, dataObj, elemObj);
-        } else {
-            Tcl_DecrRefCount (elemObj);
-        }
-    }
+    rstat = ReadList (interp, &readData, &dataObj);
+    Tcl_IncrRefCount (dataObj);
     if (rstat == TCL_ERROR)
         goto errorExit;
 
@@ -478,12 +1321,13 @@ TclX_LgetsObjCmd (ClientData  clientData,
             resultLen = -1;
         } else {
             /* Adjust length for extra newlines that are inserted */
-            resultLen = Tcl_DStringLength (&readData.buffer) - 1;
+            Tcl_GetStringFromObj (readData.lineObj, &resultLen);
+            resultLen--;
         }
         Tcl_SetIntObj (Tcl_GetObjResult (interp), resultLen);
     }
     Tcl_DecrRefCount (dataObj);
-    Tcl_DStringFree (&readData.buffer);
+    Tcl_DecrRefCount (readData.lineObj);
     return TCL_OK;
     
   errorExit:
@@ -494,13 +1338,19 @@ TclX_LgetsObjCmd (ClientData  clientData,
      */
     if (objc > 2) {
         Tcl_Obj *saveResult;
-        int len = Tcl_DStringLength (&readData.buffer) - readData.lineIdx;
+        char *lineStr;
+        int len;
 
+        lineStr = Tcl_GetStringFromObj (readData.lineObj, &len);
+        len -= readData.lineIdx;
         if (len > 0) {
-            Tcl_ListObjAppendElement (
-                NULL, dataObj,
-                Tcl_NewStringObj (Tcl_DStringValue (&readData.buffer),
-                                  len));
+            if (Tcl_IsShared (dataObj)) {
+                Tcl_DecrRefCount (dataObj);
+                dataObj = Tcl_DuplicateObj (dataObj);
+                Tcl_IncrRefCount (dataObj);
+            }
+            Tcl_ListObjAppendElement (NULL, dataObj,
+                                      Tcl_NewStringObj (lineStr, len));
         }
         
         saveResult = Tcl_GetObjResult (interp);
@@ -519,12 +1369,17 @@ TclX_LgetsObjCmd (ClientData  clientData,
     }
 
     Tcl_DecrRefCount (dataObj);
-    Tcl_DStringFree (&readData.buffer);
+    Tcl_DecrRefCount (readData.lineObj);
 
     return TCL_ERROR;
+
+  batchWrongArgs:
+    return TclX_WrongArgs (interp, objv [0],
+                           "?-count count|-all? ?-parallel numthreads? "
+                           "fileId ?varName?");
 }
     
-
+
 /*-----------------------------------------------------------------------------
  * TclX_LgetsInit --
  *     Initialize the lgets command.
@@ -533,6 +1388,20 @@ TclX_LgetsObjCmd (ClientData  clientData,
 void
 TclX_LgetsInit (Tcl_Interp *interp)
 {
+    if (!specialCharsInit) {
+        specialChars [0] = TRUE;
+        specialChars ['{'] = TRUE;
+        specialChars ['}'] = TRUE;
+        specialChars ['\\'] = TRUE;
+        specialChars ['"'] = TRUE;
+        specialChars [' '] = TRUE;
+        specialChars ['\f'] = TRUE;
+        specialChars ['\n'] = TRUE;
+        specialChars ['\r'] = TRUE;
+        specialChars ['\t'] = TRUE;
+        specialChars ['\v'] = TRUE;
+        specialCharsInit = TRUE;
+    }
     Tcl_CreateObjCommand (interp,
                           "lgets",
                           TclX_LgetsObjCmd,
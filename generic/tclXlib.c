@@ -53,6 +53,71 @@ static char autoloadCmd [] =
     "source [file join $tclx_library autoload.tcl]";
 #endif
 
+/*
+ * Parsed package library indexes are cached for the life of the process, so
+ * interpreters created later don't parse the .tndx files again.  The cache is
+ * keyed by index file path, and an entry is only used if the contents of the
+ * index file are unchanged.  Entries are reference counted, since one thread
+ * may replace an entry while another is still using it.
+ */
+typedef struct {
+    int           pkgArgc;      /* Split index line: name, offset, length */
+    const char  **pkgArgv;      /* and the entry procedures.              */
+    off_t         offset;
+    unsigned      length;
+} indexPkg_t;
+
+typedef struct {
+    int           refCount;
+    int           textLen;      /* Contents of the index file.            */
+    char         *text;
+    int           numPkgs;
+    indexPkg_t   *pkgs;
+} indexCache_t;
+
+static Tcl_HashTable indexCacheTable;
+static int indexCacheInitialized = FALSE;
+TCL_DECLARE_MUTEX(indexCacheMutex)
+
+/*
+ * Library files are mapped into memory once per process and shared between
+ * interpreters, so autoloading a package doesn't have to open and read the
+ * library.  A mapping is used as long as the file has the same identity, size
+ * and modification time.  Access is serialized and package text is copied out
+ * of the mapping, so a mapping can be replaced at any time.  The file is
+ * stat-ed under the mutex right before each copy, so a library that has been
+ * truncated is read instead; only one truncated during the copy itself can
+ * still fault.
+ */
+typedef struct {
+    dev_t   dev;
+    ino_t   ino;
+    time_t  mtime;
+    long    mtimeNsec;
+    off_t   size;               /* Size of the mapping. */
+    char   *addr;
+} libFileMap_t;
+
+static Tcl_HashTable libFileMapTable;
+static int libFileMapInitialized = FALSE;
+TCL_DECLARE_MUTEX(libFileMapMutex)
+
+/*
+ * Procedure entries from package library indexes aren't set in auto_index
+ * when the index is loaded.  They are kept in a per-interpreter table and a
+ * trace on auto_index sets each one the first time it is accessed, so only
+ * the procedures that are actually looked up are ever set.
+ */
+typedef struct {
+    Tcl_HashTable *pendingTablePtr;  /* Proc name to auto_index value. */
+    int            traced;           /* Trace is set on auto_index.    */
+} lazyIndex_t;
+
+#define LAZY_INDEX_ASSOC "tclx_lazy_index"
+#define LAZY_INDEX_TRACE_FLAGS \
+    (TCL_GLOBAL_ONLY | TCL_TRACE_READS | TCL_TRACE_WRITES | \
+     TCL_TRACE_UNSETS | TCL_TRACE_ARRAY)
+
 /*
  * Indicates the type of library index.
  */
@@ -61,9 +126,62 @@ typedef enum {
     TCLLIB_TND         /* *.tnd (.tndx in 8.3 land) */
 } indexNameClass_t;
 
+/*
+ * Package library headers.
+ */
+#define PACKAGE_HDR      "#@package: "
+#define PACKAGE_HDR_LEN  11
+#define PACKAGE_END      "#@packend"
+#define PACKAGE_END_LEN  9
+
+/*
+ * A package library index that is missing or older than its library is
+ * rebuilt before it's loaded.  Building an index doesn't use an interpreter,
+ * so the stale indexes of several libraries can be built concurrently by
+ * threads taking entries from a queue.  Errors are returned as a message.
+ */
+typedef struct {
+    char         *tlibFilePath;
+    char         *tndxFilePath;
+    int           needBuild;        /* Index must be (re)built.        */
+    char         *errorMsg;         /* Build error, NULL if none.      */
+} indexBuild_t;
+
+typedef struct {
+    indexBuild_t *builds;
+    int           numBuilds;
+    int           nextBuild;        /* Next entry to check for a build. */
+    Tcl_Mutex     mutex;
+} indexBuildQueue_t;
+
+/*
+ * Package libraries found in a directory by LoadDirIndexes.
+ */
+typedef struct {
+    indexBuild_t *builds;
+    int           numBuilds;
+    int           buildsSize;
+} dirIndexes_t;
+
+/*
+ * Maximum number of threads used to rebuild the stale indexes in a
+ * directory.
+ */
+#define INDEX_BUILD_THREADS 4
+
 /*
  * Prototypes of internal functions.
  */
+static void
+LibFileMapExitHandler (ClientData clientData);
+
+static int
+ReadMappedFilePart (char        *fileName,
+                    off_t        offset,
+                    off_t        length,
+                    Tcl_DString *cmdBufPtr,
+                    off_t       *fileSizePtr);
+
 static int
 EvalFilePart (Tcl_Interp  *interp,
               char        *fileName,
@@ -78,7 +196,7 @@ MakeAbsFile (Tcl_Interp  *interp,
 static int
 SetPackageIndexEntry (Tcl_Interp *interp,
                       const char *packageName,
-                      const char *fileName,
+                      Tcl_Obj    *fileNameObj,
                       off_t       offset,
                       unsigned    length);
 
@@ -89,23 +207,103 @@ GetPackageIndexEntry (Tcl_Interp *interp,
                       off_t      *offsetPtr,
                       unsigned   *lengthPtr);
 
-static int
-SetProcIndexEntry (Tcl_Interp *interp,
-                   const char *procName,
-                   const char *package);
-
 static void
 AddLibIndexErrorInfo (Tcl_Interp *interp,
                       char       *indexName);
 
+static void
+ReleaseIndexCache (indexCache_t *cachePtr);
+
+static void
+ClearLazyIndex (lazyIndex_t *lazyPtr);
+
+static char *
+LazyIndexTrace (ClientData  clientData,
+                Tcl_Interp *interp,
+                const char *name1,
+                const char *name2,
+                int         flags);
+
+static void
+LazyIndexCleanUp (ClientData  clientData,
+                  Tcl_Interp *interp);
+
+static int
+SetLazyProcIndexEntry (Tcl_Interp *interp,
+                       const char *procName,
+                       Tcl_Obj    *commandObj);
+
+static void
+IndexCacheExitHandler (ClientData clientData);
+
+static indexCache_t *
+ParseIndexFile (Tcl_Interp *interp,
+                char       *tndxFilePath,
+                char       *text,
+                int         textLen);
+
+static int
+ApplyIndex (Tcl_Interp   *interp,
+            char         *tlibFilePath,
+            indexCache_t *cachePtr);
+
 static int
 ProcessIndexFile (Tcl_Interp *interp,
                   char       *tlibFilePath,
                   char       *tndxFilePath);
 
+static char *
+NextLibLine (char  *linePtr,
+             char  *textEnd,
+             char **lineEndPtr);
+
+static void
+AppendQualifiedProc (Tcl_DString *lineBufPtr,
+                     const char  *procName);
+
+static void
+PutIndexEntry (Tcl_DString *indexPtr,
+               char        *pkgName,
+               long         offset,
+               long         length,
+               Tcl_DString *procsPtr);
+
+static int
+ScanLibrary (char        *tlibFilePath,
+             char        *text,
+             int          textLen,
+             Tcl_DString *indexPtr,
+             Tcl_DString *errorPtr);
+
+static int
+BuildIndexFile (char        *tlibFilePath,
+                char        *tndxFilePath,
+                Tcl_DString *errorPtr);
+
+static void
+RunIndexBuilds (indexBuildQueue_t *queuePtr);
+
+#ifdef TCL_THREADS
+static Tcl_ThreadCreateType
+IndexBuildThread (ClientData clientData);
+#endif
+
+static void
+BuildIndexes (indexBuild_t *builds,
+              int           numBuilds,
+              int           numThreads);
+
+static void
+InitIndexBuild (indexBuild_t     *buildPtr,
+                char             *tlibFilePath,
+                indexNameClass_t  indexNameClass);
+
+static void
+FreeIndexBuild (indexBuild_t *buildPtr);
+
 static int
-BuildPackageIndex  (Tcl_Interp *interp,
-                    char       *tlibFilePath);
+LoadIndexBuild (Tcl_Interp   *interp,
+                indexBuild_t *buildPtr);
 
 static int
 LoadPackageIndex (Tcl_Interp       *interp,
@@ -113,11 +311,13 @@ LoadPackageIndex (Tcl_Interp       *interp,
                   indexNameClass_t  indexNameClass);
 
 static int
-LoadDirIndexCallback (Tcl_Interp  *interp,
-                      char        *dirPath,
-                      char        *fileName,
-                      int          caseSensitive,
-                      ClientData   clientData);
+LoadDirIndexCallback (Tcl_Interp    *interp,
+                      char          *dirPath,
+                      char          *fileName,
+                      int            caseSensitive,
+                      TclX_FileType  fileType,
+                      ClientData     dirHandle,
+                      ClientData     clientData);
 
 static int
 LoadDirIndexes (Tcl_Interp  *interp,
@@ -129,6 +329,12 @@ TclX_load_tndxsObjCmd (ClientData  clientData,
                        int         objc,
                        Tcl_Obj    *const objv[]);
                                    
+static int
+TclX_build_tndxsObjCmd (ClientData  clientData,
+                        Tcl_Interp *interp,
+                        int         objc,
+                        Tcl_Obj    *const objv[]);
+
 static int
 TclX_Auto_load_pkgObjCmd (ClientData clientData, 
                           Tcl_Interp *interp,
@@ -142,10 +348,147 @@ TclX_LoadlibindexObjCmd (ClientData clientData,
                          Tcl_Obj *const objv[]);
 
 
+/*-----------------------------------------------------------------------------
+ * LibFileMapExitHandler --
+ *
+ *   Unmap all of the library files at process exit.
+ *-----------------------------------------------------------------------------
+ */
+static void
+LibFileMapExitHandler (ClientData clientData)
+{
+    Tcl_HashEntry  *entryPtr;
+    Tcl_HashSearch  search;
+    libFileMap_t   *mapPtr;
+
+    Tcl_MutexLock (&libFileMapMutex);
+    if (libFileMapInitialized) {
+        for (entryPtr = Tcl_FirstHashEntry (&libFileMapTable, &search);
+             entryPtr != NULL; entryPtr = Tcl_NextHashEntry (&search)) {
+            mapPtr = (libFileMap_t *) Tcl_GetHashValue (entryPtr);
+            TclXOSUnmapFile (mapPtr->addr, mapPtr->size);
+            ckfree ((char *) mapPtr);
+        }
+        Tcl_DeleteHashTable (&libFileMapTable);
+        libFileMapInitialized = FALSE;
+    }
+    Tcl_MutexUnlock (&libFileMapMutex);
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadMappedFilePart --
+ *
+ *   Copy a byte range of a library file from its shared mapping, mapping the
+ * file if it isn't already mapped or has changed.  The file is checked with
+ * the mutex held, so the mapping can't be replaced between the check and the
+ * copy.
+ *
+ * Parameters:
+ *   o fileName - The native name of the file.
+ *   o offset - Byte offset into the file of the area to copy.
+ *   o length - Number of bytes to copy.
+ *   o cmdBufPtr - The bytes are returned in this dynamic string.
+ *   o fileSizePtr - The size of the file is returned here if the range is
+ *     outside of the file.
+ * Returns:
+ *   TCL_OK if the bytes were copied, TCL_BREAK if the range is outside of
+ * the file or TCL_CONTINUE if the file can't be mapped or the range contains
+ * carriage returns, which the caller must translate by reading the file.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadMappedFilePart (char        *fileName,
+                    off_t        offset,
+                    off_t        length,
+                    Tcl_DString *cmdBufPtr,
+                    off_t       *fileSizePtr)
+{
+    struct stat    statBuf;
+    Tcl_HashEntry *entryPtr;
+    libFileMap_t  *mapPtr;
+    Tcl_Channel    channel;
+    off_t          mapSize;
+    char          *addr;
+    long           statMtimeNsec;
+    int            newEntry, result;
+
+    Tcl_MutexLock (&libFileMapMutex);
+    if ((stat (fileName, &statBuf) < 0) || !S_ISREG (statBuf.st_mode) ||
+        (statBuf.st_size == 0)) {
+        Tcl_MutexUnlock (&libFileMapMutex);
+        return TCL_CONTINUE;
+    }
+#ifdef NO_STAT_MTIM
+    statMtimeNsec = 0;
+#else
+    statMtimeNsec = statBuf.st_mtim.tv_nsec;
+#endif
+
+    if (!libFileMapInitialized) {
+        Tcl_InitHashTable (&libFileMapTable, TCL_STRING_KEYS);
+        Tcl_CreateExitHandler (LibFileMapExitHandler, (ClientData) NULL);
+        libFileMapInitialized = TRUE;
+    }
+
+    entryPtr = Tcl_CreateHashEntry (&libFileMapTable, fileName, &newEntry);
+    mapPtr = newEntry ? NULL : (libFileMap_t *) Tcl_GetHashValue (entryPtr);
+    if ((mapPtr == NULL) || (mapPtr->dev != statBuf.st_dev) ||
+        (mapPtr->ino != statBuf.st_ino) ||
+        (mapPtr->mtime != statBuf.st_mtime) ||
+        (mapPtr->mtimeNsec != statMtimeNsec) ||
+        (mapPtr->size != statBuf.st_size)) {
+        /*
+         * Map the file as it is now.  The size is taken from the open file,
+         * so the mapping never extends past its end.
+         */
+        if (mapPtr != NULL) {
+            TclXOSUnmapFile (mapPtr->addr, mapPtr->size);
+            ckfree ((char *) mapPtr);
+            mapPtr = NULL;
+        }
+        channel = Tcl_OpenFileChannel (NULL, fileName, "r", 0);
+        if (channel != NULL) {
+            if ((TclXOSGetFileSize (channel, &mapSize) == TCL_OK) &&
+                (mapSize > 0) &&
+                (TclXOSMapFile (channel, mapSize, &addr) == TCL_OK)) {
+                mapPtr = (libFileMap_t *) ckalloc (sizeof (libFileMap_t));
+                mapPtr->dev = statBuf.st_dev;
+                mapPtr->ino = statBuf.st_ino;
+                mapPtr->mtime = statBuf.st_mtime;
+                mapPtr->mtimeNsec = statMtimeNsec;
+                mapPtr->size = mapSize;
+                mapPtr->addr = addr;
+            }
+            Tcl_Close (NULL, channel);
+        }
+        if (mapPtr == NULL) {
+            Tcl_DeleteHashEntry (entryPtr);
+            Tcl_MutexUnlock (&libFileMapMutex);
+            return TCL_CONTINUE;
+        }
+        Tcl_SetHashValue (entryPtr, (ClientData) mapPtr);
+    }
+
+    if ((offset < 0) || (mapPtr->size < offset + length)) {
+        *fileSizePtr = mapPtr->size;
+        result = TCL_BREAK;
+    } else if (memchr (mapPtr->addr + offset, '\r', (size_t) length) != NULL) {
+        result = TCL_CONTINUE;
+    } else {
+        Tcl_DStringSetLength (cmdBufPtr, length);
+        memcpy (Tcl_DStringValue (cmdBufPtr), mapPtr->addr + offset,
+                (size_t) length);
+        result = TCL_OK;
+    }
+    Tcl_MutexUnlock (&libFileMapMutex);
+    return result;
+}
+
 /*-----------------------------------------------------------------------------
  * EvalFilePart --
  *
- *   Read in a byte range of a file and evaulate it.
+ *   Read in a byte range of a file and evaulate it.  The range is copied
+ *   from the file's shared mapping when possible.
  *
  * Parameters:
  *   o interp - A pointer to the interpreter, error returned in result.
@@ -175,36 +518,38 @@ EvalFilePart (Tcl_Interp  *interp,
     if (fileName == NULL)
         goto errorExit;
 
-    channel = Tcl_OpenFileChannel (interp, fileName, "r", 0);
-    if (channel == NULL)
-        goto errorExit;
+    result = ReadMappedFilePart (fileName, offset, length, &cmdBuf,
+                                 &fileSize);
+    if (result == TCL_BREAK)
+        goto outOfBounds;
 
-    if (TclXOSGetFileSize (channel, &fileSize) == TCL_ERROR)
-        goto posixError;
+    if (result == TCL_CONTINUE) {
+        channel = Tcl_OpenFileChannel (interp, fileName, "r", 0);
+        if (channel == NULL)
+            goto errorExit;
 
-    if ((fileSize < offset + length) || (offset < 0)) {
-        TclX_AppendObjResult (interp,
-                              "range to eval outside of file bounds in \"",
-                              fileName, "\", index file probably corrupt",
-                              (char *) NULL);
-        goto errorExit;
-    }
+        if (TclXOSGetFileSize (channel, &fileSize) == TCL_ERROR)
+            goto posixError;
 
-    if (Tcl_Seek (channel, offset, SEEK_SET) < 0)
-        goto posixError;
+        if ((fileSize < offset + length) || (offset < 0))
+            goto outOfBounds;
 
-    Tcl_DStringSetLength (&cmdBuf, length + 1);
-    if (Tcl_Read (channel, cmdBuf.string, length) != length) {
-        if (Tcl_Eof (channel))
-            goto prematureEof;
-        else
+        if (Tcl_Seek (channel, offset, SEEK_SET) < 0)
             goto posixError;
-    }
-    cmdBuf.string [length] = '\0';
 
-    if (Tcl_Close (NULL, channel) != 0)
-        goto posixError;
-    channel = NULL;
+        Tcl_DStringSetLength (&cmdBuf, length + 1);
+        if (Tcl_Read (channel, cmdBuf.string, length) != length) {
+            if (Tcl_Eof (channel))
+                goto prematureEof;
+            else
+                goto posixError;
+        }
+        cmdBuf.string [length] = '\0';
+
+        if (Tcl_Close (NULL, channel) != 0)
+            goto posixError;
+        channel = NULL;
+    }
 
     /*
      * The internal scriptFile element changed from char* to Tcl_Obj* in 8.4.
@@ -256,6 +601,13 @@ EvalFilePart (Tcl_Interp  *interp,
                           (char *) NULL);
     goto errorExit;
 
+  outOfBounds:
+    TclX_AppendObjResult (interp,
+                          "range to eval outside of file bounds in \"",
+                          fileName, "\", index file probably corrupt",
+                          (char *) NULL);
+    goto errorExit;
+
   errorExit:
     if (channel != NULL)
         Tcl_Close (NULL, channel);
@@ -340,7 +692,8 @@ MakeAbsFile (Tcl_Interp  *interp,
  * Parameters
  *   o interp - A pointer to the interpreter, error returned in result.
  *   o packageName - Package name.
- *   o fileName - Absolute file name of the file containing the package.
+ *   o fileNameObj - Absolute file name of the file containing the package.
+ *     It is shared by all of the packages in the file.
  *   o offset - String containing the numeric start of the package.
  *   o length - String containing the numeric length of the package.
  * Returns:
@@ -350,7 +703,7 @@ MakeAbsFile (Tcl_Interp  *interp,
 static int
 SetPackageIndexEntry (Tcl_Interp *interp,
                       const char *packageName,
-                      const char *fileName,
+                      Tcl_Obj    *fileNameObj,
                       off_t       offset,
                       unsigned    length)
 {
@@ -359,7 +712,7 @@ SetPackageIndexEntry (Tcl_Interp *interp,
     /*
      * Build up the list of values to save.
      */
-    pkgDataObjv [0] = Tcl_NewStringObj (fileName, -1);
+    pkgDataObjv [0] = fileNameObj;
     pkgDataObjv [1] = Tcl_NewIntObj ((int) offset);
     pkgDataObjv [2] = Tcl_NewIntObj ((int) length);
     pkgDataPtr = Tcl_NewListObj (3, pkgDataObjv);
@@ -443,39 +796,180 @@ GetPackageIndexEntry (Tcl_Interp *interp,
 }
 
 /*-----------------------------------------------------------------------------
- * SetProcIndexEntry --
+ * ClearLazyIndex --
+ *
+ * Discard all of the pending auto_index entries of an interpreter.
+ *
+ * Parameters
+ *   o lazyPtr - The interpreter's lazy index.
+ *-----------------------------------------------------------------------------
+ */
+static void
+ClearLazyIndex (lazyIndex_t *lazyPtr)
+{
+    Tcl_HashEntry  *entryPtr;
+    Tcl_HashSearch  search;
+
+    for (entryPtr = Tcl_FirstHashEntry (lazyPtr->pendingTablePtr, &search);
+         entryPtr != NULL; entryPtr = Tcl_NextHashEntry (&search)) {
+        Tcl_DecrRefCount ((Tcl_Obj *) Tcl_GetHashValue (entryPtr));
+    }
+    Tcl_DeleteHashTable (lazyPtr->pendingTablePtr);
+    Tcl_InitHashTable (lazyPtr->pendingTablePtr, TCL_STRING_KEYS);
+}
+
+/*-----------------------------------------------------------------------------
+ * LazyIndexTrace --
+ *
+ * Trace on the auto_index array that sets pending entries when they are
+ * accessed.  Reading an element sets it from its pending entry, any array
+ * command sets all of the pending entries, and setting or unsetting an
+ * element discards its pending entry, since the new value is more recent.
+ *
+ * Parameters
+ *   o clientData - The interpreter's lazy index.
+ *   o interp - The interpreter containing the auto_index array.
+ *   o name1, name2 - Name of the variable being accessed.
+ *   o flags - The trace flags.
+ * Returns:
+ *   NULL, the variable access is never aborted.
+ *-----------------------------------------------------------------------------
+ */
+static char *
+LazyIndexTrace (ClientData  clientData,
+                Tcl_Interp *interp,
+                const char *name1,
+                const char *name2,
+                int         flags)
+{
+    lazyIndex_t    *lazyPtr = (lazyIndex_t *) clientData;
+    Tcl_HashTable  *pendingTablePtr;
+    Tcl_HashEntry  *entryPtr;
+    Tcl_HashSearch  search;
+    Tcl_Obj        *commandObj;
+
+    if (flags & TCL_TRACE_DESTROYED) {
+        ClearLazyIndex (lazyPtr);
+        lazyPtr->traced = FALSE;
+        return NULL;
+    }
+
+    if (flags & TCL_TRACE_ARRAY) {
+        /*
+         * Take all of the pending entries first, since setting the elements
+         * may call the trace again.
+         */
+        pendingTablePtr = lazyPtr->pendingTablePtr;
+        lazyPtr->pendingTablePtr =
+            (Tcl_HashTable *) ckalloc (sizeof (Tcl_HashTable));
+        Tcl_InitHashTable (lazyPtr->pendingTablePtr, TCL_STRING_KEYS);
+        for (entryPtr = Tcl_FirstHashEntry (pendingTablePtr, &search);
+             entryPtr != NULL; entryPtr = Tcl_NextHashEntry (&search)) {
+            commandObj = (Tcl_Obj *) Tcl_GetHashValue (entryPtr);
+            Tcl_SetVar2Ex (interp, AUTO_INDEX,
+                           Tcl_GetHashKey (pendingTablePtr, entryPtr),
+                           commandObj, TCL_GLOBAL_ONLY);
+            Tcl_DecrRefCount (commandObj);
+        }
+        Tcl_DeleteHashTable (pendingTablePtr);
+        ckfree ((char *) pendingTablePtr);
+        return NULL;
+    }
+
+    if (name2 == NULL)
+        return NULL;
+    entryPtr = Tcl_FindHashEntry (lazyPtr->pendingTablePtr, name2);
+    if (entryPtr == NULL)
+        return NULL;
+    commandObj = (Tcl_Obj *) Tcl_GetHashValue (entryPtr);
+    Tcl_DeleteHashEntry (entryPtr);
+
+    if (flags & TCL_TRACE_READS) {
+        Tcl_SetVar2Ex (interp, AUTO_INDEX, name2, commandObj,
+                       TCL_GLOBAL_ONLY);
+    }
+    Tcl_DecrRefCount (commandObj);
+    return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * LazyIndexCleanUp --
+ *
+ * Release an interpreter's lazy index when the interpreter is deleted.
+ *-----------------------------------------------------------------------------
+ */
+static void
+LazyIndexCleanUp (ClientData  clientData,
+                  Tcl_Interp *interp)
+{
+    lazyIndex_t *lazyPtr = (lazyIndex_t *) clientData;
+
+    if (lazyPtr->traced) {
+        Tcl_UntraceVar2 (interp, AUTO_INDEX, NULL, LAZY_INDEX_TRACE_FLAGS,
+                         LazyIndexTrace, (ClientData) lazyPtr);
+    }
+    ClearLazyIndex (lazyPtr);
+    Tcl_DeleteHashTable (lazyPtr->pendingTablePtr);
+    ckfree ((char *) lazyPtr->pendingTablePtr);
+    ckfree ((char *) lazyPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * SetLazyProcIndexEntry --
  *
- * Set the proc entry in the auto_index array.  These entry contains a command
- * to make the proc available from a package.
+ * Add a pending entry for a procedure to the auto_index array.  The first
+ * entry is set in the array, so that the array exists, and the trace that
+ * sets the rest on demand is established.
  *
  * Parameters
  *   o interp - A pointer to the interpreter, error returned in result.
  *   o procName - The Tcl proc name.
- *   o package - Pacakge containing the proc.
+ *   o commandObj - Command that loads the procedure's package.
  * Returns:
  *   TCL_OK or TCL_ERROR.
  *-----------------------------------------------------------------------------
  */
 static int
-SetProcIndexEntry (Tcl_Interp *interp,
-                   const char *procName,
-                   const char *package)
+SetLazyProcIndexEntry (Tcl_Interp *interp,
+                       const char *procName,
+                       Tcl_Obj    *commandObj)
 {
-    Tcl_DString  command;
-    const char *result;
-
-    Tcl_DStringInit (&command);
-    Tcl_DStringAppendElement (&command, "auto_load_pkg");
-    Tcl_DStringAppendElement (&command, package);
-
-    result = Tcl_SetVar2 (interp, AUTO_INDEX, procName, command.string,
-                          TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG);
+    lazyIndex_t   *lazyPtr;
+    Tcl_HashEntry *entryPtr;
+    int            newEntry;
+
+    lazyPtr = (lazyIndex_t *) Tcl_GetAssocData (interp, LAZY_INDEX_ASSOC,
+                                                NULL);
+    if (lazyPtr == NULL) {
+        lazyPtr = (lazyIndex_t *) ckalloc (sizeof (lazyIndex_t));
+        lazyPtr->pendingTablePtr =
+            (Tcl_HashTable *) ckalloc (sizeof (Tcl_HashTable));
+        Tcl_InitHashTable (lazyPtr->pendingTablePtr, TCL_STRING_KEYS);
+        lazyPtr->traced = FALSE;
+        Tcl_SetAssocData (interp, LAZY_INDEX_ASSOC, LazyIndexCleanUp,
+                          (ClientData) lazyPtr);
+    }
 
-    Tcl_DStringFree (&command);
+    if (!lazyPtr->traced) {
+        if (Tcl_SetVar2Ex (interp, AUTO_INDEX, procName, commandObj,
+                           TCL_GLOBAL_ONLY | TCL_LEAVE_ERR_MSG) == NULL)
+            return TCL_ERROR;
+        if (Tcl_TraceVar2 (interp, AUTO_INDEX, NULL, LAZY_INDEX_TRACE_FLAGS,
+                           LazyIndexTrace, (ClientData) lazyPtr) != TCL_OK)
+            return TCL_ERROR;
+        lazyPtr->traced = TRUE;
+        return TCL_OK;
+    }
 
-    return (result == NULL) ? TCL_ERROR : TCL_OK;
+    entryPtr = Tcl_CreateHashEntry (lazyPtr->pendingTablePtr, procName,
+                                    &newEntry);
+    if (!newEntry)
+        Tcl_DecrRefCount ((Tcl_Obj *) Tcl_GetHashValue (entryPtr));
+    Tcl_IncrRefCount (commandObj);
+    Tcl_SetHashValue (entryPtr, (ClientData) commandObj);
+    return TCL_OK;
 }
-
+
 /*-----------------------------------------------------------------------------
  * AddLibIndexErrorInfo --
  *
@@ -503,95 +997,152 @@ AddLibIndexErrorInfo (Tcl_Interp *interp,
 
 
 /*-----------------------------------------------------------------------------
- * ProcessIndexFile --
+ * ReleaseIndexCache --
  *
- * Open and process a package library index file (.tndx).  Creates entries
- * in the auto_index and auto_pkg_index arrays.  Existing entries are over
- * written.
+ * Release a reference to a cached package library index, freeing it when
+ * there are no more references.
+ *
+ * Parameters
+ *   o cachePtr - The cached index.
+ *-----------------------------------------------------------------------------
+ */
+static void
+ReleaseIndexCache (indexCache_t *cachePtr)
+{
+    int idx;
+
+    Tcl_MutexLock (&indexCacheMutex);
+    cachePtr->refCount--;
+    if (cachePtr->refCount > 0) {
+        Tcl_MutexUnlock (&indexCacheMutex);
+        return;
+    }
+    Tcl_MutexUnlock (&indexCacheMutex);
+
+    for (idx = 0; idx < cachePtr->numPkgs; idx++)
+        ckfree ((char *) cachePtr->pkgs [idx].pkgArgv);
+    if (cachePtr->pkgs != NULL)
+        ckfree ((char *) cachePtr->pkgs);
+    ckfree (cachePtr->text);
+    ckfree ((char *) cachePtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * IndexCacheExitHandler --
+ *
+ * Free the package library index cache at process exit.
+ *-----------------------------------------------------------------------------
+ */
+static void
+IndexCacheExitHandler (ClientData clientData)
+{
+    Tcl_HashEntry  *entryPtr;
+    Tcl_HashSearch  search;
+
+    Tcl_MutexLock (&indexCacheMutex);
+    if (!indexCacheInitialized) {
+        Tcl_MutexUnlock (&indexCacheMutex);
+        return;
+    }
+    entryPtr = Tcl_FirstHashEntry (&indexCacheTable, &search);
+    while (entryPtr != NULL) {
+        Tcl_MutexUnlock (&indexCacheMutex);
+        ReleaseIndexCache ((indexCache_t *) Tcl_GetHashValue (entryPtr));
+        Tcl_MutexLock (&indexCacheMutex);
+        entryPtr = Tcl_NextHashEntry (&search);
+    }
+    Tcl_DeleteHashTable (&indexCacheTable);
+    indexCacheInitialized = FALSE;
+    Tcl_MutexUnlock (&indexCacheMutex);
+}
+
+/*-----------------------------------------------------------------------------
+ * ParseIndexFile --
+ *
+ * Parse the contents of a package library index file (.tndx).  Each line
+ * contains the package name, its offset and length in the library and the
+ * entry procedures of the package.
  *
  * Parameters
  *   o interp - A pointer to the interpreter, error returned in result.
- *   o tlibFilePath - Absolute path name to the library file.
- *   o tndxFilePath - Absolute path name to the library file index.
+ *   o tndxFilePath - Absolute path name to the library file index, for
+ *     error messages.
+ *   o text - Contents of the index file.  A copy is saved in the result.
+ *   o textLen - Length of text.
  * Returns:
- *   TCL_OK or TCL_ERROR.
+ *   The parsed index, with a reference count of one, or NULL if an error
+ * occured.
  *-----------------------------------------------------------------------------
  */
-static int
-ProcessIndexFile (Tcl_Interp *interp,
-                  char       *tlibFilePath,
-                  char       *tndxFilePath)
+static indexCache_t *
+ParseIndexFile (Tcl_Interp *interp,
+                char       *tndxFilePath,
+                char       *text,
+                int         textLen)
 {
-    Tcl_Channel  indexChannel = NULL;
-    Tcl_DString  lineBuffer;
-    int          lineArgc, idx, result, tmpNum;
-    const char **lineArgv = NULL;
-    off_t        offset;
-    unsigned     length;
+    indexCache_t *cachePtr;
+    indexPkg_t   *pkgPtr;
+    Tcl_DString   lineBuffer;
+    char         *linePtr, *lineEnd, *textEnd = text + textLen;
+    int           numLines, pkgsSize, tmpNum;
+
+    /*
+     * Size the package array from the number of lines.
+     */
+    numLines = 0;
+    for (linePtr = text; linePtr < textEnd; linePtr++) {
+        if (*linePtr == '\n')
+            numLines++;
+    }
+    pkgsSize = numLines + 1;
+
+    cachePtr = (indexCache_t *) ckalloc (sizeof (indexCache_t));
+    cachePtr->refCount = 1;
+    cachePtr->textLen = textLen;
+    cachePtr->text = ckalloc (textLen + 1);
+    memcpy (cachePtr->text, text, textLen);
+    cachePtr->text [textLen] = '\0';
+    cachePtr->numPkgs = 0;
+    cachePtr->pkgs = (indexPkg_t *) ckalloc (pkgsSize * sizeof (indexPkg_t));
 
     Tcl_DStringInit (&lineBuffer);
 
-    indexChannel = Tcl_OpenFileChannel (interp, tndxFilePath, "r", 0);
-    if (indexChannel == NULL)
-        return TCL_ERROR;
-    
-    while (TRUE) {
+    for (linePtr = text; linePtr < textEnd; linePtr = lineEnd + 1) {
+        lineEnd = memchr (linePtr, '\n', textEnd - linePtr);
+        if (lineEnd == NULL)
+            lineEnd = textEnd;
         Tcl_DStringSetLength (&lineBuffer, 0);
-        if (Tcl_Gets (indexChannel, &lineBuffer) < 0) {
-            if (Tcl_Eof (indexChannel))
-                goto reachedEOF;
-            else
-                goto fileError;
-        }
+        Tcl_DStringAppend (&lineBuffer, linePtr, lineEnd - linePtr);
 
-        if ((Tcl_SplitList (interp, lineBuffer.string, &lineArgc,
-                            &lineArgv) != TCL_OK) || (lineArgc < 4))
+        pkgPtr = &cachePtr->pkgs [cachePtr->numPkgs];
+        if (Tcl_SplitList (interp, lineBuffer.string, &pkgPtr->pkgArgc,
+                           &pkgPtr->pkgArgv) != TCL_OK)
             goto formatError;
-        
+        cachePtr->numPkgs++;
+        if (pkgPtr->pkgArgc < 4)
+            goto formatError;
+
         /*
-         * lineArgv [0] is the package name.
-         * lineArgv [1] is the package offset in the library.
-         * lineArgv [2] is the package length in the library.
-         * lineArgv [3-n] are the entry procedures for the package.
+         * pkgArgv [0] is the package name.
+         * pkgArgv [1] is the package offset in the library.
+         * pkgArgv [2] is the package length in the library.
+         * pkgArgv [3-n] are the entry procedures for the package.
          */
-        if (Tcl_GetInt (interp, lineArgv [1], &tmpNum) != TCL_OK)
+        if (Tcl_GetInt (interp, pkgPtr->pkgArgv [1], &tmpNum) != TCL_OK)
             goto errorExit;
         if (tmpNum < 0)
             goto formatError;
-        offset = (off_t) tmpNum;
+        pkgPtr->offset = (off_t) tmpNum;
 
-        if (Tcl_GetInt (interp, lineArgv [2], &tmpNum) != TCL_OK)
+        if (Tcl_GetInt (interp, pkgPtr->pkgArgv [2], &tmpNum) != TCL_OK)
             goto errorExit;
         if (tmpNum < 0)
             goto formatError;
-        length = (unsigned) tmpNum;
-
-        result = SetPackageIndexEntry (interp, lineArgv [0], tlibFilePath,
-                                       offset, length);
-        if (result == TCL_ERROR)
-            goto errorExit;
-
-        /*
-         * If the package is not duplicated, add the commands to load
-         * the procedures.
-         */
-        if (result != TCL_CONTINUE) {
-            for (idx = 3; idx < lineArgc; idx++) {
-                if (SetProcIndexEntry (interp, lineArgv [idx],
-                                       lineArgv [0]) != TCL_OK)
-                    goto errorExit;
-            }
-        }
-        ckfree ((char *) lineArgv);
-        lineArgv = NULL;
+        pkgPtr->length = (unsigned) tmpNum;
     }
 
-  reachedEOF:
-    Tcl_DStringFree (&lineBuffer);    
-    if (Tcl_Close (NULL, indexChannel) != TCL_OK)
-        goto fileError;
-
-    return TCL_OK;
+    Tcl_DStringFree (&lineBuffer);
+    return cachePtr;
 
     /*
      * Handle format error in library input line.
@@ -601,97 +1152,694 @@ ProcessIndexFile (Tcl_Interp *interp,
     TclX_AppendObjResult (interp, "format error in library index \"",
                           tndxFilePath, "\" (", lineBuffer.string, ")",
                           (char *) NULL);
-    goto errorExit;
-
-  fileError:
-    TclX_AppendObjResult (interp, "error accessing package index file \"",
-                          tndxFilePath, "\": ", Tcl_PosixError (interp),
-                          (char *) NULL);
-    goto errorExit;
 
-    /*
-     * Error exit here, releasing resources and closing the file.
-     */
   errorExit:
-    if (lineArgv != NULL)
-        ckfree ((char *) lineArgv);
     Tcl_DStringFree (&lineBuffer);
-    if (indexChannel != NULL)
-        Tcl_Close (NULL, indexChannel);
-    return TCL_ERROR;
+    ReleaseIndexCache (cachePtr);
+    return NULL;
 }
-
+
 /*-----------------------------------------------------------------------------
- * BuildPackageIndex --
+ * ApplyIndex --
  *
- * Call the "buildpackageindex" Tcl procedure to rebuild a package index.
- * This is found in the directory pointed to by the $tclx_library variable.
+ * Create entries in the auto_index and auto_pkg_index arrays from a parsed
+ * package library index.  Existing entries are over written.  All of the
+ * procedures of a package share the same auto_index value, which is only set
+ * when the entry is first accessed.
  *
  * Parameters
  *   o interp - A pointer to the interpreter, error returned in result.
  *   o tlibFilePath - Absolute path name to the library file.
+ *   o cachePtr - The parsed index.
  * Returns:
  *   TCL_OK or TCL_ERROR.
  *-----------------------------------------------------------------------------
  */
 static int
-BuildPackageIndex (Tcl_Interp *interp, char *tlibFilePath)
+ApplyIndex (Tcl_Interp   *interp,
+            char         *tlibFilePath,
+            indexCache_t *cachePtr)
 {
-    Tcl_DString  command;
-    int          result;
-
-    Tcl_DStringInit (&command);
-
-    Tcl_DStringAppend (&command, 
-		       "if [catch {source -rsrc buildidx}] {source [file join $tclx_library buildidx.tcl]};", -1);
-    Tcl_DStringAppend (&command, "buildpackageindex ", -1);
-    Tcl_DStringAppend (&command, tlibFilePath, -1);
-
-    result = Tcl_GlobalEval (interp, command.string);
+    indexPkg_t *pkgPtr;
+    Tcl_Obj    *fileNameObj, *commandObj;
+    int         pkgIdx, idx;
+
+    fileNameObj = Tcl_NewStringObj (tlibFilePath, -1);
+    Tcl_IncrRefCount (fileNameObj);
+
+    for (pkgIdx = 0; pkgIdx < cachePtr->numPkgs; pkgIdx++) {
+        pkgPtr = &cachePtr->pkgs [pkgIdx];
+        if (SetPackageIndexEntry (interp, pkgPtr->pkgArgv [0], fileNameObj,
+                                  pkgPtr->offset,
+                                  pkgPtr->length) != TCL_OK)
+            goto errorExit;
 
-    Tcl_DStringFree (&command);
+        commandObj = Tcl_NewStringObj ("auto_load_pkg", -1);
+        Tcl_IncrRefCount (commandObj);
+        Tcl_ListObjAppendElement (NULL, commandObj,
+                                  Tcl_NewStringObj (pkgPtr->pkgArgv [0], -1));
+        for (idx = 3; idx < pkgPtr->pkgArgc; idx++) {
+            if (SetLazyProcIndexEntry (interp, pkgPtr->pkgArgv [idx],
+                                       commandObj) != TCL_OK) {
+                Tcl_DecrRefCount (commandObj);
+                goto errorExit;
+            }
+        }
+        Tcl_DecrRefCount (commandObj);
+    }
+    Tcl_DecrRefCount (fileNameObj);
+    return TCL_OK;
 
-    if (result == TCL_ERROR)
-        return TCL_ERROR;
-    Tcl_ResetResult (interp);
-    return result;
+  errorExit:
+    Tcl_DecrRefCount (fileNameObj);
+    return TCL_ERROR;
 }
-
+
 /*-----------------------------------------------------------------------------
- * LoadPackageIndex --
+ * ProcessIndexFile --
  *
- * Load a package .tndx file.  Rebuild .tndx if non-existant or out of
- * date.
+ * Open and process a package library index file (.tndx).  Creates entries
+ * in the auto_index and auto_pkg_index arrays.  Existing entries are over
+ * written.  The parsed index is cached and reused as long as the contents of
+ * the file don't change.
  *
  * Parameters
  *   o interp - A pointer to the interpreter, error returned in result.
  *   o tlibFilePath - Absolute path name to the library file.
- *   o indexNameClass - TCLLIB_TNDX if the index file should the suffix
- *     ".tndx" or TCLLIB_TND if it should have ".tnd".
+ *   o tndxFilePath - Absolute path name to the library file index.
  * Returns:
  *   TCL_OK or TCL_ERROR.
  *-----------------------------------------------------------------------------
  */
 static int
-LoadPackageIndex (Tcl_Interp       *interp,
-                  char             *tlibFilePath,
-                  indexNameClass_t  indexNameClass)
+ProcessIndexFile (Tcl_Interp *interp,
+                  char       *tlibFilePath,
+                  char       *tndxFilePath)
 {
-    Tcl_DString tndxFilePath;
+    Tcl_Channel    indexChannel;
+    Tcl_Obj       *textObj;
+    Tcl_HashEntry *entryPtr;
+    indexCache_t  *cachePtr = NULL, *oldCachePtr;
+    char          *text;
+    int            textLen, newEntry, result;
 
+    indexChannel = Tcl_OpenFileChannel (interp, tndxFilePath, "r", 0);
+    if (indexChannel == NULL)
+        return TCL_ERROR;
+
+    textObj = Tcl_NewObj ();
+    Tcl_IncrRefCount (textObj);
+    if (Tcl_ReadChars (indexChannel, textObj, -1, 0) < 0) {
+        Tcl_DecrRefCount (textObj);
+        Tcl_Close (NULL, indexChannel);
+        goto fileError;
+    }
+    if (Tcl_Close (NULL, indexChannel) != TCL_OK) {
+        Tcl_DecrRefCount (textObj);
+        goto fileError;
+    }
+    text = Tcl_GetStringFromObj (textObj, &textLen);
+
+    /*
+     * Use the cached index if the file hasn't changed.
+     */
+    Tcl_MutexLock (&indexCacheMutex);
+    if (!indexCacheInitialized) {
+        Tcl_InitHashTable (&indexCacheTable, TCL_STRING_KEYS);
+        Tcl_CreateExitHandler (IndexCacheExitHandler, (ClientData) NULL);
+        indexCacheInitialized = TRUE;
+    }
+    entryPtr = Tcl_FindHashEntry (&indexCacheTable, tndxFilePath);
+    if (entryPtr != NULL) {
+        cachePtr = (indexCache_t *) Tcl_GetHashValue (entryPtr);
+        if ((cachePtr->textLen == textLen) &&
+            (memcmp (cachePtr->text, text, textLen) == 0)) {
+            cachePtr->refCount++;
+        } else {
+            cachePtr = NULL;
+        }
+    }
+    Tcl_MutexUnlock (&indexCacheMutex);
+
+    if (cachePtr == NULL) {
+        cachePtr = ParseIndexFile (interp, tndxFilePath, text, textLen);
+        if (cachePtr == NULL) {
+            Tcl_DecrRefCount (textObj);
+            return TCL_ERROR;
+        }
+        oldCachePtr = NULL;
+        Tcl_MutexLock (&indexCacheMutex);
+        entryPtr = Tcl_CreateHashEntry (&indexCacheTable, tndxFilePath,
+                                        &newEntry);
+        if (!newEntry)
+            oldCachePtr = (indexCache_t *) Tcl_GetHashValue (entryPtr);
+        Tcl_SetHashValue (entryPtr, (ClientData) cachePtr);
+        cachePtr->refCount++;
+        Tcl_MutexUnlock (&indexCacheMutex);
+        if (oldCachePtr != NULL)
+            ReleaseIndexCache (oldCachePtr);
+    }
+    Tcl_DecrRefCount (textObj);
+
+    result = ApplyIndex (interp, tlibFilePath, cachePtr);
+    ReleaseIndexCache (cachePtr);
+    return result;
+
+  fileError:
+    TclX_AppendObjResult (interp, "error accessing package index file \"",
+                          tndxFilePath, "\": ", Tcl_PosixError (interp),
+                          (char *) NULL);
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * NextLibLine --
+ *
+ * Find the next line in the text of a package library.  A line may end with
+ * a newline, a carriage return or both, as with the "auto" translation mode.
+ *
+ * Parameters
+ *   o linePtr - Start of the line.
+ *   o textEnd - End of the library text.
+ *   o lineEndPtr - The end of the line, not including the end of line, is
+ *     returned here.
+ * Returns:
+ *   The start of the next line.
+ *-----------------------------------------------------------------------------
+ */
+static char *
+NextLibLine (char  *linePtr,
+             char  *textEnd,
+             char **lineEndPtr)
+{
+    while ((linePtr < textEnd) && (*linePtr != '\n') && (*linePtr != '\r'))
+        linePtr++;
+    *lineEndPtr = linePtr;
+    if (linePtr < textEnd) {
+        if ((*linePtr == '\r') && (linePtr + 1 < textEnd) &&
+            (linePtr [1] == '\n'))
+            linePtr++;
+        linePtr++;
+    }
+    return linePtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * AppendQualifiedProc --
+ *
+ * Append a package entry procedure name to an index line as a list element,
+ * qualified the way "auto_qualify $name ::" does it.  Global names have no
+ * leading :: (for historic reasons), all others are fully qualified.
+ *
+ * Parameters
+ *   o lineBufPtr - The index line.
+ *   o procName - The procedure name from the package header.
+ *-----------------------------------------------------------------------------
+ */
+static void
+AppendQualifiedProc (Tcl_DString *lineBufPtr,
+                     const char  *procName)
+{
+    Tcl_DString  nameBuf;
+    char        *qualName;
+    int          numSeps = 0;
+
+    /*
+     * Collapse runs of colons into "::" separators.  The name is built after
+     * a "::" so it can be returned with or without a leading separator.
+     */
+    Tcl_DStringInit (&nameBuf);
+    Tcl_DStringAppend (&nameBuf, "::", 2);
+    for (; *procName != '\0'; procName++) {
+        if ((procName [0] == ':') && (procName [1] == ':')) {
+            Tcl_DStringAppend (&nameBuf, "::", 2);
+            numSeps++;
+            while (procName [1] == ':')
+                procName++;
+        } else {
+            Tcl_DStringAppend (&nameBuf, procName, 1);
+        }
+    }
+
+    qualName = Tcl_DStringValue (&nameBuf) + 2;
+    if ((qualName [0] == ':') && (qualName [1] == ':')) {
+        if (numSeps == 1)
+            qualName += 2;
+    } else if (numSeps > 0) {
+        qualName -= 2;
+    }
+    Tcl_DStringAppendElement (lineBufPtr, qualName);
+    Tcl_DStringFree (&nameBuf);
+}
+
+/*-----------------------------------------------------------------------------
+ * PutIndexEntry --
+ *
+ * Append the line describing a package to the contents of an index.
+ *
+ * Parameters
+ *   o indexPtr - The index contents.
+ *   o pkgName - The name of the package.
+ *   o offset - The byte offset of the package in the library.
+ *   o length - Number of bytes in the package.
+ *   o procsPtr - The entry procedures, as a list.
+ *-----------------------------------------------------------------------------
+ */
+static void
+PutIndexEntry (Tcl_DString *indexPtr,
+               char        *pkgName,
+               long         offset,
+               long         length,
+               Tcl_DString *procsPtr)
+{
+    char numBuf [32];
+
+    Tcl_DStringAppendElement (indexPtr, pkgName);
+    sprintf (numBuf, "%ld", offset);
+    Tcl_DStringAppendElement (indexPtr, numBuf);
+    sprintf (numBuf, "%ld", length);
+    Tcl_DStringAppendElement (indexPtr, numBuf);
+    if (Tcl_DStringLength (procsPtr) > 0) {
+        Tcl_DStringAppend (indexPtr, " ", 1);
+        Tcl_DStringAppend (indexPtr, Tcl_DStringValue (procsPtr),
+                           Tcl_DStringLength (procsPtr));
+    }
+    Tcl_DStringAppend (indexPtr, "\n", 1);
+}
+
+/*-----------------------------------------------------------------------------
+ * ScanLibrary --
+ *
+ * Scan the text of a package library for "#@package:" headers and build the
+ * contents of its index.  Each index line contains the package name, its
+ * offset and length in the library and its entry procedures.  A package ends
+ * at a "#@packend" line or at the next package header.  The length counts an
+ * end of line as one byte, even if <cr><lf> is used, so a package can be
+ * read with a single translated read.  Doesn't use an interpreter, so it can
+ * be called from any thread.
+ *
+ * Parameters
+ *   o tlibFilePath - Path of the library file, for error messages.
+ *   o text - The untranslated contents of the library.
+ *   o textLen - Length of text.
+ *   o indexPtr - The index lines are appended to this dynamic string.
+ *   o errorPtr - An error message is returned in this dynamic string.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ScanLibrary (char        *tlibFilePath,
+             char        *text,
+             int          textLen,
+             Tcl_DString *indexPtr,
+             Tcl_DString *errorPtr)
+{
+    Tcl_DString   headerBuf, pkgName, pkgProcs;
+    char         *linePtr, *lineEnd, *nextPtr, *textEnd = text + textLen;
+    const char  **hdrArgv;
+    int           hdrArgc, hdrLen, idx, inPackage = FALSE, packageCnt = 0;
+    long          pkgOffset = 0, pkgLength = 0;
+
+    Tcl_DStringInit (&headerBuf);
+    Tcl_DStringInit (&pkgName);
+    Tcl_DStringInit (&pkgProcs);
+
+    for (linePtr = text; linePtr < textEnd; linePtr = nextPtr) {
+        nextPtr = NextLibLine (linePtr, textEnd, &lineEnd);
+
+        if ((lineEnd - linePtr >= PACKAGE_HDR_LEN) &&
+            (strncmp (linePtr, PACKAGE_HDR, PACKAGE_HDR_LEN) == 0)) {
+            Tcl_DStringSetLength (&headerBuf, 0);
+            Tcl_DStringAppend (&headerBuf, linePtr, lineEnd - linePtr);
+            if (Tcl_SplitList (NULL, Tcl_DStringValue (&headerBuf),
+                               &hdrArgc, &hdrArgv) != TCL_OK)
+                goto invalidHeader;
+            ckfree ((char *) hdrArgv);
+            if (hdrArgc < 2)
+                goto invalidHeader;
+
+            if (inPackage)
+                PutIndexEntry (indexPtr, Tcl_DStringValue (&pkgName),
+                               pkgOffset, pkgLength, &pkgProcs);
+
+            /*
+             * Join backslashed continuation lines onto the header.
+             */
+            pkgOffset = linePtr - text;
+            pkgLength = (lineEnd - linePtr) + 1;
+            hdrLen = Tcl_DStringLength (&headerBuf);
+            while ((hdrLen > 0) && ISSPACE (headerBuf.string [hdrLen - 1]))
+                hdrLen--;
+            while ((hdrLen > 0) && (headerBuf.string [hdrLen - 1] == '\\')) {
+                Tcl_DStringSetLength (&headerBuf, hdrLen - 1);
+                linePtr = nextPtr;
+                nextPtr = NextLibLine (linePtr, textEnd, &lineEnd);
+                pkgLength += (lineEnd - linePtr) + 1;
+                while ((lineEnd > linePtr) && ISSPACE (lineEnd [-1]))
+                    lineEnd--;
+                Tcl_DStringAppend (&headerBuf, " ", 1);
+                Tcl_DStringAppend (&headerBuf, linePtr, lineEnd - linePtr);
+                hdrLen = Tcl_DStringLength (&headerBuf);
+            }
+            Tcl_DStringSetLength (&headerBuf, hdrLen);
+
+            if (Tcl_SplitList (NULL, Tcl_DStringValue (&headerBuf),
+                               &hdrArgc, &hdrArgv) != TCL_OK)
+                goto invalidHeader;
+            if (hdrArgc < 2) {
+                ckfree ((char *) hdrArgv);
+                goto invalidHeader;
+            }
+            Tcl_DStringSetLength (&pkgName, 0);
+            Tcl_DStringAppend (&pkgName, hdrArgv [1], -1);
+            Tcl_DStringSetLength (&pkgProcs, 0);
+            for (idx = 2; idx < hdrArgc; idx++)
+                AppendQualifiedProc (&pkgProcs, hdrArgv [idx]);
+            ckfree ((char *) hdrArgv);
+
+            inPackage = TRUE;
+            packageCnt++;
+        } else if ((lineEnd - linePtr >= PACKAGE_END_LEN) &&
+                   (strncmp (linePtr, PACKAGE_END, PACKAGE_END_LEN) == 0)) {
+            if (!inPackage)
+                goto packendError;
+            pkgLength += (lineEnd - linePtr) + 1;
+            PutIndexEntry (indexPtr, Tcl_DStringValue (&pkgName),
+                           pkgOffset, pkgLength, &pkgProcs);
+            inPackage = FALSE;
+        } else if (inPackage) {
+            pkgLength += (lineEnd - linePtr) + 1;
+        }
+    }
+
+    if (packageCnt == 0) {
+        Tcl_DStringAppend (errorPtr, "No \"#@package:\" definitions found in ",
+                           -1);
+        Tcl_DStringAppend (errorPtr, tlibFilePath, -1);
+        goto errorExit;
+    }
+    if (inPackage)
+        PutIndexEntry (indexPtr, Tcl_DStringValue (&pkgName),
+                       pkgOffset, pkgLength, &pkgProcs);
+
+    Tcl_DStringFree (&headerBuf);
+    Tcl_DStringFree (&pkgName);
+    Tcl_DStringFree (&pkgProcs);
+    return TCL_OK;
+
+  invalidHeader:
+    Tcl_DStringAppend (errorPtr, "invalid package header \"", -1);
+    Tcl_DStringAppend (errorPtr, Tcl_DStringValue (&headerBuf), -1);
+    Tcl_DStringAppend (errorPtr, "\"", -1);
+    goto errorExit;
+
+  packendError:
+    Tcl_DStringAppend (errorPtr, "#@packend without #@package in ", -1);
+    Tcl_DStringAppend (errorPtr, tlibFilePath, -1);
+
+  errorExit:
+    Tcl_DStringFree (&headerBuf);
+    Tcl_DStringFree (&pkgName);
+    Tcl_DStringFree (&pkgProcs);
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * BuildIndexFile --
+ *
+ * Build the index file for a package library.  The index is given the same
+ * mode and, if possible, owner as the library.  Doesn't use an interpreter,
+ * so it can be called from any thread.
+ *
+ * Parameters
+ *   o tlibFilePath - Path of the library file.
+ *   o tndxFilePath - Path of the index file to create.
+ *   o errorPtr - An error message is returned in this dynamic string.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+BuildIndexFile (char        *tlibFilePath,
+                char        *tndxFilePath,
+                Tcl_DString *errorPtr)
+{
+    Tcl_Obj     *tndxPathObj;
+    Tcl_Channel  libChannel = NULL, indexChannel = NULL;
+    Tcl_DString  libText, indexText;
+    char        *errorPath;
+    int          textLen, numRead;
+#if !defined(_WIN32) && !defined(_WIN64)
     struct stat  tlibStat;
-    struct stat  tndxStat;
+#endif
 
-    Tcl_DStringInit (&tndxFilePath);
+    Tcl_DStringInit (&libText);
+    Tcl_DStringInit (&indexText);
+    tndxPathObj = Tcl_NewStringObj (tndxFilePath, -1);
+    Tcl_IncrRefCount (tndxPathObj);
+    Tcl_FSDeleteFile (tndxPathObj);
+
+    errorPath = tlibFilePath;
+    libChannel = Tcl_OpenFileChannel (NULL, tlibFilePath, "r", 0);
+    if (libChannel == NULL)
+        goto openError;
+    errorPath = tndxFilePath;
+    indexChannel = Tcl_OpenFileChannel (NULL, tndxFilePath, "w", 0666);
+    if (indexChannel == NULL)
+        goto openError;
+
+    /*
+     * Read the library untranslated, so offsets are byte offsets.
+     */
+    errorPath = tlibFilePath;
+    Tcl_SetChannelOption (NULL, libChannel, "-translation", "binary");
+    do {
+        textLen = Tcl_DStringLength (&libText);
+        Tcl_DStringSetLength (&libText, textLen + BUFSIZ);
+        numRead = Tcl_Read (libChannel, Tcl_DStringValue (&libText) + textLen,
+                            BUFSIZ);
+        if (numRead < 0)
+            goto readError;
+        Tcl_DStringSetLength (&libText, textLen + numRead);
+    } while (numRead > 0);
+
+    if (ScanLibrary (tlibFilePath, Tcl_DStringValue (&libText),
+                     Tcl_DStringLength (&libText), &indexText,
+                     errorPtr) != TCL_OK)
+        goto deleteIndex;
+
+    errorPath = tndxFilePath;
+    if (Tcl_Write (indexChannel, Tcl_DStringValue (&indexText),
+                   Tcl_DStringLength (&indexText)) < 0)
+        goto writeError;
+    if (Tcl_Close (NULL, indexChannel) != TCL_OK) {
+        indexChannel = NULL;
+        goto writeError;
+    }
+    indexChannel = NULL;
+    Tcl_Close (NULL, libChannel);
+    libChannel = NULL;
+
+    /*
+     * Set mode and ownership of the index to be the same as the library.
+     * Ignore errors if you can't set the ownership.
+     */
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (stat (tlibFilePath, &tlibStat) == 0) {
+        if (chmod (tndxFilePath, tlibStat.st_mode & 07777) < 0) {
+            Tcl_DStringAppend (errorPtr, "couldn't set mode of \"", -1);
+            goto posixError;
+        }
+        if (chown (tndxFilePath, tlibStat.st_uid, tlibStat.st_gid) < 0)
+            Tcl_SetErrno (0);
+    }
+#endif
+
+    Tcl_DecrRefCount (tndxPathObj);
+    Tcl_DStringFree (&libText);
+    Tcl_DStringFree (&indexText);
+    return TCL_OK;
+
+  openError:
+    Tcl_DStringAppend (errorPtr, "couldn't open \"", -1);
+    goto posixError;
+
+  readError:
+    Tcl_DStringAppend (errorPtr, "error reading \"", -1);
+    goto posixError;
+
+  writeError:
+    Tcl_DStringAppend (errorPtr, "error writing \"", -1);
+
+  posixError:
+    Tcl_DStringAppend (errorPtr, errorPath, -1);
+    Tcl_DStringAppend (errorPtr, "\": ", -1);
+    Tcl_DStringAppend (errorPtr, Tcl_ErrnoMsg (Tcl_GetErrno ()), -1);
+
+  deleteIndex:
+    if (indexChannel != NULL)
+        Tcl_Close (NULL, indexChannel);
+    if (libChannel != NULL)
+        Tcl_Close (NULL, libChannel);
+    Tcl_FSDeleteFile (tndxPathObj);
+    Tcl_DecrRefCount (tndxPathObj);
+    Tcl_DStringFree (&libText);
+    Tcl_DStringFree (&indexText);
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * RunIndexBuilds --
+ *
+ * Build the indexes in a queue that need building until there are none left.
+ * Called by each thread taking part in building the indexes.
+ *
+ * Parameters
+ *   o queuePtr - The queue of indexes.
+ *-----------------------------------------------------------------------------
+ */
+static void
+RunIndexBuilds (indexBuildQueue_t *queuePtr)
+{
+    indexBuild_t *buildPtr;
+    Tcl_DString   errorMsg;
+
+    Tcl_DStringInit (&errorMsg);
+    while (TRUE) {
+        Tcl_MutexLock (&queuePtr->mutex);
+        while ((queuePtr->nextBuild < queuePtr->numBuilds) &&
+               !queuePtr->builds [queuePtr->nextBuild].needBuild)
+            queuePtr->nextBuild++;
+        if (queuePtr->nextBuild >= queuePtr->numBuilds) {
+            Tcl_MutexUnlock (&queuePtr->mutex);
+            break;
+        }
+        buildPtr = &queuePtr->builds [queuePtr->nextBuild++];
+        Tcl_MutexUnlock (&queuePtr->mutex);
+
+        Tcl_DStringSetLength (&errorMsg, 0);
+        if (BuildIndexFile (buildPtr->tlibFilePath, buildPtr->tndxFilePath,
+                            &errorMsg) != TCL_OK)
+            buildPtr->errorMsg = ckstrdup (Tcl_DStringValue (&errorMsg));
+    }
+    Tcl_DStringFree (&errorMsg);
+}
+
+#ifdef TCL_THREADS
+/*-----------------------------------------------------------------------------
+ * IndexBuildThread --
+ *
+ *   Body of an index build thread.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_ThreadCreateType
+IndexBuildThread (ClientData clientData)
+{
+    RunIndexBuilds ((indexBuildQueue_t *) clientData);
+
+    Tcl_ExitThread (0);
+    TCL_THREAD_CREATE_RETURN;
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+ * BuildIndexes --
+ *
+ * Build the indexes that need building, using up to the specified number of
+ * threads.  The calling thread is one of them, so the indexes still get built
+ * if threads can't be created or Tcl was built without thread support.
+ *
+ * Parameters
+ *   o builds - The indexes, errors are returned in their errorMsg fields.
+ *   o numBuilds - The number of entries in builds.
+ *   o numThreads - The maximum number of threads to use.
+ *-----------------------------------------------------------------------------
+ */
+static void
+BuildIndexes (indexBuild_t *builds,
+              int           numBuilds,
+              int           numThreads)
+{
+    indexBuildQueue_t  queue;
+    int                idx, numStale;
+#ifdef TCL_THREADS
+    Tcl_ThreadId      *threadIds;
+    int                numWorkers, threadResult;
+#endif
+
+    numStale = 0;
+    for (idx = 0; idx < numBuilds; idx++) {
+        if (builds [idx].needBuild)
+            numStale++;
+    }
+    if (numStale == 0)
+        return;
+    if (numThreads > numStale)
+        numThreads = numStale;
+
+    queue.builds = builds;
+    queue.numBuilds = numBuilds;
+    queue.nextBuild = 0;
+    queue.mutex = NULL;
+
+#ifdef TCL_THREADS
+    threadIds = (Tcl_ThreadId *) ckalloc (numThreads * sizeof (Tcl_ThreadId));
+    for (numWorkers = 0; numWorkers < numThreads - 1; numWorkers++) {
+        if (Tcl_CreateThread (&threadIds [numWorkers], IndexBuildThread,
+                              (ClientData) &queue, TCL_THREAD_STACK_DEFAULT,
+                              TCL_THREAD_JOINABLE) != TCL_OK)
+            break;
+    }
+#endif
+
+    RunIndexBuilds (&queue);
+
+#ifdef TCL_THREADS
+    for (idx = 0; idx < numWorkers; idx++) {
+        Tcl_JoinThread (threadIds [idx], &threadResult);
+    }
+    ckfree ((char *) threadIds);
+#endif
+    Tcl_MutexFinalize (&queue.mutex);
+}
+
+/*-----------------------------------------------------------------------------
+ * InitIndexBuild --
+ *
+ * Initialize the entry for a package library index, determining if it must
+ * be rebuilt because it doesn't exist or is out of date.
+ *
+ * Parameters
+ *   o buildPtr - The entry to initialize.
+ *   o tlibFilePath - Absolute path name to the library file.
+ *   o indexNameClass - TCLLIB_TNDX if the index file should the suffix
+ *     ".tndx" or TCLLIB_TND if it should have ".tnd".
+ *-----------------------------------------------------------------------------
+ */
+static void
+InitIndexBuild (indexBuild_t     *buildPtr,
+                char             *tlibFilePath,
+                indexNameClass_t  indexNameClass)
+{
+    struct stat  tlibStat;
+    struct stat  tndxStat;
+    char        *tndxFilePath;
+    int          pathLen = strlen (tlibFilePath);
 
     /*
      * Modify library file path to be the index file path.
      */
-    Tcl_DStringAppend (&tndxFilePath, tlibFilePath, -1);
-    tndxFilePath.string [tndxFilePath.length - 3] = 'n';
-    tndxFilePath.string [tndxFilePath.length - 2] = 'd';
+    tndxFilePath = ckalloc (pathLen + 1);
+    strcpy (tndxFilePath, tlibFilePath);
+    tndxFilePath [pathLen - 3] = 'n';
+    tndxFilePath [pathLen - 2] = 'd';
     if (indexNameClass == TCLLIB_TNDX)
-        tndxFilePath.string [tndxFilePath.length - 1] = 'x';
+        tndxFilePath [pathLen - 1] = 'x';
+
+    buildPtr->tlibFilePath = ckstrdup (tlibFilePath);
+    buildPtr->tndxFilePath = tndxFilePath;
+    buildPtr->errorMsg = NULL;
 
     /*
      * Get library's modification time.  If the file can't be accessed, set
@@ -705,28 +1853,93 @@ LoadPackageIndex (Tcl_Interp       *interp,
      * Get the time for the index.  If the file does not exists or is
      * out of date, rebuild it.
      */
-    if ((stat (tndxFilePath.string, &tndxStat) < 0) ||
-        (tndxStat.st_mtime < tlibStat.st_mtime)) {
-        if (BuildPackageIndex (interp, tlibFilePath) != TCL_OK)
-            goto errorExit;
+    buildPtr->needBuild = (stat (tndxFilePath, &tndxStat) < 0) ||
+        (tndxStat.st_mtime < tlibStat.st_mtime);
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeIndexBuild --
+ *
+ * Free the contents of a package library index entry.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeIndexBuild (indexBuild_t *buildPtr)
+{
+    ckfree (buildPtr->tlibFilePath);
+    ckfree (buildPtr->tndxFilePath);
+    if (buildPtr->errorMsg != NULL)
+        ckfree (buildPtr->errorMsg);
+}
+
+/*-----------------------------------------------------------------------------
+ * LoadIndexBuild --
+ *
+ * Load a package library index once it has been rebuilt, if needed.
+ *
+ * Parameters
+ *   o interp - A pointer to the interpreter, error returned in result.
+ *   o buildPtr - The index entry.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+LoadIndexBuild (Tcl_Interp   *interp,
+                indexBuild_t *buildPtr)
+{
+    if (buildPtr->errorMsg != NULL) {
+        TclX_AppendObjResult (interp, "building package index for `",
+                              buildPtr->tlibFilePath, "' failed: ",
+                              buildPtr->errorMsg, (char *) NULL);
+        goto errorExit;
     }
 
-    if (ProcessIndexFile (interp, tlibFilePath, tndxFilePath.string) != TCL_OK)
+    if (ProcessIndexFile (interp, buildPtr->tlibFilePath,
+                          buildPtr->tndxFilePath) != TCL_OK)
         goto errorExit;
-    Tcl_DStringFree (&tndxFilePath);
     return TCL_OK;
 
   errorExit:
-    AddLibIndexErrorInfo (interp, tndxFilePath.string);
-    Tcl_DStringFree (&tndxFilePath);
-
+    AddLibIndexErrorInfo (interp, buildPtr->tndxFilePath);
     return TCL_ERROR;
 }
-
+
+/*-----------------------------------------------------------------------------
+ * LoadPackageIndex --
+ *
+ * Load a package .tndx file.  Rebuild .tndx if non-existant or out of
+ * date.
+ *
+ * Parameters
+ *   o interp - A pointer to the interpreter, error returned in result.
+ *   o tlibFilePath - Absolute path name to the library file.
+ *   o indexNameClass - TCLLIB_TNDX if the index file should the suffix
+ *     ".tndx" or TCLLIB_TND if it should have ".tnd".
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+LoadPackageIndex (Tcl_Interp       *interp,
+                  char             *tlibFilePath,
+                  indexNameClass_t  indexNameClass)
+{
+    indexBuild_t build;
+    int          result;
+
+    InitIndexBuild (&build, tlibFilePath, indexNameClass);
+    BuildIndexes (&build, 1, 1);
+    result = LoadIndexBuild (interp, &build);
+    FreeIndexBuild (&build);
+    return result;
+}
+
 /*-----------------------------------------------------------------------------
  * LoadDirIndexCallback --
  *
- *   Function called for every directory entry for LoadDirIndexes.
+ *   Function called for every directory entry for LoadDirIndexes.  Adds
+ * package libraries to the list of indexes to load.
  *
  * Parameters
  *   o interp - Interp is passed though.
@@ -734,20 +1947,23 @@ LoadPackageIndex (Tcl_Interp       *interp,
  *   o fileName - Tcl normalized file name in directory.
  *   o caseSensitive - Are the file names case sensitive?  Always
  *     TRUE on Unix.
- *   o clientData - Pointer to a boolean that is set to TRUE if an error
- *     occures while porocessing the index file.
+ *   o fileType - Type of the entry, not used.
+ *   o dirHandle - Directory handle, not used.
+ *   o clientData - Pointer to the dirIndexes_t the library is added to.
  * Returns:
- *   TCL_OK or TCL_ERROR.
+ *   TCL_OK.
  *-----------------------------------------------------------------------------
  */
 static int
-LoadDirIndexCallback (Tcl_Interp  *interp,
-                      char        *dirPath,
-                      char        *fileName,
-                      int          caseSensitive,
-                      ClientData   clientData)
+LoadDirIndexCallback (Tcl_Interp    *interp,
+                      char          *dirPath,
+                      char          *fileName,
+                      int            caseSensitive,
+                      TclX_FileType  fileType,
+                      ClientData     dirHandle,
+                      ClientData     clientData)
 {
-    int *indexErrorPtr = (int *) clientData;
+    dirIndexes_t *dirIndexesPtr = (dirIndexes_t *) clientData;
     int nameLen;
     char *chkName;
     indexNameClass_t indexNameClass;
@@ -789,29 +2005,28 @@ LoadDirIndexCallback (Tcl_Interp  *interp,
     if (access (filePath.string, R_OK) < 0)
         goto exitPoint;
 
-    /*
-     * Process the index according to its type.
-     */
-    if (LoadPackageIndex (interp, filePath.string,
-                          indexNameClass) != TCL_OK)
-        goto errorExit;
+    if (dirIndexesPtr->numBuilds == dirIndexesPtr->buildsSize) {
+        dirIndexesPtr->buildsSize = (dirIndexesPtr->buildsSize == 0) ? 8 :
+            2 * dirIndexesPtr->buildsSize;
+        dirIndexesPtr->builds = (indexBuild_t *)
+            ckrealloc ((char *) dirIndexesPtr->builds,
+                       dirIndexesPtr->buildsSize * sizeof (indexBuild_t));
+    }
+    InitIndexBuild (&dirIndexesPtr->builds [dirIndexesPtr->numBuilds++],
+                    filePath.string, indexNameClass);
 
   exitPoint:
     Tcl_DStringFree (&filePath);
     return TCL_OK;
-
-  errorExit:
-    Tcl_DStringFree (&filePath);
-    *indexErrorPtr = TRUE;
-    return TCL_ERROR;
 }
-
+
 /*-----------------------------------------------------------------------------
  * LoadDirIndexes --
  *
  *     Load the indexes for all package library (.tlib) or a Ousterhout
  *  "tclIndex" file in a directory.  Nonexistent or unreadable directories
- *  are skipped.
+ *  are skipped.  Out of date indexes in the directory are rebuilt
+ *  concurrently before any of the indexes are loaded.
  *
  * Parameters
  *   o interp - A pointer to the interpreter, error returned in result.
@@ -822,26 +2037,37 @@ LoadDirIndexCallback (Tcl_Interp  *interp,
 static int
 LoadDirIndexes (Tcl_Interp *interp, char *dirName)
 {
-    int indexError = FALSE;
+    dirIndexes_t dirIndexes;
+    int idx, result = TCL_OK;
+
+    dirIndexes.builds = NULL;
+    dirIndexes.numBuilds = 0;
+    dirIndexes.buildsSize = 0;
 
     /*
-     * This is a little tricky.  We want to skip directories we can't read,
-     * read, but if we get an error processing an index, we want
-     * to report it.  A boolean is passed in to indicate if the error
-     * returned involved parsing the file.
+     * Collecting the libraries never fails, so an error is from reading the
+     * directory, which is skipped.  Errors processing an index are reported
+     * when it's loaded, in directory order.
      */
     if (TclXOSWalkDir (interp, dirName, FALSE, /* hidden */
                        LoadDirIndexCallback,
-                       (ClientData) &indexError) == TCL_ERROR) {
-        if (!indexError) {
-            Tcl_ResetResult (interp);
-            return TCL_OK;
-        }
-        return TCL_ERROR;
+                       (ClientData) &dirIndexes) == TCL_ERROR) {
+        Tcl_ResetResult (interp);
     }
-    return TCL_OK;
+
+    BuildIndexes (dirIndexes.builds, dirIndexes.numBuilds,
+                  INDEX_BUILD_THREADS);
+    for (idx = 0; idx < dirIndexes.numBuilds; idx++) {
+        if ((result == TCL_OK) &&
+            (LoadIndexBuild (interp, &dirIndexes.builds [idx]) != TCL_OK))
+            result = TCL_ERROR;
+        FreeIndexBuild (&dirIndexes.builds [idx]);
+    }
+    if (dirIndexes.builds != NULL)
+        ckfree ((char *) dirIndexes.builds);
+    return result;
 }
-
+
 /*-----------------------------------------------------------------------------
  * TclX_load_tndxsObjCmd --
  *
@@ -866,6 +2092,94 @@ TclX_load_tndxsObjCmd (ClientData  clientData,
     return LoadDirIndexes (interp, dirname);
 }
 
+/*-----------------------------------------------------------------------------
+ * TclX_build_tndxsObjCmd --
+ *
+ *   Implements the command:
+ *      tclx_build_tndxs ?-parallel numthreads? libfilelist
+ *
+ * Which is called from buildpackageindex to build the .tndx files for a list
+ * of package libraries.
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_build_tndxsObjCmd (ClientData  clientData,
+                        Tcl_Interp *interp,
+                        int         objc,
+                        Tcl_Obj    *const objv[])
+{
+    indexBuild_t  *builds, *buildPtr;
+    Tcl_Obj      **libObjv;
+    char          *libName;
+    int            libObjc, numThreads, nameLen, idx, result;
+
+    numThreads = 1;
+    if (objc == 4) {
+        if (!STREQU (Tcl_GetStringFromObj (objv [1], NULL), "-parallel"))
+            goto argError;
+        if (Tcl_GetIntFromObj (interp, objv [2], &numThreads) != TCL_OK)
+            return TCL_ERROR;
+        if (numThreads < 1) {
+            TclX_AppendObjResult (interp, "number of threads must be ",
+                                  "greater than zero, got \"",
+                                  Tcl_GetStringFromObj (objv [2], NULL),
+                                  "\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+    } else if (objc != 2) {
+        goto argError;
+    }
+
+    if (Tcl_ListObjGetElements (interp, objv [objc - 1], &libObjc,
+                                &libObjv) != TCL_OK)
+        return TCL_ERROR;
+    if (libObjc == 0)
+        return TCL_OK;
+
+    builds = (indexBuild_t *) ckalloc (libObjc * sizeof (indexBuild_t));
+    for (idx = 0; idx < libObjc; idx++) {
+        buildPtr = &builds [idx];
+        libName = Tcl_GetStringFromObj (libObjv [idx], &nameLen);
+        buildPtr->tlibFilePath = ckstrdup (libName);
+        buildPtr->tndxFilePath = ckalloc (nameLen + 1);
+        buildPtr->errorMsg = NULL;
+        buildPtr->needBuild = (nameLen >= 5) &&
+            STREQU (libName + nameLen - 5, ".tlib");
+        if (buildPtr->needBuild) {
+            strcpy (buildPtr->tndxFilePath, libName);
+            strcpy (buildPtr->tndxFilePath + nameLen - 5, ".tndx");
+        } else {
+            buildPtr->tndxFilePath [0] = '\0';
+            buildPtr->errorMsg = ckalloc (nameLen + 64);
+            sprintf (buildPtr->errorMsg, "Package library `%s' does not %s",
+                     libName, "have the extension `.tlib'");
+        }
+    }
+
+    BuildIndexes (builds, libObjc, numThreads);
+
+    /*
+     * All of the libraries are built, the first error is returned.
+     */
+    result = TCL_OK;
+    for (idx = 0; idx < libObjc; idx++) {
+        buildPtr = &builds [idx];
+        if ((result == TCL_OK) && (buildPtr->errorMsg != NULL)) {
+            TclX_AppendObjResult (interp, "building package index for `",
+                                  buildPtr->tlibFilePath, "' failed: ",
+                                  buildPtr->errorMsg, (char *) NULL);
+            result = TCL_ERROR;
+        }
+        FreeIndexBuild (buildPtr);
+    }
+    ckfree ((char *) builds);
+    return result;
+
+  argError:
+    return TclX_WrongArgs (interp, objv [0],
+                           "?-parallel numthreads? libfilelist");
+}
+
 /*-----------------------------------------------------------------------------
  * TclX_Auto_load_pkgObjCmd --
  *
@@ -983,6 +2297,10 @@ TclX_LibraryInit (Tcl_Interp *interp)
                           TclX_load_tndxsObjCmd,
                           (ClientData) NULL,
                           (Tcl_CmdDeleteProc*) NULL);
+    Tcl_CreateObjCommand (interp, "tclx_build_tndxs",
+                          TclX_build_tndxsObjCmd,
+                          (ClientData) NULL,
+                          (Tcl_CmdDeleteProc*) NULL);
     Tcl_CreateObjCommand (interp, "auto_load_pkg",
                           TclX_Auto_load_pkgObjCmd,
                           (ClientData) NULL,
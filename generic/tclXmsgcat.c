@@ -67,6 +67,12 @@ MsgCatCleanUp (ClientData  clientData,
  */
 static void_pt msgCatTblPtr = NULL;
 
+/*
+ * Serializes creation and release of the table by interpreters in different
+ * threads.  The table itself is shared, so it handles concurrent use.
+ */
+TCL_DECLARE_MUTEX(msgCatMutex)
+
 #ifdef NO_CATGETS
 
 /*-----------------------------------------------------------------------------
@@ -328,8 +334,11 @@ MsgCatCleanUp (ClientData  clientData,
     nl_catd *catDescPtr;
     int      walkKey;
     
-    if (TclX_HandleTblUseCount (msgCatTblPtr, -1) > 0)
+    Tcl_MutexLock (&msgCatMutex);
+    if (TclX_HandleTblUseCount (msgCatTblPtr, -1) > 0) {
+        Tcl_MutexUnlock (&msgCatMutex);
         return;
+    }
 
     walkKey = -1;
     while (TRUE) {
@@ -341,6 +350,7 @@ MsgCatCleanUp (ClientData  clientData,
     }
     TclX_HandleTblRelease (msgCatTblPtr);
     msgCatTblPtr = NULL;
+    Tcl_MutexUnlock (&msgCatMutex);
 }
 
 /*-----------------------------------------------------------------------------
@@ -354,13 +364,17 @@ TclX_MsgCatInit (Tcl_Interp *interp)
 {
     /*
      * Set up the table.  It is shared between all interpreters, so the use
-     * count reflects the number of interpreters.
+     * count reflects the number of interpreters, which may be in different
+     * threads.
      */
+    Tcl_MutexLock (&msgCatMutex);
     if (msgCatTblPtr == NULL) {
-        msgCatTblPtr = TclX_HandleTblInit ("msgcat", sizeof (nl_catd), 6);
+        msgCatTblPtr = TclX_HandleTblInitShared ("msgcat", sizeof (nl_catd),
+                                                 6);
     } else {
         (void) TclX_HandleTblUseCount (msgCatTblPtr, 1);
     }
+    Tcl_MutexUnlock (&msgCatMutex);
 
     Tcl_CallWhenDeleted (interp, MsgCatCleanUp, (ClientData) NULL);
 
@@ -40,6 +40,12 @@ TclX_ForkObjCmd (ClientData clientData,
                  int objc,
                  Tcl_Obj *const objv[]);
 
+static int 
+TclX_SpawnObjCmd (ClientData clientData,
+                  Tcl_Interp *interp,
+                  int objc,
+                  Tcl_Obj *const objv[]);
+
 static int 
 TclX_WaitObjCmd (ClientData clientData,
                  Tcl_Interp *interp,
@@ -153,23 +159,265 @@ TclX_ExeclObjCmd (ClientData clientData,
     return TCL_ERROR;
 }
 
+/*-----------------------------------------------------------------------------
+ * TclX_SpawnObjCmd --
+ *   Implements the TclX spawn command:
+ *     spawn ?-argv0 argv0? ?-env envList? ?-fd fdList? prog ?argList?
+ *-----------------------------------------------------------------------------
+ */
+static int 
+TclX_SpawnObjCmd (ClientData clientData,
+                  Tcl_Interp *interp,
+                  int objc,
+                  Tcl_Obj *const objv[])
+{
+    char  *staticArgv [STATIC_ARG_SIZE];
+    char **argList = staticArgv;
+    char **envList = NULL;
+    int   *childFds = NULL;
+    Tcl_Channel *channels = NULL;
+    int nextArg = 1;
+    char *argStr;
+    int argObjc, envObjc = 0, fdObjc = 0;
+    Tcl_Obj **argObjv, **envObjv, **fdObjv;
+    Tcl_Obj *envObj = NULL, *fdObj = NULL;
+    char *path, *argv0 = NULL;
+    int idx, status, numFds = 0;
+    Tcl_DString pathBuf;
+
+    while ((nextArg < objc) &&
+           ((argStr = Tcl_GetStringFromObj (objv [nextArg], NULL)) [0] == '-')) {
+        if (nextArg == objc - 1)
+            goto wrongArgs;
+        if (STREQU (argStr, "-argv0")) {
+            argv0 = Tcl_GetStringFromObj (objv [nextArg + 1], NULL);
+        } else if (STREQU (argStr, "-env")) {
+            envObj = objv [nextArg + 1];
+        } else if (STREQU (argStr, "-fd")) {
+            fdObj = objv [nextArg + 1];
+        } else {
+            TclX_AppendObjResult (interp, "invalid option \"", argStr,
+                                  "\", expected one of \"-argv0\", \"-env\" ",
+                                  "or \"-fd\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        nextArg += 2;
+    }
+    if ((nextArg == objc) || (nextArg < objc - 2))
+        goto wrongArgs;
+
+    status = TCL_ERROR;  /* assume the worst */
+    Tcl_DStringInit (&pathBuf);
+
+    /*
+     * Build the environment from the name and value pairs.
+     */
+    if (envObj != NULL) {
+        if (Tcl_ListObjGetElements (interp, envObj,
+                                    &envObjc, &envObjv) != TCL_OK)
+            goto exitPoint;
+        if (envObjc & 1) {
+            TclX_AppendObjResult (interp, "environment list must contain ",
+                                  "name and value pairs", (char *) NULL);
+            goto exitPoint;
+        }
+        envList = (char **) ckalloc (((envObjc / 2) + 1) * sizeof (char *));
+        for (idx = 0; idx < envObjc; idx += 2) {
+            char *name, *value;
+            int nameLen, valueLen;
+
+            name = Tcl_GetStringFromObj (envObjv [idx], &nameLen);
+            value = Tcl_GetStringFromObj (envObjv [idx + 1], &valueLen);
+            envList [idx / 2] = ckalloc (nameLen + valueLen + 2);
+            memcpy (envList [idx / 2], name, nameLen);
+            envList [idx / 2] [nameLen] = '=';
+            memcpy (envList [idx / 2] + nameLen + 1, value, valueLen + 1);
+        }
+        envList [envObjc / 2] = NULL;
+    }
+
+    /*
+     * Get the file numbers to redirect and the channels to redirect them
+     * to.  Flush output channels so buffered output is not reordered with
+     * the new process's output.
+     */
+    if (fdObj != NULL) {
+        if (Tcl_ListObjGetElements (interp, fdObj,
+                                    &fdObjc, &fdObjv) != TCL_OK)
+            goto exitPoint;
+        if (fdObjc & 1) {
+            TclX_AppendObjResult (interp, "file list must contain file ",
+                                  "number and fileId pairs", (char *) NULL);
+            goto exitPoint;
+        }
+        numFds = fdObjc / 2;
+        childFds = (int *) ckalloc ((numFds + 1) * sizeof (int));
+        channels = (Tcl_Channel *) ckalloc ((numFds + 1) *
+                                            sizeof (Tcl_Channel));
+        for (idx = 0; idx < numFds; idx++) {
+            if (Tcl_GetIntFromObj (interp, fdObjv [idx * 2],
+                                   &childFds [idx]) != TCL_OK)
+                goto exitPoint;
+            if (childFds [idx] < 0) {
+                TclX_AppendObjResult (interp, "file number must be greater ",
+                                      "than or equal to zero, got \"",
+                                      Tcl_GetStringFromObj (fdObjv [idx * 2],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                goto exitPoint;
+            }
+            channels [idx] = TclX_GetOpenChannelObj (interp,
+                                                     fdObjv [idx * 2 + 1], 0);
+            if (channels [idx] == NULL)
+                goto exitPoint;
+            if ((Tcl_GetChannelMode (channels [idx]) & TCL_WRITABLE) &&
+                (Tcl_Flush (channels [idx]) != TCL_OK)) {
+                TclX_AppendObjResult (interp, "flushing ",
+                                      Tcl_GetChannelName (channels [idx]),
+                                      " failed: ", Tcl_PosixError (interp),
+                                      (char *) NULL);
+                goto exitPoint;
+            }
+        }
+    }
+
+    /*
+     * Get path or command name and build the arguments as execl does.
+     */
+    path = Tcl_TranslateFileName (interp,
+                                  Tcl_GetStringFromObj (objv [nextArg++],
+                                                        NULL),
+                                  &pathBuf);
+    if (path == NULL)
+        goto exitPoint;
+
+    if (nextArg == objc) {
+        argList [1] = NULL;
+    } else {
+        if (Tcl_ListObjGetElements (interp, objv [nextArg++],
+                                    &argObjc, &argObjv) != TCL_OK)
+            goto exitPoint;
+
+        if (argObjc > STATIC_ARG_SIZE - 2)
+            argList = (char **) ckalloc ((argObjc + 2) * sizeof (char *));
+
+        for (idx = 0; idx < argObjc; idx++) {
+            argList [idx + 1] = Tcl_GetStringFromObj (argObjv [idx], NULL);
+        }
+        argList [argObjc + 1] = NULL;
+    }
+    argList [0] = (argv0 != NULL) ? argv0 : path;
+
+    status = TclXOSspawn (interp, path, argList, envList,
+                          numFds, childFds, channels);
+
+  exitPoint:
+    if (argList != staticArgv)
+        ckfree ((char *) argList);
+    if (envList != NULL) {
+        for (idx = 0; idx < envObjc / 2; idx++)
+            ckfree (envList [idx]);
+        ckfree ((char *) envList);
+    }
+    if (childFds != NULL) {
+        ckfree ((char *) childFds);
+        ckfree ((char *) channels);
+    }
+    Tcl_DStringFree (&pathBuf);
+    return status;
+
+  wrongArgs:
+    TclX_WrongArgs (interp, objv [0],
+                    "?-argv0 argv0? ?-env envList? ?-fd fdList? prog ?argList?");
+    return TCL_ERROR;
+}
+
+#ifndef NO_WAIT4
+/*-----------------------------------------------------------------------------
+ * FormatUsage --
+ *   Format the resource usage of a child process as a keyed list.
+ *
+ * Parameters:
+ *   o usagePtr - Usage returned by wait4.
+ * Returns:
+ *   A keyed list object with the keys utime, stime and maxrss.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+FormatUsage (struct rusage *usagePtr)
+{
+    Tcl_Obj *usageObj = TclX_NewKeyedListObj ();
+
+    TclX_KeyedListSet (NULL, usageObj, "utime",
+                       Tcl_NewDoubleObj (usagePtr->ru_utime.tv_sec +
+                                         usagePtr->ru_utime.tv_usec / 1e6));
+    TclX_KeyedListSet (NULL, usageObj, "stime",
+                       Tcl_NewDoubleObj (usagePtr->ru_stime.tv_sec +
+                                         usagePtr->ru_stime.tv_usec / 1e6));
+    TclX_KeyedListSet (NULL, usageObj, "maxrss",
+                       Tcl_NewLongObj (usagePtr->ru_maxrss));
+    return usageObj;
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+ * FormatWaitStatus --
+ *   Format the status of a process returned by waitpid as a list of the
+ * pid, why it stopped and the exit code or signal.
+ *
+ * Parameters:
+ *   o pid - The process id.
+ *   o status - Status returned by waitpid.
+ *   o usageObj - If not NULL, resource usage to add as a fourth element.
+ * Returns:
+ *   The list object.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+FormatWaitStatus (pid_t pid, int status, Tcl_Obj *usageObj)
+{
+    Tcl_Obj *resultList [4];
+    int numElems = 3;
+
+    resultList [0] = Tcl_NewIntObj (pid);
+    if (WIFEXITED (status)) {
+        resultList [1] = Tcl_NewStringObj ("EXIT", -1);
+        resultList [2] = Tcl_NewIntObj (WEXITSTATUS (status));
+    } else if (WIFSIGNALED (status)) {
+        resultList [1] = Tcl_NewStringObj ("SIG", -1);
+        resultList [2] = Tcl_NewStringObj (Tcl_SignalId (WTERMSIG (status)),
+                                           -1);
+    } else {
+        resultList [1] = Tcl_NewStringObj ("STOP", -1);
+        resultList [2] = Tcl_NewStringObj (Tcl_SignalId (WSTOPSIG (status)),
+                                           -1);
+    }
+    if (usageObj != NULL)
+        resultList [numElems++] = usageObj;
+    return Tcl_NewListObj (numElems, resultList);
+}
+
 /*-----------------------------------------------------------------------------
  * TclX_WaitObjCmd --
  *   Implements the TCL wait command:
- *     wait ?-nohang? ?-untraced? ?-pgroup? ?pid?
+ *     wait ?-nohang? ?-untraced? ?-pgroup? ?-all? ?-rusage? ?pid?
  *-----------------------------------------------------------------------------
  */
-static int 
+static int
 TclX_WaitObjCmd (ClientData clientData,
                  Tcl_Interp *interp,
                  int objc,
                  Tcl_Obj *const objv[])
 {
-    int idx, options = 0, pgroup = FALSE;
+    int idx, options = 0, pgroup = FALSE, all = FALSE, usage = FALSE;
+    int numReaped = 0;
     char *argStr;
     pid_t returnedPid, pid;
     int tmpPid, status;
-    Tcl_Obj *resultList [3];
+    Tcl_Obj *statusObj, *usageObj, *allListObj = NULL;
+#ifndef NO_WAIT4
+    struct rusage rusage;
+#endif
 
     for (idx = 1; idx < objc; idx++) {
         argStr = Tcl_GetStringFromObj (objv [idx], NULL);
@@ -193,6 +441,18 @@ TclX_WaitObjCmd (ClientData clientData,
             pgroup = TRUE;
             continue;
         }
+        if (STREQU (argStr, "-all")) {
+            if (all)
+                goto usage;
+            all = TRUE;
+            continue;
+        }
+        if (STREQU (argStr, "-rusage")) {
+            if (usage)
+                goto usage;
+            usage = TRUE;
+            continue;
+        }
         goto usage;  /* None match */
     }
     /*
@@ -200,7 +460,7 @@ TclX_WaitObjCmd (ClientData clientData,
      * if supplied.
      */
     if (idx < objc - 1)
-        goto usage;  
+        goto usage;
     if (idx < objc) {
         if (Tcl_GetIntFromObj (interp, objv [idx], &tmpPid) != TCL_OK) {
             Tcl_ResetResult (interp);
@@ -219,10 +479,17 @@ TclX_WaitObjCmd (ClientData clientData,
      * Versions that don't have real waitpid have limited functionality.
      */
 #ifdef NO_WAITPID
-    if ((options != 0) || pgroup) {
-        TclX_AppendObjResult (interp, "The \"-nohang\", \"-untraced\" and ",
-                              "\"-pgroup\" options are not available on this ",
-                              "system", (char *) NULL);
+    if ((options != 0) || pgroup || all) {
+        TclX_AppendObjResult (interp, "The \"-nohang\", \"-untraced\", ",
+                              "\"-pgroup\" and \"-all\" options are not ",
+                              "available on this system", (char *) NULL);
+        return TCL_ERROR;
+    }
+#endif
+#ifdef NO_WAIT4
+    if (usage) {
+        TclX_AppendObjResult (interp, "The \"-rusage\" option is not ",
+                              "available on this system", (char *) NULL);
         return TCL_ERROR;
     }
 #endif
@@ -234,40 +501,66 @@ TclX_WaitObjCmd (ClientData clientData,
             pid = 0;
     }
 
-    returnedPid = (pid_t) TCLX_WAITPID (pid, (int *) (&status), options);
-
-    if (returnedPid < 0) {
-        Tcl_SetErrno(errno);
-        TclX_AppendObjResult (interp, "wait for process failed: ",
-                              Tcl_PosixError (interp), (char *) NULL);
-        return TCL_ERROR;
-    }
-
     /*
-     * If no process was available, return an empty status.  Otherwise return
-     * a list contain the PID and why it stopped.
+     * With -all, keep waiting until there are no more children to wait on,
+     * or, with -nohang, none that have changed state.
      */
-    if (returnedPid == 0)
-        return TCL_OK;
+    if (all)
+        allListObj = Tcl_NewListObj (0, NULL);
+
+    while (TRUE) {
+#ifndef NO_WAIT4
+        if (usage) {
+            returnedPid = (pid_t) TCLX_WAIT4 (pid, (int *) (&status), options,
+                                              &rusage);
+        } else
+#endif
+        returnedPid = (pid_t) TCLX_WAITPID (pid, (int *) (&status), options);
+
+        if (returnedPid < 0) {
+            /*
+             * Running out of children, or being interrupted after some have
+             * been reaped, ends -all with the ones collected so far.
+             */
+            if (all && ((errno == ECHILD) ||
+                        ((errno == EINTR) && (numReaped > 0))))
+                break;
+            Tcl_SetErrno(errno);
+            TclX_AppendObjResult (interp, "wait for process failed: ",
+                                  Tcl_PosixError (interp), (char *) NULL);
+            if (allListObj != NULL)
+                Tcl_DecrRefCount (allListObj);
+            return TCL_ERROR;
+        }
 
-    resultList [0] = Tcl_NewIntObj (returnedPid);
-    if (WIFEXITED (status)) {
-        resultList [1] = Tcl_NewStringObj ("EXIT", -1);
-        resultList [2] = Tcl_NewIntObj (WEXITSTATUS (status));
-    } else if (WIFSIGNALED (status)) {
-        resultList [1] = Tcl_NewStringObj ("SIG", -1);
-        resultList [2] = Tcl_NewStringObj (Tcl_SignalId (WTERMSIG (status)),
-                                           -1);
-    } else if (WIFSTOPPED (status)) {
-        resultList [1] = Tcl_NewStringObj ("STOP", -1);
-        resultList [2] = Tcl_NewStringObj (Tcl_SignalId (WSTOPSIG (status)),
-                                           -1);
+        /*
+         * If no process was available, return an empty status.  Otherwise
+         * return a list contain the PID and why it stopped.
+         */
+        if (returnedPid == 0)
+            break;
+
+        usageObj = NULL;
+#ifndef NO_WAIT4
+        if (usage)
+            usageObj = FormatUsage (&rusage);
+#endif
+        statusObj = FormatWaitStatus (returnedPid, status, usageObj);
+        if (!all) {
+            Tcl_SetObjResult (interp, statusObj);
+            return TCL_OK;
+        }
+        Tcl_ListObjAppendElement (NULL, allListObj, statusObj);
+        numReaped++;
     }
-    Tcl_SetListObj (Tcl_GetObjResult (interp), 3, resultList);
+
+    if (allListObj != NULL)
+        Tcl_SetObjResult (interp, allListObj);
     return TCL_OK;
 
   usage:
-    TclX_WrongArgs (interp, objv [0], "?-nohang? ?-untraced? ?-pgroup? ?pid?");
+    TclX_WrongArgs (interp, objv [0],
+                    "?-nohang? ?-untraced? ?-pgroup? ?-all? ?-rusage? ?pid?");
     return TCL_ERROR;
 
   invalidPid:
@@ -282,6 +575,7 @@ TclX_WaitObjCmd (ClientData clientData,
     return TCL_ERROR;
 }
 
+
 
 /*-----------------------------------------------------------------------------
  * TclX_ProcessInit --
@@ -306,6 +600,12 @@ TclX_ProcessInit (Tcl_Interp *interp)
                           (ClientData) NULL,
 			  (Tcl_CmdDeleteProc*) NULL, 0);
 
+    TclX_CreateObjCommand (interp,
+                          "spawn",
+                          TclX_SpawnObjCmd,
+                          (ClientData) NULL,
+                          (Tcl_CmdDeleteProc*) NULL, 0);
+
     TclX_CreateObjCommand (interp,
                           "wait",
                           TclX_WaitObjCmd,
@@ -2,12 +2,10 @@
  * tclXselect.c
  *
  * Select command.  This is the generic code associated with the select system
- * call.  It relies on the Unix style select, which operates on bit sets of
- * file numbers.  Platform specific code is called to translate channels into
- * file numbers, but all operations are generic.  On Win32, this only works
- * on sockets.  Ideally, it would push more code into the platform specific
- * modules and work on more file types.  However, right now, I don't see a
- * good way to do this on Win32.
+ * call.  Platform specific code is called to translate channels into file
+ * numbers and to wait on them (TclXOSPoll), which uses poll on Unix, so
+ * there is no limit on the number or value of the file numbers.  On Win32,
+ * this only works on sockets.
  *-----------------------------------------------------------------------------
  * Copyright 1991-1999 Karl Lehenbauer and Mark Diekhans.
  *
@@ -27,52 +25,154 @@
 #include "tclExtdInt.h"
 
 /*
- * A few systems (A/UX 2.0) have select but no macros, define em in this case.
+ * Data kept about a file channel.  Each channel has an entry in the array
+ * passed to TclXOSPoll.
  */
-#ifndef FD_SET
-#   define FD_SET(fd,fdset)     (fdset)->fds_bits[0] |= (1<<(fd))
-#   define FD_CLR(fd,fdset)     (fdset)->fds_bits[0] &= ~(1<<(fd))
-#   define FD_ZERO(fdset)       (fdset)->fds_bits[0] = 0
-#   define FD_ISSET(fd,fdset)   (((fdset)->fds_bits[0]) & (1<<(fd)))
-#endif
+typedef struct {
+    Tcl_Obj     *channelIdObj;
+    Tcl_Channel  channel;
+    int          pollIdx;       /* Index of the poll entry. */
+    int          pending;       /* Input is buffered. */
+} channelData_t;
 
 /*
- * Data kept about a file channel.
+ * A persistent select set, implemented by the selectset command.  Each
+ * channel in the set is registered once, with its read and write file
+ * numbers sharing a registration when they are the same.  Where the system
+ * has a persistent poll set (epoll), waiting costs time proportional to the
+ * number of ready channels.  Otherwise the registrations are kept in an
+ * array that is passed to TclXOSPoll.
  */
+typedef struct selectSet_t selectSet_t;
+
 typedef struct {
-    Tcl_Obj     *channelIdObj;
-    Tcl_Channel  channel;
-#ifdef WIN32
+    int  fnum;
+    int  events;                /* TCLX_POLL_* events. */
+    int  pollIdx;               /* Index in pollInfo without a poll set. */
+} setReg_t;
+
+typedef struct {
+    selectSet_t   *setPtr;
+    Tcl_Channel    channel;
+    Tcl_Obj       *channelIdObj;
+    Tcl_HashEntry *hashEntryPtr;
+    setReg_t       regs [2];
+    int            numRegs;
+    int            readSerial;    /* Last wait returning it readable. */
+    int            writeSerial;   /* Last wait returning it writable. */
+    int            pendingSerial; /* Last wait finding input buffered. */
+    int            candidateIdx;  /* Index in candidates, or -1. */
+} setChannel_t;
+
+struct selectSet_t {
+    char            setHandle [16];
+    TclX_PollSet   *pollSetPtr;     /* System poll set, or NULL. */
+    Tcl_HashTable   channelTable;   /* setChannel_t keyed by channel. */
+    TclX_PollInfo  *pollInfo;       /* Registrations without a poll set, */
+    int             numFnums;       /* ready files returned with one.    */
+    int             pollAlloc;
+    int             numRegs;        /* Total registrations. */
+
     /*
-     * XXX Not strictly correct, according to TclX's usage of fds, but we
-     * XXX expect noone to really being using select hardcore on Windows
+     * Channels that may have input buffered: the ones added or returned
+     * readable since the last wait, plus any that still had input buffered
+     * then.  Input is only checked for on these.
      */
-    unsigned int readFd;
-    unsigned int writeFd;
-#else
-    int readFd;
-    int writeFd;
-#endif
-} channelData_t;
+    setChannel_t  **candidates;
+    int             numCandidates;
+    int             candidatesAlloc;
+    int             waitSerial;
+};
+
+/*
+ * Default number of characters select -read reads from each channel.
+ */
+#define SELECT_READ_BUDGET 65536
 
 /*
  * Prototypes of internal functions.
  */
 static int
+GetSelectTimeout (Tcl_Interp      *interp,
+                  Tcl_Obj         *timeoutObj,
+                  struct timeval  *timeoutRecPtr,
+                  struct timeval **timeoutRecPtrPtr);
+
+static Tcl_Obj *
+ReadSelectedChannels (Tcl_Interp    *interp,
+                      TclX_PollInfo *pollInfo,
+                      int            fileDescCnt,
+                      channelData_t *channelList,
+                      int            budget);
+
+static void
+AddCandidate (selectSet_t  *setPtr,
+              setChannel_t *setChanPtr);
+
+static void
+RemoveCandidate (selectSet_t  *setPtr,
+                 setChannel_t *setChanPtr);
+
+static int
+SetChannelRegister (Tcl_Interp   *interp,
+                    setChannel_t *setChanPtr,
+                    int           events);
+
+static void
+SetChannelRemove (setChannel_t *setChanPtr);
+
+static void
+SetChannelFree (setChannel_t *setChanPtr);
+
+static void
+SetChannelCloseHandler (ClientData clientData);
+
+static void
+FreeSelectSet (selectSet_t *setPtr);
+
+static int
+SelectSetAdd (Tcl_Interp  *interp,
+              Tcl_Obj     *cmdObj,
+              selectSet_t *setPtr,
+              int          objc,
+              Tcl_Obj     *const objv[]);
+
+static int
+SelectSetRemove (Tcl_Interp  *interp,
+                 selectSet_t *setPtr,
+                 int          objc,
+                 Tcl_Obj     *const objv[]);
+
+static int
+SelectSetWait (Tcl_Interp  *interp,
+               selectSet_t *setPtr,
+               Tcl_Obj     *timeoutObj);
+
+static int
+TclX_SelectsetObjCmd (ClientData clientData,
+                      Tcl_Interp *interp,
+                      int objc,
+                      Tcl_Obj *const objv[]);
+
+static void
+SelectSetCleanUp (ClientData  clientData,
+                  Tcl_Interp *interp);
+
+static int
 ParseSelectFileList (Tcl_Interp     *interp,
                      int             chanAccess,
                      Tcl_Obj        *handleList,
-                     fd_set         *fileSetPtr,
-                     channelData_t **channelListPtr,
-                     int            *maxFileIdPtr);
+                     TclX_PollInfo **pollInfoPtr,
+                     int            *numFnumsPtr,
+                     int            *pollAllocPtr,
+                     channelData_t **channelListPtr);
 
 static int
 FindPendingData (int            fileDescCnt,
-                 channelData_t *channelList,
-                 fd_set        *fileDescSetPtr);
+                 channelData_t *channelList);
 
 static Tcl_Obj *
-ReturnSelectedFileList (fd_set        *fileDescSetPtr,
+ReturnSelectedFileList (TclX_PollInfo *pollInfo,
                         int            fileDescCnt,
                         channelData_t *channelListPtr);
 
@@ -82,7 +182,49 @@ TclX_SelectObjCmd (ClientData clientData,
                    int objc,
                    Tcl_Obj *const objv[]);
 
-
+
+/*-----------------------------------------------------------------------------
+ * GetSelectTimeout --
+ *
+ *   Parse a select timeout in seconds.  Zero is different than not
+ * specified.
+ *
+ * Parameters:
+ *   o interp - Error messages are returned in the result.
+ *   o timeoutObj (I) - The timeout, an empty value means no timeout.
+ *   o timeoutRecPtr (O) - The timeout is returned here.
+ *   o timeoutRecPtrPtr (O) - Set to timeoutRecPtr, or NULL for no timeout.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+GetSelectTimeout (Tcl_Interp *interp,
+                  Tcl_Obj *timeoutObj,
+                  struct timeval *timeoutRecPtr,
+                  struct timeval **timeoutRecPtrPtr)
+{
+    double  timeout, seconds, microseconds;
+
+    *timeoutRecPtrPtr = NULL;
+    if (TclX_IsNullObj (timeoutObj))
+        return TCL_OK;
+
+    if (Tcl_GetDoubleFromObj (interp, timeoutObj, &timeout) != TCL_OK)
+        return TCL_ERROR;
+    if (timeout < 0.0) {
+        TclX_AppendObjResult (interp, "timeout must be greater than ",
+                              "or equal to zero", (char *) NULL);
+        return TCL_ERROR;
+    }
+    seconds = floor (timeout);
+    microseconds = (timeout - seconds) * 1000000.0;
+    timeoutRecPtr->tv_sec = (long) seconds;
+    timeoutRecPtr->tv_usec = (long) microseconds;
+    *timeoutRecPtrPtr = timeoutRecPtr;
+    return TCL_OK;
+}
+
 /*-----------------------------------------------------------------------------
  * ParseSelectFileList --
  *
@@ -91,32 +233,32 @@ TclX_SelectObjCmd (ClientData clientData,
  * Parameters:
  *   o interp - Error messages are returned in the result.
  *   o chanAccess - TCL_READABLE for read direction, TCL_WRITABLE for write
- *     direction or both for both files.
+ *     direction or zero for exceptions.
  *   o handleList (I) - The list of file handles to parse, may be empty.
- *   o fileSetPtr - The select fd_set for the parsed handles is
- *     filled in.
+ *   o pollInfoPtr (I/O) - A dynamically allocated array of file numbers to
+ *     poll.  An entry is added for each handle, growing the array as needed.
+ *   o numFnumsPtr (I/O) - The number of entries in the poll array.
+ *   o pollAllocPtr (I/O) - The number of entries allocated.
  *   o channelListPtr - A pointer to a dynamically allocated list of
  *     the channels that are in the set.  If the list is empty, NULL is
  *     returned.
- *   o maxFileIdPtr (I/O) - If a file id greater than the current value is
- *     encountered, it will be set to that file id.
  * Returns:
  *   The number of files in the list, or -1 if an error occured.
- * FIX: Should really pass in access and only get channels that are 
- * requested.
  *-----------------------------------------------------------------------------
  */
 static int
 ParseSelectFileList (Tcl_Interp     *interp,
                      int             chanAccess,
                      Tcl_Obj        *handleList,
-                     fd_set         *fileSetPtr,
-                     channelData_t **channelListPtr,
-                     int            *maxFileIdPtr)
+                     TclX_PollInfo **pollInfoPtr,
+                     int            *numFnumsPtr,
+                     int            *pollAllocPtr,
+                     channelData_t **channelListPtr)
 {
-    int handleCnt, idx;
+    int handleCnt, idx, direction, fnum;
     Tcl_Obj **handleObjv;
     channelData_t *channelList;
+    TclX_PollInfo *pollEntryPtr;
 
     /*
      * Optimize empty list handling.
@@ -142,8 +284,16 @@ ParseSelectFileList (Tcl_Interp     *interp,
     channelList =
         (channelData_t*) ckalloc (sizeof (channelData_t) * handleCnt);
 
+    if (*numFnumsPtr + handleCnt > *pollAllocPtr) {
+        *pollAllocPtr = *numFnumsPtr + handleCnt;
+        *pollInfoPtr = (TclX_PollInfo *)
+            ckrealloc ((char *) *pollInfoPtr,
+                       *pollAllocPtr * sizeof (TclX_PollInfo));
+    }
+
     for (idx = 0; idx < handleCnt; idx++) {
         channelList [idx].channelIdObj = handleObjv [idx];
+        channelList [idx].pending = FALSE;
         channelList [idx].channel =
             TclX_GetOpenChannelObj (interp,
                                     handleObjv [idx],
@@ -151,28 +301,29 @@ ParseSelectFileList (Tcl_Interp     *interp,
         if (channelList [idx].channel == NULL)
             goto errorExit;
 
-        if (chanAccess & TCL_READABLE) {
-            if (TclXOSGetSelectFnum (interp, channelList [idx].channel,
-			TCL_READABLE,
-			&channelList [idx].readFd) != TCL_OK)
-                goto errorExit;
-            FD_SET (channelList [idx].readFd, fileSetPtr);
-            if ((int)channelList [idx].readFd > *maxFileIdPtr)
-                *maxFileIdPtr = (int)channelList [idx].readFd;
-        } else {
-            channelList [idx].readFd = -1;
+        /*
+         * Exceptions are checked on the read side of the channel, if it
+         * has one.
+         */
+        direction = chanAccess;
+        if (direction == 0) {
+            direction = (Tcl_GetChannelMode (channelList [idx].channel) &
+                         TCL_READABLE) ? TCL_READABLE : TCL_WRITABLE;
         }
+        if (TclXOSGetSelectFnum (interp, channelList [idx].channel,
+                                 direction, &fnum) != TCL_OK)
+            goto errorExit;
 
-        if (chanAccess & TCL_WRITABLE) {
-            if (TclXOSGetSelectFnum (interp, channelList [idx].channel,
-			TCL_WRITABLE,
-			&channelList [idx].writeFd) != TCL_OK)
-                goto errorExit;
-            FD_SET (channelList [idx].writeFd, fileSetPtr);
-            if ((int)channelList [idx].writeFd > *maxFileIdPtr)
-                *maxFileIdPtr = (int)channelList [idx].writeFd;
+        channelList [idx].pollIdx = *numFnumsPtr;
+        pollEntryPtr = &(*pollInfoPtr) [(*numFnumsPtr)++];
+        pollEntryPtr->fnum = fnum;
+        pollEntryPtr->revents = 0;
+        if (chanAccess == TCL_READABLE) {
+            pollEntryPtr->events = TCLX_POLL_READ;
+        } else if (chanAccess == TCL_WRITABLE) {
+            pollEntryPtr->events = TCLX_POLL_WRITE;
         } else {
-            channelList [idx].writeFd = -1;
+            pollEntryPtr->events = TCLX_POLL_EXCEPT;
         }
     }
 
@@ -184,7 +335,7 @@ ParseSelectFileList (Tcl_Interp     *interp,
     return -1;
 
 }
-
+
 /*-----------------------------------------------------------------------------
  * FindPendingData --
  *
@@ -193,74 +344,145 @@ ParseSelectFileList (Tcl_Interp     *interp,
  *
  * Parameters:
  *   o fileDescCnt (I) - Number of descriptors in the list.
- *   o channelListPtr (I) - A pointer to a list of the channel data for
- *     the channels to check.
- *   o fileDescSetPtr (I) - A select fd_set with will have a bit set for
- *     every file that has data pending it its buffer.
+ *   o channelListPtr (I/O) - A pointer to a list of the channel data for
+ *     the channels to check.  The pending flag is set for every channel
+ *     that has data pending it its buffer.
  * Returns:
  *   TRUE if any where found that had pending data, FALSE if none were found.
  *-----------------------------------------------------------------------------
  */
 static int
 FindPendingData (int            fileDescCnt,
-                 channelData_t *channelList,
-                 fd_set        *fileDescSetPtr)
+                 channelData_t *channelList)
 {
     int idx, found = FALSE;
 
-    FD_ZERO (fileDescSetPtr);
-
     for (idx = 0; idx < fileDescCnt; idx++) {
         if (Tcl_InputBuffered (channelList [idx].channel)) {
-            FD_SET (channelList [idx].readFd, fileDescSetPtr);
+            channelList [idx].pending = TRUE;
             found = TRUE;
         }
     }
     return found;
 }
-
+
 /*-----------------------------------------------------------------------------
  * ReturnSelectedFileList --
  *
- *   Take the resulting file descriptor sets from a select, and the
- *   list of file descritpors and build up a list of Tcl file handles.
+ *   Take the resulting events from a poll, and the list of channels and
+ *   build up a list of Tcl file handles.
  *
  * Parameters:
- *   o fileDescSetPtr (I) - The select fd_set.
+ *   o pollInfo (I) - The poll entries.
  *   o fileDescCnt (I) - Number of descriptors in the list.
- *   o channelListPtr (I) - A pointer to a list of the FILE pointers for
+ *   o channelListPtr (I) - A pointer to a list of the channel data for
  *     files that are in the set.
  * Returns:
  *   List of file handles.
  *-----------------------------------------------------------------------------
  */
 static Tcl_Obj *
-ReturnSelectedFileList (fd_set        *fileDescSetPtr,
+ReturnSelectedFileList (TclX_PollInfo *pollInfo,
                         int            fileDescCnt,
                         channelData_t *channelList)
 {
-    int idx, handleCnt;
+    int idx;
     Tcl_Obj *fileHandleList = Tcl_NewListObj (0, NULL);
 
-    handleCnt = 0;
     for (idx = 0; idx < fileDescCnt; idx++) {
-        if (((channelList [idx].readFd >= 0) &&
-             FD_ISSET (channelList [idx].readFd, fileDescSetPtr)) ||
-            ((channelList [idx].writeFd >= 0) &&
-             FD_ISSET (channelList [idx].writeFd, fileDescSetPtr))) {
+        if (channelList [idx].pending ||
+            (pollInfo [channelList [idx].pollIdx].revents != 0)) {
             Tcl_ListObjAppendElement (NULL, fileHandleList,
                                       channelList [idx].channelIdObj);
-            handleCnt++;
         }
     }
 
     return fileHandleList;
 }
-
+
+/*-----------------------------------------------------------------------------
+ * ReadSelectedChannels --
+ *
+ *   Read the data available on each ready channel of a read list, without
+ * blocking, and return a list of channel and data pairs.
+ *
+ * Parameters:
+ *   o interp (I) - Errors are returned in the result.
+ *   o pollInfo (I) - The poll entries.
+ *   o fileDescCnt (I) - Number of descriptors in the list.
+ *   o channelListPtr (I) - A pointer to a list of the channel data for
+ *     files that are in the set.
+ *   o budget (I) - The maximum number of characters to read from a channel.
+ * Returns:
+ *   The list of pairs, or NULL if an error occured.  A channel at end of
+ * file is returned with empty data.  Ready channels that turn out to have
+ * nothing to read are left out.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+ReadSelectedChannels (Tcl_Interp    *interp,
+                      TclX_PollInfo *pollInfo,
+                      int            fileDescCnt,
+                      channelData_t *channelList,
+                      int            budget)
+{
+    int idx, mode, numRead;
+    Tcl_Channel channel;
+    Tcl_Obj *dataObj;
+    Tcl_Obj *pairList = Tcl_NewListObj (0, NULL);
+
+    for (idx = 0; idx < fileDescCnt; idx++) {
+        if (!(channelList [idx].pending ||
+              (pollInfo [channelList [idx].pollIdx].revents != 0)))
+            continue;
+        channel = channelList [idx].channel;
+
+        if (TclX_GetChannelOption (interp, channel, TCLX_COPT_BLOCKING,
+                                   &mode) != TCL_OK)
+            goto errorExit;
+        if ((mode == TCLX_MODE_BLOCKING) &&
+            (TclX_SetChannelOption (interp, channel, TCLX_COPT_BLOCKING,
+                                    TCLX_MODE_NONBLOCKING) != TCL_OK))
+            goto errorExit;
+
+        dataObj = Tcl_NewObj ();
+        numRead = Tcl_ReadChars (channel, dataObj, budget, 0);
+        if (numRead < 0) {
+            TclX_AppendObjResult (interp, "error reading \"",
+                                  Tcl_GetChannelName (channel), "\": ",
+                                  Tcl_PosixError (interp), (char *) NULL);
+        }
+
+        if ((mode == TCLX_MODE_BLOCKING) &&
+            (TclX_SetChannelOption ((numRead < 0) ? NULL : interp, channel,
+                                    TCLX_COPT_BLOCKING,
+                                    TCLX_MODE_BLOCKING) != TCL_OK))
+            numRead = -1;
+        if (numRead < 0) {
+            Tcl_DecrRefCount (dataObj);
+            goto errorExit;
+        }
+
+        if ((numRead == 0) && !Tcl_Eof (channel)) {
+            Tcl_DecrRefCount (dataObj);
+            continue;
+        }
+        Tcl_ListObjAppendElement (NULL, pairList,
+                                  channelList [idx].channelIdObj);
+        Tcl_ListObjAppendElement (NULL, pairList, dataObj);
+    }
+    return pairList;
+
+  errorExit:
+    Tcl_DecrRefCount (pairList);
+    return NULL;
+}
+
 /*-----------------------------------------------------------------------------
  * TclX_SelectObjCmd --
  *  Implements the select TCL command:
  *      select readhandles ?writehandles? ?excepthandles? ?timeout?
+ *      select -read ?-budget count? readhandles ?timeout?
  *
  *  This command is extra smart in the fact that it checks for read data
  * pending in the stdio buffer first before doing a select.
@@ -268,7 +490,8 @@ ReturnSelectedFileList (fd_set        *fileDescSetPtr,
  * Results:
  *     A list in the form:
  *        {readhandles writehandles excepthandles}
- *     or {} it the timeout expired.
+ *     or {} it the timeout expired.  With -read, the data available on the
+ *     readable handles is read and a list of handle and data pairs returned.
  *-----------------------------------------------------------------------------
  */
 static int 
@@ -279,39 +502,81 @@ TclX_SelectObjCmd (ClientData clientData,
 {
     static int chanAccess [] = {TCL_READABLE, TCL_WRITABLE, 0};
     int idx;
-    fd_set fdSets [3], readPendingFDSet;
     int descCnts [3];
     channelData_t *descLists [3];
     Tcl_Obj *handleSetList [3];
-    int numSelected, maxFileId = 0, pending;
+    TclX_PollInfo *pollInfo = NULL;
+    int numFnums = 0, pollAlloc = 0;
+    int numSelected, pending, numLists, argIdx;
+    int readData = FALSE, budget = SELECT_READ_BUDGET;
     int result = TCL_ERROR;
     struct timeval  timeoutRec;
     struct timeval *timeoutRecPtr;
+    Tcl_Obj *pairList;
+    char *optStr;
 
-    if (objc < 2) {
-        return TclX_WrongArgs (interp, objv [0], 
-                      " readFileIds ?writeFileIds? ?exceptFileIds? ?timeout?");
+    /*
+     * Parse the options.  Channel names never start with a `-'.
+     */
+    for (argIdx = 1; argIdx < objc; argIdx++) {
+        optStr = Tcl_GetStringFromObj (objv [argIdx], NULL);
+        if (optStr [0] != '-')
+            break;
+        if (STREQU (optStr, "-read")) {
+            readData = TRUE;
+        } else if (STREQU (optStr, "-budget")) {
+            if (argIdx == objc - 1)
+                goto wrongArgs;
+            argIdx++;
+            if (Tcl_GetIntFromObj (interp, objv [argIdx], &budget) != TCL_OK)
+                return TCL_ERROR;
+            if (budget <= 0) {
+                TclX_AppendObjResult (interp, "budget must be greater than ",
+                                      "zero, got \"",
+                                      Tcl_GetStringFromObj (objv [argIdx],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else {
+            TclX_AppendObjResult (interp, "invalid option \"", optStr,
+                                  "\", expected one of \"-read\" or ",
+                                  "\"-budget\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+    }
+    if ((argIdx > 1) && !readData) {
+        TclX_AppendObjResult (interp, "-budget is only valid with -read",
+                              (char *) NULL);
+        return TCL_ERROR;
     }
 
+    /*
+     * With -read, only the read handles and the timeout may be given.
+     */
+    numLists = readData ? 1 : 3;
+    if ((argIdx == objc) || (readData && (objc - argIdx > 2)))
+        goto wrongArgs;
+
     /*
      * Initialize. 0 == read, 1 == write and 2 == exception.
      */
     for (idx = 0; idx < 3; idx++) {
-        FD_ZERO (&fdSets [idx]);
         descCnts [idx] = 0;
         descLists [idx] = NULL;
     }
 
     /*
-     * Parse the file handles and set everything up for the select call.
+     * Parse the file handles and set everything up for the poll call.
      */
-    for (idx = 0; (idx < 3) && (idx < objc - 1); idx++) {
+    for (idx = 0; (idx < numLists) && (idx < objc - argIdx); idx++) {
         descCnts [idx] = ParseSelectFileList (interp, 
                                               chanAccess [idx],
-                                              objv [idx + 1],
-                                              &fdSets [idx],
-                                              &descLists [idx],
-                                              &maxFileId);
+                                              objv [argIdx + idx],
+                                              &pollInfo,
+                                              &numFnums,
+                                              &pollAlloc,
+                                              &descLists [idx]);
         if (descCnts [idx] < 0)
             goto exitPoint;
     }
@@ -320,28 +585,17 @@ TclX_SelectObjCmd (ClientData clientData,
      * Get the time out.  Zero is different that not specified.
      */
     timeoutRecPtr = NULL;
-    if ((objc > 4) && !TclX_IsNullObj (objv [4])) {
-        double  timeout, seconds, microseconds;
-
-        if (Tcl_GetDoubleFromObj (interp, objv [4], &timeout) != TCL_OK)
-            goto exitPoint;
-        if (timeout < 0.0) {
-            TclX_AppendObjResult (interp, "timeout must be greater than ",
-                                  "or equal to zero", (char *) NULL);
+    if (objc - argIdx > numLists) {
+        if (GetSelectTimeout (interp, objv [argIdx + numLists], &timeoutRec,
+                              &timeoutRecPtr) != TCL_OK)
             goto exitPoint;
-        }
-        seconds = floor (timeout);
-        microseconds = (timeout - seconds) * 1000000.0;
-        timeoutRec.tv_sec = (long) seconds;
-        timeoutRec.tv_usec = (long) microseconds;
-        timeoutRecPtr = &timeoutRec;
     }
 
     /*
      * Check if any data is pending in the read buffers.  If there is,
-     * then do the select, but don't block in it.
+     * then do the poll, but don't block in it.
      */
-    pending = FindPendingData (descCnts [0], descLists [0], &readPendingFDSet);
+    pending = FindPendingData (descCnts [0], descLists [0]);
     if (pending) {
         timeoutRec.tv_sec = 0;
         timeoutRec.tv_usec = 0;
@@ -349,36 +603,27 @@ TclX_SelectObjCmd (ClientData clientData,
     }
 
     /*
-     * All set, do the select.
+     * All set, do the poll.
      */
-    numSelected = select (maxFileId + 1,
-                          &fdSets [0], &fdSets [1], &fdSets [2],
-                          timeoutRecPtr);
-    if (numSelected < 0) {
-        TclX_AppendObjResult (interp, "select error: ",
-                              Tcl_PosixError (interp), (char *) NULL);
+    numSelected = TclXOSPoll (interp, pollInfo, numFnums, timeoutRecPtr);
+    if (numSelected < 0)
         goto exitPoint;
-    }
-    
-    /*
-     * If there is read data pending in the buffers, force the bits to be set
-     * in the read fdSet.
-     */
-    if (pending) {
-        for (idx = 0; idx < descCnts [0]; idx++) {
-            if (FD_ISSET (descLists [0] [idx].readFd, &readPendingFDSet))
-                FD_SET (descLists [0] [idx].readFd, &(fdSets [0]));
-        }
-    }
 
     /*
      * Return the result, either a 3 element list, or leave the result
-     * empty if the timeout occured.
+     * empty if the timeout occured.  Channels with read data pending in
+     * their buffers are returned as readable.
      */
-    if (numSelected > 0 || pending) {
+    if (readData) {
+        pairList = ReadSelectedChannels (interp, pollInfo, descCnts [0],
+                                         descLists [0], budget);
+        if (pairList == NULL)
+            goto exitPoint;
+        Tcl_SetObjResult (interp, pairList);
+    } else if (numSelected > 0 || pending) {
         for (idx = 0; idx < 3; idx++) {
             handleSetList [idx] =
-                ReturnSelectedFileList (&fdSets [idx],
+                ReturnSelectedFileList (pollInfo,
                                         descCnts [idx],
                                         descLists [idx]);
         }
@@ -392,7 +637,589 @@ TclX_SelectObjCmd (ClientData clientData,
         if (descLists [idx] != NULL)
             ckfree ((char *) descLists [idx]);
     }
+    if (pollInfo != NULL)
+        ckfree ((char *) pollInfo);
     return result;
+
+  wrongArgs:
+    if (readData) {
+        return TclX_WrongArgs (interp, objv [0], 
+                      "-read ?-budget count? readFileIds ?timeout?");
+    }
+    return TclX_WrongArgs (interp, objv [0], 
+                      " readFileIds ?writeFileIds? ?exceptFileIds? ?timeout?");
+}
+
+/*-----------------------------------------------------------------------------
+ * AddCandidate --
+ *   Add a channel to the list of channels to check for buffered input, if
+ * it's not already there.
+ *-----------------------------------------------------------------------------
+ */
+static void
+AddCandidate (selectSet_t *setPtr, setChannel_t *setChanPtr)
+{
+    if (setChanPtr->candidateIdx >= 0)
+        return;
+    if (setPtr->numCandidates == setPtr->candidatesAlloc) {
+        setPtr->candidatesAlloc = (setPtr->candidatesAlloc == 0) ? 16 :
+            2 * setPtr->candidatesAlloc;
+        setPtr->candidates = (setChannel_t **)
+            ckrealloc ((char *) setPtr->candidates,
+                       setPtr->candidatesAlloc * sizeof (setChannel_t *));
+    }
+    setChanPtr->candidateIdx = setPtr->numCandidates;
+    setPtr->candidates [setPtr->numCandidates++] = setChanPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * RemoveCandidate --
+ *   Remove a channel from the list of channels to check for buffered input.
+ *-----------------------------------------------------------------------------
+ */
+static void
+RemoveCandidate (selectSet_t *setPtr, setChannel_t *setChanPtr)
+{
+    setChannel_t *lastPtr;
+
+    if (setChanPtr->candidateIdx < 0)
+        return;
+    lastPtr = setPtr->candidates [--setPtr->numCandidates];
+    setPtr->candidates [setChanPtr->candidateIdx] = lastPtr;
+    lastPtr->candidateIdx = setChanPtr->candidateIdx;
+    setChanPtr->candidateIdx = -1;
+}
+
+/*-----------------------------------------------------------------------------
+ * SetChannelRegister --
+ *   Register a channel's file numbers for the specified events, replacing
+ * any previous registration.
+ *
+ * Parameters:
+ *   o interp - Errors are returned in the result.
+ *   o setChanPtr - The channel entry.
+ *   o events - TCLX_POLL_READ and/or TCLX_POLL_WRITE.
+ * Returns:
+ *   TCL_OK or TCL_ERROR, in which case the channel has no registrations.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SetChannelRegister (Tcl_Interp *interp,
+                    setChannel_t *setChanPtr,
+                    int events)
+{
+    selectSet_t *setPtr = setChanPtr->setPtr;
+    setReg_t newRegs [2], *regPtr;
+    int numRegs = 0, idx, fnum;
+
+    if (events & TCLX_POLL_READ) {
+        if (TclXOSGetSelectFnum (interp, setChanPtr->channel, TCL_READABLE,
+                                 &fnum) != TCL_OK)
+            return TCL_ERROR;
+        newRegs [numRegs].fnum = fnum;
+        newRegs [numRegs++].events = TCLX_POLL_READ;
+    }
+    if (events & TCLX_POLL_WRITE) {
+        if (TclXOSGetSelectFnum (interp, setChanPtr->channel, TCL_WRITABLE,
+                                 &fnum) != TCL_OK)
+            return TCL_ERROR;
+        if ((numRegs > 0) && (newRegs [0].fnum == fnum)) {
+            newRegs [0].events |= TCLX_POLL_WRITE;
+        } else {
+            newRegs [numRegs].fnum = fnum;
+            newRegs [numRegs++].events = TCLX_POLL_WRITE;
+        }
+    }
+
+    /*
+     * Drop the old registrations and add the new ones.  This is simplest,
+     * and changing the events of a channel is rare.
+     */
+    SetChannelRemove (setChanPtr);
+
+    for (idx = 0; idx < numRegs; idx++) {
+        regPtr = &setChanPtr->regs [idx];
+        *regPtr = newRegs [idx];
+        regPtr->pollIdx = -1;
+        if (setPtr->pollSetPtr != NULL) {
+            if (TclXOSPollSetCtl (interp, setPtr->pollSetPtr, regPtr->fnum,
+                                  0, regPtr->events,
+                                  (ClientData) setChanPtr) != TCL_OK) {
+                SetChannelRemove (setChanPtr);
+                return TCL_ERROR;
+            }
+        } else {
+            if (setPtr->numFnums == setPtr->pollAlloc) {
+                setPtr->pollAlloc = (setPtr->pollAlloc == 0) ? 16 :
+                    2 * setPtr->pollAlloc;
+                setPtr->pollInfo = (TclX_PollInfo *)
+                    ckrealloc ((char *) setPtr->pollInfo,
+                               setPtr->pollAlloc * sizeof (TclX_PollInfo));
+            }
+            regPtr->pollIdx = setPtr->numFnums++;
+            setPtr->pollInfo [regPtr->pollIdx].fnum = regPtr->fnum;
+            setPtr->pollInfo [regPtr->pollIdx].events = regPtr->events;
+            setPtr->pollInfo [regPtr->pollIdx].clientData =
+                (ClientData) setChanPtr;
+        }
+        setChanPtr->numRegs++;
+        setPtr->numRegs++;
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * SetChannelRemove --
+ *   Remove a channel's registrations from a set.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SetChannelRemove (setChannel_t *setChanPtr)
+{
+    selectSet_t *setPtr = setChanPtr->setPtr;
+    setReg_t *regPtr, *movedRegPtr;
+    setChannel_t *movedChanPtr;
+    int idx, lastIdx;
+
+    while (setChanPtr->numRegs > 0) {
+        regPtr = &setChanPtr->regs [--setChanPtr->numRegs];
+        setPtr->numRegs--;
+        if (setPtr->pollSetPtr != NULL) {
+            TclXOSPollSetCtl (NULL, setPtr->pollSetPtr, regPtr->fnum,
+                              regPtr->events, 0, NULL);
+            continue;
+        }
+
+        /*
+         * Move the last registration into the hole.
+         */
+        lastIdx = --setPtr->numFnums;
+        if (regPtr->pollIdx != lastIdx) {
+            setPtr->pollInfo [regPtr->pollIdx] = setPtr->pollInfo [lastIdx];
+            movedChanPtr = (setChannel_t *)
+                setPtr->pollInfo [regPtr->pollIdx].clientData;
+            for (idx = 0; idx < movedChanPtr->numRegs; idx++) {
+                movedRegPtr = &movedChanPtr->regs [idx];
+                if (movedRegPtr->pollIdx == lastIdx)
+                    movedRegPtr->pollIdx = regPtr->pollIdx;
+            }
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * SetChannelFree --
+ *   Remove a channel from its set and free the entry.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SetChannelFree (setChannel_t *setChanPtr)
+{
+    SetChannelRemove (setChanPtr);
+    RemoveCandidate (setChanPtr->setPtr, setChanPtr);
+    Tcl_DeleteHashEntry (setChanPtr->hashEntryPtr);
+    Tcl_DecrRefCount (setChanPtr->channelIdObj);
+    ckfree ((char *) setChanPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * SetChannelCloseHandler --
+ *   Close handler for channels in a set, removes the channel from the set
+ * before its file is closed.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SetChannelCloseHandler (ClientData clientData)
+{
+    SetChannelFree ((setChannel_t *) clientData);
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeSelectSet --
+ *   Release all resources of a select set.  Doesn't free the table entry.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeSelectSet (selectSet_t *setPtr)
+{
+    Tcl_HashEntry *hashEntryPtr;
+    Tcl_HashSearch search;
+    setChannel_t *setChanPtr;
+
+    while ((hashEntryPtr = Tcl_FirstHashEntry (&setPtr->channelTable,
+                                               &search)) != NULL) {
+        setChanPtr = (setChannel_t *) Tcl_GetHashValue (hashEntryPtr);
+        Tcl_DeleteCloseHandler (setChanPtr->channel, SetChannelCloseHandler,
+                                (ClientData) setChanPtr);
+        SetChannelFree (setChanPtr);
+    }
+    Tcl_DeleteHashTable (&setPtr->channelTable);
+    if (setPtr->pollSetPtr != NULL)
+        TclXOSPollSetDelete (setPtr->pollSetPtr);
+    if (setPtr->pollInfo != NULL)
+        ckfree ((char *) setPtr->pollInfo);
+    if (setPtr->candidates != NULL)
+        ckfree ((char *) setPtr->candidates);
+    ckfree ((char *) setPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectSetAdd --
+ *   Implements the subcommand:
+ *         selectset add sethandle ?-read? ?-write? channelId ?channelId ...?
+ *   Adding a channel that is already in the set changes its events.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SelectSetAdd (Tcl_Interp *interp,
+              Tcl_Obj *cmdObj,
+              selectSet_t *setPtr,
+              int objc,
+              Tcl_Obj *const objv[])
+{
+    setChannel_t *setChanPtr;
+    Tcl_HashEntry *hashEntryPtr;
+    Tcl_Channel channel;
+    int argIdx, events = 0, access = 0, newEntry;
+    char *option;
+
+    for (argIdx = 0; argIdx < objc; argIdx++) {
+        option = Tcl_GetStringFromObj (objv [argIdx], NULL);
+        if (STREQU (option, "-read")) {
+            events |= TCLX_POLL_READ;
+            access |= TCL_READABLE;
+        } else if (STREQU (option, "-write")) {
+            events |= TCLX_POLL_WRITE;
+            access |= TCL_WRITABLE;
+        } else {
+            break;
+        }
+    }
+    if (argIdx == objc) {
+        return TclX_WrongArgs (interp, cmdObj,
+                               "add sethandle ?-read? ?-write? channelId ?...?");
+    }
+    if (events == 0) {
+        events = TCLX_POLL_READ;
+        access = TCL_READABLE;
+    }
+
+    for (; argIdx < objc; argIdx++) {
+        channel = TclX_GetOpenChannelObj (interp, objv [argIdx], access);
+        if (channel == NULL)
+            return TCL_ERROR;
+
+        hashEntryPtr = Tcl_CreateHashEntry (&setPtr->channelTable,
+                                            (char *) channel, &newEntry);
+        if (newEntry) {
+            setChanPtr = (setChannel_t *) ckalloc (sizeof (setChannel_t));
+            setChanPtr->setPtr = setPtr;
+            setChanPtr->channel = channel;
+            setChanPtr->channelIdObj =
+                Tcl_NewStringObj (Tcl_GetChannelName (channel), -1);
+            Tcl_IncrRefCount (setChanPtr->channelIdObj);
+            setChanPtr->hashEntryPtr = hashEntryPtr;
+            setChanPtr->numRegs = 0;
+            setChanPtr->readSerial = 0;
+            setChanPtr->writeSerial = 0;
+            setChanPtr->pendingSerial = 0;
+            setChanPtr->candidateIdx = -1;
+            Tcl_SetHashValue (hashEntryPtr, (ClientData) setChanPtr);
+            Tcl_CreateCloseHandler (channel, SetChannelCloseHandler,
+                                    (ClientData) setChanPtr);
+        } else {
+            setChanPtr = (setChannel_t *) Tcl_GetHashValue (hashEntryPtr);
+        }
+
+        if (SetChannelRegister (interp, setChanPtr, events) != TCL_OK) {
+            Tcl_DeleteCloseHandler (channel, SetChannelCloseHandler,
+                                    (ClientData) setChanPtr);
+            SetChannelFree (setChanPtr);
+            return TCL_ERROR;
+        }
+
+        /*
+         * It may already have input buffered.
+         */
+        if (events & TCLX_POLL_READ) {
+            AddCandidate (setPtr, setChanPtr);
+        } else {
+            RemoveCandidate (setPtr, setChanPtr);
+        }
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectSetRemove --
+ *   Implements the subcommand:
+ *         selectset remove sethandle channelId ?channelId ...?
+ *-----------------------------------------------------------------------------
+ */
+static int
+SelectSetRemove (Tcl_Interp *interp,
+                 selectSet_t *setPtr,
+                 int objc,
+                 Tcl_Obj *const objv[])
+{
+    setChannel_t *setChanPtr;
+    Tcl_HashEntry *hashEntryPtr;
+    Tcl_Channel channel;
+    int argIdx;
+
+    for (argIdx = 0; argIdx < objc; argIdx++) {
+        channel = TclX_GetOpenChannelObj (interp, objv [argIdx], 0);
+        if (channel == NULL)
+            return TCL_ERROR;
+        hashEntryPtr = Tcl_FindHashEntry (&setPtr->channelTable,
+                                          (char *) channel);
+        if (hashEntryPtr == NULL) {
+            TclX_AppendObjResult (interp, "channel \"",
+                                  Tcl_GetStringFromObj (objv [argIdx], NULL),
+                                  "\" is not in select set \"",
+                                  setPtr->setHandle, "\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        setChanPtr = (setChannel_t *) Tcl_GetHashValue (hashEntryPtr);
+        Tcl_DeleteCloseHandler (channel, SetChannelCloseHandler,
+                                (ClientData) setChanPtr);
+        SetChannelFree (setChanPtr);
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectSetWait --
+ *   Implements the subcommand:
+ *         selectset wait sethandle ?timeout?
+ *
+ *   Like select, channels with input buffered are returned as readable
+ * without blocking.
+ *
+ * Results:
+ *     A list in the form:
+ *        {readhandles writehandles}
+ *     or {} it the timeout expired.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SelectSetWait (Tcl_Interp *interp,
+               selectSet_t *setPtr,
+               Tcl_Obj *timeoutObj)
+{
+    struct timeval timeoutRec, *timeoutRecPtr = NULL;
+    setChannel_t *setChanPtr;
+    TclX_PollInfo *readyInfo;
+    Tcl_Obj *handleSetList [2];
+    int idx, numReady, pending = FALSE, serial;
+
+    if (timeoutObj != NULL) {
+        if (GetSelectTimeout (interp, timeoutObj, &timeoutRec,
+                              &timeoutRecPtr) != TCL_OK)
+            return TCL_ERROR;
+    }
+    serial = ++setPtr->waitSerial;
+
+    /*
+     * Check for buffered input.  Candidates without any are dropped, they
+     * are added back when they are next returned readable.
+     */
+    for (idx = 0; idx < setPtr->numCandidates;) {
+        setChanPtr = setPtr->candidates [idx];
+        if (Tcl_InputBuffered (setChanPtr->channel)) {
+            setChanPtr->pendingSerial = serial;
+            pending = TRUE;
+            idx++;
+        } else {
+            RemoveCandidate (setPtr, setChanPtr);
+        }
+    }
+    if (pending) {
+        timeoutRec.tv_sec = 0;
+        timeoutRec.tv_usec = 0;
+        timeoutRecPtr = &timeoutRec;
+    }
+
+    if (setPtr->pollSetPtr != NULL) {
+        if (setPtr->pollAlloc < setPtr->numRegs) {
+            setPtr->pollAlloc = setPtr->numRegs;
+            setPtr->pollInfo = (TclX_PollInfo *)
+                ckrealloc ((char *) setPtr->pollInfo,
+                           setPtr->pollAlloc * sizeof (TclX_PollInfo));
+        }
+        numReady = TclXOSPollSetWait (interp, setPtr->pollSetPtr,
+                                      setPtr->pollInfo, setPtr->numRegs,
+                                      timeoutRecPtr);
+        readyInfo = setPtr->pollInfo;
+    } else {
+        numReady = TclXOSPoll (interp, setPtr->pollInfo, setPtr->numFnums,
+                               timeoutRecPtr);
+        readyInfo = setPtr->pollInfo;
+        if (numReady > 0)
+            numReady = setPtr->numFnums;  /* Have to scan them all. */
+    }
+    if (numReady < 0)
+        return TCL_ERROR;
+    if ((numReady == 0) && !pending)
+        return TCL_OK;
+
+    handleSetList [0] = Tcl_NewListObj (0, NULL);
+    handleSetList [1] = Tcl_NewListObj (0, NULL);
+    for (idx = 0; idx < numReady; idx++) {
+        if (readyInfo [idx].revents == 0)
+            continue;
+        setChanPtr = (setChannel_t *) readyInfo [idx].clientData;
+        if ((readyInfo [idx].revents & TCLX_POLL_READ) &&
+            (setChanPtr->readSerial != serial)) {
+            setChanPtr->readSerial = serial;
+            Tcl_ListObjAppendElement (NULL, handleSetList [0],
+                                      setChanPtr->channelIdObj);
+            AddCandidate (setPtr, setChanPtr);
+        }
+        if ((readyInfo [idx].revents & TCLX_POLL_WRITE) &&
+            (setChanPtr->writeSerial != serial)) {
+            setChanPtr->writeSerial = serial;
+            Tcl_ListObjAppendElement (NULL, handleSetList [1],
+                                      setChanPtr->channelIdObj);
+        }
+    }
+    if (pending) {
+        for (idx = 0; idx < setPtr->numCandidates; idx++) {
+            setChanPtr = setPtr->candidates [idx];
+            if ((setChanPtr->pendingSerial == serial) &&
+                (setChanPtr->readSerial != serial)) {
+                setChanPtr->readSerial = serial;
+                Tcl_ListObjAppendElement (NULL, handleSetList [0],
+                                          setChanPtr->channelIdObj);
+            }
+        }
+    }
+    Tcl_SetObjResult (interp, Tcl_NewListObj (2, handleSetList));
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_SelectsetObjCmd --
+ *     Implements the TCL selectset command:
+ *         selectset create
+ *         selectset delete sethandle
+ *         selectset add sethandle ?-read? ?-write? channelId ?channelId ...?
+ *         selectset remove sethandle channelId ?channelId ...?
+ *         selectset wait sethandle ?timeout?
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_SelectsetObjCmd (ClientData clientData,
+                      Tcl_Interp *interp,
+                      int objc,
+                      Tcl_Obj *const objv[])
+{
+    void_pt setTablePtr = (void_pt) clientData;
+    selectSet_t *setPtr, **tableEntryPtr;
+    char *subCommand;
+
+    if (objc < 2)
+	return TclX_WrongArgs (interp, objv [0], "option ...");
+
+    subCommand = Tcl_GetStringFromObj (objv [1], NULL);
+
+    if (STREQU (subCommand, "create")) {
+        if (objc != 2)
+	    return TclX_WrongArgs (interp, objv [0], "create");
+
+        setPtr = (selectSet_t *) ckalloc (sizeof (selectSet_t));
+        setPtr->pollSetPtr = TclXOSPollSetCreate (interp);
+        if ((setPtr->pollSetPtr == NULL) &&
+            (Tcl_GetCharLength (Tcl_GetObjResult (interp)) > 0)) {
+            ckfree ((char *) setPtr);
+            return TCL_ERROR;
+        }
+        Tcl_InitHashTable (&setPtr->channelTable, TCL_ONE_WORD_KEYS);
+        setPtr->pollInfo = NULL;
+        setPtr->numFnums = 0;
+        setPtr->pollAlloc = 0;
+        setPtr->numRegs = 0;
+        setPtr->candidates = NULL;
+        setPtr->numCandidates = 0;
+        setPtr->candidatesAlloc = 0;
+        setPtr->waitSerial = 0;
+
+        tableEntryPtr = (selectSet_t **)
+            TclX_HandleAlloc (setTablePtr, setPtr->setHandle);
+        *tableEntryPtr = setPtr;
+
+        Tcl_SetStringObj (Tcl_GetObjResult (interp), setPtr->setHandle, -1);
+        return TCL_OK;
+    }
+
+    if (!(STREQU (subCommand, "delete") || STREQU (subCommand, "add") ||
+          STREQU (subCommand, "remove") || STREQU (subCommand, "wait"))) {
+        TclX_AppendObjResult (interp, "invalid argument, expected one of: ",
+                              "\"create\", \"delete\", \"add\", \"remove\", ",
+                              "or \"wait\"", (char *) NULL);
+        return TCL_ERROR;
+    }
+    if (objc < 3)
+        goto argError;
+
+    tableEntryPtr = (selectSet_t **)
+        TclX_HandleXlateObj (interp, setTablePtr, objv [2]);
+    if (tableEntryPtr == NULL)
+        return TCL_ERROR;
+    setPtr = *tableEntryPtr;
+
+    if (STREQU (subCommand, "delete")) {
+        if (objc != 3)
+            goto argError;
+        FreeSelectSet (setPtr);
+        TclX_HandleFree (setTablePtr, tableEntryPtr);
+        return TCL_OK;
+    }
+    if (STREQU (subCommand, "add")) {
+        return SelectSetAdd (interp, objv [0], setPtr, objc - 3, objv + 3);
+    }
+    if (STREQU (subCommand, "remove")) {
+        if (objc < 4)
+            goto argError;
+        return SelectSetRemove (interp, setPtr, objc - 3, objv + 3);
+    }
+    if (objc > 4)
+        goto argError;
+    return SelectSetWait (interp, setPtr, (objc == 4) ? objv [3] : NULL);
+
+  argError:
+    if (STREQU (subCommand, "delete")) {
+        return TclX_WrongArgs (interp, objv [0], "delete sethandle");
+    } else if (STREQU (subCommand, "remove")) {
+        return TclX_WrongArgs (interp, objv [0],
+                               "remove sethandle channelId ?...?");
+    } else if (STREQU (subCommand, "add")) {
+        return TclX_WrongArgs (interp, objv [0],
+                               "add sethandle ?-read? ?-write? channelId ?...?");
+    }
+    return TclX_WrongArgs (interp, objv [0], "wait sethandle ?timeout?");
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectSetCleanUp --
+ *     Called when the interpreter is deleted to free all select sets.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SelectSetCleanUp (ClientData clientData, Tcl_Interp *interp)
+{
+    selectSet_t **tableEntryPtr;
+    int walkKey;
+
+    walkKey = -1;
+    while (TRUE) {
+        tableEntryPtr =
+            (selectSet_t **) TclX_HandleWalk ((void_pt) clientData, &walkKey);
+        if (tableEntryPtr == NULL)
+            break;
+        FreeSelectSet (*tableEntryPtr);
+    }
+    TclX_HandleTblRelease ((void_pt) clientData);
 }
 #else /* NO_SELECT */
 /*-----------------------------------------------------------------------------
@@ -417,17 +1244,32 @@ TclX_SelectObjCmd (clientData, interp, objc, objv)
 
 /*-----------------------------------------------------------------------------
  * TclX_SelectInit --
- *     Initialize the select command.
+ *     Initialize the select and selectset commands.
  *-----------------------------------------------------------------------------
  */
 void
 TclX_SelectInit (Tcl_Interp *interp)
 {
+#ifndef NO_SELECT
+    void_pt setTablePtr;
+#endif
+
     Tcl_CreateObjCommand (interp, 
                           "select",
                           TclX_SelectObjCmd,
                           (ClientData) NULL,
                           (Tcl_CmdDeleteProc*) NULL);
+
+#ifndef NO_SELECT
+    setTablePtr = TclX_HandleTblInit ("selectset", sizeof (selectSet_t *), 10);
+    Tcl_CallWhenDeleted (interp, SelectSetCleanUp, (ClientData) setTablePtr);
+
+    Tcl_CreateObjCommand (interp, 
+                          "selectset",
+                          TclX_SelectsetObjCmd,
+                          (ClientData) setTablePtr,
+                          (Tcl_CmdDeleteProc*) NULL);
+#endif
 }
 
 
@@ -227,12 +227,60 @@ static ClientData                 appSigErrorClientData = NULL;
  */
 static unsigned signalsReceived[MAXSIG];
 
+/*
+ * Bitmap of signals that may have a non-zero count in signalsReceived, so
+ * pending signals are found without scanning every counter.  Bits are set
+ * by the signal handler, which may run on any thread, and taken a word at a
+ * time by ProcessSignals.  Without atomic operations, a bit is only a hint
+ * and taking a word returns all bits set.
+ */
+#define SIG_WORD_BITS   ((int) (sizeof (unsigned) * 8))
+#define SIG_WORDS       ((MAXSIG + SIG_WORD_BITS - 1) / SIG_WORD_BITS)
+
+static volatile unsigned signalsPending [SIG_WORDS];
+
+#ifdef __GNUC__
+#   define SIG_PENDING_SET(word, bits) \
+        __sync_fetch_and_or (&signalsPending [word], (bits))
+#   define SIG_PENDING_TAKE(word) \
+        __sync_fetch_and_and (&signalsPending [word], 0)
+#else
+#   define SIG_PENDING_SET(word, bits) (signalsPending [word] |= (bits))
+#   define SIG_PENDING_TAKE(word) (signalsPending [word] = 0, ~0U)
+#endif
+
+/*
+ * Signal delivery modes.  With "async", pending signals are processed at
+ * the next safe point after a command completes.  With "event", the signal
+ * handler writes to a pipe and signals are processed, coalesced into a
+ * single trap evaluation per signal type, when the event loop services it.
+ * wakeupPending avoids writing to the pipe for every signal in a burst.
+ * Event delivery is used while any interpreter has selected it; those
+ * interpreters are marked with SIGNAL_EVENT_ASSOC and each holds a
+ * reference to the pipe.
+ */
+static char *SIGDELIVERY_ASYNC = "async";
+static char *SIGDELIVERY_EVENT = "event";
+
+#define SIGNAL_EVENT_ASSOC "TclX_SignalEvent"
+
+static volatile int eventDelivery = FALSE;
+static volatile int wakeupPending = FALSE;
+static int          numEventInterps = 0;
+
 /*
  * Table of commands to evaluate when a signal occurs.  If the command is
  * NULL and the signal is received, an error is returned.
  */
 static char *signalTrapCmds[MAXSIG];
 
+/*
+ * Trap commands with %S already formatted in, created when the signal first
+ * occurs so the command's bytecode is kept between signals.  Not cached for
+ * commands that use %C, as they differ each time.
+ */
+static Tcl_Obj *signalTrapObjs[MAXSIG];
+
 /*
  * Prototypes of internal functions.
  */
@@ -267,17 +315,29 @@ ParseSignalSpec (Tcl_Interp *interp,
                  char       *signalStr,
                  int         allowZero);
 
+static void
+MarkSignalsPending (void);
+
+static int
+SignalsArePending (void);
+
 static RETSIGTYPE
 SignalTrap (int signalNum);
 
 static int
 FormatTrapCode  (Tcl_Interp  *interp,
                  int          signalNum,
-                 Tcl_DString *command);
+                 unsigned     count,
+                 Tcl_DString *command,
+                 int         *usedCountPtr);
+
+static void
+FreeTrapCode (int signalNum);
 
 static int
 EvalTrapCode (Tcl_Interp *interp,
-              int         signalNum);
+              int         signalNum,
+              unsigned    count);
 
 static int
 ProcessASignal (Tcl_Interp *interp,
@@ -289,6 +349,18 @@ ProcessSignals (ClientData  clientData,
                 Tcl_Interp *interp,
                 int         cmdResultCode);
 
+static void
+SignalFileProc (ClientData clientData,
+                int        mask);
+
+static int
+SetSignalDelivery (Tcl_Interp *interp,
+                   int         event);
+
+static void
+SignalEventCleanUp (ClientData  clientData,
+                    Tcl_Interp *interp);
+
 static int
 ParseSignalList (Tcl_Interp    *interp,
                  Tcl_Obj       *signalListObjPtr,
@@ -600,6 +672,52 @@ ParseSignalSpec (Tcl_Interp *interp, char *signalStr, int allowZero)
     return signalNum;
 }
 
+/*-----------------------------------------------------------------------------
+ * MarkSignalsPending --
+ *
+ *   Arrange for ProcessSignals to be called, either by marking the async
+ * handler or by waking up the event loop.  Safe to call from a signal
+ * handler.
+ *-----------------------------------------------------------------------------
+ */
+static void
+MarkSignalsPending (void)
+{
+    if (eventDelivery) {
+        if (!wakeupPending) {
+            wakeupPending = TRUE;
+            TclXOSSignalPipeWakeup ();
+        }
+    } else if (asyncHandler != NULL) {
+        Tcl_AsyncMark (asyncHandler);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * SignalsArePending --
+ *
+ *   Determine if any signal flagged in the pending bitmap has actually been
+ * received and not yet processed.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SignalsArePending (void)
+{
+    int word, bitIdx, signalNum;
+    unsigned bits;
+
+    for (word = 0; word < SIG_WORDS; word++) {
+        bits = signalsPending [word];
+        for (bitIdx = 0; bits != 0; bitIdx++, bits >>= 1) {
+            signalNum = (word * SIG_WORD_BITS) + bitIdx;
+            if ((bits & 1) && (signalNum < MAXSIG) &&
+                (signalsReceived [signalNum] != 0))
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
 /*-----------------------------------------------------------------------------
  * SignalTrap --
  *
@@ -618,8 +736,10 @@ SignalTrap (int signalNum)
      * and tell all the interpreters to call the async handler when safe.
      */
     signalsReceived [signalNum]++;
+    SIG_PENDING_SET (signalNum / SIG_WORD_BITS,
+                     1U << (signalNum % SIG_WORD_BITS));
 
-    Tcl_AsyncMark (asyncHandler);
+    MarkSignalsPending ();
 
 #ifdef NO_SIGACTION
     /*
@@ -643,20 +763,28 @@ SignalTrap (int signalNum)
 /*-----------------------------------------------------------------------------
  * FormatTrapCode --
  *     Format the signal name into the signal trap command.  Replacing %S with
- * the signal name.
+ * the signal name and %C with the number of signals the trap is run for.
  *
  * Parameters:
  *   o interp (I/O) - The interpreter to return errors in.
  *   o signalNum - The signal number of the signal that occured.
+ *   o count - Number of times the signal occured.
  *   o command - The resulting command adter the formatting.
+ *   o usedCountPtr - Set to TRUE if %C was formatted into the command.
  *-----------------------------------------------------------------------------
  */
 static int
-FormatTrapCode (Tcl_Interp *interp, int signalNum, Tcl_DString *command)
+FormatTrapCode (Tcl_Interp  *interp,
+                int          signalNum,
+                unsigned     count,
+                Tcl_DString *command,
+                int         *usedCountPtr)
 {
     char *copyPtr, *scanPtr;
+    char  countStr [32];
 
     Tcl_DStringInit (command);
+    *usedCountPtr = FALSE;
 
     copyPtr = scanPtr = signalTrapCmds [signalNum];
 
@@ -676,6 +804,12 @@ FormatTrapCode (Tcl_Interp *interp, int signalNum, Tcl_DString *command)
               Tcl_DStringAppend (command, GetSignalName (signalNum), -1);
               break;
           }
+          case 'C': {
+              sprintf (countStr, "%u", count);
+              Tcl_DStringAppend (command, countStr, -1);
+              *usedCountPtr = TRUE;
+              break;
+          }
           default:
             goto badSpec;
         }
@@ -697,48 +831,84 @@ FormatTrapCode (Tcl_Interp *interp, int signalNum, Tcl_DString *command)
         badSpec [1] = '\0';
         TclX_AppendObjResult (interp, "bad signal trap command formatting ",
                               "specification \"%", badSpec,
-                              "\", expected one of \"%%\" or \"%S\"",
+                              "\", expected one of \"%%\", \"%S\" or \"%C\"",
                               (char *) NULL);
         return TCL_ERROR;
     }
 }
 
+/*-----------------------------------------------------------------------------
+ * FreeTrapCode --
+ *     Release the trap command for a signal and its formatted object.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeTrapCode (int signalNum)
+{
+    if (signalTrapCmds [signalNum] != NULL) {
+        ckfree (signalTrapCmds [signalNum]);
+        signalTrapCmds [signalNum] = NULL;
+    }
+    if (signalTrapObjs [signalNum] != NULL) {
+        Tcl_DecrRefCount (signalTrapObjs [signalNum]);
+        signalTrapObjs [signalNum] = NULL;
+    }
+}
+
 /*-----------------------------------------------------------------------------
  * EvalTrapCode --
  *     Run code as the result of a signal.  The symbolic signal name is
  * formatted into the command replacing %S with the symbolic signal name.
+ * The formatted command is kept unless it depends on the count, so it is
+ * only compiled once.
  *
  * Parameters:
  *   o interp - The interpreter to run the signal in. If an error
  *     occures, then the result will be left in the interp.
  *   o signalNum - The signal number of the signal that occured.
+ *   o count - Number of times the signal occured, formatted for %C.
  * Return:
  *   TCL_OK or TCL_ERROR.
  *-----------------------------------------------------------------------------
  */
 static int
-EvalTrapCode (Tcl_Interp *interp, int signalNum)
+EvalTrapCode (Tcl_Interp *interp, int signalNum, unsigned count)
 {
-    int          result;
+    int          result, usedCount;
     Tcl_DString  command;
-    Tcl_Obj     *saveObjPtr;
+    Tcl_Obj     *saveObjPtr, *cmdObjPtr;
 
     saveObjPtr = TclX_SaveResultErrorInfo (interp);
     Tcl_ResetResult (interp);
 
     /*
-     * Format the signal name into the command.  This also allows the signal
-     * to be reset in the command.
+     * Format the signal name into the command, unless already done.  Hold
+     * a reference while evaluating, as the command may reset the signal.
      */
-
-    result = FormatTrapCode (interp,
-                             signalNum,
-                             &command);
-    if (result == TCL_OK)
-        result = Tcl_GlobalEval (interp, 
-                                 command.string);
-
-    Tcl_DStringFree (&command);
+    cmdObjPtr = signalTrapObjs [signalNum];
+    if (cmdObjPtr == NULL) {
+        result = FormatTrapCode (interp,
+                                 signalNum,
+                                 count,
+                                 &command,
+                                 &usedCount);
+        if (result == TCL_OK) {
+            cmdObjPtr = Tcl_NewStringObj (Tcl_DStringValue (&command),
+                                          Tcl_DStringLength (&command));
+            if (!usedCount) {
+                signalTrapObjs [signalNum] = cmdObjPtr;
+                Tcl_IncrRefCount (cmdObjPtr);
+            }
+        }
+        Tcl_DStringFree (&command);
+    } else {
+        result = TCL_OK;
+    }
+    if (result == TCL_OK) {
+        Tcl_IncrRefCount (cmdObjPtr);
+        result = Tcl_EvalObjEx (interp, cmdObjPtr, TCL_EVAL_GLOBAL);
+        Tcl_DecrRefCount (cmdObjPtr);
+    }
 
     if (result == TCL_ERROR) {
         char errorInfo [128];
@@ -776,7 +946,8 @@ ProcessASignal (Tcl_Interp *interp, int background, int signalNum)
 
     /*
      * Either return an error or evaluate code associated with this signal.
-     * If evaluating code, call it for each time the signal occured.
+     * If evaluating code, call it for each time the signal occured, or once
+     * for all of them with event delivery.
      */
     if (signalTrapCmds [signalNum] == NULL) {
         const char *signalName = GetSignalName (signalNum);
@@ -796,10 +967,15 @@ ProcessASignal (Tcl_Interp *interp, int background, int signalNum)
                                             appSigErrorClientData,
                                             background,
                                             signalNum);
+    } else if (eventDelivery) {
+        unsigned count = signalsReceived [signalNum];
+
+        signalsReceived [signalNum] -= count;
+        result = EvalTrapCode (interp, signalNum, count);
     } else {
         while (signalsReceived [signalNum] > 0) {
             (signalsReceived [signalNum])--;
-            result = EvalTrapCode (interp, signalNum);
+            result = EvalTrapCode (interp, signalNum, 1);
             if (result == TCL_ERROR)
                 break;
         }
@@ -820,7 +996,8 @@ ProcessASignal (Tcl_Interp *interp, int background, int signalNum)
  * otherwise bogus or non-existant information will be returned if this
  * routine was called somewhere besides Tcl_Eval.  If a signal was received
  * multiple times and a trap is set on it, then that trap will be executed for
- * each time the signal was received.
+ * each time the signal was received (once with event delivery).  Only the
+ * signals flagged in the pending bitmap are examined.
  * 
  * Parameters:
  *   o clientData - Not used.
@@ -844,7 +1021,8 @@ ProcessSignals (ClientData clientData, Tcl_Interp *interp, int cmdResultCode)
 {
     Tcl_Interp *sigInterp;
     Tcl_Obj    *errStateObjPtr;
-    int         signalNum, result;
+    int         signalNum, result, word, bitIdx;
+    unsigned    bits, mask;
 
     /*
      * Get the interpreter if it wasn't supplied, if none is available,
@@ -861,18 +1039,34 @@ ProcessSignals (ClientData clientData, Tcl_Interp *interp, int cmdResultCode)
     errStateObjPtr = TclX_SaveResultErrorInfo (sigInterp);
 
     /*
-     * Process all signals.  Don't process any more if one returns an error.
+     * Process all pending signals.  Don't process any more if one returns an
+     * error, putting back the pending bits that were taken but not handled.
      */
     result = TCL_OK;
 
-    for (signalNum = 1; signalNum < MAXSIG; signalNum++) {
-        if (signalsReceived [signalNum] == 0)
-            continue;
-        result = ProcessASignal (sigInterp,
-                                 (interp == NULL),
-                                 signalNum);
-        if (result == TCL_ERROR)
-            break;
+    for (word = 0; (word < SIG_WORDS) && (result != TCL_ERROR); word++) {
+        bits = SIG_PENDING_TAKE (word);
+        for (bitIdx = 0; bits != 0; bitIdx++) {
+            mask = 1U << bitIdx;
+            if ((bits & mask) == 0)
+                continue;
+            bits &= ~mask;
+            signalNum = (word * SIG_WORD_BITS) + bitIdx;
+            if ((signalNum == 0) || (signalNum >= MAXSIG))
+                continue;
+            if (signalsReceived [signalNum] == 0)
+                continue;
+            result = ProcessASignal (sigInterp,
+                                     (interp == NULL),
+                                     signalNum);
+            if (result == TCL_ERROR) {
+                if (signalsReceived [signalNum] != 0)
+                    bits |= mask;
+                if (bits != 0)
+                    SIG_PENDING_SET (word, bits);
+                break;
+            }
+        }
     }
 
     /*
@@ -889,14 +1083,8 @@ ProcessSignals (ClientData clientData, Tcl_Interp *interp, int cmdResultCode)
     /*
      * Reset the signal received flag in case more signals are pending.
      */
-    for (signalNum = 1; signalNum < MAXSIG; signalNum++) {
-        if (signalsReceived [signalNum] != 0)
-            break;
-    }
-    if (signalNum < MAXSIG) {
-	if (asyncHandler)
-	    Tcl_AsyncMark (asyncHandler);
-    }
+    if (SignalsArePending ())
+        MarkSignalsPending ();
 
     /*
      * If a signal handler returned an error and an interpreter was not
@@ -908,6 +1096,82 @@ ProcessSignals (ClientData clientData, Tcl_Interp *interp, int cmdResultCode)
     return cmdResultCode;
 }
 
+/*-----------------------------------------------------------------------------
+ * SignalFileProc --
+ *  
+ *   File handler for the signal pipe when signals are delivered through the
+ * event loop.  The pipe is drained before the wakeup is cleared, so a
+ * signal arriving in between can't have its wakeup read and then never
+ * write another one.  A signal arriving after the wakeup is cleared writes
+ * a new one, so nothing pending is left unprocessed.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SignalFileProc (ClientData clientData, int mask)
+{
+    TclXOSSignalPipeDrain ();
+    wakeupPending = FALSE;
+    ProcessSignals (NULL, NULL, TCL_OK);
+}
+
+/*-----------------------------------------------------------------------------
+ * SetSignalDelivery --
+ *  
+ *   Select or deselect event loop signal delivery for an interpreter.
+ * Signals are delivered through the event loop while any interpreter has
+ * selected it.  Signals already pending are delivered by the new mode.
+ * 
+ * Parameters:
+ *   o interp - The interpreter, also used for returning errors.
+ *   o event - TRUE for event loop delivery, FALSE for async delivery.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SetSignalDelivery (Tcl_Interp *interp, int event)
+{
+    int selected;
+
+    selected = (Tcl_GetAssocData (interp, SIGNAL_EVENT_ASSOC,
+                                  NULL) != NULL);
+    if (event == selected)
+        return TCL_OK;
+
+    if (event) {
+        if (TclXOSSignalPipeOpen (interp, SignalFileProc) != TCL_OK)
+            return TCL_ERROR;
+        Tcl_SetAssocData (interp, SIGNAL_EVENT_ASSOC, SignalEventCleanUp,
+                          (ClientData) interp);
+        if (numEventInterps++ == 0) {
+            wakeupPending = FALSE;
+            eventDelivery = TRUE;
+        }
+    } else {
+        Tcl_DeleteAssocData (interp, SIGNAL_EVENT_ASSOC);
+    }
+
+    if (SignalsArePending ())
+        MarkSignalsPending ();
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * SignalEventCleanUp --
+ *  
+ *   Release an interpreter's reference to the signal pipe when it deselects
+ * event loop delivery or is deleted.  Delivery reverts to async when no
+ * interpreter has selected it.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SignalEventCleanUp (ClientData clientData, Tcl_Interp *interp)
+{
+    if (--numEventInterps == 0)
+        eventDelivery = FALSE;
+    TclXOSSignalPipeClose ();
+}
+
 /*-----------------------------------------------------------------------------
  * ParseSignalList --
  *  
@@ -1019,10 +1283,7 @@ SetSignalActions (Tcl_Interp      *interp,
         if (!signals [signalNum])
             continue;
 
-        if (signalTrapCmds [signalNum] != NULL) {
-            ckfree (signalTrapCmds [signalNum]);
-            signalTrapCmds [signalNum] = NULL;
-        }
+        FreeTrapCode (signalNum);
         if (command != NULL)
             signalTrapCmds [signalNum] = ckstrdup (command);
 
@@ -1305,6 +1566,7 @@ SetSignalStates (Tcl_Interp *interp, Tcl_Obj *sigStatesObjPtr)
  * TclX_SignalObjCmd --
  *     Implements the Tcl signal command:
  *         signal action siglist ?command?
+ *         signal delivery ?async|event?
  *-----------------------------------------------------------------------------
  */
 static int
@@ -1335,6 +1597,35 @@ TclX_SignalObjCmd (ClientData   clientData,
     }
     numArgs = objc - firstArg;
 
+    /*
+     * "delivery" takes a mode rather than a signal list.
+     */
+    if ((numArgs >= 1) &&
+        STREQU (Tcl_GetStringFromObj (objv [firstArg], NULL), "delivery")) {
+        if ((numArgs > 2) || restart) {
+            TclX_WrongArgs (interp, objv [0], "delivery ?async|event?");
+            return TCL_ERROR;
+        }
+        if (numArgs == 2) {
+            argStr = Tcl_GetStringFromObj (objv [firstArg+1], NULL);
+            if (STREQU (argStr, SIGDELIVERY_EVENT)) {
+                if (SetSignalDelivery (interp, TRUE) != TCL_OK)
+                    return TCL_ERROR;
+            } else if (STREQU (argStr, SIGDELIVERY_ASYNC)) {
+                SetSignalDelivery (interp, FALSE);
+            } else {
+                TclX_AppendObjResult (interp, "invalid signal delivery mode \"",
+                                      argStr, "\", expected \"async\" or ",
+                                      "\"event\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        }
+        Tcl_SetObjResult (interp, Tcl_NewStringObj (eventDelivery ?
+                                                    SIGDELIVERY_EVENT :
+                                                    SIGDELIVERY_ASYNC, -1));
+        return TCL_OK;
+    }
+
     if ((numArgs < 2) || (numArgs > 3)) {
         TclX_WrongArgs (interp, objv [0], "?-restart? action signalList ?command?");
         return TCL_ERROR;
@@ -1427,7 +1718,8 @@ TclX_SignalObjCmd (ClientData   clientData,
     TclX_AppendObjResult (interp, "invalid signal action specified: ", 
                           actionStr, ": expected one of \"default\", ",
                           "\"ignore\", \"error\", \"trap\", \"get\", ",
-                          "\"set\", \"block\", or \"unblock\"", (char *) NULL);
+                          "\"set\", \"block\", \"unblock\", or \"delivery\"",
+                          (char *) NULL);
     return TCL_ERROR;
 
 
@@ -1553,12 +1845,10 @@ SignalCmdCleanUp (ClientData clientData, Tcl_Interp *interp)
         interpTableSize = 0;
 
 	Tcl_AsyncDelete(asyncHandler);
+	asyncHandler = NULL;
 
         for (idx = 0; idx < MAXSIG; idx++) {
-            if (signalTrapCmds [idx] != NULL) {
-                ckfree (signalTrapCmds [idx]);
-                signalTrapCmds [idx] = NULL;
-            }
+            FreeTrapCode (idx);
         }
     }
 }
@@ -1623,7 +1913,10 @@ TclX_SignalInit (Tcl_Interp *interp)
         for (idx = 0; idx < MAXSIG; idx++) {
             signalsReceived [idx] = 0;
             signalTrapCmds [idx] = NULL;
+            signalTrapObjs [idx] = NULL;
         }
+        for (idx = 0; idx < SIG_WORDS; idx++)
+            signalsPending [idx] = 0;
 	asyncHandler = Tcl_AsyncCreate (ProcessSignals, (ClientData) NULL);
         /*
          * Get address of "unknown signal" message.
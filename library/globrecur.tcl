@@ -16,37 +16,47 @@
 #------------------------------------------------------------------------------
 #
 
-#@package: TclX-globrecur recursive_glob
+#@package: TclX-globrecur recursive_glob for_recursive_glob
+
+namespace eval TclX {
+    #--------------------------------------------------------------------------
+    # Return the names of the subdirectories of a directory.  The entry types
+    # come from reading the directory, only symbolic links need to be checked.
+    #
+    proc GlobRecurSubDirs dir {
+        set subDirs {}
+        foreach {file type} [readdir -types $dir] {
+            if {[cequal $type directory] ||
+                ([cequal $type link] &&
+                 [file isdirectory [file join $dir $file]])} {
+                lappend subDirs $file
+            }
+        }
+        return $subDirs
+    }
+}
 
 proc recursive_glob {dirlist globlist} {
     set result {}
-    set recurse {}
-    foreach dir $dirlist {
-        if ![file isdirectory $dir] {
-            error "\"$dir\" is not a directory"
-        }
-        foreach pattern $globlist {
-            set result [concat $result \
-                    [glob -nocomplain -- [file join $dir $pattern]]]
-        }
-        foreach file [readdir $dir] {
-            set file [file join $dir $file]
-            if [file isdirectory $file] {
-                set fileTail [file tail $file]
-                if {!([cequal $fileTail .] || [cequal $fileTail ..])} {
-                    lappend recurse $file
-                }
+    while {![lempty $dirlist]} {
+        set recurse {}
+        foreach dir $dirlist {
+            if ![file isdirectory $dir] {
+                error "\"$dir\" is not a directory"
+            }
+            foreach pattern $globlist {
+                eval lappend result \
+                        [glob -nocomplain -- [file join $dir $pattern]]
+            }
+            foreach file [TclX::GlobRecurSubDirs $dir] {
+                lappend recurse [file join $dir $file]
             }
         }
-    }
-    if ![lempty $recurse] {
-        set result [concat $result [recursive_glob $recurse $globlist]]
+        set dirlist $recurse
     }
     return $result
 }
 
-#@package: TclX-forrecur for_recursive_glob
-
 proc for_recursive_glob {var dirlist globlist cmd {depth 1}} {
     upvar $depth $var myVar
     set recurse {}
@@ -76,14 +86,8 @@ proc for_recursive_glob {var dirlist globlist cmd {depth 1}} {
             return -code $code $result
         }
 
-        foreach file [lsort [readdir $dir]] {
-            set file [file join $dir $file]
-            if [file isdirectory $file] {
-                set fileTail [file tail $file]
-                if {!([cequal $fileTail .] || [cequal $fileTail ..])} {
-                    lappend recurse $file
-                }
-            }
+        foreach file [lsort [TclX::GlobRecurSubDirs $dir]] {
+            lappend recurse [file join $dir $file]
         }
     }
     if ![lempty $recurse] {
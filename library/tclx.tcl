@@ -28,14 +28,12 @@ namespace eval ::tclx {
 	edprocs.tcl	1
 	events.tcl	1
 	fmath.tcl	1
-	forfile.tcl	1
 	globrecur.tcl	1
 	help.tcl	1
 	profrep.tcl	1
 	pushd.tcl	1
 	setfuncs.tcl	1
 	showproc.tcl	1
-	stringfile.tcl	1
 	tcllib.tcl	0
 	tclx.tcl	0
     }
@@ -23,11 +23,25 @@
 
 #include "tclExtdInt.h"
 #include <stdint.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <poll.h>
+
+#if defined(__linux__) && !defined(NO_EPOLL)
+#include <sys/epoll.h>
+#define HAVE_EPOLL
+#endif
 
 #ifndef NO_GETPRIORITY
 #include <sys/resource.h>
 #endif
 
+#ifndef NO_POSIX_SPAWN
+#include <spawn.h>
+#endif
+
+extern char **environ;
+
 /*
  * Tcl 8.4 had some weird and unnecessary ifdef'ery for readdir
  * readdir() should be thread-safe according to the Single Unix Spec.
@@ -44,6 +58,16 @@ static int
 ChannelToFnum (Tcl_Channel channel,
                int         direction);
 
+static int
+TimevalToMs (struct timeval *timeoutPtr);
+
+static int
+WalkOpenDir (Tcl_Interp       *interp,
+             DIR              *handle,
+             char             *path,
+             TclX_WalkDirProc *callback,
+             ClientData        clientData);
+
 static int
 ConvertOwnerGroup (Tcl_Interp  *interp,
                    unsigned     options,
@@ -670,19 +694,20 @@ TclXOSSeekable (Tcl_Interp *interp, Tcl_Channel channel, int *seekablePtr)
  *        o fileName - Tcl normalized file name in directory.
  *        o caseSensitive - Are the file names case sensitive?  Always
  *          TRUE on Unix.
+ *        o fileType - Type of the entry, from d_type if the system has it.
+ *        o dirHandle - Handle to pass to TclXOSStatDirEntry.
  *        o clientData - Client data that was passed.
  *   o clientData - Client data to pass to callback.
  * Results:
- *   TCL_OK if completed directory walk.  TCL_BREAK if callback returned
- * TCL_BREAK and TCL_ERROR if an error occured.
+ *   TCL_OK if completed directory walk.  TCL_BREAK, or any other code other
+ * than TCL_CONTINUE, if the callback returned it and TCL_ERROR if an error
+ * occured.
  *-----------------------------------------------------------------------------
 */
 int
 TclXOSWalkDir (Tcl_Interp *interp, char *path, int hidden, TclX_WalkDirProc *callback, ClientData clientData)
 {
     DIR *handle;
-    struct dirent *entryPtr;
-    int result = TCL_OK;
 
     handle = opendir (path);
     if (handle == NULL)  {
@@ -692,6 +717,168 @@ TclXOSWalkDir (Tcl_Interp *interp, char *path, int hidden, TclX_WalkDirProc *cal
                                   (char *) NULL);
         return TCL_ERROR;
     }
+    return WalkOpenDir (interp, handle, path, callback, clientData);
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSOpenDir --
+ *   System dependent interface to opening a directory, so that directories
+ * under it can be walked with TclXOSWalkDirAt.
+ *
+ * Parameters:
+ *   o interp - Interp to return errors in.
+ *   o path - Path to the directory.
+ *   o dirHandlePtr - The directory handle is returned here.
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSOpenDir (Tcl_Interp *interp, char *path, ClientData *dirHandlePtr)
+{
+    DIR *handle;
+
+    handle = opendir (path);
+    if (handle == NULL)  {
+        TclX_AppendObjResult (interp, "open of directory \"", path,
+                              "\" failed: ", Tcl_PosixError (interp),
+                              (char *) NULL);
+        return TCL_ERROR;
+    }
+    *dirHandlePtr = (ClientData) handle;
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSCloseDir --
+ *   Close a directory handle returned by TclXOSOpenDir.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSCloseDir (ClientData dirHandle)
+{
+    closedir ((DIR *) dirHandle);
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSWalkDirAt --
+ *   System dependent interface to reading the contents of a subdirectory
+ * found while walking a directory with TclXOSWalkDir.  The subdirectory is
+ * opened relative to the open directory, rather than by its path, if the
+ * system supports it.  Symbolic links are not followed.  A subdirectory that
+ * has been removed or replaced since it was read is skipped.  The handle may
+ * be used by several threads at once.
+ *
+ * Parameters:
+ *   o interp - Interp to return errors in.
+ *   o dirHandle - Directory handle passed to the callback or returned by
+ *     TclXOSOpenDir.
+ *   o path - Path to the directory containing the subdirectory.
+ *   o fileName - Name of the subdirectory.  This may also be a relative
+ *     path of several subdirectories separated by "/", each of which is
+ *     opened relative to the one before, or empty for the directory itself.
+ *   o hidden - Include hidden files.  Ignored on Unix.
+ *   o callback - Callback function to call on each directory entry, as
+ *     with TclXOSWalkDir.
+ *   o clientData - Client data to pass to callback.
+ * Results:
+ *   The same as TclXOSWalkDir.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSWalkDirAt (Tcl_Interp *interp, ClientData dirHandle, char *path, char *fileName, int hidden, TclX_WalkDirProc *callback, ClientData clientData)
+{
+    Tcl_DString subDirPath;
+    DIR *handle;
+    int result;
+#if defined(O_DIRECTORY) && defined(O_NOFOLLOW) && defined(AT_SYMLINK_NOFOLLOW)
+    Tcl_DString name;
+    char *namePtr, *nameEnd;
+    int fileNum, parentNum, saveErrno;
+#endif
+
+    Tcl_DStringInit (&subDirPath);
+    if (fileName [0] == '\0') {
+        Tcl_DStringAppend (&subDirPath, path, -1);
+    } else {
+        TclX_JoinPath (path, fileName, &subDirPath);
+    }
+
+#if defined(O_DIRECTORY) && defined(O_NOFOLLOW) && defined(AT_SYMLINK_NOFOLLOW)
+    /*
+     * Open each directory of a relative path from the one before, so none
+     * of them can be replaced by a symbolic link.
+     */
+    handle = NULL;
+    Tcl_DStringInit (&name);
+    parentNum = dirfd ((DIR *) dirHandle);
+    fileNum = -1;
+    namePtr = fileName;
+    do {
+        nameEnd = strchr (namePtr, '/');
+        if (nameEnd == NULL)
+            nameEnd = namePtr + strlen (namePtr);
+        Tcl_DStringSetLength (&name, 0);
+        if (nameEnd == namePtr) {
+            Tcl_DStringAppend (&name, ".", 1);
+        } else {
+            Tcl_DStringAppend (&name, namePtr, nameEnd - namePtr);
+        }
+        fileNum = openat (parentNum, Tcl_DStringValue (&name),
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if (parentNum != dirfd ((DIR *) dirHandle)) {
+            saveErrno = errno;
+            close (parentNum);
+            errno = saveErrno;
+        }
+        parentNum = fileNum;
+        namePtr = (*nameEnd == '/') ? nameEnd + 1 : nameEnd;
+    } while ((fileNum >= 0) && (*namePtr != '\0'));
+    Tcl_DStringFree (&name);
+
+    if (fileNum >= 0) {
+        handle = fdopendir (fileNum);
+        if (handle == NULL)
+            close (fileNum);
+    }
+#else
+    handle = opendir (Tcl_DStringValue (&subDirPath));
+#endif
+    if (handle == NULL)  {
+        if ((errno == ENOENT) || (errno == ENOTDIR) || (errno == ELOOP)) {
+            Tcl_DStringFree (&subDirPath);
+            return TCL_OK;
+        }
+        if (interp != NULL)
+            TclX_AppendObjResult (interp, "open of directory \"",
+                                  Tcl_DStringValue (&subDirPath),
+                                  "\" failed: ", Tcl_PosixError (interp),
+                                  (char *) NULL);
+        Tcl_DStringFree (&subDirPath);
+        return TCL_ERROR;
+    }
+    result = WalkOpenDir (interp, handle, Tcl_DStringValue (&subDirPath),
+                          callback, clientData);
+    Tcl_DStringFree (&subDirPath);
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * WalkOpenDir --
+ *   Call a TclXOSWalkDir callback on each entry of an open directory, then
+ * close it.
+ *-----------------------------------------------------------------------------
+ */
+static int
+WalkOpenDir (Tcl_Interp       *interp,
+             DIR              *handle,
+             char             *path,
+             TclX_WalkDirProc *callback,
+             ClientData        clientData)
+{
+    struct dirent *entryPtr;
+    TclX_FileType fileType;
+    int result = TCL_OK;
 
     while (TRUE) {
         entryPtr = readdir (handle);
@@ -705,8 +892,35 @@ TclXOSWalkDir (Tcl_Interp *interp, char *path, int hidden, TclX_WalkDirProc *cal
                 (entryPtr->d_name [2] == '\0'))
                 continue;
         }
+        fileType = TCLX_FTYPE_UNKNOWN;
+#ifdef DT_UNKNOWN
+        switch (entryPtr->d_type) {
+          case DT_REG:
+            fileType = TCLX_FTYPE_FILE;
+            break;
+          case DT_DIR:
+            fileType = TCLX_FTYPE_DIRECTORY;
+            break;
+          case DT_LNK:
+            fileType = TCLX_FTYPE_LINK;
+            break;
+          case DT_CHR:
+            fileType = TCLX_FTYPE_CHAR;
+            break;
+          case DT_BLK:
+            fileType = TCLX_FTYPE_BLOCK;
+            break;
+          case DT_FIFO:
+            fileType = TCLX_FTYPE_FIFO;
+            break;
+          case DT_SOCK:
+            fileType = TCLX_FTYPE_SOCKET;
+            break;
+        }
+#endif
         result = (*callback) (interp, path, entryPtr->d_name,
-                              TRUE, clientData);
+                              TRUE, fileType, (ClientData) handle,
+                              clientData);
         if (!((result == TCL_OK) || (result == TCL_CONTINUE)))
             break;
     }
@@ -722,7 +936,41 @@ TclXOSWalkDir (Tcl_Interp *interp, char *path, int hidden, TclX_WalkDirProc *cal
     }
     return result;
 }
-
+
+/*-----------------------------------------------------------------------------
+ * TclXOSStatDirEntry --
+ *   System dependent interface to get the status of a directory entry from a
+ * TclXOSWalkDir callback, without following symbolic links.  The entry is
+ * looked up relative to the open directory, rather than by its path, if the
+ * system supports it.
+ *
+ * Parameters:
+ *   o dirHandle - Directory handle passed to the callback.
+ *   o path - Path to the directory.
+ *   o fileName - Name of the entry in the directory.
+ *   o statBuf - Status is returned here.
+ * Results:
+ *   0 if ok or -1 if an error occured, with errno set.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSStatDirEntry (ClientData dirHandle, char *path, char *fileName, struct stat *statBuf)
+{
+#ifdef AT_SYMLINK_NOFOLLOW
+    return fstatat (dirfd ((DIR *) dirHandle), fileName, statBuf,
+                    AT_SYMLINK_NOFOLLOW);
+#else
+    Tcl_DString filePath;
+    int result;
+
+    Tcl_DStringInit (&filePath);
+    TclX_JoinPath (path, fileName, &filePath);
+    result = lstat (Tcl_DStringValue (&filePath), statBuf);
+    Tcl_DStringFree (&filePath);
+    return result;
+#endif
+}
+
 /*-----------------------------------------------------------------------------
  * TclXOSGetFileSize --
  *   System dependent interface to get the size of an open file.
@@ -746,6 +994,116 @@ TclXOSGetFileSize (Tcl_Channel channel, off_t *fileSize)
     return TCL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+ * TclXOSMapFile --
+ *   System dependent interface to map an open file read-only into memory.
+ *
+ * Parameters:
+ *   o channel - Channel open on a regular file.
+ *   o fileSize - Number of bytes to map, must be greater than zero.
+ *   o addrPtr - The address of the mapping is returned here.
+ * Results:
+ *   TCL_OK or TCL_ERROR if the file can't be mapped, in which case the
+ * caller should read it instead.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSMapFile (Tcl_Channel channel, off_t fileSize, char **addrPtr)
+{
+    void *addr;
+
+    if ((off_t) (size_t) fileSize != fileSize)
+        return TCL_ERROR;
+    addr = mmap (NULL, (size_t) fileSize, PROT_READ, MAP_SHARED,
+                 ChannelToFnum (channel, TCL_READABLE), 0);
+    if (addr == MAP_FAILED)
+        return TCL_ERROR;
+#ifdef MADV_RANDOM
+    madvise (addr, (size_t) fileSize, MADV_RANDOM);
+#endif
+    *addrPtr = (char *) addr;
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSUnmapFile --
+ *   Release a mapping returned by TclXOSMapFile.
+ *
+ * Parameters:
+ *   o addr - Address of the mapping.
+ *   o fileSize - The size that was mapped.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSUnmapFile (char *addr, off_t fileSize)
+{
+    munmap ((void *) addr, (size_t) fileSize);
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSWriteBuffers --
+ *   System dependent interface to write a list of buffers to an open file,
+ * bypassing the channel's buffering and translation.  The buffers are
+ * gathered into as few system calls as possible.  The channel must not have
+ * any buffered output.
+ *
+ * Parameters:
+ *   o channel - Channel to write to.
+ *   o numBufs - Number of buffers.
+ *   o bufs - The buffers.
+ *   o bufLens - The length of each buffer.
+ * Results:
+ *   TCL_OK or TCL_ERROR with errno set.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSWriteBuffers (Tcl_Channel channel, int numBufs, char **bufs, int *bufLens)
+{
+    struct iovec iov [64];
+    int fileNum, bufIdx, numIov, iovIdx;
+    ssize_t numWritten;
+
+    fileNum = ChannelToFnum (channel, TCL_WRITABLE);
+    if (fileNum < 0) {
+        errno = EBADF;
+        return TCL_ERROR;
+    }
+
+    bufIdx = 0;
+    while (bufIdx < numBufs) {
+        for (numIov = 0; (numIov < 64) && (bufIdx + numIov < numBufs);
+             numIov++) {
+            iov [numIov].iov_base = bufs [bufIdx + numIov];
+            iov [numIov].iov_len = bufLens [bufIdx + numIov];
+        }
+        bufIdx += numIov;
+
+        /*
+         * Write the vector, advancing through it after partial writes.
+         */
+        iovIdx = 0;
+        while (iovIdx < numIov) {
+            numWritten = writev (fileNum, &iov [iovIdx], numIov - iovIdx);
+            if (numWritten < 0) {
+                if (errno == EINTR)
+                    continue;
+                return TCL_ERROR;
+            }
+            while ((iovIdx < numIov) &&
+                   ((size_t) numWritten >= iov [iovIdx].iov_len)) {
+                numWritten -= iov [iovIdx].iov_len;
+                iovIdx++;
+            }
+            if (iovIdx < numIov) {
+                iov [iovIdx].iov_base =
+                    (char *) iov [iovIdx].iov_base + numWritten;
+                iov [iovIdx].iov_len -= numWritten;
+            }
+        }
+    }
+    return TCL_OK;
+}
+
 /*-----------------------------------------------------------------------------
  * TclXOSftruncate --
  *   System dependent interface to ftruncate functionality.
@@ -833,6 +1191,208 @@ TclXOSexecl (Tcl_Interp *interp, char *path, char **argList)
     return TCL_ERROR;
 }
 
+#ifndef HAVE_WAIT4
+/*-----------------------------------------------------------------------------
+ * TclXOSWait4 --
+ *   Emulate wait4 with waitpid.  The CPU times are the change in the usage
+ * of all children across the wait, which is the usage of the child reaped as
+ * long as no other wait runs at the same time.  The maximum resident set
+ * size is the largest of any child.
+ *
+ * Parameters:
+ *   o pid, statusPtr, options - As for waitpid.
+ *   o usagePtr - The resource usage is returned here.
+ * Results:
+ *   As for waitpid.
+ *-----------------------------------------------------------------------------
+ */
+pid_t
+TclXOSWait4 (pid_t pid, int *statusPtr, int options, struct rusage *usagePtr)
+{
+    struct rusage before;
+    pid_t returnedPid;
+
+    getrusage (RUSAGE_CHILDREN, &before);
+    returnedPid = waitpid (pid, statusPtr, options);
+    if (returnedPid <= 0)
+        return returnedPid;
+    getrusage (RUSAGE_CHILDREN, usagePtr);
+
+    usagePtr->ru_utime.tv_sec -= before.ru_utime.tv_sec;
+    usagePtr->ru_utime.tv_usec -= before.ru_utime.tv_usec;
+    if (usagePtr->ru_utime.tv_usec < 0) {
+        usagePtr->ru_utime.tv_sec--;
+        usagePtr->ru_utime.tv_usec += 1000000;
+    }
+    usagePtr->ru_stime.tv_sec -= before.ru_stime.tv_sec;
+    usagePtr->ru_stime.tv_usec -= before.ru_stime.tv_usec;
+    if (usagePtr->ru_stime.tv_usec < 0) {
+        usagePtr->ru_stime.tv_sec--;
+        usagePtr->ru_stime.tv_usec += 1000000;
+    }
+    return returnedPid;
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+ * TclXOSspawn --
+ *   System dependent interface to start a program in a new process without
+ * copying the address space of this one, as fork does.
+ *
+ * Parameters:
+ *   o interp - The process id or errors are returned in result.
+ *   o path - Path to the program, searched for in PATH if it has no "/".
+ *   o argList - NULL terminated argument vector.
+ *   o envList - NULL terminated environment, or NULL to pass the current
+ *     one.
+ *   o numFds - Number of file numbers to redirect in the new process.
+ *   o childFds - File numbers in the new process to redirect.
+ *   o channels - Channels to redirect each of them to.  For file number
+ *     zero the read side of the channel is used, otherwise the write side.
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ * Notes:
+ *   A file number redirected may be the source of another redirection, as
+ * in swapping stdout and stderr, so all the sources are first duplicated
+ * above the file numbers redirected, and moved into place from there.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSspawn (Tcl_Interp  *interp,
+             char        *path,
+             char       **argList,
+             char       **envList,
+             int          numFds,
+             int         *childFds,
+             Tcl_Channel *channels)
+{
+    pid_t pid = 0;
+    int idx, status, *fnums, tempBase = 0;
+#ifndef NO_POSIX_SPAWN
+    posix_spawn_file_actions_t fileActions;
+    int *tempFnums, tempFnum;
+#else
+    int errPipe [2];
+    ssize_t numRead;
+#endif
+
+    fnums = (int *) ckalloc ((numFds + 1) * sizeof (int));
+    for (idx = 0; idx < numFds; idx++) {
+        fnums [idx] = ChannelToFnum (channels [idx], (childFds [idx] == 0) ?
+                                     TCL_READABLE : TCL_WRITABLE);
+        if (fnums [idx] < 0)
+            fnums [idx] = ChannelToFnum (channels [idx], 0);
+        if (childFds [idx] >= tempBase)
+            tempBase = childFds [idx] + 1;
+    }
+
+#ifndef NO_POSIX_SPAWN
+    /*
+     * The actions can't ask for a free file number, so the temporary ones
+     * are numbers above the sources that aren't open in this process.
+     */
+    tempFnums = (int *) ckalloc ((numFds + 1) * sizeof (int));
+    for (idx = 0; idx < numFds; idx++) {
+        if (fnums [idx] >= tempBase)
+            tempBase = fnums [idx] + 1;
+    }
+    tempFnum = tempBase;
+    for (idx = 0; idx < numFds; idx++) {
+        while (fcntl (tempFnum, F_GETFD) >= 0)
+            tempFnum++;
+        tempFnums [idx] = tempFnum++;
+    }
+
+    posix_spawn_file_actions_init (&fileActions);
+    status = 0;
+    for (idx = 0; (idx < numFds) && (status == 0); idx++) {
+        status = posix_spawn_file_actions_adddup2 (&fileActions, fnums [idx],
+                                                   tempFnums [idx]);
+    }
+    for (idx = 0; (idx < numFds) && (status == 0); idx++) {
+        status = posix_spawn_file_actions_adddup2 (&fileActions,
+                                                   tempFnums [idx],
+                                                   childFds [idx]);
+    }
+    for (idx = 0; (idx < numFds) && (status == 0); idx++) {
+        status = posix_spawn_file_actions_addclose (&fileActions,
+                                                    tempFnums [idx]);
+    }
+
+    if (status == 0)
+        status = posix_spawnp (&pid, path, &fileActions, NULL, argList,
+                               (envList != NULL) ? envList : environ);
+    posix_spawn_file_actions_destroy (&fileActions);
+    ckfree ((char *) tempFnums);
+    ckfree ((char *) fnums);
+#else
+    /*
+     * Without posix_spawn, fork and exec.  The child reports an exec
+     * failure through a pipe that is closed when the exec succeeds.
+     */
+    if (pipe (errPipe) < 0) {
+        status = errno;
+        ckfree ((char *) fnums);
+        goto errorExit;
+    }
+    fcntl (errPipe [1], F_SETFD, FD_CLOEXEC);
+
+    pid = fork ();
+    if (pid < 0) {
+        status = errno;
+        close (errPipe [0]);
+        close (errPipe [1]);
+        ckfree ((char *) fnums);
+        goto errorExit;
+    }
+    if (pid == 0) {
+        close (errPipe [0]);
+        for (idx = 0; idx < numFds; idx++) {
+            fnums [idx] = fcntl (fnums [idx], F_DUPFD, tempBase);
+            if (fnums [idx] < 0)
+                goto childError;
+        }
+        for (idx = 0; idx < numFds; idx++) {
+            if (dup2 (fnums [idx], childFds [idx]) < 0)
+                goto childError;
+        }
+        for (idx = 0; idx < numFds; idx++) {
+            close (fnums [idx]);
+        }
+        if (envList != NULL)
+            environ = envList;
+        execvp (path, argList);
+      childError:
+        status = errno;
+        (void) write (errPipe [1], &status, sizeof (status));
+        _exit (127);
+    }
+
+    close (errPipe [1]);
+    ckfree ((char *) fnums);
+    do {
+        numRead = read (errPipe [0], &status, sizeof (status));
+    } while ((numRead < 0) && (errno == EINTR));
+    close (errPipe [0]);
+    if (numRead == sizeof (status)) {
+        waitpid (pid, NULL, 0);
+    } else {
+        status = 0;
+    }
+  errorExit:
+#endif
+
+    if (status != 0) {
+        Tcl_SetErrno (status);
+        TclX_AppendObjResult (interp, "spawn of \"", path, "\" failed: ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        return TCL_ERROR;
+    }
+
+    Tcl_SetIntObj (Tcl_GetObjResult (interp), (int) pid);
+    return TCL_OK;
+}
+
 /*-----------------------------------------------------------------------------
  * TclXOSInetAtoN --
  *
@@ -1379,6 +1939,398 @@ TclXOSGetSelectFnum (Tcl_Interp *interp, Tcl_Channel channel, int direction, int
     return TCL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+ * TimevalToMs --
+ *   Convert a timeout to milliseconds for poll or epoll_wait, rounding up so
+ * a short timeout doesn't become a busy poll.
+ *
+ * Parameters:
+ *   o timeoutPtr - The timeout, or NULL for no timeout.
+ * Returns:
+ *   The timeout in milliseconds, or -1 for no timeout.
+ *-----------------------------------------------------------------------------
+ */
+static int
+TimevalToMs (struct timeval *timeoutPtr)
+{
+    double timeoutMs;
+
+    if (timeoutPtr == NULL)
+        return -1;
+    timeoutMs = (timeoutPtr->tv_sec * 1000.0) +
+        ((timeoutPtr->tv_usec + 999) / 1000);
+    return (timeoutMs > INT_MAX) ? INT_MAX : (int) timeoutMs;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSPoll --
+ *   Wait for file numbers to become ready.  Implemented with poll, so there
+ * is no limit on the file numbers and the cost is proportional to the number
+ * of files rather than the largest file number.  Like select, end of file
+ * and errors make a file readable and writable.
+ *
+ * Parameters:
+ *   o interp - Errors are returned in the result.
+ *   o pollInfo - The file numbers and events to wait for, revents is
+ *     returned in each entry.
+ *   o numFnums - Number of entries in pollInfo.
+ *   o timeoutPtr - Maximum time to wait, or NULL to wait forever.
+ * Returns:
+ *   The number of entries with events, 0 if the timeout expired, or -1 on
+ * an error.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSPoll (Tcl_Interp *interp, TclX_PollInfo *pollInfo, int numFnums,
+            struct timeval *timeoutPtr)
+{
+    struct pollfd staticPollFds [64], *pollFds;
+    int idx, numReady;
+
+    if (numFnums <= (int) (sizeof (staticPollFds) / sizeof (struct pollfd))) {
+        pollFds = staticPollFds;
+    } else {
+        pollFds = (struct pollfd *) ckalloc (numFnums * sizeof (struct pollfd));
+    }
+    for (idx = 0; idx < numFnums; idx++) {
+        pollFds [idx].fd = pollInfo [idx].fnum;
+        pollFds [idx].events = 0;
+        pollFds [idx].revents = 0;
+        if (pollInfo [idx].events & TCLX_POLL_READ)
+            pollFds [idx].events |= POLLIN;
+        if (pollInfo [idx].events & TCLX_POLL_WRITE)
+            pollFds [idx].events |= POLLOUT;
+        if (pollInfo [idx].events & TCLX_POLL_EXCEPT)
+            pollFds [idx].events |= POLLPRI;
+    }
+
+    numReady = poll (pollFds, numFnums, TimevalToMs (timeoutPtr));
+    if (numReady < 0) {
+        TclX_AppendObjResult (interp, "select error: ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        goto exitPoint;
+    }
+
+    numReady = 0;
+    for (idx = 0; idx < numFnums; idx++) {
+        short revents = pollFds [idx].revents;
+
+        pollInfo [idx].revents = 0;
+        if (revents & POLLNVAL) {
+            errno = EBADF;
+            TclX_AppendObjResult (interp, "select error: ",
+                                  Tcl_PosixError (interp), (char *) NULL);
+            numReady = -1;
+            goto exitPoint;
+        }
+        if (revents & (POLLIN | POLLHUP | POLLERR))
+            pollInfo [idx].revents |= TCLX_POLL_READ;
+        if (revents & (POLLOUT | POLLHUP | POLLERR))
+            pollInfo [idx].revents |= TCLX_POLL_WRITE;
+        if (revents & POLLPRI)
+            pollInfo [idx].revents |= TCLX_POLL_EXCEPT;
+        pollInfo [idx].revents &= pollInfo [idx].events;
+        if (pollInfo [idx].revents != 0)
+            numReady++;
+    }
+
+  exitPoint:
+    if (pollFds != staticPollFds)
+        ckfree ((char *) pollFds);
+    return numReady;
+}
+
+#ifdef HAVE_EPOLL
+/*
+ * A poll set is an epoll instance.  Each file number registered has a
+ * TclX_PollInfo, which epoll returns when the file is ready.  Epoll refuses
+ * regular files, which poll always reports ready, so those are kept in a
+ * list that is returned ready by every wait.
+ */
+struct TclX_PollSet {
+    int                 epollFd;
+    Tcl_HashTable       fnumTable;      /* TclX_PollInfo keyed by fnum. */
+    struct epoll_event *epollEvents;
+    int                 eventsAlloc;
+    TclX_PollInfo     **alwaysReady;
+    int                 numAlwaysReady;
+    int                 alwaysReadyAlloc;
+};
+#endif
+
+/*-----------------------------------------------------------------------------
+ * TclXOSPollSetCreate --
+ *   Create a persistent set of file numbers to wait on.
+ *
+ * Parameters:
+ *   o interp - Errors are returned in the result.
+ * Returns:
+ *   The set, or NULL if there was an error or the system doesn't support
+ * persistent sets, in which case the interp result is left empty and the
+ * caller should use TclXOSPoll.
+ *-----------------------------------------------------------------------------
+ */
+TclX_PollSet *
+TclXOSPollSetCreate (Tcl_Interp *interp)
+{
+#ifdef HAVE_EPOLL
+    TclX_PollSet *pollSetPtr;
+    int epollFd;
+
+    epollFd = epoll_create (64);
+    if (epollFd < 0) {
+        TclX_AppendObjResult (interp, "epoll_create failed: ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        return NULL;
+    }
+    fcntl (epollFd, F_SETFD, FD_CLOEXEC);
+
+    pollSetPtr = (TclX_PollSet *) ckalloc (sizeof (TclX_PollSet));
+    pollSetPtr->epollFd = epollFd;
+    Tcl_InitHashTable (&pollSetPtr->fnumTable, TCL_ONE_WORD_KEYS);
+    pollSetPtr->epollEvents = NULL;
+    pollSetPtr->eventsAlloc = 0;
+    pollSetPtr->alwaysReady = NULL;
+    pollSetPtr->numAlwaysReady = 0;
+    pollSetPtr->alwaysReadyAlloc = 0;
+    return pollSetPtr;
+#else
+    return NULL;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSPollSetDelete --
+ *   Release a set returned by TclXOSPollSetCreate.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSPollSetDelete (TclX_PollSet *pollSetPtr)
+{
+#ifdef HAVE_EPOLL
+    Tcl_HashEntry *hashEntryPtr;
+    Tcl_HashSearch search;
+
+    for (hashEntryPtr = Tcl_FirstHashEntry (&pollSetPtr->fnumTable, &search);
+         hashEntryPtr != NULL;
+         hashEntryPtr = Tcl_NextHashEntry (&search)) {
+        ckfree ((char *) Tcl_GetHashValue (hashEntryPtr));
+    }
+    Tcl_DeleteHashTable (&pollSetPtr->fnumTable);
+    if (pollSetPtr->epollEvents != NULL)
+        ckfree ((char *) pollSetPtr->epollEvents);
+    if (pollSetPtr->alwaysReady != NULL)
+        ckfree ((char *) pollSetPtr->alwaysReady);
+    close (pollSetPtr->epollFd);
+    ckfree ((char *) pollSetPtr);
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSPollSetCtl --
+ *   Add, change or remove a file number in a set.
+ *
+ * Parameters:
+ *   o interp - Errors are returned in the result.
+ *   o pollSetPtr - The set.
+ *   o fnum - The file number.
+ *   o oldEvents - The TCLX_POLL_* events it is registered for, zero if it
+ *     is not in the set.
+ *   o newEvents - The events to wait for, zero to remove it from the set.
+ *   o clientData - Returned by TclXOSPollSetWait when the file is ready.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.  Removing a file never fails, interp may be NULL.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSPollSetCtl (Tcl_Interp *interp,
+                  TclX_PollSet *pollSetPtr,
+                  int fnum,
+                  int oldEvents,
+                  int newEvents,
+                  ClientData clientData)
+{
+#ifdef HAVE_EPOLL
+    TclX_PollInfo *pollInfoPtr;
+    Tcl_HashEntry *hashEntryPtr;
+    struct epoll_event epollEvent;
+    int newEntry, op, idx;
+
+    if (oldEvents == 0) {
+        hashEntryPtr = Tcl_CreateHashEntry (&pollSetPtr->fnumTable,
+                                            (char *) (size_t) fnum,
+                                            &newEntry);
+        if (!newEntry) {
+            TclX_AppendObjResult (interp, "file number is already in the ",
+                                  "set", (char *) NULL);
+            return TCL_ERROR;
+        }
+        pollInfoPtr = (TclX_PollInfo *) ckalloc (sizeof (TclX_PollInfo));
+        pollInfoPtr->fnum = fnum;
+        Tcl_SetHashValue (hashEntryPtr, (ClientData) pollInfoPtr);
+        op = EPOLL_CTL_ADD;
+    } else {
+        hashEntryPtr = Tcl_FindHashEntry (&pollSetPtr->fnumTable,
+                                          (char *) (size_t) fnum);
+        pollInfoPtr = (TclX_PollInfo *) Tcl_GetHashValue (hashEntryPtr);
+        op = (newEvents == 0) ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    }
+    pollInfoPtr->events = newEvents;
+    pollInfoPtr->clientData = clientData;
+
+    /*
+     * A file that is always ready only has to be dropped from the list.
+     */
+    if (op != EPOLL_CTL_ADD) {
+        for (idx = 0; idx < pollSetPtr->numAlwaysReady; idx++) {
+            if (pollSetPtr->alwaysReady [idx] == pollInfoPtr)
+                break;
+        }
+        if (idx < pollSetPtr->numAlwaysReady) {
+            if (op == EPOLL_CTL_MOD)
+                return TCL_OK;
+            pollSetPtr->alwaysReady [idx] =
+                pollSetPtr->alwaysReady [--pollSetPtr->numAlwaysReady];
+            Tcl_DeleteHashEntry (hashEntryPtr);
+            ckfree ((char *) pollInfoPtr);
+            return TCL_OK;
+        }
+    }
+
+    memset (&epollEvent, 0, sizeof (epollEvent));
+    if (newEvents & TCLX_POLL_READ)
+        epollEvent.events |= EPOLLIN;
+    if (newEvents & TCLX_POLL_WRITE)
+        epollEvent.events |= EPOLLOUT;
+    if (newEvents & TCLX_POLL_EXCEPT)
+        epollEvent.events |= EPOLLPRI;
+    epollEvent.data.ptr = pollInfoPtr;
+
+    /*
+     * Removing can't fail; a file that was closed behind our back is
+     * already gone from the set.
+     */
+    if ((epoll_ctl (pollSetPtr->epollFd, op, fnum, &epollEvent) < 0) &&
+        (op != EPOLL_CTL_DEL)) {
+        if ((op == EPOLL_CTL_ADD) && (errno == EPERM)) {
+            if (pollSetPtr->numAlwaysReady == pollSetPtr->alwaysReadyAlloc) {
+                pollSetPtr->alwaysReadyAlloc =
+                    (pollSetPtr->alwaysReadyAlloc == 0) ? 8 :
+                    2 * pollSetPtr->alwaysReadyAlloc;
+                pollSetPtr->alwaysReady = (TclX_PollInfo **)
+                    ckrealloc ((char *) pollSetPtr->alwaysReady,
+                               pollSetPtr->alwaysReadyAlloc *
+                               sizeof (TclX_PollInfo *));
+            }
+            pollSetPtr->alwaysReady [pollSetPtr->numAlwaysReady++] =
+                pollInfoPtr;
+            return TCL_OK;
+        }
+        TclX_AppendObjResult (interp, "epoll_ctl failed: ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        if (op == EPOLL_CTL_MOD)
+            return TCL_ERROR;
+        op = EPOLL_CTL_DEL;
+    }
+    if (op == EPOLL_CTL_DEL) {
+        Tcl_DeleteHashEntry (hashEntryPtr);
+        ckfree ((char *) pollInfoPtr);
+        return (newEvents == 0) ? TCL_OK : TCL_ERROR;
+    }
+    return TCL_OK;
+#else
+    return TclXNotAvailableError (interp, "epoll");
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSPollSetWait --
+ *   Wait for files in a set to become ready.  The cost is proportional to
+ * the number of ready files, not the size of the set.  Files that are
+ * always ready are returned without waiting.
+ *
+ * Parameters:
+ *   o interp - Errors are returned in the result.
+ *   o pollSetPtr - The set.
+ *   o readyInfo - The fnum, revents and clientData of the ready files are
+ *     returned in this array.
+ *   o maxReady - Size of the readyInfo array.
+ *   o timeoutPtr - Maximum time to wait, or NULL to wait forever.
+ * Returns:
+ *   The number of entries returned, 0 if the timeout expired, or -1 on
+ * an error.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSPollSetWait (Tcl_Interp *interp,
+                   TclX_PollSet *pollSetPtr,
+                   TclX_PollInfo *readyInfo,
+                   int maxReady,
+                   struct timeval *timeoutPtr)
+{
+#ifdef HAVE_EPOLL
+    TclX_PollInfo *pollInfoPtr;
+    int idx, numEvents, numReady, maxEvents;
+    unsigned events;
+
+    numReady = 0;
+    for (idx = 0; (idx < pollSetPtr->numAlwaysReady) && (numReady < maxReady);
+         idx++) {
+        pollInfoPtr = pollSetPtr->alwaysReady [idx];
+        readyInfo [numReady].fnum = pollInfoPtr->fnum;
+        readyInfo [numReady].events = pollInfoPtr->events;
+        readyInfo [numReady].clientData = pollInfoPtr->clientData;
+        readyInfo [numReady].revents =
+            pollInfoPtr->events & (TCLX_POLL_READ | TCLX_POLL_WRITE);
+        if (readyInfo [numReady].revents != 0)
+            numReady++;
+    }
+
+    maxEvents = maxReady - numReady;
+    if (maxEvents <= 0)
+        maxEvents = 1;
+    if (maxEvents > pollSetPtr->eventsAlloc) {
+        pollSetPtr->eventsAlloc = maxEvents;
+        pollSetPtr->epollEvents = (struct epoll_event *)
+            ckrealloc ((char *) pollSetPtr->epollEvents,
+                       maxEvents * sizeof (struct epoll_event));
+    }
+
+    numEvents = epoll_wait (pollSetPtr->epollFd, pollSetPtr->epollEvents,
+                            maxEvents,
+                            (numReady > 0) ? 0 : TimevalToMs (timeoutPtr));
+    if (numEvents < 0) {
+        TclX_AppendObjResult (interp, "select error: ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        return -1;
+    }
+    if (numEvents > maxReady - numReady)
+        numEvents = maxReady - numReady;
+
+    for (idx = 0; idx < numEvents; idx++) {
+        pollInfoPtr = (TclX_PollInfo *) pollSetPtr->epollEvents [idx].data.ptr;
+        events = pollSetPtr->epollEvents [idx].events;
+
+        readyInfo [numReady].fnum = pollInfoPtr->fnum;
+        readyInfo [numReady].events = pollInfoPtr->events;
+        readyInfo [numReady].clientData = pollInfoPtr->clientData;
+        readyInfo [numReady].revents = 0;
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            readyInfo [numReady].revents |= TCLX_POLL_READ;
+        if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            readyInfo [numReady].revents |= TCLX_POLL_WRITE;
+        if (events & EPOLLPRI)
+            readyInfo [numReady].revents |= TCLX_POLL_EXCEPT;
+        readyInfo [numReady].revents &= pollInfoPtr->events;
+        if (readyInfo [numReady].revents != 0)
+            numReady++;
+    }
+    return numReady;
+#else
+    return 0;
+#endif
+}
+
 /*-----------------------------------------------------------------------------
  * TclXOSHaveFlock --
  *   System dependent interface to determine if file locking is available.
@@ -1674,4 +2626,126 @@ TclXOSSetCloseOnExec (Tcl_Interp *interp, Tcl_Channel channel, int value)
     return TCL_ERROR;
 }
 
+
+/*
+ * Self-pipe used to deliver signals through the notifier.  Written to from
+ * the signal handler, so the write end is non-blocking.  It is shared by
+ * every interpreter using it and closed when the last one is done.  A file
+ * handler is registered with the notifier of each thread using it, and
+ * deleted by that thread when its last reference is released.
+ */
+static int signalPipe [2] = {-1, -1};
+static int signalPipeRefs = 0;
+TCL_DECLARE_MUTEX(signalPipeMutex)
+
+typedef struct {
+    int handlerRefs;    /* References held by this thread. */
+} signalPipeTsd_t;
+
+static Tcl_ThreadDataKey signalPipeKey;
+
+/*-----------------------------------------------------------------------------
+ * TclXOSSignalPipeOpen --
+ *   Create the signal wakeup pipe, if it doesn't exist, and arrange for proc
+ * to be called from the current thread's event loop when it is readable.
+ * Each call adds a reference that must be released with
+ * TclXOSSignalPipeClose in the same thread.
+ *
+ * Parameters:
+ *   o interp - Errors are returned in the result.
+ *   o proc - File handler to call when a wakeup was written.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSSignalPipeOpen (Tcl_Interp *interp, Tcl_FileProc *proc)
+{
+    signalPipeTsd_t *tsdPtr = (signalPipeTsd_t *)
+        Tcl_GetThreadData (&signalPipeKey, sizeof (signalPipeTsd_t));
+    int idx;
+
+    Tcl_MutexLock (&signalPipeMutex);
+    if (signalPipe [0] < 0) {
+        if (pipe (signalPipe) < 0) {
+            Tcl_MutexUnlock (&signalPipeMutex);
+            TclX_AppendObjResult (interp, "creating signal pipe failed: ",
+                                  Tcl_PosixError (interp), (char *) NULL);
+            return TCL_ERROR;
+        }
+        for (idx = 0; idx < 2; idx++) {
+            fcntl (signalPipe [idx], F_SETFD, FD_CLOEXEC);
+            fcntl (signalPipe [idx], F_SETFL,
+                   fcntl (signalPipe [idx], F_GETFL) | O_NONBLOCK);
+        }
+    }
+    signalPipeRefs++;
+    if (tsdPtr->handlerRefs++ == 0)
+        Tcl_CreateFileHandler (signalPipe [0], TCL_READABLE, proc,
+                               (ClientData) NULL);
+    Tcl_MutexUnlock (&signalPipeMutex);
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSSignalPipeClose --
+ *   Release a reference to the signal wakeup pipe taken by this thread.  The
+ * thread's file handler is removed when its last reference is released,
+ * and the pipe is closed when the last reference of any thread is.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSSignalPipeClose (void)
+{
+    signalPipeTsd_t *tsdPtr = (signalPipeTsd_t *)
+        Tcl_GetThreadData (&signalPipeKey, sizeof (signalPipeTsd_t));
+
+    Tcl_MutexLock (&signalPipeMutex);
+    if ((signalPipe [0] < 0) || (tsdPtr->handlerRefs == 0)) {
+        Tcl_MutexUnlock (&signalPipeMutex);
+        return;
+    }
+    if (--tsdPtr->handlerRefs == 0)
+        Tcl_DeleteFileHandler (signalPipe [0]);
+    if (--signalPipeRefs == 0) {
+        close (signalPipe [0]);
+        close (signalPipe [1]);
+        signalPipe [0] = signalPipe [1] = -1;
+    }
+    Tcl_MutexUnlock (&signalPipeMutex);
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSSignalPipeWakeup --
+ *   Write a wakeup byte to the signal pipe.  Called from a signal handler,
+ * so only async-signal-safe calls are made and errno is preserved.  A full
+ * pipe already has a wakeup pending, so that error is ignored.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSSignalPipeWakeup (void)
+{
+    int saveErrno = errno;
+
+    if (signalPipe [1] >= 0)
+        (void) write (signalPipe [1], "", 1);
+    errno = saveErrno;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSSignalPipeDrain --
+ *   Read all pending wakeup bytes from the signal pipe.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSSignalPipeDrain (void)
+{
+    char buf [64];
+
+    if (signalPipe [0] < 0)
+        return;
+    while (read (signalPipe [0], buf, sizeof (buf)) > 0)
+        continue;
+}
+
 /* vim: set ts=4 sw=4 sts=4 et : */
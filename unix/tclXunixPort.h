@@ -30,6 +30,7 @@
 #endif
 
 #include <sys/times.h>
+#include <sys/resource.h>
 #include <grp.h>
 #include <assert.h>
 
@@ -124,6 +125,21 @@ extern long random ();
  */
 #define TCLX_WAITPID(pid, status, options) waitpid (pid, status, options)
 
+/*
+ * Wait that also returns the resource usage of the child.  Without wait4, the
+ * usage is derived from the change in the usage of all children.
+ */
+#ifdef HAVE_WAIT4
+#define TCLX_WAIT4(pid, status, options, rusage) \
+        wait4 (pid, status, options, rusage)
+#else
+#define TCLX_WAIT4(pid, status, options, rusage) \
+        TclXOSWait4 (pid, status, options, rusage)
+
+extern pid_t
+TclXOSWait4 (pid_t pid, int *statusPtr, int options, struct rusage *usagePtr);
+#endif
+
 #endif
 
 /* vim: set ts=4 sw=4 sts=4 et : */
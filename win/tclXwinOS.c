@@ -733,11 +733,14 @@ TclXOSFstat (Tcl_Interp  *interp,
  *        o path - Normalized path to directory.
  *        o fileName - Tcl normalized file name in directory.
  *        o caseSensitive - Are the file names case sensitive?
+ *        o fileType - Type of the entry, from its attributes.
+ *        o dirHandle - Handle to pass to TclXOSStatDirEntry.
  *        o clientData - Client data that was passed.
  *   o clientData - Client data to pass to callback.
  * Results:
- *   TCL_OK if completed directory walk.  TCL_BREAK if callback returned
- * TCL_BREAK and TCL_ERROR if an error occured.
+ *   TCL_OK if completed directory walk.  TCL_BREAK, or any other code other
+ * than TCL_CONTINUE, if the callback returned it and TCL_ERROR if an error
+ * occured.
  *-----------------------------------------------------------------------------
  */
 int
@@ -755,6 +758,7 @@ TclXOSWalkDir (Tcl_Interp       *interp,
     HANDLE handle;
     WIN32_FIND_DATA data;
     BOOL found;
+    TclX_FileType fileType;
 
     /*
      * Convert the path to normalized form since some interfaces only
@@ -829,11 +833,13 @@ TclXOSWalkDir (Tcl_Interp       *interp,
     if (!found) {
         Tcl_DStringFree (&pathBuf);
         TclWinConvertError (GetLastError ());
-        Tcl_ResetResult (interp);
-        TclX_AppendObjResult (interp,
-                              "couldn't read volume information for \"",
-                              path, "\": ", Tcl_PosixError (interp),
-                              (char *) NULL);
+        if (interp != NULL) {
+            Tcl_ResetResult (interp);
+            TclX_AppendObjResult (interp,
+                                  "couldn't read volume information for \"",
+                                  path, "\": ", Tcl_PosixError (interp),
+                                  (char *) NULL);
+        }
         return TCL_ERROR;
     }
 
@@ -851,10 +857,12 @@ TclXOSWalkDir (Tcl_Interp       *interp,
 
     if (handle == INVALID_HANDLE_VALUE) {
         TclWinConvertError (GetLastError ());
-        Tcl_ResetResult (interp);
-        TclX_AppendObjResult (interp, "couldn't read directory \"",
-                              path, "\": ", Tcl_PosixError (interp),
-                              (char *) NULL);
+        if (interp != NULL) {
+            Tcl_ResetResult (interp);
+            TclX_AppendObjResult (interp, "couldn't read directory \"",
+                                  path, "\": ", Tcl_PosixError (interp),
+                                  (char *) NULL);
+        }
         return TCL_ERROR;
     }
 
@@ -875,10 +883,19 @@ TclXOSWalkDir (Tcl_Interp       *interp,
             continue;
 
         /*
-         * Call the callback with this file.
+         * Call the callback with this file.  Reparse points may be links,
+         * their type is left for the callback to find out.
          */
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+            fileType = TCLX_FTYPE_UNKNOWN;
+        } else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            fileType = TCLX_FTYPE_DIRECTORY;
+        } else {
+            fileType = TCLX_FTYPE_FILE;
+        }
         result = (*callback) (interp, path, data.cFileName,
-                              (volFlags & FS_CASE_SENSITIVE), clientData);
+                              (volFlags & FS_CASE_SENSITIVE), fileType,
+                              (ClientData) handle, clientData);
         if (!((result == TCL_OK) || (result == TCL_CONTINUE)))
             break;
     }
@@ -888,6 +905,125 @@ TclXOSWalkDir (Tcl_Interp       *interp,
     return result;
 }
 
+/*-----------------------------------------------------------------------------
+ * TclXOSOpenDir --
+ *   System dependent interface to opening a directory, so that directories
+ * under it can be walked with TclXOSWalkDirAt.  Directories are walked by
+ * path on Windows, so this only checks that it is a directory.
+ *
+ * Parameters:
+ *   o interp - Interp to return errors in.
+ *   o path - Path to the directory.
+ *   o dirHandlePtr - The directory handle is returned here.
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSOpenDir (Tcl_Interp *interp,
+               char       *path,
+               ClientData *dirHandlePtr)
+{
+    DWORD atts;
+
+    atts = GetFileAttributes (path);
+    if ((atts == 0xFFFFFFFF) || ((atts & FILE_ATTRIBUTE_DIRECTORY) == 0)) {
+        TclWinConvertError (GetLastError ());
+        if ((atts != 0xFFFFFFFF) || (errno == 0))
+            errno = ENOTDIR;
+        TclX_AppendObjResult (interp, "open of directory \"", path,
+                              "\" failed: ", Tcl_PosixError (interp),
+                              (char *) NULL);
+        return TCL_ERROR;
+    }
+    *dirHandlePtr = NULL;
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSCloseDir --
+ *   Close a directory handle returned by TclXOSOpenDir.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSCloseDir (ClientData dirHandle)
+{
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSWalkDirAt --
+ *   System dependent interface to reading the contents of a subdirectory
+ * found while walking a directory with TclXOSWalkDir.  A subdirectory that
+ * has been removed or replaced since it was read is skipped.
+ *
+ * Parameters:
+ *   o interp - Interp to return errors in.
+ *   o dirHandle - Directory handle passed to the callback, not used.
+ *   o path - Path to the directory containing the subdirectory.
+ *   o fileName - Name of the subdirectory, a relative path of several
+ *     subdirectories separated by "/" or empty for the directory itself.
+ *   o hidden - Include hidden files.
+ *   o callback - Callback function to call on each directory entry, as
+ *     with TclXOSWalkDir.
+ *   o clientData - Client data to pass to callback.
+ * Results:
+ *   The same as TclXOSWalkDir.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSWalkDirAt (Tcl_Interp       *interp,
+                 ClientData        dirHandle,
+                 char             *path,
+                 char             *fileName,
+                 int               hidden,
+                 TclX_WalkDirProc *callback,
+                 ClientData        clientData)
+{
+    Tcl_DString subDirPath;
+    int result;
+
+    Tcl_DStringInit (&subDirPath);
+    if (fileName [0] == '\0') {
+        Tcl_DStringAppend (&subDirPath, path, -1);
+    } else {
+        TclX_JoinPath (path, fileName, &subDirPath);
+    }
+    result = TclXOSWalkDir (interp, Tcl_DStringValue (&subDirPath), hidden,
+                            callback, clientData);
+    Tcl_DStringFree (&subDirPath);
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSStatDirEntry --
+ *   System dependent interface to get the status of a directory entry from a
+ * TclXOSWalkDir callback.
+ *
+ * Parameters:
+ *   o dirHandle - Directory handle passed to the callback, not used.
+ *   o path - Path to the directory.
+ *   o fileName - Name of the entry in the directory.
+ *   o statBuf - Status is returned here.
+ * Results:
+ *   0 if ok or -1 if an error occured, with errno set.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSStatDirEntry (ClientData   dirHandle,
+                    char        *path,
+                    char        *fileName,
+                    struct stat *statBuf)
+{
+    Tcl_DString filePath;
+    int result;
+
+    Tcl_DStringInit (&filePath);
+    TclX_JoinPath (path, fileName, &filePath);
+    result = stat (Tcl_DStringValue (&filePath), statBuf);
+    Tcl_DStringFree (&filePath);
+    return result;
+}
+
 /*-----------------------------------------------------------------------------
  * TclXOSGetFileSize --
  *   System dependent interface to get the size of an open file.
@@ -928,6 +1064,69 @@ TclXOSGetFileSize (Tcl_Channel  channel,
     return TCL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+ * TclXOSMapFile --
+ *   System dependent interface to map an open file read-only into memory.
+ * Not implemented on Windows, the caller reads the file instead.
+ *
+ * Parameters:
+ *   o channel - Channel open on a regular file.
+ *   o fileSize - Number of bytes to map, must be greater than zero.
+ *   o addrPtr - The address of the mapping is returned here.
+ * Results:
+ *   TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSMapFile (Tcl_Channel channel, off_t fileSize, char **addrPtr)
+{
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSUnmapFile --
+ *   Release a mapping returned by TclXOSMapFile.
+ *
+ * Parameters:
+ *   o addr - Address of the mapping.
+ *   o fileSize - The size that was mapped.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSUnmapFile (char *addr, off_t fileSize)
+{
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSWriteBuffers --
+ *   System dependent interface to write a list of buffers to an open file,
+ * bypassing the channel's buffering and translation.  The channel must not
+ * have any buffered output.
+ *
+ * Parameters:
+ *   o channel - Channel to write to.
+ *   o numBufs - Number of buffers.
+ *   o bufs - The buffers.
+ *   o bufLens - The length of each buffer.
+ * Results:
+ *   TCL_OK or TCL_ERROR with errno set.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSWriteBuffers (Tcl_Channel   channel,
+                    int           numBufs,
+                    char        **bufs,
+                    int          *bufLens)
+{
+    int bufIdx;
+
+    for (bufIdx = 0; bufIdx < numBufs; bufIdx++) {
+        if (Tcl_WriteRaw (channel, bufs [bufIdx], bufLens [bufIdx]) < 0)
+            return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
 /*-----------------------------------------------------------------------------
  * TclXOSftruncate --
  *   System dependent interface to ftruncate functionality. 
@@ -1059,6 +1258,54 @@ TclXOSexecl (Tcl_Interp *interp,
     return TCL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+ * TclXOSspawn --
+ *   System dependent interface to start a program in a new process.
+ * Redirecting file numbers is not supported on Windows.
+ *
+ * Parameters:
+ *   o interp - A process id or errors are returned in result.
+ *   o path - Path to the program.
+ *   o argList - NULL terminated argument vector.
+ *   o envList - NULL terminated environment, or NULL to pass the current
+ *     one.
+ *   o numFds - Number of file numbers to redirect, must be zero.
+ *   o childFds, channels - Not used.
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSspawn (Tcl_Interp  *interp,
+             char        *path,
+             char       **argList,
+             char       **envList,
+             int          numFds,
+             int         *childFds,
+             Tcl_Channel *channels)
+{
+    int pid;
+    char numBuf [32];
+
+    if (numFds > 0)
+        return TclXNotAvailableError (interp, "spawn -fd");
+
+    if (envList != NULL) {
+        pid = spawnvpe (_P_NOWAIT, path, argList, envList);
+    } else {
+        pid = spawnvp (_P_NOWAIT, path, argList);
+    }
+    if (pid == -1) {
+        TclX_AppendObjResult (interp, "spawn of \"", path, "\" failed: ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        return TCL_ERROR;
+    }
+
+    sprintf (numBuf, "%d", pid);
+    Tcl_SetResult (interp, numBuf, TCL_VOLATILE);
+    return TCL_OK;
+}
+
 /*-----------------------------------------------------------------------------
  * TclXOSInetAtoN --
  *
@@ -1395,6 +1642,125 @@ TclXOSGetSelectFnum (Tcl_Interp *interp,
     return TCL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+ * TclXOSPoll --
+ *   Wait for file numbers to become ready.  Only sockets are supported on
+ * Windows, so this is done with select.
+ *
+ * Parameters:
+ *   o interp - Errors are returned in the result.
+ *   o pollInfo - The file numbers and events to wait for, revents is
+ *     returned in each entry.
+ *   o numFnums - Number of entries in pollInfo.
+ *   o timeoutPtr - Maximum time to wait, or NULL to wait forever.
+ * Returns:
+ *   The number of entries with events, 0 if the timeout expired, or -1 on
+ * an error.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSPoll (Tcl_Interp     *interp,
+            TclX_PollInfo  *pollInfo,
+            int             numFnums,
+            struct timeval *timeoutPtr)
+{
+    fd_set readSet, writeSet, exceptSet;
+    int idx, numReady;
+
+    FD_ZERO (&readSet);
+    FD_ZERO (&writeSet);
+    FD_ZERO (&exceptSet);
+    for (idx = 0; idx < numFnums; idx++) {
+        if (pollInfo [idx].events & TCLX_POLL_READ)
+            FD_SET ((SOCKET) pollInfo [idx].fnum, &readSet);
+        if (pollInfo [idx].events & TCLX_POLL_WRITE)
+            FD_SET ((SOCKET) pollInfo [idx].fnum, &writeSet);
+        if (pollInfo [idx].events & TCLX_POLL_EXCEPT)
+            FD_SET ((SOCKET) pollInfo [idx].fnum, &exceptSet);
+    }
+
+    numReady = select (0, &readSet, &writeSet, &exceptSet, timeoutPtr);
+    if (numReady == SOCKET_ERROR) {
+        TclWinConvertError (WSAGetLastError ());
+        TclX_AppendObjResult (interp, "select error: ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        return -1;
+    }
+
+    numReady = 0;
+    for (idx = 0; idx < numFnums; idx++) {
+        pollInfo [idx].revents = 0;
+        if (FD_ISSET ((SOCKET) pollInfo [idx].fnum, &readSet))
+            pollInfo [idx].revents |= TCLX_POLL_READ;
+        if (FD_ISSET ((SOCKET) pollInfo [idx].fnum, &writeSet))
+            pollInfo [idx].revents |= TCLX_POLL_WRITE;
+        if (FD_ISSET ((SOCKET) pollInfo [idx].fnum, &exceptSet))
+            pollInfo [idx].revents |= TCLX_POLL_EXCEPT;
+        pollInfo [idx].revents &= pollInfo [idx].events;
+        if (pollInfo [idx].revents != 0)
+            numReady++;
+    }
+    return numReady;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSPollSetCreate --
+ *   Create a persistent set of file numbers to wait on.  Not available on
+ * Windows, the caller uses TclXOSPoll instead.
+ *
+ * Parameters:
+ *   o interp - Errors are returned in the result.
+ * Returns:
+ *   NULL, with the interp result left empty.
+ *-----------------------------------------------------------------------------
+ */
+TclX_PollSet *
+TclXOSPollSetCreate (Tcl_Interp *interp)
+{
+    return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSPollSetDelete --
+ *   Release a set returned by TclXOSPollSetCreate.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSPollSetDelete (TclX_PollSet *pollSetPtr)
+{
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSPollSetCtl --
+ *   Add, change or remove a file number in a set.  Never called on Windows.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSPollSetCtl (Tcl_Interp    *interp,
+                  TclX_PollSet  *pollSetPtr,
+                  int            fnum,
+                  int            oldEvents,
+                  int            newEvents,
+                  ClientData     clientData)
+{
+    return TclXNotAvailableError (interp, "poll sets");
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSPollSetWait --
+ *   Wait for files in a set to become ready.  Never called on Windows.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSPollSetWait (Tcl_Interp     *interp,
+                   TclX_PollSet   *pollSetPtr,
+                   TclX_PollInfo  *readyInfo,
+                   int             maxReady,
+                   struct timeval *timeoutPtr)
+{
+    return 0;
+}
+
 /*-----------------------------------------------------------------------------
  * TclXOSHaveFlock --
  *   System dependent interface to determine if file locking is available.
@@ -1777,4 +2143,33 @@ TclXOSSetCloseOnExec (Tcl_Interp *interp,
     return TCL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+ * TclXOSSignalPipeOpen --
+ *   Deliver signals through the notifier.  Not available on Windows.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSSignalPipeOpen (Tcl_Interp *interp, Tcl_FileProc *proc)
+{
+    return TclXNotAvailableError (interp, "event signal delivery");
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSSignalPipeClose, TclXOSSignalPipeWakeup, TclXOSSignalPipeDrain --
+ *   Never have a pipe to operate on under Windows.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSSignalPipeClose (void)
+{
+}
+
+void
+TclXOSSignalPipeWakeup (void)
+{
+}
 
+void
+TclXOSSignalPipeDrain (void)
+{
+}
@@ -80,6 +80,13 @@
 #define TCLX_WAITPID(pid, status, options) \
 	Tcl_WaitPid((Tcl_Pid)pid, status, options)
 
+/*
+ * No resource usage for children.
+ */
+#ifndef NO_WAIT4
+#   define NO_WAIT4
+#endif
+
 #define bcopy(from, to, length)    memmove((to), (from), (length))
 
 /*